@@ -88,6 +88,8 @@
 #include "pmutils.h"
 #include "t30tone.h"
 #include "tone_gen.h"
+#include "v21.h"
+#include "t30.h"
 #include "audio.h"
 
 #define new PNEW
@@ -124,6 +126,8 @@ class FakeReadThread : public PThread
 
 void FakeReadThread::Main()
 {
+  ModemClock::Participant participant;
+
   PTRACE(3, audioEngine.Name() << " FakeReadThread::Main started");
 
   audioEngine.OpenOut(EngineBase::HOWNEROUT(this), TRUE);
@@ -174,6 +178,8 @@ class FakeWriteThread : public PThread
 
 void FakeWriteThread::Main()
 {
+  ModemClock::Participant participant;
+
   PTRACE(3, audioEngine.Name() << " FakeWriteThread::Main started");
 
   audioEngine.OpenIn(EngineBase::HOWNERIN(this), TRUE);
@@ -210,13 +216,17 @@ static ToneGenerator::ToneType dt2tt(EngineBase::DataType dataType)
 }
 ///////////////////////////////////////////////////////////////
 AudioEngine::AudioEngine(const PString &_name)
-  : EngineBase(_name + " AudioEngine")
+  : EngineBase(_name, "AudioEngine")
+  , readPacing(metrics, ModemMetrics::spAudio)
   , callbackParam(cbpReset)
   , sendAudio(NULL)
   , recvAudio(NULL)
   , pToneIn(NULL)
   , pToneOut(NULL)
   , t30ToneDetect(NULL)
+  , v21MonitorIn(FALSE)
+  , v21Receiver(NULL)
+  , t30(NULL)
 {
   PTRACE(2, name << " AudioEngine");
 }
@@ -225,11 +235,23 @@ AudioEngine::~AudioEngine()
 {
   PTRACE(2, name << " ~AudioEngine");
 
+  if (readPacing.Lateness().GetCount()) {
+    PTRACE(2, name << " Send pacing: frames=" << readPacing.Lateness().GetCount()
+                   << " lateness p50/p99/max=" << readPacing.Lateness().GetPercentile(50)
+                   << "/" << readPacing.Lateness().GetPercentile(99)
+                   << "/" << readPacing.Lateness().GetMax()
+                   << " us jitter p50/p99/max=" << readPacing.Jitter().GetPercentile(50)
+                   << "/" << readPacing.Jitter().GetPercentile(99)
+                   << "/" << readPacing.Jitter().GetMax() << " us");
+  }
+
   delete sendAudio;
   delete recvAudio;
   delete pToneIn;
   delete pToneOut;
   delete t30ToneDetect;
+  delete v21Receiver;
+  delete t30;
 }
 
 void AudioEngine::OnAttach()
@@ -275,7 +297,7 @@ void AudioEngine::OnChangeModemClass()
 {
   EngineBase::OnChangeModemClass();
 
-  if (modemClass == mcAudio) {
+  if (modemClass == mcAudio || modemClass == mcFax) {
     if (!t30ToneDetect)
       t30ToneDetect = new T30ToneDetect;
   } else {
@@ -284,6 +306,29 @@ void AudioEngine::OnChangeModemClass()
       t30ToneDetect = NULL;
     }
   }
+
+  OnChangeV21Monitor();
+}
+
+void AudioEngine::OnChangeV21Monitor()
+{
+  if (modemClass == mcFax && v21MonitorIn) {
+    if (!v21Receiver)
+      v21Receiver = new V21Receiver;
+
+    if (!t30)
+      t30 = new T30;
+  } else {
+    if (v21Receiver) {
+      delete v21Receiver;
+      v21Receiver = NULL;
+    }
+
+    if (t30) {
+      delete t30;
+      t30 = NULL;
+    }
+  }
 }
 ///////////////////////////////////////////////////////////////
 void AudioEngine::OnOpenOut()
@@ -466,6 +511,24 @@ PBoolean AudioEngine::isOutBufFull() const
 void AudioEngine::OnOpenIn()
 {
   EngineBase::OnOpenIn();
+  v21MonitorIn = FALSE;
+  OnChangeV21Monitor();
+}
+
+void AudioEngine::SetV21MonitorIn(HOWNERIN hOwner, PBoolean v21Monitor)
+{
+  if (hOwnerIn != hOwner)
+    return;
+
+  PWaitAndSignal mutexWait(Mutex);
+
+  if (hOwnerIn != hOwner)
+    return;
+
+  v21MonitorIn = v21Monitor;
+  OnChangeV21Monitor();
+
+  myPTRACE(3, name << " SetV21MonitorIn " << v21MonitorIn);
 }
 
 void AudioEngine::OnCloseIn()
@@ -521,11 +584,48 @@ PBoolean AudioEngine::Write(HOWNERIN hOwner, const void * buffer, PINDEX len)
           return FALSE;
       }
 
-      if (t30ToneDetect && t30ToneDetect->Write(buffer, len)) {
-        OnUserInput('c');
+      int events = t30ToneDetect ? t30ToneDetect->Write(buffer, len) : 0;
 
-        if (hOwnerIn != hOwner || !IsModemOpen())
-          return FALSE;
+      if (v21Receiver && t30) {
+        const PInt16 *pSamples = (const PInt16 *)buffer;
+        PINDEX count = len/BYTES_PER_SIMPLE;
+        PINDEX done;
+
+        while (v21Receiver->Write(pSamples, count, done)) {
+          PINDEX size;
+          const BYTE *pFrame = v21Receiver->GetFrame(size);
+
+          t30->v21Begin();
+          t30->v21Data(pFrame, size);
+          t30->v21End(FALSE);
+          OnT30Frame(*t30);
+
+          pSamples += done;
+          count -= done;
+        }
+      }
+
+      if (modemClass == mcFax) {
+        if (events & (T30ToneDetect::evCED | T30ToneDetect::evANSam | T30ToneDetect::evV21)) {
+          ModemCallbackWithUnlock(cbpFaxSignal);
+
+          if (hOwnerIn != hOwner || !IsModemOpen())
+            return FALSE;
+        }
+      } else {
+        if (events & T30ToneDetect::evCNG) {
+          OnUserInput('c');
+
+          if (hOwnerIn != hOwner || !IsModemOpen())
+            return FALSE;
+        }
+
+        if (events & (T30ToneDetect::evCED | T30ToneDetect::evANSam)) {
+          OnUserInput('a');
+
+          if (hOwnerIn != hOwner || !IsModemOpen())
+            return FALSE;
+        }
       }
     } else {
       if (recvAudio && !recvAudio->isFull()) {
@@ -59,13 +59,15 @@
 #ifndef _PM_AUDIO_H
 #define _PM_AUDIO_H
 
-#include <ptclib/delaychan.h>
+#include "pmutils.h"
 #include "enginebase.h"
 
 ///////////////////////////////////////////////////////////////
 class DataStream;
 class ToneGenerator;
 class T30ToneDetect;
+class V21Receiver;
+class T30;
 ///////////////////////////////////////////////////////////////
 class AudioEngine : public EngineBase
 {
@@ -82,6 +84,17 @@ class AudioEngine : public EngineBase
   /**@name Modem API */
   //@{
     PBoolean Read(HOWNEROUT hOwner, void * buffer, PINDEX amount);
+
+    /**Get the time the data of the last Read() was scheduled to be sent at
+       (the end of the pacing delay).
+      */
+    const PTime &GetReadScheduled() const { return readDelay.GetTarget(); }
+
+    /**Get the send pacing of the call. The reader should call
+       Sent(GetReadScheduled()) on sending the data of each Read().
+      */
+    ModemMetrics::SendPacing &ReadPacing() { return readPacing; }
+
     virtual void SendOnIdle(DataType _dataType);
     virtual PBoolean SendStart(DataType _dataType, int param);
     virtual int Send(const void *pBuf, PINDEX count);
@@ -89,6 +102,16 @@ class AudioEngine : public EngineBase
     virtual PBoolean isOutBufFull() const;
 
     PBoolean Write(HOWNERIN hOwner, const void * buffer, PINDEX len);
+
+    /**Enable demodulation of V.21 HDLC frames received as audio in fax class.
+       The frames are only logged in the trace, so it's disabled by default.
+       It's reset to disabled by OpenIn().
+      */
+    void SetV21MonitorIn(
+      HOWNERIN hOwner,
+      PBoolean v21Monitor
+    );
+
     virtual void RecvOnIdle(DataType _dataType);
     virtual PBoolean RecvWait(DataType _dataType, int param, int _callbackParam, PBoolean &done);
     virtual PBoolean RecvStart(int _callbackParam);
@@ -109,8 +132,11 @@ class AudioEngine : public EngineBase
     virtual void OnChangeEnableFakeIn();
     virtual void OnChangeEnableFakeOut();
 
-    PAdaptiveDelay readDelay;
-    PAdaptiveDelay writeDelay;
+    void OnChangeV21Monitor();
+
+    ModemDelay readDelay;
+    ModemDelay writeDelay;
+    ModemMetrics::SendPacing readPacing;
 
     int callbackParam;
 
@@ -120,6 +146,9 @@ class AudioEngine : public EngineBase
     ToneGenerator *volatile pToneIn;
     ToneGenerator *volatile pToneOut;
     T30ToneDetect *volatile t30ToneDetect;
+    PBoolean v21MonitorIn;
+    V21Receiver *volatile v21Receiver;
+    T30 *volatile t30;
 };
 ///////////////////////////////////////////////////////////////
 
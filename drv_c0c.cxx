@@ -206,6 +206,7 @@ InC0C::InC0C(PseudoModemC0C &_parent, HANDLE _hC0C)
 void InC0C::Main()
 {
   RenameCurrentThread(Parent().ptyName() + "(i)");
+  ModemMetrics::ThreadCpu threadCpu(Parent().Metrics(), ModemMetrics::trPtyIn);
   myPTRACE(1, "--> Started");
 
   enum {
@@ -349,6 +350,7 @@ OutC0C::OutC0C(PseudoModemC0C &_parent, HANDLE _hC0C)
 void OutC0C::Main()
 {
   RenameCurrentThread(Parent().ptyName() + "(o)");
+  ModemMetrics::ThreadCpu threadCpu(Parent().Metrics(), ModemMetrics::trPtyOut);
   myPTRACE(1, "<-- Started");
 
   enum {
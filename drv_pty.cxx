@@ -143,6 +143,7 @@ InPty::InPty(PseudoModemPty &_parent, int _hPty)
 void InPty::Main()
 {
   RenameCurrentThread(Parent().ptyName() + "(i)");
+  ModemMetrics::ThreadCpu threadCpu(Parent().Metrics(), ModemMetrics::trPtyIn);
   myPTRACE(1, "--> Started");
 
   for (;;) {
@@ -155,6 +156,7 @@ void InPty::Main()
       break;
 
     ::poll(&pollfd, 1, 5000);
+    Parent().Metrics().Add(ModemMetrics::cPtyPolls);
 
     if (pollfd.revents) {
       char cbuf[1024];
@@ -164,6 +166,7 @@ void InPty::Main()
         break;
 
       len = ::read(hPty, cbuf, sizeof(cbuf));
+      Parent().Metrics().Add(ModemMetrics::cPtyReads);
 
       if (len < 0) {
         int err = errno;
@@ -178,6 +181,8 @@ void InPty::Main()
       }
 
       if (len > 0) {
+        Parent().Metrics().Add(ModemMetrics::cPtyBytesIn, len);
+        BinTrace::Add(Parent().Metrics().TraceId(), BinTrace::evPtyIn, len, cbuf, len);
         Parent().ToInPtyQ(cbuf, len);
         if (stop)
           break;
@@ -196,6 +201,7 @@ OutPty::OutPty(PseudoModemPty &_parent, int _hPty)
 void OutPty::Main()
 {
   RenameCurrentThread(Parent().ptyName() + "(o)");
+  ModemMetrics::ThreadCpu threadCpu(Parent().Metrics(), ModemMetrics::trPtyOut);
   myPTRACE(1, "<-- Started");
 
   PBYTEArray *buf = NULL;
@@ -222,6 +228,7 @@ void OutPty::Main()
       break;
 
     ::poll(&pollfd, 1, 5000);
+    Parent().Metrics().Add(ModemMetrics::cPtyPolls);
 
     if (pollfd.revents) {
       int len;
@@ -230,6 +237,7 @@ void OutPty::Main()
         break;
 
       len = ::write(hPty, (const BYTE *)*buf + done, buf->GetSize() - done);
+      Parent().Metrics().Add(ModemMetrics::cPtyWrites);
 
       if (len < 0) {
         int err = errno;
@@ -238,6 +246,8 @@ void OutPty::Main()
         break;
       }
 
+      Parent().Metrics().Add(ModemMetrics::cPtyBytesOut, len);
+      BinTrace::Add(Parent().Metrics().TraceId(), BinTrace::evPtyOut, len, (const BYTE *)*buf + done, len);
       done += len;
       if (buf->GetSize() <= done) {
         if (buf->GetSize() < done) {
@@ -0,0 +1,575 @@
+/*
+ * dtescript.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: dtescript.cxx,v $
+ *
+ */
+
+#include <ptlib.h>
+#include "pmutils.h"
+#include "dtescript.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+enum {
+  ETX = 0x03,
+  DLE = 0x10
+};
+///////////////////////////////////////////////////////////////
+static const DteScript::Mod mods[] = {
+  {  24,  2400, 0x00 },
+  {  48,  4800, 0x10 },
+  {  72,  7200, 0x30 },
+  {  73,  7200, 0x34 },
+  {  74,  7200, 0x34 },
+  {  96,  9600, 0x20 },
+  {  97,  9600, 0x24 },
+  {  98,  9600, 0x24 },
+  { 121, 12000, 0x14 },
+  { 122, 12000, 0x14 },
+  { 145, 14400, 0x04 },
+  { 146, 14400, 0x04 },
+};
+
+const DteScript::Mod *DteScript::FindMod(int mod)
+{
+  for (PINDEX i = 0 ; i < PINDEX(sizeof(mods)/sizeof(mods[0])) ; i++) {
+    if (mods[i].mod == mod)
+      return &mods[i];
+  }
+
+  return NULL;
+}
+///////////////////////////////////////////////////////////////
+/**Modified Huffman encoder with LSB first bit order (as in the Class 1
+   stream of non-ECM data).
+ */
+class T4Writer
+{
+  public:
+    T4Writer(PBYTEArray &_data) : data(_data), count(0), cur(0), bits(0) {}
+
+    void Put(unsigned code, int len) {
+      while (len--) {
+        if ((code >> len) & 1)
+          cur |= BYTE(1 << bits);
+
+        if (++bits == 8) {
+          data[count++] = cur;
+          cur = 0;
+          bits = 0;
+        }
+      }
+    }
+
+    void Flush() {
+      if (bits)
+        data[count++] = cur;
+
+      data.SetSize(count);
+    }
+
+  protected:
+    PBYTEArray &data;
+    PINDEX count;
+    BYTE cur;
+    int bits;
+};
+
+void DteScript::MakePage(PBYTEArray &page, int lines, int density)
+{
+  T4Writer t4(page);
+
+  for (int i = 0 ; i < lines ; i++) {
+    t4.Put(0x001, 12);                // EOL
+
+    if ((i*37) % 100 < density) {
+      for (int j = 0 ; j < 1728/16 ; j++) {
+        t4.Put(0x13, 5);              // white 8
+        t4.Put(0x05, 6);              // black 8
+      }
+    } else {
+      t4.Put(0x9B, 9);                // white 1728
+      t4.Put(0x35, 8);                // white 0
+    }
+  }
+
+  for (int i = 0 ; i < 6 ; i++)
+    t4.Put(0x001, 12);                // RTC
+
+  t4.Flush();
+}
+///////////////////////////////////////////////////////////////
+DteScript::DteScript(const PString &_name, int _mod, PBoolean _ecm, int _stall)
+  : dteName(_name),
+    mod(_mod),
+    br(FindMod(_mod) ? FindMod(_mod)->br : 14400),
+    ecm(_ecm),
+    stall(_stall),
+    inPtr(NULL),
+    inLen(0),
+    inDone(0)
+{
+}
+
+int DteScript::GetChar(int timeout)
+{
+  if (inDone >= inLen) {
+    inDone = 0;
+
+    if ((inPtr = Read(inLen, timeout)) == NULL || inLen <= 0) {
+      inLen = 0;
+      return -1;
+    }
+  }
+
+  return inPtr[inDone++];
+}
+
+PBoolean DteScript::WriteDle(const BYTE *pData, PINDEX count, PBoolean etx)
+{
+  PBYTEArray buf(count*2 + 2);
+  PINDEX len = 0;
+
+  for (PINDEX i = 0 ; i < count ; i++) {
+    if (pData[i] == DLE)
+      buf[len++] = DLE;
+
+    buf[len++] = pData[i];
+  }
+
+  if (etx) {
+    buf[len++] = DLE;
+    buf[len++] = ETX;
+  }
+
+  return Write((const BYTE *)buf, len);
+}
+
+void DteScript::Command(const PString &cmd)
+{
+  PString line = "AT" + cmd + "\r";
+
+  myPTRACE(3, dteName << " DTE --> " << line);
+
+  Write((const char *)line, line.GetLength());
+}
+
+PString DteScript::Result(int timeout)
+{
+  PString line;
+
+  for (;;) {
+    int c = GetChar(timeout);
+
+    if (c < 0)
+      return PString();
+
+    if (c == '\r')
+      continue;
+
+    if (c != '\n') {
+      line += char(c);
+      continue;
+    }
+
+    // skip empty lines and echo
+    if (line.IsEmpty() || (line.Left(2) *= "AT")) {
+      line = PString();
+      continue;
+    }
+
+    myPTRACE(3, dteName << " DTE <-- " << line);
+
+    return line;
+  }
+}
+
+PBoolean DteScript::Expect(const PString &cmd, const char *result, int timeout)
+{
+  Command(cmd);
+
+  PString res = Result(timeout);
+
+  if (res == result)
+    return TRUE;
+
+  myPTRACE(1, dteName << " DTE AT" << cmd << " -> " << res << " (expected " << result << ")");
+
+  return FALSE;
+}
+
+/**Expect for the command executed by modem w/o waiting for remote.
+  */
+PBoolean DteScript::ExpectLocal(const PString &cmd, const char *result)
+{
+  PInt64 begin = ClockUs();
+  PBoolean res = Expect(cmd, result, 10000);
+
+  OnLocalCommand(ClockUs() - begin);
+
+  return res;
+}
+
+/**Receive the DLE stuffed data up to <DLE><ETX>. If page is TRUE then
+   the stalls are counted and OnRecvPage() is called.
+  */
+PINDEX DteScript::RecvDle(BYTE *pData, PINDEX size, PBoolean page, int timeout)
+{
+  PINDEX len = 0;
+  PInt64 first = 0;
+  PInt64 last = 0;
+  int stalls = 0;
+
+  for (;;) {
+    int c = GetChar(timeout);
+
+    if (c < 0)
+      return P_MAX_INDEX;
+
+    if (page && inDone == 1) {
+      // the first byte of the read
+      PInt64 now = ClockUs();
+
+      if (!first)
+        first = now;
+      else
+      if (stall && (now - last)/1000 >= stall)
+        stalls++;
+
+      last = now;
+    }
+
+    if (c == DLE) {
+      if ((c = GetChar(timeout)) < 0)
+        return P_MAX_INDEX;
+
+      if (c == ETX)
+        break;
+
+      if (c != DLE)
+        continue;
+    }
+
+    if (pData && len < size)
+      pData[len] = BYTE(c);
+
+    len++;
+  }
+
+  if (page && len > 0)
+    OnRecvPage(len, ClockUs() - first, stalls);
+
+  return len;
+}
+
+/**Receive one HDLC frame w/o FCS. If cmd is not empty then it's sent
+   before and CONNECT is expected.
+  */
+PBoolean DteScript::RecvFrame(const PString &cmd, BYTE *pFrame, PINDEX &len)
+{
+  if (!cmd.IsEmpty() && !Expect(cmd, "CONNECT", 90000))
+    return FALSE;
+
+  len = RecvDle(pFrame, maxFrameLen);
+
+  if (len == P_MAX_INDEX || len < 5 || len > maxFrameLen)
+    return FALSE;
+
+  len -= 2;
+
+  return Result() == "OK";
+}
+
+/**Send one HDLC frame and check the result (CONNECT for not final frames).
+  */
+PBoolean DteScript::SendFrame(const BYTE *pFrame, PINDEX len)
+{
+  if (!WriteDle(pFrame, len))
+    return FALSE;
+
+  return Result() == ((pFrame[1] & 0x08) ? "OK" : "CONNECT");
+}
+///////////////////////////////////////////////////////////////
+/*
+ * The T.30 frames are in the same bit order as in t30.cxx
+ * (the first transmitted bit is the most significant one)
+ */
+static const BYTE frameDIS[] = { 0xFF, 0xC8, 0x01, 0x00, 0x74, 0x01, 0x20 };
+static const BYTE frameCFR[] = { 0xFF, 0xC8, 0x21 };
+static const BYTE frameMCF[] = { 0xFF, 0xC8, 0x31 };
+static const BYTE frameDCN[] = { 0xFF, 0xC8, 0xDF };
+
+enum {
+  fcfDCS  = 0x41,
+  fcfCFR  = 0x21,
+  fcfMCF  = 0x31,
+  fcfMPS  = 0x72,
+  fcfEOP  = 0x74,
+  fcfPPS  = 0x7D,
+  fcfFCD  = 0x60,
+  fcfRCP  = 0x61,
+  fcfX    = 0x80
+};
+
+PBoolean DteScript::Sender(const PString &number, const PBYTEArray &page, int pages, int tries)
+{
+  BYTE frame[maxFrameLen];
+  PINDEX len;
+  PString res;
+
+  // dial and receive DIS (implicit AT+FRH=3)
+
+  for (int i = 1 ;; i++) {
+    Command("D" + number);
+
+    if ((res = Result(90000)) == "CONNECT")
+      break;
+
+    if (i >= tries || res.IsEmpty()) {
+      myPTRACE(1, dteName << " DTE ATD" << number << " -> " << res << " (expected CONNECT)");
+      return FALSE;
+    }
+
+    ModemClock::Get().Sleep(200);
+  }
+
+  len = RecvDle(frame, sizeof(frame));
+
+  if (len == P_MAX_INDEX || len < 5 || Result() != "OK")
+    return FALSE;
+
+  while ((frame[1] & 0x08) == 0) {
+    if (!RecvFrame("+FRH=3", frame, len))
+      return FALSE;
+  }
+
+  // send TSI and DCS
+
+  static const BYTE tsi[] = { 0xFF, 0xC0, 0xC2,
+    0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,
+    0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 };
+  const Mod *pMod = FindMod(mod);
+  const BYTE dcs[] = { 0xFF, 0xC8, fcfDCS | fcfX, 0x00,
+                       BYTE(0x40 | (pMod ? pMod->dcsRate : 0x04)), BYTE(ecm ? 0x01 : 0x00), 0x20 };
+  const PString ftm = psprintf("+FTM=%d", mod);
+
+  if (!ExpectLocal("+FTH=3", "CONNECT") ||
+      !SendFrame(tsi, sizeof(tsi)) ||
+      !SendFrame(dcs, ecm ? sizeof(dcs) : sizeof(dcs) - 1))
+  {
+    return FALSE;
+  }
+
+  // send TCF (1.5 secs)
+
+  {
+    PBYTEArray tcf(br*3/2/8);
+
+    if (!Expect(ftm, "CONNECT") || !WriteDle(tcf, tcf.GetSize()) || Result() != "OK")
+      return FALSE;
+  }
+
+  if (!RecvFrame("+FRH=3", frame, len) || (frame[2] & 0x7F) != fcfCFR)
+    return FALSE;
+
+  // send pages
+
+  for (int iPage = 0 ; iPage < pages ; iPage++) {
+    PInt64 begin = ClockUs();
+    BYTE fcf = BYTE((iPage == pages - 1 ? fcfEOP : fcfMPS) | fcfX);
+
+    if (ecm) {
+      const PString fth = psprintf("+FTH=%d", mod);
+      PINDEX frames = (page.GetSize() + 255)/256;
+
+      for (PINDEX block = 0 ; block*256 < frames ; block++) {
+        PINDEX first = block*256;
+        PINDEX count = PMIN(frames - first, 256);
+
+        if (!Expect(fth, "CONNECT"))
+          return FALSE;
+
+        for (PINDEX i = 0 ; i < count ; i++) {
+          BYTE fcd[4 + 256];
+          PINDEX offset = (first + i)*256;
+          PINDEX size = PMIN(page.GetSize() - offset, 256);
+
+          fcd[0] = 0xFF;
+          fcd[1] = 0xC0;
+          fcd[2] = fcfFCD;
+          fcd[3] = ReverseBits(BYTE(i));
+          memcpy(fcd + 4, (const BYTE *)page + offset, size);
+          memset(fcd + 4 + size, 0, 256 - size);
+
+          if (!SendFrame(fcd, sizeof(fcd)))
+            return FALSE;
+        }
+
+        for (int i = 0 ; i < 3 ; i++) {
+          const BYTE rcp[] = { 0xFF, BYTE(i < 2 ? 0xC0 : 0xC8), fcfRCP };
+
+          if (!SendFrame(rcp, sizeof(rcp)))
+            return FALSE;
+        }
+
+        PBoolean last = (first + count >= frames);
+        const BYTE pps[] = { 0xFF, 0xC8, fcfPPS | fcfX, BYTE(last ? fcf : 0x00),
+                             ReverseBits(BYTE(iPage)), ReverseBits(BYTE(block)), ReverseBits(BYTE(count - 1)) };
+
+        if (!ExpectLocal("+FTS=8", "OK") ||
+            !ExpectLocal("+FTH=3", "CONNECT") ||
+            !SendFrame(pps, sizeof(pps)) ||
+            !RecvFrame("+FRH=3", frame, len) ||
+            (frame[2] & 0x7F) != fcfMCF)
+        {
+          return FALSE;
+        }
+      }
+    } else {
+      if (!Expect(ftm, "CONNECT") || !SendPage(page))
+        return FALSE;
+
+      const BYTE post[] = { 0xFF, 0xC8, fcf };
+
+      if (!ExpectLocal("+FTS=8", "OK") ||
+          !ExpectLocal("+FTH=3", "CONNECT") ||
+          !SendFrame(post, sizeof(post)) ||
+          !RecvFrame("+FRH=3", frame, len) ||
+          (frame[2] & 0x7F) != fcfMCF)
+      {
+        return FALSE;
+      }
+    }
+
+    OnPage(TRUE, ClockUs() - begin);
+  }
+
+  if (!ExpectLocal("+FTH=3", "CONNECT") || !SendFrame(frameDCN, sizeof(frameDCN)))
+    return FALSE;
+
+  return ExpectLocal("H0", "OK");
+}
+
+int DteScript::Receiver()
+{
+  BYTE frame[maxFrameLen];
+  PINDEX len;
+
+  for (;;) {
+    if (NoMoreCalls())
+      return -1;
+
+    if (Result(1000) == "RING")
+      break;
+  }
+
+  // answer and send DIS (implicit AT+FTH=3)
+
+  if (!Expect("A", "CONNECT", 90000) || !SendFrame(frameDIS, sizeof(frameDIS)))
+    return 0;
+
+  // receive TSI and DCS
+
+  do {
+    if (!RecvFrame("+FRH=3", frame, len))
+      return 0;
+  } while ((frame[1] & 0x08) == 0);
+
+  if ((frame[2] & 0x7F) != fcfDCS)
+    return 0;
+
+  PBoolean ecmDcs = (len >= 7 && (frame[5] & 0x01) && (frame[6] & 0x20));
+  const PString frm = psprintf("+FRM=%d", mod);
+
+  // receive TCF and send CFR
+
+  if (!Expect(frm, "CONNECT") ||
+      RecvDle(NULL, 0) == P_MAX_INDEX ||
+      Result() != "NO CARRIER" ||
+      !ExpectLocal("+FTH=3", "CONNECT") ||
+      !SendFrame(frameCFR, sizeof(frameCFR)))
+  {
+    return 0;
+  }
+
+  // receive pages
+
+  for (;;) {
+    if (ecmDcs) {
+      const PString frh = psprintf("+FRH=%d", mod);
+
+      for (;;) {
+        if (!RecvFrame(frh, frame, len))
+          return 0;
+
+        if ((frame[2] & 0x7F) == fcfRCP && (frame[1] & 0x08))
+          break;
+      }
+    } else {
+      if (!Expect(frm, "CONNECT") ||
+          RecvDle(NULL, 0, TRUE) == P_MAX_INDEX ||
+          Result() != "NO CARRIER")
+      {
+        return 0;
+      }
+    }
+
+    if (!RecvFrame("+FRH=3", frame, len))
+      return 0;
+
+    BYTE fcf = BYTE(frame[2] & 0x7F);
+
+    if (fcf == fcfPPS && len >= 4)
+      fcf = BYTE(frame[3] & 0x7F);
+
+    if (!ExpectLocal("+FTH=3", "CONNECT") || !SendFrame(frameMCF, sizeof(frameMCF)))
+      return 0;
+
+    // not PPS-NULL (the end of the page)
+    if (fcf)
+      OnPage(FALSE, 0);
+
+    if (fcf == fcfEOP)
+      break;
+  }
+
+  // receive DCN (the call can be already cleared)
+
+  RecvFrame("+FRH=3", frame, len);
+
+  HangUp();
+
+  return 1;
+}
+
+void DteScript::HangUp()
+{
+  Command("H0");
+  Result(5000);
+}
+///////////////////////////////////////////////////////////////
+
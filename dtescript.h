@@ -0,0 +1,258 @@
+/*
+ * dtescript.h
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: dtescript.h,v $
+ *
+ */
+
+#ifndef _DTESCRIPT_H
+#define _DTESCRIPT_H
+
+///////////////////////////////////////////////////////////////
+/**Histogram of the latencies with fixed width buckets.
+ */
+class Histogram
+{
+  public:
+    enum { numBuckets = 4096 };
+
+    Histogram(long _width) : width(_width) { Reset(); }
+
+    void Reset() {
+      PWaitAndSignal mutexWait(mutex);
+      memset(buckets, 0, sizeof(buckets));
+      count = 0;
+      max = 0;
+    }
+
+    void Add(PInt64 value) {
+      PInt64 i = value/width;
+
+      PWaitAndSignal mutexWait(mutex);
+      buckets[i < numBuckets ? PINDEX(i) : numBuckets - 1]++;
+      count++;
+
+      if (max < value)
+        max = value;
+    }
+
+    void Add(const Histogram &other) {
+      PWaitAndSignal mutexWait(mutex);
+      PWaitAndSignal mutexWaitOther(other.mutex);
+
+      for (PINDEX i = 0 ; i < numBuckets ; i++)
+        buckets[i] += other.buckets[i];
+
+      count += other.count;
+
+      if (max < other.max)
+        max = other.max;
+    }
+
+    /**Returns the upper bound of the bucket containing the percentile.
+      */
+    PInt64 Percentile(int percents) const {
+      PWaitAndSignal mutexWait(mutex);
+
+      long need = (count*percents + 99)/100;
+      long sum = 0;
+
+      for (PINDEX i = 0 ; i < numBuckets - 1 ; i++) {
+        sum += buckets[i];
+
+        if (sum >= need && sum > 0)
+          return PInt64(i + 1)*width;
+      }
+
+      return max;
+    }
+
+    long GetCount() const { return count; }
+    PInt64 GetMax() const { return max; }
+
+  protected:
+    PMutex mutex;
+    const long width;
+    long buckets[numBuckets];
+    long count;
+    PInt64 max;
+};
+///////////////////////////////////////////////////////////////
+/**Scripted Class 1 DTE (used by t38dte and t38loop).
+
+   Sender() dials, sends TSI/DCS, TCF and the ECM or non-ECM pages,
+   Receiver() answers, sends DIS, CFR and MCF and receives the pages.
+
+   The derived class provides the transport (Read() and Write()) and
+   collects the counters (the On...() notifications). All timing goes
+   through ModemClock, so the scripts can run in virtual time.
+ */
+class DteScript
+{
+  public:
+    /**Class 1 modulation for AT+FTM/AT+FRM.
+      */
+    struct Mod {
+      int mod;
+      int br;
+      BYTE dcsRate;                     ///<  DCS bits 11-14 in t30.cxx bit order
+    };
+
+    /**Returns NULL for unknown modulation.
+      */
+    static const Mod *FindMod(
+      int mod
+    );
+
+    /**Make the non-ECM page (Modified Huffman, LSB first) with the given
+       percents of non-blank lines.
+      */
+    static void MakePage(
+      PBYTEArray &page,
+      int lines,
+      int density
+    );
+
+  protected:
+  /**@name Construction */
+  //@{
+    /**The mod should be a known one (see FindMod()). If stall is not 0
+       then the receive gaps not shorter than stall ms are counted.
+      */
+    DteScript(
+      const PString &_name,
+      int _mod,
+      PBoolean _ecm,
+      int _stall = 0
+    );
+    virtual ~DteScript() {}
+  //@}
+
+  /**@name Transport */
+  //@{
+    /**Wait not longer than timeout ms for the data from the modem.
+       Returns NULL if timeout, error or stop. The data should be valid
+       up to the next call.
+      */
+    virtual const BYTE *Read(
+      PINDEX &len,
+      int timeout
+    ) = 0;
+
+    virtual PBoolean Write(
+      const void *pBuf,
+      PINDEX count
+    ) = 0;
+
+    /**Returns TRUE if Receiver() should not wait for the calls more.
+      */
+    virtual PBoolean NoMoreCalls() = 0;
+  //@}
+
+  /**@name Notifications */
+  //@{
+    /**Write the non-ECM page after CONNECT of AT+FTM (with <DLE><ETX>)
+       and wait for OK.
+      */
+    virtual PBoolean SendPage(
+      const PBYTEArray &page
+    ) { return WriteDle(page, page.GetSize()) && Result() == "OK"; }
+
+    /**The command executed by modem w/o waiting for remote took us.
+      */
+    virtual void OnLocalCommand(
+      PInt64 /*us*/
+    ) {}
+
+    /**The non-ECM page (len bytes) was received in us (from the first
+       byte to <DLE><ETX>) with stalls receive gaps.
+      */
+    virtual void OnRecvPage(
+      PINDEX /*len*/,
+      PInt64 /*us*/,
+      int /*stalls*/
+    ) {}
+
+    /**The page was confirmed by MCF. The sender gets us from the page
+       start to MCF.
+      */
+    virtual void OnPage(
+      PBoolean /*sender*/,
+      PInt64 /*us*/
+    ) {}
+  //@}
+
+  /**@name Commands */
+  //@{
+    enum { maxFrameLen = 4 + 256 + 2 };  ///<  ECM FCD frame with FCS
+
+    int GetChar(int timeout);
+    PBoolean WriteDle(const BYTE *pData, PINDEX count, PBoolean etx = TRUE);
+    void Command(const PString &cmd);
+    PString Result(int timeout = 60000);
+    PBoolean Expect(const PString &cmd, const char *result, int timeout = 60000);
+    PBoolean ExpectLocal(const PString &cmd, const char *result);
+
+    PINDEX RecvDle(BYTE *pData, PINDEX size, PBoolean page = FALSE, int timeout = 60000);
+    PBoolean RecvFrame(const PString &cmd, BYTE *pFrame, PINDEX &len);
+    PBoolean SendFrame(const BYTE *pFrame, PINDEX len);
+  //@}
+
+  /**@name Sessions */
+  //@{
+    /**Dial number (up to tries times) and send pages copies of page.
+      */
+    PBoolean Sender(
+      const PString &number,
+      const PBYTEArray &page,
+      int pages,
+      int tries = 1
+    );
+
+    /**Returns 1 on success, 0 on error and -1 if no more calls are expected.
+      */
+    int Receiver();
+
+    /**Hang up after the error.
+      */
+    void HangUp();
+  //@}
+
+    static PInt64 ClockUs() { return ModemClock::Get().Now().GetTimestamp(); }
+
+    const PString dteName;
+    const int mod;
+    const int br;
+    const PBoolean ecm;
+    const int stall;
+
+    const BYTE *inPtr;
+    PINDEX inLen;
+    PINDEX inDone;
+};
+///////////////////////////////////////////////////////////////
+
+#endif  // _DTESCRIPT_H
+
@@ -70,6 +70,7 @@
 
 #include <ptlib.h>
 #include "pmutils.h"
+#include "t30.h"
 #include "enginebase.h"
 
 #define new PNEW
@@ -101,6 +102,7 @@ ostream & operator<<(ostream & out, EngineBase::ModemCallbackParam param)
     case EngineBase::cbpReset:          return out << "cbpReset";
     case EngineBase::cbpOutBufEmpty:    return out << "cbpOutBufEmpty";
     case EngineBase::cbpUserInput:      return out << "cbpUserInput";
+    case EngineBase::cbpFaxSignal:      return out << "cbpFaxSignal";
   }
 
   return out << "cbp" << INT(param);
@@ -118,8 +120,9 @@ ostream & operator<<(ostream & out, EngineBase::ModemClass modemClass)
 }
 #endif
 ///////////////////////////////////////////////////////////////
-EngineBase::EngineBase(const PString &_name)
-  : name(_name)
+EngineBase::EngineBase(const PString &_modemName, const char *_engineName)
+  : name(_engineName != NULL ? _modemName + " " + _engineName : _modemName)
+  , metrics(ModemMetrics::Get(_modemName))
   , recvUserInput(NULL)
   , modemClass(mcUndefined)
   , hOwnerIn(NULL)
@@ -426,12 +429,18 @@ void EngineBase::UnlockModemCallback()
 void EngineBase::ModemCallbackWithUnlock(INT extra)
 {
   Mutex.Signal();
-  MutexModemCallback.Wait();
 
-  if (!modemCallback.IsNULL())
-    modemCallback(*this, extra);
+  {
+    ModemMetrics::Latency latency(metrics);
+
+    MutexModemCallback.Wait();
+
+    if (!modemCallback.IsNULL())
+      modemCallback(*this, extra);
+
+    MutexModemCallback.Signal();
+  }
 
-  MutexModemCallback.Signal();
   Mutex.Wait();
 }
 
@@ -455,6 +464,31 @@ void EngineBase::OnUserInput(const PString & value)
   }
 }
 
+void EngineBase::OnT30Frame(const T30 &t30)
+{
+  T30::FrameType type = t30.getFrameType();
+
+  if (type == T30::ftUnknown)
+    return;
+
+  metrics.Add(t30.isFrameSent() ? ModemMetrics::cT30FramesSent : ModemMetrics::cT30FramesReceived);
+
+  switch (type) {
+    case T30::ftDCS:
+      myPTRACE(2, name << " OnT30Frame DCS " << t30.getBitRate() << " bps" << (t30.isEcm() ? " ECM" : ""));
+      break;
+    case T30::ftPPR:
+      metrics.Add(ModemMetrics::cEcmPprFrames, t30.getPprFrames());
+      break;
+    case T30::ftDCN:
+      myPTRACE(2, name << " OnT30Frame DCN " << (t30.isFrameSent() ? "sent" : "received")
+                       << ", pages " << t30.getPages());
+      break;
+    default:
+      break;
+  }
+}
+
 int EngineBase::RecvUserInput(void * pBuf, PINDEX count)
 {
   PWaitAndSignal mutexWaitModem(MutexModem);
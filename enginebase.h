@@ -76,6 +76,8 @@
 
 ///////////////////////////////////////////////////////////////
 class DataStream;
+class ModemMetrics;
+class T30;
 ///////////////////////////////////////////////////////////////
 class ReferenceObject : public PObject
 {
@@ -121,7 +123,7 @@ class EngineBase : public ReferenceObject
 
   /**@name Construction */
   //@{
-    EngineBase(const PString &_name = "");
+    EngineBase(const PString &_modemName = "", const char *_engineName = NULL);
     virtual ~EngineBase();
   //@}
 
@@ -153,6 +155,7 @@ class EngineBase : public ReferenceObject
       cbpReset         = -1,
       cbpOutBufEmpty   = -2,
       cbpUserInput     = -3,
+      cbpFaxSignal     = -4,
     };
 
     enum ModemClass {
@@ -164,6 +167,7 @@ class EngineBase : public ReferenceObject
   /**@name Modem API */
   //@{
     const PString &Name() const { return name; }
+    ModemMetrics &Metrics() const { return metrics; }
 
     PBoolean Attach(const PNotifier &callback);
     void Detach(const PNotifier &callback);
@@ -211,6 +215,11 @@ class EngineBase : public ReferenceObject
     virtual void OnChangeModemClass();
     virtual void OnUserInput(const PString & value);
 
+    /**Called by the engine with Mutex locked after the T.30 control frame
+       was sent or received (t30.getFrameType() is the type of it).
+      */
+    virtual void OnT30Frame(const T30 &t30);
+
     virtual void OnOpenIn();
     virtual void OnOpenOut();
     virtual void OnCloseIn();
@@ -219,6 +228,7 @@ class EngineBase : public ReferenceObject
     virtual void OnChangeEnableFakeOut();
 
     const PString name;
+    ModemMetrics &metrics;
     DataStream *volatile recvUserInput;
     ModemClass modemClass;
     volatile HOWNERIN hOwnerIn;
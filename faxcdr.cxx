@@ -0,0 +1,435 @@
+/*
+ * faxcdr.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: faxcdr.cxx,v $
+ *
+ */
+
+#include <ptlib.h>
+
+#include "t30.h"
+#include "reorder.h"
+#include "faxcdr.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+static PString JsonString(const PString &value)
+{
+  PString res = "\"";
+
+  for (PINDEX i = 0 ; i < value.GetLength() ; i++) {
+    char c = value[i];
+
+    switch (c) {
+      case '\\': res += "\\\\"; break;
+      case '"':  res += "\\\""; break;
+      case '\n': res += "\\n";  break;
+      case '\r': res += "\\r";  break;
+      case '\t': res += "\\t";  break;
+      default:
+        if ((BYTE)c < 0x20)
+          res += psprintf("\\u%04x", (unsigned)(BYTE)c);
+        else
+          res += c;
+    }
+  }
+
+  return res + "\"";
+}
+
+static PString JsonMs(PInt64 ns)
+{
+  return psprintf("%.3f", ns/1000000.0);
+}
+
+static PString JsonPercentilesMs(const HdrHistogram &hist)
+{
+  // the values are microseconds
+  return "{\"p50\":" + JsonMs(hist.GetPercentile(50)*1000) +
+         ",\"p90\":" + JsonMs(hist.GetPercentile(90)*1000) +
+         ",\"p99\":" + JsonMs(hist.GetPercentile(99)*1000) +
+         ",\"max\":" + JsonMs(hist.GetMax()*1000) + "}";
+}
+///////////////////////////////////////////////////////////////
+FaxCdr::Side::Side()
+  : packets(0)
+  , bytes(0)
+  , again(0)
+  , againBytes(0)
+  , redundancyBytes(0)
+  , cpuNs(0)
+{
+}
+
+FaxCdr::FaxCdr()
+  : start(ModemClock::Get().Now())
+  , originating(FALSE)
+  , maxGap(0)
+  , gapCount(0)
+  , lost(0)
+  , recovered(0)
+  , reordered(0)
+  , held(0)
+  , heldTime(0)
+{
+  int i;
+
+  for (i = 0 ; i <= maxGapMs ; i++)
+    gaps[i] = 0;
+
+  for (i = 0 ; i < ModemMetrics::NumThreadRoles ; i++)
+    threadCpuStart[i] = 0;
+}
+
+void FaxCdr::SetCall(const PString &_token, PBoolean _originating)
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  token = _token;
+  originating = _originating;
+}
+
+void FaxCdr::SetOption(const PString &key, const PString &value)
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  options.SetAt(key, value);
+}
+
+void FaxCdr::StartThreadCpu(const ModemMetrics &metrics)
+{
+  if (!CdrWriter::IsStarted())
+    return;
+
+  for (int i = 0 ; i < ModemMetrics::NumThreadRoles ; i++)
+    threadCpuStart[i] = metrics.GetThreadCpu(ModemMetrics::ThreadRole(i));
+}
+
+void FaxCdr::OnSent(PINDEX bytes, PINDEX redundancyBytes)
+{
+  sendSide.packets++;
+  sendSide.bytes += bytes;
+  sendSide.redundancyBytes += redundancyBytes;
+}
+
+void FaxCdr::OnResent(PINDEX bytes)
+{
+  sendSide.again++;
+  sendSide.againBytes += bytes;
+}
+
+void FaxCdr::OnReceived(PINDEX bytes, PINDEX redundancyBytes)
+{
+  PTime now = ModemClock::Get().Now();
+
+  if (recvSide.packets > 0) {
+    long gap = (long)(now - lastReceived).GetMilliSeconds();
+
+    if (gap < 0)
+      gap = 0;
+
+    if (maxGap < gap)
+      maxGap = gap;
+
+    gaps[gap < maxGapMs ? gap : long(maxGapMs)]++;
+    gapCount++;
+  }
+
+  lastReceived = now;
+
+  recvSide.packets++;
+  recvSide.bytes += bytes;
+  recvSide.redundancyBytes += redundancyBytes;
+}
+
+void FaxCdr::OnRepeated(PINDEX bytes)
+{
+  recvSide.again++;
+  recvSide.againBytes += bytes;
+}
+
+void FaxCdr::SetReorder(const ReorderBuffer &reorder)
+{
+  lost = reorder.GetLost();
+  recovered = reorder.GetRecovered();
+  reordered = reorder.GetReordered();
+  held = reorder.GetHeld();
+  heldTime = reorder.GetHeldTime();
+}
+
+long FaxCdr::GapPercentile(int percent) const
+{
+  if (gapCount == 0)
+    return 0;
+
+  long rank = (gapCount*percent + 99)/100;
+  long count = 0;
+
+  for (int i = 0 ; i < maxGapMs ; i++) {
+    count += gaps[i];
+
+    if (count >= rank)
+      return i;
+  }
+
+  return maxGap;
+}
+
+void FaxCdr::PrintSide(ostream &strm, const Side &side, const ModemMetrics::SendPacing *pacing) const
+{
+  PBoolean send = (pacing != NULL);
+
+  strm << "{\"packets\":" << side.packets
+       << ",\"bytes\":" << side.bytes
+       << (send ? ",\"resent\":" : ",\"repeated\":") << side.again
+       << (send ? ",\"resent_bytes\":" : ",\"repeated_bytes\":") << side.againBytes
+       << ",\"redundancy_bytes\":" << side.redundancyBytes;
+
+  if (!send) {
+    strm << ",\"lost\":" << lost
+         << ",\"recovered\":" << recovered
+         << ",\"reordered\":" << reordered
+         << ",\"held\":" << held
+         << ",\"held_ms\":" << heldTime
+         << ",\"interarrival_ms\":{"
+            "\"p50\":" << GapPercentile(50)
+         << ",\"p90\":" << GapPercentile(90)
+         << ",\"p99\":" << GapPercentile(99)
+         << ",\"max\":" << maxGap
+         << "}";
+  } else {
+    strm << ",\"lateness_ms\":" << JsonPercentilesMs(pacing->Lateness())
+         << ",\"jitter_ms\":" << JsonPercentilesMs(pacing->Jitter());
+  }
+
+  strm << ",\"cpu_ms\":" << JsonMs(side.cpuNs) << "}";
+}
+
+void FaxCdr::Submit(const ModemMetrics &metrics, const ModemMetrics::SendPacing &pacing, const T30 &t30)
+{
+  if (!CdrWriter::IsStarted())
+    return;
+
+  PWaitAndSignal mutexWait(mutex);
+
+  if (token.IsEmpty() && sendSide.packets == 0 && recvSide.packets == 0)
+    return;
+
+  PStringStream strm;
+
+  strm << "{\"time\":" << JsonString(start.AsString(PTime::LongISO8601))
+       << ",\"duration_ms\":" << (ModemClock::Get().Now() - start).GetMilliSeconds()
+       << ",\"token\":" << JsonString(token)
+       << ",\"modem\":" << JsonString(metrics.Name())
+       << ",\"direction\":\"" << (originating ? "outgoing" : "incoming") << "\""
+       << ",\"options\":{";
+
+  for (PINDEX i = 0 ; i < options.GetSize() ; i++) {
+    strm << (i ? "," : "") << JsonString(options.GetKeyAt(i))
+         << ":" << JsonString(options.GetDataAt(i));
+  }
+
+  strm << "},\"send\":";
+  PrintSide(strm, sendSide, &pacing);
+  strm << ",\"receive\":";
+  PrintSide(strm, recvSide, NULL);
+
+  strm << ",\"t30\":{"
+          "\"bit_rate\":" << t30.getBitRate()
+       << ",\"remote_bit_rate\":" << t30.getRemoteBitRate()
+       << ",\"ecm\":" << (t30.isEcm() ? "true" : "false")
+       << ",\"pages\":" << t30.getPages()
+       << ",\"ecm_blocks\":" << t30.getEcmBlocks()
+       << ",\"ppr\":" << t30.getEcmPprs()
+       << ",\"ppr_frames\":" << t30.getEcmPprFrames()
+       << ",\"frames\":{";
+
+  PBoolean first = TRUE;
+
+  for (int i = T30::ftUnknown ; i < T30::ftNumTypes ; i++) {
+    long count = t30.getFrameCount(T30::FrameType(i));
+
+    if (count) {
+      strm << (first ? "" : ",") << "\"" << T30::getFrameName(T30::FrameType(i)) << "\":" << count;
+      first = FALSE;
+    }
+  }
+
+  // [ms from the call start, "out" (sent to remote) or "in", frame or TCF or DATA]
+  strm << "},\"timeline\":[";
+
+  for (PINDEX i = 0 ; i < t30.getEventCount() ; i++) {
+    const T30::Event &event = t30.getEvent(i);
+
+    strm << (i ? "," : "")
+         << "[" << (event.time - start).GetMilliSeconds()
+         << ",\"" << (event.sent ? "out" : "in") << "\",\""
+         << (event.frameType != T30::ftNone ? T30::getFrameName(event.frameType) : event.tcf ? "TCF" : "DATA")
+         << "\"]";
+  }
+
+  strm << "]}";
+
+  // CPU time of the modem threads during the call
+  strm << ",\"threads_cpu_ms\":{";
+
+  for (int i = 0 ; i < ModemMetrics::NumThreadRoles ; i++) {
+    ModemMetrics::ThreadRole role = ModemMetrics::ThreadRole(i);
+
+    strm << (i ? "," : "") << "\"" << ModemMetrics::GetThreadRoleName(role) << "\":"
+         << JsonMs(metrics.GetThreadCpu(role) - threadCpuStart[i]);
+  }
+
+  strm << "}}";
+
+  CdrWriter::Write(strm);
+}
+///////////////////////////////////////////////////////////////
+CdrWriter *CdrWriter::writer = NULL;
+
+CdrWriter::CdrWriter(const PString &_path, PINDEX _maxSize, int _maxFiles)
+  : PThread(30000, NoAutoDeleteThread, LowPriority, "CDR")
+  , path(_path)
+  , maxSize(_maxSize)
+  , maxFiles(_maxFiles)
+  , dropped(0)
+{
+}
+
+PBoolean CdrWriter::Start(const PString &path, PINDEX maxSize, int maxFiles)
+{
+  if (writer != NULL)
+    return TRUE;
+
+  CdrWriter *cdrWriter = new CdrWriter(path, maxSize, maxFiles);
+
+  if (!cdrWriter->OpenFile()) {
+    cerr << "Can't open CDR file " << path << endl;
+    delete cdrWriter;
+    return FALSE;
+  }
+
+  writer = cdrWriter;
+  writer->Resume();
+
+  return TRUE;
+}
+
+void CdrWriter::Write(const PString &record)
+{
+  if (writer == NULL)
+    return;
+
+  {
+    PWaitAndSignal mutexWait(writer->mutex);
+
+    if (writer->queue.GetSize() >= maxQueued) {
+      writer->dropped++;
+      return;
+    }
+
+    writer->queue.AppendString(record);
+  }
+
+  writer->queueSyncPoint.Signal();
+}
+
+PBoolean CdrWriter::OpenFile()
+{
+  if (!file.Open(path, PFile::WriteOnly, PFile::Create)) {
+    myPTRACE(1, "CdrWriter: can't open " << path << " " << file.GetErrorText());
+    return FALSE;
+  }
+
+  file.SetPosition(0, PFile::End);
+
+  return TRUE;
+}
+
+void CdrWriter::Rotate()
+{
+  file.Close();
+
+  if (maxFiles > 0) {
+    PFile::Remove(psprintf("%s.%d", (const char *)path, maxFiles));
+
+    for (int i = maxFiles - 1 ; i > 0 ; i--) {
+      PString from = psprintf("%s.%d", (const char *)path, i);
+
+      if (PFile::Exists(from))
+        PFile::Move(from, psprintf("%s.%d", (const char *)path, i + 1), TRUE);
+    }
+
+    PFile::Move(path, path + ".1", TRUE);
+  } else {
+    PFile::Remove(path);
+  }
+
+  myPTRACE(2, "CdrWriter: rotated " << path);
+
+  OpenFile();
+}
+
+void CdrWriter::Main()
+{
+  myPTRACE(1, "CdrWriter: started for " << path);
+
+  for (;;) {
+    queueSyncPoint.Wait();
+
+    PStringList records;
+    long droppedRecords;
+
+    {
+      PWaitAndSignal mutexWait(mutex);
+
+      records = queue;
+      queue = PStringList();
+      droppedRecords = dropped;
+      dropped = 0;
+    }
+
+    if (droppedRecords) {
+      myPTRACE(1, "CdrWriter: dropped " << droppedRecords << " records (queue is full)");
+    }
+
+    for (PINDEX i = 0 ; i < records.GetSize() ; i++) {
+      if (!file.IsOpen() && !OpenFile())
+        break;
+
+      if (!file.WriteLine(records[i])) {
+        myPTRACE(1, "CdrWriter: write ERROR " << file.GetErrorText());
+        file.Close();
+        break;
+      }
+
+      if (maxSize > 0 && file.GetLength() >= maxSize)
+        Rotate();
+    }
+  }
+}
+///////////////////////////////////////////////////////////////
+
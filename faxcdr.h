@@ -0,0 +1,211 @@
+/*
+ * faxcdr.h
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: faxcdr.h,v $
+ *
+ */
+
+#ifndef _FAXCDR_H
+#define _FAXCDR_H
+
+#include "pmutils.h"
+
+///////////////////////////////////////////////////////////////
+class T30;
+class ReorderBuffer;
+///////////////////////////////////////////////////////////////
+/**Per call QoS record of T.38 fax (CDR).
+
+   The statistics are collected by the T.38 engine and its streams while
+   the call is active and written by Submit() as one JSON line via
+   CdrWriter when the engine of the call is destroyed.
+
+   The send side is updated by the send thread only and the receive side
+   by the receive thread only, so the data path needs no locks.
+ */
+class FaxCdr : public PObject
+{
+    PCLASSINFO(FaxCdr, PObject);
+  public:
+    enum {
+      maxGapMs = 1000                   ///<  Range of the inter-arrival histogram
+    };
+
+  /**@name Construction */
+  //@{
+    FaxCdr();
+  //@}
+
+  /**@name Call information */
+  //@{
+    void SetCall(const PString &token, PBoolean originating);
+    void SetOption(const PString &key, const PString &value);
+
+    /**Remember the CPU time of the modem threads at the call start.
+      */
+    void StartThreadCpu(const ModemMetrics &metrics);
+  //@}
+
+  /**@name Send side */
+  //@{
+    void OnSent(PINDEX bytes, PINDEX redundancyBytes = 0);
+    void OnResent(PINDEX bytes);
+    void AddSendCpu(PInt64 ns) { sendSide.cpuNs += ns; }
+  //@}
+
+  /**@name Receive side */
+  //@{
+    void OnReceived(PINDEX bytes, PINDEX redundancyBytes = 0);
+    void OnRepeated(PINDEX bytes);
+    void SetReorder(const ReorderBuffer &reorder);
+    void AddRecvCpu(PInt64 ns) { recvSide.cpuNs += ns; }
+  //@}
+
+  /**@name Output */
+  //@{
+    /**Write the record with the send pacing and the T.30 data of the call
+       and the CPU time of the modem threads since StartThreadCpu().
+      */
+    void Submit(const ModemMetrics &metrics, const ModemMetrics::SendPacing &pacing, const T30 &t30);
+  //@}
+
+    /**Adds the CPU time of the current thread for the scope. If metrics
+       is not NULL then the same time is added to its role too, so the
+       scope is sampled once for both (see ModemMetrics::Cpu).
+      */
+    class Cpu
+    {
+      public:
+        Cpu(
+          FaxCdr &_cdr,
+          PBoolean _send,
+          ModemMetrics *_metrics = NULL,
+          ModemMetrics::ThreadRole _role = ModemMetrics::trMedia
+        ) : cdr(_cdr), send(_send), metrics(_metrics), role(_role), start(GetThreadCpuNs()) {}
+
+        ~Cpu() {
+          PInt64 ns = GetThreadCpuNs() - start;
+
+          if (send)
+            cdr.AddSendCpu(ns);
+          else
+            cdr.AddRecvCpu(ns);
+
+          if (metrics != NULL)
+            metrics->AddThreadCpu(role, ns);
+        }
+
+      protected:
+        FaxCdr &cdr;
+        const PBoolean send;
+        ModemMetrics *const metrics;
+        const ModemMetrics::ThreadRole role;
+        const PInt64 start;
+    };
+
+  protected:
+    struct Side {
+      Side();
+
+      long packets;
+      PInt64 bytes;
+      long again;                       ///<  Resent or repeated
+      PInt64 againBytes;
+      PInt64 redundancyBytes;
+      PInt64 cpuNs;
+    };
+
+    long GapPercentile(int percent) const;
+    void PrintSide(ostream &strm, const Side &side, const ModemMetrics::SendPacing *pacing) const;
+
+    PMutex mutex;                       ///<  Guards call information
+    const PTime start;
+    PString token;
+    PBoolean originating;
+    PStringToString options;
+
+    Side sendSide;
+    Side recvSide;
+
+    PTime lastReceived;
+    long gaps[maxGapMs + 1];            ///<  Inter-arrival gaps, ms (the last is overflow)
+    long maxGap;
+    long gapCount;
+
+    long lost;
+    long recovered;
+    long reordered;
+    long held;
+    long heldTime;
+
+    PInt64 threadCpuStart[ModemMetrics::NumThreadRoles];
+};
+///////////////////////////////////////////////////////////////
+/**Background writer of the CDRs to the rotating JSON lines file.
+ */
+class CdrWriter : public PThread
+{
+    PCLASSINFO(CdrWriter, PThread);
+  public:
+  /**@name Operations */
+  //@{
+    /**Start the writer to the file path. The file is rotated to path.1,
+       path.2, ... path.maxFiles if it's larger than maxSize bytes.
+      */
+    static PBoolean Start(const PString &path, PINDEX maxSize, int maxFiles);
+
+    /**Queue the record (ignored if the writer is not started).
+      */
+    static void Write(const PString &record);
+
+    static PBoolean IsStarted() { return writer != NULL; }
+  //@}
+
+  protected:
+    enum { maxQueued = 1000 };
+
+    CdrWriter(const PString &_path, PINDEX _maxSize, int _maxFiles);
+
+    void Main();
+    PBoolean OpenFile();
+    void Rotate();
+
+    const PString path;
+    const PINDEX maxSize;
+    const int maxFiles;
+
+    PTextFile file;
+
+    PMutex mutex;
+    PStringList queue;
+    PSyncPoint queueSyncPoint;
+    long dropped;
+
+    static CdrWriter *writer;
+};
+///////////////////////////////////////////////////////////////
+
+#endif  // _FAXCDR_H
+
@@ -70,6 +70,7 @@ PBoolean ModemAudioChannel::Read(void * buffer, PINDEX amount)
   if (!audioEngine->Read(EngineBase::HOWNEROUT(this), buffer, amount))
     return FALSE;
 
+  audioEngine->ReadPacing().Sent(audioEngine->GetReadScheduled());
   lastReadCount = amount;
 
   return TRUE;
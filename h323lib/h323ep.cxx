@@ -236,7 +236,12 @@ PString MyH323EndPoint::ArgSpec()
              "-route:"
              "-redundancy:"
              "-repeat:"
+             "-packet-interval:"
+             "-reorder-depth:"
+             "-reorder-delay:"
              "-old-asn."
+             "-t38-tcp."
+             "-early-fax-switch."
 
              "F-fastenable."
              "T-h245tunneldisable."
@@ -274,8 +279,21 @@ PStringArray MyH323EndPoint::Descriptions()
         "                              speed IFP packets. I, L and H are digits.\n"
         "  --repeat ms               : Continuously resend last UDPTL packet each ms\n"
         "                              milliseconds.\n"
+        "  --packet-interval ms      : Set packetization interval for high speed\n"
+        "                              IFP packets to ms milliseconds (20-100).\n"
+        "  --reorder-depth n         : Hold a gap in incoming UDPTL sequence open\n"
+        "                              while no more than n (0-8) packets are\n"
+        "                              waiting behind it (default 0 or 8 if\n"
+        "                              only --reorder-delay is set).\n"
+        "  --reorder-delay ms        : Hold a gap in incoming UDPTL sequence open\n"
+        "                              no more than ms milliseconds.\n"
         "  --old-asn                 : Use original ASN.1 sequence in T.38 (06/98)\n"
         "                              Annex A (w/o CORRIGENDUM No. 1 fix).\n"
+        "  --t38-tcp                 : Prefer T.38 over TCP (IFP packets with TPKT\n"
+        "                              framing) to T.38 over UDPTL.\n"
+        "  --early-fax-switch        : Request T.38 mode as soon as CED, ANSam or\n"
+        "                              V.21 flags are detected in the audio from\n"
+        "                              the remote party.\n"
         "  -i --interface ip         : Bind to a specific interface.\n"
         "  --no-listenport           : Disable listen for incoming calls.\n"
         "  --listenport port         : Listen on a specific port.\n"
@@ -394,7 +412,11 @@ MyH323EndPoint::MyH323EndPoint()
   ls_redundancy = -1;
   hs_redundancy = -1;
   re_interval = -1;
+  pk_interval = -1;
+  ro_depth = -1;
+  ro_delay = -1;
   old_asn = FALSE;
+  early_fax_switch = FALSE;
 }
 
 void MyH323EndPoint::OnMyCallback(PObject &from, INT myPTRACE_PARAM(extra))
@@ -482,7 +504,7 @@ void MyH323EndPoint::OnMyCallback(PObject &from, INT myPTRACE_PARAM(extra))
       PString callToken = request("calltoken");
       H323Connection * _conn = FindConnectionWithLock(callToken);
       if( _conn != NULL ) {
-        if (request("mode") == "fax") {
+        if (request("mode") == "fax" || (early_fax_switch && request("mode") == "fax-detected")) {
           if (_conn->RequestModeChangeT38()) {
             PTRACE(2, "MyH323EndPoint::OnMyCallback RequestMode T38 - OK");
             response = "confirm";
@@ -532,7 +554,7 @@ void MyH323EndPoint::PMFree(PseudoModem *pmodem) const
     pmodem_pool->Enqueue(pmodem);
 }
 
-void MyH323EndPoint::SetOptions(MyH323Connection &/*conn*/, OpalT38Protocol *t38handler) const
+void MyH323EndPoint::SetOptions(MyH323Connection &conn, OpalT38Protocol *t38handler) const
 {
   // TODO: make it per host
 
@@ -545,8 +567,13 @@ void MyH323EndPoint::SetOptions(MyH323Connection &/*conn*/, OpalT38Protocol *t38
         hs_redundancy,
         re_interval);
 
+    ((T38Protocol *)t38handler)->SetPacketInterval(pk_interval);
+    ((T38Protocol *)t38handler)->SetReorderDepth(ro_depth, ro_delay);
+
     if (old_asn)
       ((T38Protocol *)t38handler)->SetOldASN();
+
+    ((T38Protocol *)t38handler)->SetCall(conn.GetCallToken(), !conn.HadAnsweredCall());
   }
 }
 
@@ -667,9 +694,21 @@ PBoolean MyH323EndPoint::Initialise(const PConfigArgs &args)
   if (args.HasOption("repeat"))
     re_interval = (int)args.GetOptionString("repeat").AsInteger();
 
+  if (args.HasOption("packet-interval"))
+    pk_interval = (int)args.GetOptionString("packet-interval").AsInteger();
+
+  if (args.HasOption("reorder-depth"))
+    ro_depth = (int)args.GetOptionString("reorder-depth").AsInteger();
+
+  if (args.HasOption("reorder-delay"))
+    ro_delay = (int)args.GetOptionString("reorder-delay").AsInteger();
+
   if (args.HasOption("old-asn"))
     old_asn = TRUE;
 
+  if (args.HasOption("early-fax-switch"))
+    early_fax_switch = TRUE;
+
   if (args.HasOption('G'))
     SetCapability(0, 0, new G7231_Fake_Capability());
   else {
@@ -677,6 +716,9 @@ PBoolean MyH323EndPoint::Initialise(const PConfigArgs &args)
     SetCapability(0, 0, new H323_G711Capability(H323_G711Capability::ALaw,  H323_G711Capability::At64k));
   }
 
+  if (args.HasOption("t38-tcp"))
+    SetCapability(0, 0, new H323_T38Capability(H323_T38Capability::e_SingleTCP));
+
   SetCapability(0, 0, new H323_T38Capability(H323_T38Capability::e_UDP));
   //SetCapability(0, 0, new H323_T38NonStandardCapability(181, 0, 18));
 
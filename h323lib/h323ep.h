@@ -141,7 +141,11 @@ class MyH323EndPoint : public H323EndPoint
     int ls_redundancy;
     int hs_redundancy;
     int re_interval;
+    int pk_interval;
+    int ro_depth;
+    int ro_delay;
     PBoolean old_asn;
+    PBoolean early_fax_switch;
 
     PDECLARE_NOTIFIER(PObject, MyH323EndPoint, OnMyCallback);
 };
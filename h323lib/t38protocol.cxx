@@ -44,6 +44,7 @@
 
 #include "t38protocol.h"
 #include "../t38engine.h"
+#include "../ifpcodec.h"
 #include "../pmodem.h"
 
 #define new PNEW
@@ -55,6 +56,10 @@ T38Protocol::T38Protocol(PseudoModem * pmodem)
   , ls_redundancy(0)
   , hs_redundancy(0)
   , re_interval(-1)
+  , pk_interval(-1)
+  , rawSizeIn(0)
+  , redundancyBytesIn(0)
+  , repeatedIn(0)
 {
 }
 
@@ -75,6 +80,9 @@ void T38Protocol::SetRedundancy(int indication, int low_speed, int high_speed, i
 
   re_interval = repeat_interval;
 
+  t38engine->Cdr().SetOption("Redundancy", psprintf("indication=%d low_speed=%d high_speed=%d repeat_interval=%d",
+                                                   in_redundancy, ls_redundancy, hs_redundancy, re_interval));
+
   myPTRACE(3, t38engine->Name() << " T38Protocol::SetRedundancy indication=" << in_redundancy
                                             << " low_speed=" << ls_redundancy
                                             << " high_speed=" << hs_redundancy
@@ -82,74 +90,52 @@ void T38Protocol::SetRedundancy(int indication, int low_speed, int high_speed, i
   );
 }
 
-#ifdef OPTIMIZE_CORRIGENDUM_IFP
-  #define T38_IFP_NOT_NATIVE       T38_PreCorrigendum_IFPPacket
-  #define T38_IFP_NOT_NATIVE_NAME  "Pre-corrigendum IFP"
-  #define IS_NATIVE_ASN            corrigendumASN
-  #define IS_EXTENDABLE            FALSE
-#else
-  #define T38_IFP_NOT_NATIVE       T38_IFPPacket
-  #define T38_IFP_NOT_NATIVE_NAME  "IFP"
-  #define IS_NATIVE_ASN            (!corrigendumASN)
-  #define IS_EXTENDABLE            TRUE
-#endif
+void T38Protocol::SetCall(const PString &token, PBoolean originating)
+{
+  t38engine->Cdr().SetCall(token, originating);
+  t38engine->Cdr().SetOption("ASN", corrigendumASN ? "corrigendum" : "original");
+}
 
-static void EncodeIFPPacket(PASN_OctetString &ifp_packet, const T38_IFP &T38_ifp, PBoolean nativeASN)
+void T38Protocol::SetReorderDepth(int depth, int delay)
 {
-  if (!nativeASN && T38_ifp.HasOptionalField(T38_IFPPacket::e_data_field)) {
-    T38_IFP ifp = T38_ifp;
-    PINDEX count = ifp.m_data_field.GetSize();
+  if (depth < 0 && delay < 0)
+    return;
 
-    for( PINDEX i = 0 ; i < count ; i++ ) {
-      ifp.m_data_field[i].m_field_type.SetExtendable(IS_EXTENDABLE);
-    }
-    ifp_packet.EncodeSubType(ifp);
-  } else {
-    ifp_packet.EncodeSubType(T38_ifp);
-  }
+  reorder.SetDepth(depth < 0 ? int(ReorderBuffer::maxDepth) : depth, delay);
 }
 
 PBoolean T38Protocol::HandleRawIFP(const PASN_OctetString & pdu)
 {
-  T38_IFP ifp;
+  const PBYTEArray &value = pdu.GetValue();
 
-  if (IS_NATIVE_ASN) {
-    if (pdu.DecodeSubType(ifp))
-      return t38engine->HandlePacket(EngineBase::HOWNERIN(this), ifp);
+  return HandleRawIFP(value, value.GetSize());
+}
 
-    PTRACE(2, "T38\t" T38_IFP_NAME " decode failure:\n  " << setprecision(2) << ifp);
-    return TRUE;
-  }
+PBoolean T38Protocol::HandleRawIFP(const BYTE * pData, PINDEX len)
+{
+  T38_IFP ifp;
 
-  T38_IFP_NOT_NATIVE old_ifp;
-  if (!pdu.DecodeSubType(old_ifp)) {
-    PTRACE(2, "T38\t" T38_IFP_NOT_NATIVE_NAME " decode failure:\n  " << setprecision(2) << old_ifp);
+  // decode natively for both ASN.1 variants
+  if (!IFPCodec::Decode(pData, len, ifp, corrigendumASN)) {
+    PTRACE(2, "T38\t" << (corrigendumASN ? "" : "Pre-corrigendum ") << "IFP decode failure: "
+        << PRTHEX(PBYTEArray(pData, len, FALSE)));
     return TRUE;
   }
 
-  ifp.m_type_of_msg = old_ifp.m_type_of_msg;
-
-  if (old_ifp.HasOptionalField(T38_IFPPacket::e_data_field)) {
-    ifp.IncludeOptionalField(T38_IFPPacket::e_data_field);
-    PINDEX count = old_ifp.m_data_field.GetSize();
-    ifp.m_data_field.SetSize(count);
-    for (PINDEX i = 0 ; i < count; i++) {
-      ifp.m_data_field[i].m_field_type = old_ifp.m_data_field[i].m_field_type;
-      if (old_ifp.m_data_field[i].HasOptionalField(T38_Data_Field_subtype::e_field_data)) {
-        ifp.m_data_field[i].IncludeOptionalField(T38_Data_Field_subtype::e_field_data);
-        ifp.m_data_field[i].m_field_data = old_ifp.m_data_field[i].m_field_data;
-      }
-    }
-  }
-
   return t38engine->HandlePacket(EngineBase::HOWNERIN(this), ifp);
 }
 
 PBoolean T38Protocol::Originate()
 {
   RenameCurrentThread(t38engine->Name() + "(tx)");
+  ModemMetrics::ThreadCpu threadCpu(t38engine->Metrics(), ModemMetrics::trT38Tx);
   PTRACE(2, "T38\tOriginate, transport=" << *transport);
 
+  FaxCdr::Cpu cpu(t38engine->Cdr(), TRUE);
+
+  if (PIsDescendant(transport, H323TransportTCP))
+    return OriginateTCP();
+
   long seq = -1;
   int maxRedundancy = 0;
 #if PTRACING
@@ -165,6 +151,12 @@ PBoolean T38Protocol::Originate()
 
   t38engine->OpenOut(EngineBase::HOWNEROUT(this));
 
+  if (pk_interval > 0)
+    t38engine->SetPacketInterval(EngineBase::HOWNEROUT(this), pk_interval);
+
+  ModemMetrics &metrics = t38engine->Metrics();
+  FaxCdr &cdr = t38engine->Cdr();
+
   for (;;) {
     T38_IFP ifp;
     int res;
@@ -186,6 +178,9 @@ PBoolean T38Protocol::Originate()
 
     res = t38engine->PreparePacket(EngineBase::HOWNEROUT(this), ifp);
 
+    // only the prepared packets are paced (not the repeated ones)
+    PBoolean paced = (res > 0);
+
 #ifdef REPEAT_INDICATOR_SENDING
     if (res > 0)
       lastifp = ifp;
@@ -220,7 +215,17 @@ PBoolean T38Protocol::Originate()
 
       udptl.m_seq_number = ++seq & 0xFFFF;
 
-      EncodeIFPPacket(udptl.m_primary_ifp_packet, ifp, IS_NATIVE_ASN);
+      // encode directly to the primary IFP packet buffer
+      PINDEX len = IFPCodec::Encode(ifp, udptl.m_primary_ifp_packet.GetPointer(maxIfpSize),
+                                    maxIfpSize, corrigendumASN);
+
+      if (len < 0) {
+        PTRACE(1, "T38\tOriginate - " << (corrigendumASN ? "" : "Pre-corrigendum ")
+            << "IFP encode failure:\n  ifp = " << setprecision(2) << ifp);
+        break;
+      }
+
+      udptl.m_primary_ifp_packet.SetSize(len);
 
       /*
        * Calculate maxRedundancy for current ifp packet
@@ -308,6 +313,38 @@ PBoolean T38Protocol::Originate()
       PTRACE(1, "T38\tOriginate - WritePDU ERROR: " << transport->GetErrorText());
       break;
     }
+
+    if (paced)
+      t38engine->Pacing().Sent(t38engine->GetScheduledOut());
+
+    {
+      const PBYTEArray &value = udptl.m_primary_ifp_packet.GetValue();
+
+      BinTrace::Add(metrics.TraceId(), BinTrace::evIfpOut,
+                    (udptl.m_seq_number & BinTrace::argSeqMask) |
+                        (corrigendumASN ? BinTrace::argCorrigendum : 0) |
+                        (res < 0 ? BinTrace::argRepeated : 0),
+                    value, value.GetSize());
+    }
+
+    PINDEX redundancyBytes = 0;
+
+    if (udptl.m_error_recovery.GetTag() == T38_UDPTLPacket_error_recovery::e_secondary_ifp_packets) {
+      const T38_UDPTLPacket_error_recovery_secondary_ifp_packets &secondary = udptl.m_error_recovery;
+
+      for (PINDEX i = 0 ; i < secondary.GetSize() ; i++)
+        redundancyBytes += secondary[i].GetSize();
+
+      metrics.Add(ModemMetrics::cRedundancyBytesSent, redundancyBytes);
+    }
+
+    if (res > 0) {
+      metrics.Add(ModemMetrics::cPacketsSent);
+      cdr.OnSent(rawData.GetSize(), redundancyBytes);
+    } else {
+      metrics.Add(ModemMetrics::cPacketsResent);
+      cdr.OnResent(rawData.GetSize());
+    }
   }
 
   myPTRACE(2, "T38\tSend statistics: sequence=" << seq
@@ -320,25 +357,43 @@ PBoolean T38Protocol::Originate()
 PBoolean T38Protocol::Answer()
 {
   RenameCurrentThread(t38engine->Name() + "(rx)");
+  ModemMetrics::ThreadCpu threadCpu(t38engine->Metrics(), ModemMetrics::trT38Rx);
   PTRACE(2, "T38\tAnswer, transport=" << *transport);
 
+  FaxCdr::Cpu cpu(t38engine->Cdr(), FALSE);
+
+  if (PIsDescendant(transport, H323TransportTCP))
+    return AnswerTCP();
+
   // We can't get negotiated sender's address and port,
   // so accept first packet from any address and port
   transport->SetPromiscuous(transport->AcceptFromAny);
 
   int consecutiveBadPackets = 0;
-  long expectedSequenceNumber = 0;
-#if PTRACING
-  int totalrecovered = 0;
-  int totallost = 0;
-  int repeated = 0;
-#endif
+  PTimeInterval readTimeout = transport->GetReadTimeout();
+
+  repeatedIn = 0;
+  reorder.Reset();
 
   t38engine->OpenIn(EngineBase::HOWNERIN(this));
 
+  ModemMetrics &metrics = t38engine->Metrics();
+  FaxCdr &cdr = t38engine->Cdr();
+
   for (;;) {
+    // wake up to declare the held gap lost in time
+    int timeout = reorder.GetTimeout();
+
+    transport->SetReadTimeout(timeout >= 0 ? PTimeInterval(timeout) : readTimeout);
+
     PPER_Stream rawData;
     if (!transport->ReadPDU(rawData)) {
+      if (timeout >= 0 && transport->GetErrorCode(PChannel::LastReadError) == PChannel::Timeout) {
+        if (!reorder.Flush(*this))
+          break;
+        continue;
+      }
+
       PTRACE(1, "T38\tError reading PDU: " << transport->GetErrorText(PChannel::LastReadError));
       break;
     }
@@ -350,7 +405,7 @@ PBoolean T38Protocol::Answer()
 
       // When we get the first packet, we know sender's address and port,
       // so accept next packets from sender's address and port only
-      if (expectedSequenceNumber == 0) {
+      if (reorder.GetExpected() == 0) {
         PTRACE(3, "T38\tReceived first packet, remote=" << transport->GetLastReceivedAddress());
         transport->SetPromiscuous(transport->AcceptFromLastReceivedOnly);
       }
@@ -366,95 +421,254 @@ PBoolean T38Protocol::Answer()
       continue;
     }
 
-    long receivedSequenceNumber = (udptl.m_seq_number & 0xFFFF) + (expectedSequenceNumber & ~0xFFFFL);
-    long lost = receivedSequenceNumber - expectedSequenceNumber;
-
-    if (lost < -0x10000L/2) {
-      lost += 0x10000L;
-      receivedSequenceNumber += 0x10000L;
-    }
-    else if (lost > 0x10000L/2) {
-      lost -= 0x10000L;
-      receivedSequenceNumber -= 0x10000L;
-    }
+    long receivedSequenceNumber = reorder.Unwrap(WORD(udptl.m_seq_number & 0xFFFF));
 
     PTRACE(4, "T38\tReceived PDU:\n  "
            << setprecision(2) << rawData << "\n  UDPTL = "
            << setprecision(2) << udptl);
 
-    if (lost < 0) {
-      PTRACE(4, "T38\tRepeated packet " << receivedSequenceNumber);
-#if PTRACING
-      repeated++;
-#endif
-      continue;
+    rawSizeIn = rawData.GetSize();
+    redundancyBytesIn = 0;
+
+    if (udptl.m_error_recovery.GetTag() == T38_UDPTLPacket_error_recovery::e_secondary_ifp_packets) {
+      const T38_UDPTLPacket_error_recovery_secondary_ifp_packets &secondary = udptl.m_error_recovery;
+
+      for (PINDEX i = 0 ; i < secondary.GetSize() ; i++)
+        redundancyBytesIn += secondary[i].GetSize();
+
+      metrics.Add(ModemMetrics::cRedundancyBytesReceived, redundancyBytesIn);
     }
-    else if(lost > 0) {
+
+    if (receivedSequenceNumber > reorder.GetExpected()) {
+      // try to fill the gap from the redundancy
       const T38_UDPTLPacket_error_recovery &recovery = udptl.m_error_recovery;
       if (recovery.GetTag() == T38_UDPTLPacket_error_recovery::e_secondary_ifp_packets) {
         const T38_UDPTLPacket_error_recovery_secondary_ifp_packets &secondary = recovery;
-        int nRedundancy = secondary.GetSize();
-        if (lost > nRedundancy) {
-          if (!t38engine->HandlePacketLost(EngineBase::HOWNERIN(this), lost - nRedundancy))
-            break;
-#if PTRACING
-          totallost += lost - nRedundancy;
-#endif
-          lost = nRedundancy;
-        }
-        else
-          nRedundancy = lost;
+        long recovered = reorder.GetRecovered();
 
-        receivedSequenceNumber -= lost;
+        for (int i = secondary.GetSize() - 1 ; i >= 0 ; i--) {
+          long seq = receivedSequenceNumber - 1 - i;
 
-        for (int i = nRedundancy - 1 ; i >= 0 ; i--) {
-          PTRACE(3, "T38\tReceived ifp seq=" << receivedSequenceNumber << " (secondary)");
+          if (seq < reorder.GetExpected())
+            continue;
 
-          if (!HandleRawIFP(secondary[i]))
-            goto done;
+          const PBYTEArray &value = secondary[i].GetValue();
 
-#if PTRACING
-          totalrecovered++;
-#endif
-          lost--;
-          receivedSequenceNumber++;
+          if (!reorder.Receive(WORD(seq & 0xFFFF), value, value.GetSize(), *this, TRUE))
+            goto done;
         }
-        receivedSequenceNumber += lost;
+
+        metrics.Add(ModemMetrics::cPacketsRecovered, reorder.GetRecovered() - recovered);
       }
       else {
         PTRACE(3, "T38\tNot implemented yet " << recovery.GetTagName());
       }
+    }
 
-      if (lost) {
-        if (!t38engine->HandlePacketLost(EngineBase::HOWNERIN(this), lost))
-          break;
+    const PBYTEArray &value = udptl.m_primary_ifp_packet.GetValue();
+
+    if (!reorder.Receive(WORD(udptl.m_seq_number & 0xFFFF), value, value.GetSize(), *this))
+      break;
+  }
+
+done:
+
+  transport->SetReadTimeout(readTimeout);
+  cdr.SetReorder(reorder);
+
+  myPTRACE(2, "T38\tReceive statistics: sequence=" << reorder.GetExpected()
+      << " repeated=" << repeatedIn
+      << " reordered=" << reorder.GetReordered()
+      << " recovered=" << reorder.GetRecovered()
+      << " lost=" << reorder.GetLost()
+      << " held=" << reorder.GetHeld()
+      << " added latency=" << reorder.GetHeldTime() << "ms"
+      << " (max " << reorder.GetMaxHeldTime() << "ms)"
+      << GetThreadTimes(", CPU usage: "));
+  return FALSE;
+}
+
+void T38Protocol::OnPut(
+    long seq,
+    ReorderBuffer::PutResult result,
+    const BYTE * pData,
+    PINDEX len,
+    PBoolean recovered)
+{
+  if (recovered) {
+    PTRACE_IF(3, result != ReorderBuffer::prIgnored, "T38\tReceived ifp seq=" << seq << " (secondary)");
+    return;
+  }
+
+  ModemMetrics &metrics = t38engine->Metrics();
+  FaxCdr &cdr = t38engine->Cdr();
+
+  BinTrace::Add(metrics.TraceId(), BinTrace::evIfpIn,
+                (seq & BinTrace::argSeqMask) |
+                    (corrigendumASN ? BinTrace::argCorrigendum : 0) |
+                    (result == ReorderBuffer::prIgnored ? BinTrace::argRepeated : 0),
+                pData, len);
+
+  switch (result) {
+    case ReorderBuffer::prIgnored:
+      PTRACE(4, "T38\tRepeated packet " << seq);
+      metrics.Add(ModemMetrics::cPacketsRepeated);
+      cdr.OnRepeated(rawSizeIn);
+      repeatedIn++;
+      break;
+    case ReorderBuffer::prInOrder:
+      metrics.Add(ModemMetrics::cPacketsReceived);
+      cdr.OnReceived(rawSizeIn, redundancyBytesIn);
+      break;
+    default:
+      PTRACE(3, "T38\tBuffered ifp seq=" << seq
+             << " (expected " << reorder.GetExpected() << ")");
+      metrics.Add(ModemMetrics::cPacketsReceived);
+      cdr.OnReceived(rawSizeIn, redundancyBytesIn);
+      break;
+  }
+}
+
+PBoolean T38Protocol::OnLost(int lost)
+{
+  t38engine->Metrics().Add(ModemMetrics::cPacketsLost, lost);
+
+  return t38engine->HandlePacketLost(EngineBase::HOWNERIN(this), lost);
+}
+
+PBoolean T38Protocol::OnPacket(const BYTE * pData, PINDEX len)
+{
+  PTRACE(3, "T38\tReceived ifp seq=" << (reorder.GetExpected() - 1));
+
+  return HandleRawIFP(pData, len);
+}
+///////////////////////////////////////////////////////////////
+/*
+ * T.38 over TCP: IFP packets framed by TPKT (RFC 1006) without UDPTL.
+ * The transport is reliable so no redundancy and no sequence handling.
+ */
+PBoolean T38Protocol::OriginateTCP()
+{
+  PChannel *channel = transport->GetWriteChannel();
+
+  if (channel != NULL && PIsDescendant(channel, PTCPSocket)) {
+    // do not delay small IFP packets
+    if (!((PTCPSocket *)channel)->SetOption(TCP_NODELAY, 1, IPPROTO_TCP)) {
+      PTRACE(2, "T38\tOriginateTCP - can't set TCP_NODELAY: "
+             << channel->GetErrorText(PChannel::LastGeneralError));
+    }
+  }
+
+  long seq = -1;
 #if PTRACING
-        totallost += lost;
+  int writes = 0;
 #endif
+
+  PBYTEArray batch(maxBatchSize);
+  PINDEX batchSize = 0;
+
+  t38engine->OpenOut(EngineBase::HOWNEROUT(this));
+
+  if (pk_interval > 0)
+    t38engine->SetPacketInterval(EngineBase::HOWNEROUT(this), pk_interval);
+
+  for (;;) {
+    T38_IFP ifp;
+
+    // add to the batch the packets ready to be sent without delay
+    t38engine->SetPreparePacketTimeout(EngineBase::HOWNEROUT(this), batchSize > 0 ? 0 : -1);
+
+    int res = t38engine->PreparePacket(EngineBase::HOWNEROUT(this), ifp);
+
+    if (res > 0) {
+      BYTE *pTpkt = batch.GetPointer(batchSize + tpktHeaderSize + maxIfpSize) + batchSize;
+      PINDEX len = IFPCodec::Encode(ifp, pTpkt + tpktHeaderSize, maxIfpSize, corrigendumASN);
+
+      if (len < 0) {
+        PTRACE(1, "T38\tOriginateTCP - " << (corrigendumASN ? "" : "Pre-corrigendum ")
+            << "IFP encode failure:\n  ifp = " << setprecision(2) << ifp);
+        break;
       }
+
+      // the sequence of TPKT packets starts from 0 as on the receiving side
+      seq++;
+
+      BinTrace::Add(t38engine->Metrics().TraceId(), BinTrace::evIfpOut,
+                    (seq & BinTrace::argSeqMask) | (corrigendumASN ? BinTrace::argCorrigendum : 0),
+                    pTpkt + tpktHeaderSize, len);
+
+      len += tpktHeaderSize;
+
+      pTpkt[0] = 3;                        // TPKT version
+      pTpkt[1] = 0;                        // reserved
+      pTpkt[2] = BYTE(len >> 8);
+      pTpkt[3] = BYTE(len);
+
+      batchSize += len;
+      t38engine->Metrics().Add(ModemMetrics::cPacketsSent);
+      t38engine->Cdr().OnSent(len);
+
+      PTRACE(3, "T38\tSending PDU: seq=" << seq
+           << "\n  ifp = " << setprecision(2) << ifp);
+
+      if (batchSize + tpktHeaderSize + maxIfpSize <= maxBatchSize)
+        continue;
     }
 
-#if 0
-    // recovery test
-    expectedSequenceNumber = receivedSequenceNumber;
-    continue;
+    if (batchSize > 0) {
+      if (!transport->Write(batch, batchSize)) {
+        PTRACE(1, "T38\tOriginateTCP - Write ERROR: " << transport->GetErrorText(PChannel::LastWriteError));
+        break;
+      }
+
+#if PTRACING
+      writes++;
 #endif
+      batchSize = 0;
+    }
+
+    if (res == 0)
+      break;
+  }
+
+  myPTRACE(2, "T38\tSend statistics: sequence=" << seq
+      << " writes=" << writes
+      << GetThreadTimes(", CPU usage: "));
+
+  return FALSE;
+}
+
+PBoolean T38Protocol::AnswerTCP()
+{
+  long seq = 0;
+
+  t38engine->OpenIn(EngineBase::HOWNERIN(this));
+
+  for (;;) {
+    PPER_Stream rawData;
+
+    // the transport strips the TPKT header
+    if (!transport->ReadPDU(rawData)) {
+      PTRACE(1, "T38\tError reading PDU: " << transport->GetErrorText(PChannel::LastReadError));
+      break;
+    }
 
-    PTRACE(3, "T38\tReceived ifp seq=" << receivedSequenceNumber);
+    PTRACE(3, "T38\tReceived ifp seq=" << seq);
+    BinTrace::Add(t38engine->Metrics().TraceId(), BinTrace::evIfpIn,
+                  (seq & BinTrace::argSeqMask) | (corrigendumASN ? BinTrace::argCorrigendum : 0),
+                  rawData, rawData.GetSize());
+    t38engine->Metrics().Add(ModemMetrics::cPacketsReceived);
+    t38engine->Cdr().OnReceived(rawData.GetSize());
 
-    if (!HandleRawIFP(udptl.m_primary_ifp_packet))
+    if (!HandleRawIFP(rawData, rawData.GetSize()))
       break;
 
-    expectedSequenceNumber = receivedSequenceNumber + 1;
+    seq++;
   }
 
-done:
-
-  myPTRACE(2, "T38\tReceive statistics: sequence=" << expectedSequenceNumber
-      << " repeated=" << repeated
-      << " recovered=" << totalrecovered
-      << " lost=" << totallost
+  myPTRACE(2, "T38\tReceive statistics: sequence=" << seq
       << GetThreadTimes(", CPU usage: "));
+
   return FALSE;
 }
 ///////////////////////////////////////////////////////////////
@@ -39,13 +39,14 @@
 #define _T38PROTOCOL_H
 
 #include <t38proto.h>
+#include "../reorder.h"
 
 ///////////////////////////////////////////////////////////////
 class PASN_OctetString;
 class T38Engine;
 class PseudoModem;
 ///////////////////////////////////////////////////////////////
-class T38Protocol : public OpalT38Protocol
+class T38Protocol : public OpalT38Protocol, protected ReorderBuffer::Sink
 {
   PCLASSINFO(T38Protocol, OpalT38Protocol);
 
@@ -68,6 +69,15 @@ class T38Protocol : public OpalT38Protocol
       int repeat_interval
     );
 
+    void SetPacketInterval(
+      int interval
+    ) { pk_interval = interval; }
+
+    void SetReorderDepth(
+      int depth,
+      int delay
+    );
+
     /**The calling SetOldASN() is aquivalent to the following change of the t38.asn:
 
            -  t4-non-ecm-sig-end,
@@ -75,21 +85,62 @@ class T38Protocol : public OpalT38Protocol
            +  t4-non-ecm-sig-end
      */
     void SetOldASN() { corrigendumASN = FALSE; }
+
+    /**Set the call information of the QoS record (see FaxCdr).
+      */
+    void SetCall(
+      const PString & token,
+      PBoolean originating
+    );
   //@}
 
     PBoolean HandleRawIFP(const PASN_OctetString & pdu);
+    PBoolean HandleRawIFP(const BYTE * pData, PINDEX len);
     PBoolean Originate();
     PBoolean Answer();
 
     void CleanUpOnTermination();
 
   private:
+    enum { maxIfpSize = 512 };
+    enum { tpktHeaderSize = 4 };
+    enum { maxBatchSize = 1400 };
+
+    PBoolean OriginateTCP();
+    PBoolean AnswerTCP();
+
+  /**@name Overrides of ReorderBuffer::Sink class */
+  //@{
+    virtual void OnPut(
+      long seq,
+      ReorderBuffer::PutResult result,
+      const BYTE * pData,
+      PINDEX len,
+      PBoolean recovered
+    );
+
+    virtual PBoolean OnLost(
+      int lost
+    );
+
+    virtual PBoolean OnPacket(
+      const BYTE * pData,
+      PINDEX len
+    );
+  //@}
+
     T38Engine *t38engine;
 
     int in_redundancy;
     int ls_redundancy;
     int hs_redundancy;
     int re_interval;
+    int pk_interval;
+
+    ReorderBuffer reorder;                 ///<  Used by Answer() only
+    PINDEX rawSizeIn;                      ///<  Size of the current UDPTL packet
+    PINDEX redundancyBytesIn;              ///<  Secondary IFPs of the current UDPTL packet
+    int repeatedIn;
 };
 ///////////////////////////////////////////////////////////////
 
@@ -0,0 +1,394 @@
+/*
+ * ifpcodec.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: ifpcodec.cxx,v $
+ *
+ */
+
+#include <ptlib.h>
+
+#ifdef USE_OPAL
+  #include <opal/buildopts.h>
+  #include <asn/t38.h>
+#else
+  #include <t38.h>
+#endif
+
+#include "ifpcodec.h"
+
+#define new PNEW
+
+#define T38I(t30_indicator) T38_Type_of_msg_t30_indicator::t30_indicator
+#define T38D(msg_data) T38_Type_of_msg_data::msg_data
+#define T38F(field_type) T38_Data_Field_subtype_field_type::field_type
+
+/*
+ * Numbers of root (not extension) enumerations
+ */
+#define NUM_INDICATORS    (T38I(e_v17_14400_long_training) + 1)
+#define NUM_DATA_TYPES    (T38D(e_v17_14400) + 1)
+#define NUM_FIELD_TYPES   (T38F(e_t4_non_ecm_sig_end) + 1)
+///////////////////////////////////////////////////////////////
+static unsigned CountBits(unsigned range)
+{
+  unsigned nBits = 0;
+
+  while (nBits < 32 && (1U << nBits) < range)
+    nBits++;
+
+  return nBits;
+}
+///////////////////////////////////////////////////////////////
+class PerEncoder
+{
+  public:
+    PerEncoder(BYTE *_pBuf, PINDEX _size)
+      : pBuf(_pBuf), size(_size), bitPos(0), error(FALSE) {}
+
+    void BitsEncode(unsigned value, unsigned nBits);
+    void ByteAlign() { bitPos = (bitPos + 7) & ~7; }
+    void BlockEncode(const BYTE *pData, PINDEX count);
+    void EnumerationEncode(unsigned value, unsigned numRoot, PBoolean extendable);
+    void SmallNumberEncode(unsigned value);
+    void LengthEncode(unsigned len);
+    void SetError() { error = TRUE; }
+
+    PINDEX CompleteEncoding() {
+      ByteAlign();
+      return error ? -1 : PINDEX(bitPos >> 3);
+    }
+
+  protected:
+    BYTE *pBuf;
+    PINDEX size;
+    PINDEX bitPos;
+    PBoolean error;
+};
+
+void PerEncoder::BitsEncode(unsigned value, unsigned nBits)
+{
+  while (nBits-- > 0) {
+    PINDEX i = bitPos >> 3;
+
+    if (i >= size) {
+      error = TRUE;
+      return;
+    }
+
+    if ((bitPos & 7) == 0)
+      pBuf[i] = 0;
+
+    if ((value >> nBits) & 1)
+      pBuf[i] |= BYTE(0x80 >> (bitPos & 7));
+
+    bitPos++;
+  }
+}
+
+void PerEncoder::BlockEncode(const BYTE *pData, PINDEX count)
+{
+  ByteAlign();
+
+  if ((bitPos >> 3) + count > size) {
+    error = TRUE;
+    return;
+  }
+
+  memcpy(pBuf + (bitPos >> 3), pData, count);
+  bitPos += count << 3;
+}
+
+void PerEncoder::EnumerationEncode(unsigned value, unsigned numRoot, PBoolean extendable)
+{
+  if (value < numRoot) {
+    if (extendable)
+      BitsEncode(0, 1);
+
+    BitsEncode(value, CountBits(numRoot));
+  }
+  else
+  if (extendable) {
+    BitsEncode(1, 1);
+    SmallNumberEncode(value - numRoot);
+  }
+  else {
+    error = TRUE;
+  }
+}
+
+void PerEncoder::SmallNumberEncode(unsigned value)
+{
+  if (value > 63) {
+    error = TRUE;
+    return;
+  }
+
+  BitsEncode(0, 1);
+  BitsEncode(value, 6);
+}
+
+void PerEncoder::LengthEncode(unsigned len)
+{
+  ByteAlign();
+
+  if (len < 128)
+    BitsEncode(len, 8);
+  else
+  if (len < 16384)
+    BitsEncode(len | 0x8000, 16);
+  else
+    error = TRUE;
+}
+///////////////////////////////////////////////////////////////
+class PerDecoder
+{
+  public:
+    PerDecoder(const BYTE *_pBuf, PINDEX _size)
+      : pBuf(_pBuf), size(_size), bitPos(0) {}
+
+    PBoolean BitsDecode(unsigned &value, unsigned nBits);
+    void ByteAlign() { bitPos = (bitPos + 7) & ~7; }
+    const BYTE *BlockDecode(PINDEX count);
+    PBoolean EnumerationDecode(unsigned &value, unsigned numRoot, PBoolean extendable);
+    PBoolean SmallNumberDecode(unsigned &value);
+    PBoolean LengthDecode(unsigned &len);
+
+  protected:
+    const BYTE *pBuf;
+    PINDEX size;
+    PINDEX bitPos;
+};
+
+PBoolean PerDecoder::BitsDecode(unsigned &value, unsigned nBits)
+{
+  value = 0;
+
+  while (nBits-- > 0) {
+    PINDEX i = bitPos >> 3;
+
+    if (i >= size)
+      return FALSE;
+
+    value = (value << 1) | ((pBuf[i] >> (7 - (bitPos & 7))) & 1);
+    bitPos++;
+  }
+
+  return TRUE;
+}
+
+const BYTE *PerDecoder::BlockDecode(PINDEX count)
+{
+  ByteAlign();
+
+  if ((bitPos >> 3) + count > size)
+    return NULL;
+
+  const BYTE *pData = pBuf + (bitPos >> 3);
+
+  bitPos += count << 3;
+
+  return pData;
+}
+
+PBoolean PerDecoder::EnumerationDecode(unsigned &value, unsigned numRoot, PBoolean extendable)
+{
+  if (extendable) {
+    unsigned ext;
+
+    if (!BitsDecode(ext, 1))
+      return FALSE;
+
+    if (ext) {
+      if (!SmallNumberDecode(value))
+        return FALSE;
+
+      value += numRoot;
+      return TRUE;
+    }
+  }
+
+  if (!BitsDecode(value, CountBits(numRoot)))
+    return FALSE;
+
+  return value < numRoot;
+}
+
+PBoolean PerDecoder::SmallNumberDecode(unsigned &value)
+{
+  unsigned big;
+
+  if (!BitsDecode(big, 1) || big)
+    return FALSE;
+
+  return BitsDecode(value, 6);
+}
+
+PBoolean PerDecoder::LengthDecode(unsigned &len)
+{
+  ByteAlign();
+
+  if (!BitsDecode(len, 8))
+    return FALSE;
+
+  if ((len & 0x80) == 0)
+    return TRUE;
+
+  if ((len & 0x40) != 0)
+    return FALSE;         // fragmentation is not supported
+
+  unsigned low;
+
+  if (!BitsDecode(low, 8))
+    return FALSE;
+
+  len = ((len & 0x3F) << 8) | low;
+
+  return TRUE;
+}
+///////////////////////////////////////////////////////////////
+PINDEX IFPCodec::Encode(const T38_IFP & ifp, BYTE * pBuf, PINDEX size, PBoolean corrigendum)
+{
+  PerEncoder strm(pBuf, size);
+  PBoolean hasDataField = ifp.HasOptionalField(T38_IFPPacket::e_data_field);
+
+  strm.BitsEncode(hasDataField ? 1 : 0, 1);
+
+  switch (ifp.m_type_of_msg.GetTag()) {
+    case T38_Type_of_msg::e_t30_indicator: {
+      const T38_Type_of_msg_t30_indicator &type_of_msg = ifp.m_type_of_msg;
+
+      strm.BitsEncode(T38_Type_of_msg::e_t30_indicator, 1);
+      strm.EnumerationEncode(type_of_msg.GetValue(), NUM_INDICATORS, TRUE);
+      break;
+    }
+    case T38_Type_of_msg::e_data: {
+      const T38_Type_of_msg_data &type_of_msg = ifp.m_type_of_msg;
+
+      strm.BitsEncode(T38_Type_of_msg::e_data, 1);
+      strm.EnumerationEncode(type_of_msg.GetValue(), NUM_DATA_TYPES, TRUE);
+      break;
+    }
+    default:
+      return -1;
+  }
+
+  if (hasDataField) {
+    PINDEX count = ifp.m_data_field.GetSize();
+
+    strm.LengthEncode(count);
+
+    for (PINDEX i = 0 ; i < count ; i++) {
+      const T38_DATA_FIELD &Data_Field = ifp.m_data_field[i];
+      PBoolean hasFieldData = Data_Field.HasOptionalField(T38_Data_Field_subtype::e_field_data);
+
+      strm.BitsEncode(hasFieldData ? 1 : 0, 1);
+      strm.EnumerationEncode(Data_Field.m_field_type.GetValue(), NUM_FIELD_TYPES, corrigendum);
+
+      if (hasFieldData) {
+        const PBYTEArray &data = Data_Field.m_field_data.GetValue();
+        PINDEX len = data.GetSize();
+
+        if (len < 1 || len > 65535)
+          return -1;
+
+        strm.ByteAlign();
+        strm.BitsEncode(len - 1, 16);
+        strm.BlockEncode(data, len);
+      }
+    }
+  }
+
+  return strm.CompleteEncoding();
+}
+
+PBoolean IFPCodec::Decode(const BYTE * pBuf, PINDEX size, T38_IFP & ifp, PBoolean corrigendum)
+{
+  PerDecoder strm(pBuf, size);
+  unsigned hasDataField;
+  unsigned tag;
+  unsigned value;
+
+  if (!strm.BitsDecode(hasDataField, 1) || !strm.BitsDecode(tag, 1))
+    return FALSE;
+
+  ifp.RemoveOptionalField(T38_IFPPacket::e_data_field);
+  ifp.m_data_field.SetSize(0);
+
+  if (tag == T38_Type_of_msg::e_t30_indicator) {
+    if (!strm.EnumerationDecode(value, NUM_INDICATORS, TRUE))
+      return FALSE;
+
+    ifp.m_type_of_msg.SetTag(T38_Type_of_msg::e_t30_indicator);
+    (T38_Type_of_msg_t30_indicator &)ifp.m_type_of_msg = value;
+  } else {
+    if (!strm.EnumerationDecode(value, NUM_DATA_TYPES, TRUE))
+      return FALSE;
+
+    ifp.m_type_of_msg.SetTag(T38_Type_of_msg::e_data);
+    (T38_Type_of_msg_data &)ifp.m_type_of_msg = value;
+  }
+
+  if (!hasDataField)
+    return TRUE;
+
+  unsigned count;
+
+  if (!strm.LengthDecode(count))
+    return FALSE;
+
+  ifp.IncludeOptionalField(T38_IFPPacket::e_data_field);
+  ifp.m_data_field.SetSize(count);
+
+  for (PINDEX i = 0 ; i < PINDEX(count) ; i++) {
+    T38_DATA_FIELD &Data_Field = ifp.m_data_field[i];
+    unsigned hasFieldData;
+
+    if (!strm.BitsDecode(hasFieldData, 1) || !strm.EnumerationDecode(value, NUM_FIELD_TYPES, corrigendum))
+      return FALSE;
+
+    Data_Field.m_field_type = value;
+
+    if (hasFieldData) {
+      unsigned len;
+
+      strm.ByteAlign();
+
+      if (!strm.BitsDecode(len, 16))
+        return FALSE;
+
+      const BYTE *pData = strm.BlockDecode(++len);
+
+      if (pData == NULL)
+        return FALSE;
+
+      Data_Field.IncludeOptionalField(T38_Data_Field_subtype::e_field_data);
+      Data_Field.m_field_data.SetValue(pData, len);
+    }
+  }
+
+  return TRUE;
+}
+///////////////////////////////////////////////////////////////
+
@@ -0,0 +1,73 @@
+/*
+ * ifpcodec.h
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: ifpcodec.h,v $
+ *
+ */
+
+#ifndef _IFPCODEC_H
+#define _IFPCODEC_H
+
+#include "t38engine.h"
+
+///////////////////////////////////////////////////////////////
+/**IFP packet codec (ALIGNED variant of PER, T.38 Annex A).
+
+   It encodes the IFP packet directly to the caller's buffer (for example
+   to the RTP frame payload) and decodes it directly from the caller's
+   buffer, without any intermediate PASN_OctetString or PPER_Stream copy.
+ */
+class IFPCodec
+{
+  public:
+    /**Encode the ifp packet to the buffer pBuf of size bytes.
+
+       If corrigendum is FALSE then the original ASN.1 sequence of T.38 (06/98)
+       Annex A (w/o CORRIGENDUM No. 1 fix) is used.
+
+       Returns the length of encoded packet or -1 on error (too small buffer or
+       bad field values).
+      */
+    static PINDEX Encode(
+      const T38_IFP & ifp,
+      BYTE * pBuf,
+      PINDEX size,
+      PBoolean corrigendum
+    );
+
+    /**Decode the ifp packet from the buffer pBuf of size bytes.
+
+       Returns FALSE on error.
+      */
+    static PBoolean Decode(
+      const BYTE * pBuf,
+      PINDEX size,
+      T38_IFP & ifp,
+      PBoolean corrigendum
+    );
+};
+///////////////////////////////////////////////////////////////
+
+#endif  // _IFPCODEC_H
@@ -65,6 +65,8 @@
 #endif
 
 #include "version.h"
+#include "pmutils.h"
+#include "faxcdr.h"
 
 #ifdef USE_OPAL
   #include "opal/manager.h"
@@ -156,6 +158,11 @@ PBoolean T38Modem::Initialise()
 #endif
              "h-help."
              "v-version."
+             "-metrics:"
+             "-cdr:"
+             "-cdr-max-size:"
+             "-cdr-max-files:"
+             "-bintrace:"
 #if PMEMORY_CHECK
              "-setallocationbreakpoint:"
 #endif
@@ -187,6 +194,20 @@ PBoolean T38Modem::Initialise()
         "  -t --trace                : Enable trace, use multiple times for more detail.\n"
         "  -o --output file          : File for trace output, default is stderr.\n"
 #endif
+        "     --metrics [addr:]port  : Serve metrics in Prometheus text format on\n"
+        "                              http://addr:port/metrics (default addr is\n"
+        "                              127.0.0.1). WARNING: there is no\n"
+        "                              authentication, so any addr other than\n"
+        "                              127.0.0.1 exposes the metrics and the trace\n"
+        "                              dumps (GET /tracedump) to the network.\n"
+        "     --cdr file             : Write per call fax QoS records (JSON lines)\n"
+        "                              to file.\n"
+        "     --cdr-max-size MB      : Rotate the CDR file if it's larger than MB\n"
+        "                              megabytes (default 10).\n"
+        "     --cdr-max-files num    : Keep num rotated CDR files (default 5).\n"
+        "     --bintrace file        : Keep the binary trace rings and append the\n"
+        "                              dumps (on failed call, on GET /tracedump of\n"
+        "                              metrics server or on SIGUSR2) to file.\n"
         "     --save                 : Save arguments in configuration file and exit.\n"
         "  -v --version              : Display version.\n"
         "  -h --help                 : Display this help message.\n"
@@ -254,6 +275,19 @@ PBoolean T38Modem::Initialise()
   }
 #endif
 
+  if (args.HasOption("cdr")) {
+    PINDEX maxSize = args.HasOption("cdr-max-size") ? (PINDEX)args.GetOptionString("cdr-max-size").AsUnsigned() : 10;
+    int maxFiles = args.HasOption("cdr-max-files") ? (int)args.GetOptionString("cdr-max-files").AsInteger() : 5;
+
+    if (!CdrWriter::Start(args.GetOptionString("cdr"), maxSize*1024*1024, maxFiles))
+      return FALSE;
+  }
+
+  if (args.HasOption("bintrace") && !BinTrace::Enable(args.GetOptionString("bintrace"))) {
+    cerr << "Can't enable binary trace" << endl;
+    return FALSE;
+  }
+
 #ifdef USE_OPAL
   MyManager *manager = new MyManager();
 
@@ -264,6 +298,9 @@ PBoolean T38Modem::Initialise()
     return FALSE;
 #endif
 
+  if (args.HasOption("metrics") && !ModemMetrics::StartServer(args.GetOptionString("metrics")))
+    return FALSE;
+
   return TRUE;
 }
 /////////////////////////////////////////////////////////////////////////////
@@ -205,6 +205,7 @@ class ModemConnection : public OpalConnection
       pmmAny,
       pmmFax,
       pmmFaxNoForce,
+      pmmFaxDetected,
     };
 
     bool RequestMode(
@@ -239,6 +240,7 @@ static ostream & operator<<(ostream & out, ModemConnection::PseudoModemMode mode
     case ModemConnection::pmmAny:         return out << "any";
     case ModemConnection::pmmFax:         return out << "fax";
     case ModemConnection::pmmFaxNoForce:  return out << "fax-no-force";
+    case ModemConnection::pmmFaxDetected: return out << "fax-detected";
     default:                              return out << "unknown" << INT(mode);
   }
 }
@@ -260,6 +262,8 @@ PString ModemEndPoint::ArgSpec()
     "p-ptty:"
     "-force-fax-mode."
     "-no-force-t38-mode."
+    "-early-fax-switch."
+    "-v21-monitor."
   ;
 }
 
@@ -278,6 +282,10 @@ PStringArray ModemEndPoint::Descriptions()
       "                              default.\n"
       "  --no-force-t38-mode       : Use OPAL-No-Force-T38-Mode=true route option by\n"
       "                              default.\n"
+      "  --early-fax-switch        : Use OPAL-Early-Fax-Switch=true route option by\n"
+      "                              default.\n"
+      "  --v21-monitor             : Use OPAL-V21-Monitor=true route option by\n"
+      "                              default.\n"
       "Modem route options:\n"
       "  OPAL-Set-Up-Phase-Timeout=secs\n"
       "    Set timeout for outgoing call Set-Up phase to secs seconds.\n"
@@ -288,6 +296,30 @@ PStringArray ModemEndPoint::Descriptions()
       "    Enable or disable forcing fax mode (T.38 or G.711 pass-trough).\n"
       "  OPAL-No-Force-T38-Mode={true|false}\n"
       "    Not enable or not disable forcing T.38 mode.\n"
+      "  OPAL-Early-Fax-Switch={true|false}\n"
+      "    Enable or disable forcing fax mode as soon as CED, ANSam or V.21 flags\n"
+      "    are detected in the audio from the remote party while fax mode is not\n"
+      "    forced.\n"
+      "  OPAL-V21-Monitor={true|false}\n"
+      "    Enable or disable demodulation of V.21 frames received as audio from the\n"
+      "    remote party in fax mode (for the trace only, disabled by default).\n"
+      "  OPAL-T38-Packet-Interval=ms\n"
+      "    Set packetization interval for outgoing T.38 high speed data to ms\n"
+      "    milliseconds (20-100, default 30). It can be set for incoming or\n"
+      "    outgoing party of the call.\n"
+      "  OPAL-T38-Reorder-Depth=n\n"
+      "    Hold a gap in the incoming T.38 packet sequence open while no more than\n"
+      "    n (0-8) packets are waiting behind it. By default it's 0 or 8 if only\n"
+      "    OPAL-T38-Reorder-Delay is set. It can be set for incoming or outgoing\n"
+      "    party of the call.\n"
+      "  OPAL-T38-Reorder-Delay=ms\n"
+      "    Hold a gap in the incoming T.38 packet sequence open no more than ms\n"
+      "    milliseconds (default is not limited). The delay is checked on packet\n"
+      "    arrival.\n"
+      "  OPAL-T38-Old-ASN={true|false}\n"
+      "    Use original ASN.1 sequence in T.38 (06/98) Annex A (true, default)\n"
+      "    or CORRIGENDUM No. 1 fix (false) for IFP packets. It can be set for\n"
+      "    incoming or outgoing party of the call.\n"
       "Modem drivers:\n"
   ).Lines();
 
@@ -349,6 +381,12 @@ PBoolean ModemEndPoint::Initialise(const PConfigArgs & args)
   if (args.HasOption("no-force-t38-mode"))
     defaultStringOptions.SetAt("No-Force-T38-Mode", "true");
 
+  if (args.HasOption("early-fax-switch"))
+    defaultStringOptions.SetAt("Early-Fax-Switch", "true");
+
+  if (args.HasOption("v21-monitor"))
+    defaultStringOptions.SetAt("V21-Monitor", "true");
+
   return TRUE;
 }
 
@@ -420,6 +458,7 @@ void ModemEndPoint::OnMyCallback(PObject &from, INT myPTRACE_PARAM(extra))
 
         if (newModeString == "fax")           { mode = ModemConnection::pmmFax;         } else
         if (newModeString == "fax-no-force")  { mode = ModemConnection::pmmFaxNoForce;  } else
+        if (newModeString == "fax-detected")  { mode = ModemConnection::pmmFaxDetected; } else
                                               { mode = ModemConnection::pmmUnknown;     }
 
         if (mode != ModemConnection::pmmUnknown) {
@@ -527,6 +566,8 @@ OpalMediaFormatList ModemEndPoint::GetMediaFormats() const
 
   OpalMediaFormatList formats;
 
+  formats += OpalG711uLaw;
+  formats += OpalG711ALaw;
   formats += OpalPCM16;
   formats += OpalT38;
   formats += OpalRFC2833;
@@ -647,12 +688,12 @@ OpalMediaStream * ModemConnection::CreateMediaStream(
     }
   }
   else
-  if (mediaFormat == OpalPCM16) {
+  if (mediaFormat == OpalPCM16 || mediaFormat == OpalG711uLaw || mediaFormat == OpalG711ALaw) {
     if (pmodem != NULL) {
       AudioEngine *audioEngine = pmodem->NewPtrAudioEngine();
 
       if (audioEngine != NULL)
-        return new AudioModemMediaStream(*this, sessionID, isSource, audioEngine);
+        return new AudioModemMediaStream(*this, mediaFormat, sessionID, isSource, audioEngine);
     }
   }
 
@@ -939,6 +980,16 @@ bool ModemConnection::RequestMode(PseudoModemMode mode)
 
         PThread::Create(requestMode, (INT)true);
         break;
+      case pmmFaxDetected:
+        if (!GetStringOptions().GetBoolean("Early-Fax-Switch")) {
+          PTRACE(3, "ModemConnection::RequestMode: Early-Fax-Switch=false");
+          requestedMode = oldMode;
+          return false;
+        }
+
+        PTRACE(3, "ModemConnection::RequestMode: Early-Fax-Switch=true");
+        requestedMode = pmmFax;
+        continue;
       case pmmFaxNoForce: {
         PSafePtr<OpalConnection> other = GetOtherPartyConnection();
 
@@ -75,18 +75,49 @@
 
 #include "../audio.h"
 #include "../t38engine.h"
+#include "../ifpcodec.h"
 #include "modemstrm.h"
 
 #define new PNEW
 
+/////////////////////////////////////////////////////////////////////////////
+// from g711.c (included by pmodeme.cxx)
+extern int linear2alaw(int pcm_val);
+extern int alaw2linear(int a_val);
+extern int linear2ulaw(int pcm_val);
+extern int ulaw2linear(int u_val);
+
+static struct G711Tables {
+  G711Tables() {
+    for (int i = 0 ; i < 256 ; i++) {
+      a2l[i] = (PInt16)alaw2linear(i);
+      u2l[i] = (PInt16)ulaw2linear(i);
+    }
+
+    // A-law has 13 and u-law has 14 significant bits
+    for (int i = 0 ; i < (1 << 14) ; i++) {
+      int pcm = PInt16(i << 2);
+
+      l2a[i] = (BYTE)linear2alaw(pcm);
+      l2u[i] = (BYTE)linear2ulaw(pcm);
+    }
+  }
+
+  PInt16 a2l[256];
+  PInt16 u2l[256];
+  BYTE l2a[1 << 14];
+  BYTE l2u[1 << 14];
+} g711;
 /////////////////////////////////////////////////////////////////////////////
 AudioModemMediaStream::AudioModemMediaStream(
     OpalConnection & conn,
+    const OpalMediaFormat & mediaFormat,
     unsigned sessionID,
     PBoolean isSource,
     AudioEngine *engine)
-  : OpalMediaStream(conn, OpalPCM16, sessionID, isSource)
+  : OpalMediaStream(conn, mediaFormat, sessionID, isSource)
   , audioEngine(engine)
+  , law(mediaFormat == OpalG711ALaw ? lawA : mediaFormat == OpalG711uLaw ? lawU : lawNone)
 {
   PTRACE(4, "AudioModemMediaStream::AudioModemMediaStream " << *this);
 
@@ -105,10 +136,13 @@ PBoolean AudioModemMediaStream::Open()
 
   PTRACE(3, "AudioModemMediaStream::Open " << *this);
 
-  if (IsSink())
+  if (IsSink()) {
     audioEngine->OpenIn(EngineBase::HOWNERIN(this));
-  else
+    audioEngine->SetV21MonitorIn(EngineBase::HOWNERIN(this),
+                                 connection.GetStringOptions().GetBoolean("V21-Monitor"));
+  } else {
     audioEngine->OpenOut(EngineBase::HOWNEROUT(this));
+  }
 
   return OpalMediaStream::Open();
 }
@@ -135,11 +169,38 @@ PBoolean AudioModemMediaStream::Close()
 
 PBoolean AudioModemMediaStream::ReadData(BYTE * data, PINDEX size, PINDEX & length)
 {
-  if (!isOpen || !audioEngine->Read(EngineBase::HOWNEROUT(this), data, size)) {
+  if (!isOpen) {
+    length = 0;
+    return false;
+  }
+
+  ModemMetrics::Cpu cpu(audioEngine->Metrics(), ModemMetrics::trMedia);
+
+  if (law == lawNone) {
+    if (!audioEngine->Read(EngineBase::HOWNEROUT(this), data, size)) {
+      length = 0;
+      return false;
+    }
+
+    audioEngine->ReadPacing().Sent(audioEngine->GetReadScheduled());
+    length = size;
+
+    return true;
+  }
+
+  PInt16 *ps = (PInt16 *)pcm.GetPointer(size*sizeof(PInt16));
+
+  if (!audioEngine->Read(EngineBase::HOWNEROUT(this), ps, size*sizeof(PInt16))) {
     length = 0;
     return false;
   }
 
+  const BYTE *l2x = (law == lawA) ? g711.l2a : g711.l2u;
+
+  for (PINDEX i = 0 ; i < size ; i++)
+    data[i] = l2x[(WORD)ps[i] >> 2];
+
+  audioEngine->ReadPacing().Sent(audioEngine->GetReadScheduled());
   length = size;
 
   return true;
@@ -147,7 +208,31 @@ PBoolean AudioModemMediaStream::ReadData(BYTE * data, PINDEX size, PINDEX & leng
 
 PBoolean AudioModemMediaStream::WriteData(const BYTE * data, PINDEX length, PINDEX & written)
 {
-  if (!isOpen || !audioEngine->Write(EngineBase::HOWNERIN(this), data, length)) {
+  if (!isOpen) {
+    written = 0;
+    return false;
+  }
+
+  ModemMetrics::Cpu cpu(audioEngine->Metrics(), ModemMetrics::trMedia);
+
+  if (law == lawNone) {
+    if (!audioEngine->Write(EngineBase::HOWNERIN(this), data, length)) {
+      written = 0;
+      return false;
+    }
+
+    written = length;
+
+    return true;
+  }
+
+  PInt16 *ps = (PInt16 *)pcm.GetPointer(length*sizeof(PInt16));
+  const PInt16 *x2l = (law == lawA) ? g711.a2l : g711.u2l;
+
+  for (PINDEX i = 0 ; i < length ; i++)
+    ps[i] = x2l[data[i]];
+
+  if (!audioEngine->Write(EngineBase::HOWNERIN(this), ps, length*sizeof(PInt16))) {
     written = 0;
     return false;
   }
@@ -164,6 +249,7 @@ T38ModemMediaStream::T38ModemMediaStream(
     T38Engine *engine)
   : OpalMediaStream(conn, OpalT38, sessionID, isSource)
   , t38engine(engine)
+  , ifp(new T38_IFP)
 {
   PTRACE(4, "T38ModemMediaStream::T38ModemMediaStream " << *this);
 
@@ -175,6 +261,7 @@ T38ModemMediaStream::T38ModemMediaStream(
 T38ModemMediaStream::~T38ModemMediaStream()
 {
   ReferenceObject::DelPointer(t38engine);
+  delete ifp;
 }
 
 PBoolean T38ModemMediaStream::Open()
@@ -185,18 +272,82 @@ PBoolean T38ModemMediaStream::Open()
   PTRACE(3, "T38ModemMediaStream::Open " << *this);
 
   currentSequenceNumber = 0;
-#if PTRACING
-  totallost = 0;
-#endif
 
-  if (IsSink())
+  PString oldAsn = GetCallStringOption("T38-Old-ASN");
+
+  corrigendumASN = !(oldAsn.IsEmpty() || oldAsn *= "true" || oldAsn *= "yes" || oldAsn.AsInteger() != 0);
+
+  PTRACE(3, "T38ModemMediaStream::Open " << (corrigendumASN ? "CORRIGENDUM No. 1" : "original") << " ASN.1");
+
+  PBoolean localTcf = (mediaFormat.GetOptionString("T38FaxRateManagement") *= "localTCF");
+  PBoolean fillBitRemoval = mediaFormat.GetOptionBoolean("T38FaxFillBitRemoval");
+  PBoolean transcodingMMR = mediaFormat.GetOptionBoolean("T38FaxTranscodingMMR");
+
+  FaxCdr &cdr = t38engine->Cdr();
+  static const char * const cdrOptions[] = {
+    "T38FaxVersion",
+    "T38FaxRateManagement",
+    "T38FaxMaxBuffer",
+    "T38FaxMaxDatagram",
+    "T38FaxUdpEC",
+    "T38FaxFillBitRemoval",
+    "T38FaxTranscodingMMR",
+    "T38FaxTranscodingJBIG",
+  };
+
+  cdr.SetCall(connection.GetCall().GetToken(), connection.IsOriginating());
+  cdr.SetOption("ASN", corrigendumASN ? "corrigendum" : "original");
+
+  for (PINDEX i = 0 ; i < PINDEX(PARRAYSIZE(cdrOptions)) ; i++) {
+    PString value = mediaFormat.GetOptionString(cdrOptions[i]);
+
+    if (!value.IsEmpty())
+      cdr.SetOption(cdrOptions[i], value);
+  }
+
+  if (IsSink()) {
+    reorder.Reset();
+
+    PString depth = GetCallStringOption("T38-Reorder-Depth");
+    PString delay = GetCallStringOption("T38-Reorder-Delay");
+
+    if (!depth.IsEmpty() || !delay.IsEmpty()) {
+      reorder.SetDepth(depth.IsEmpty() ? int(ReorderBuffer::maxDepth) : (int)depth.AsInteger(),
+                       (int)delay.AsInteger());
+    }
+
     t38engine->OpenIn(EngineBase::HOWNERIN(this));
-  else
+    t38engine->SetLocalTcfIn(EngineBase::HOWNERIN(this), localTcf);
+    t38engine->SetFillBitRemovalIn(EngineBase::HOWNERIN(this), fillBitRemoval);
+    t38engine->SetTranscodingMMRIn(EngineBase::HOWNERIN(this), transcodingMMR);
+  } else {
     t38engine->OpenOut(EngineBase::HOWNEROUT(this));
+    t38engine->SetLocalTcfOut(EngineBase::HOWNEROUT(this), localTcf);
+    t38engine->SetFillBitRemovalOut(EngineBase::HOWNEROUT(this), fillBitRemoval);
+    t38engine->SetTranscodingMMROut(EngineBase::HOWNEROUT(this), transcodingMMR);
+
+    PString interval = GetCallStringOption("T38-Packet-Interval");
+
+    if (!interval.IsEmpty())
+      t38engine->SetPacketInterval(EngineBase::HOWNEROUT(this), (int)interval.AsInteger());
+  }
 
   return OpalMediaStream::Open();
 }
 
+PString T38ModemMediaStream::GetCallStringOption(const PString & key) const
+{
+  if (connection.GetStringOptions().Contains(key))
+    return connection.GetStringOptions()(key);
+
+  PSafePtr<OpalConnection> other = connection.GetOtherPartyConnection();
+
+  if (other != NULL && other->GetStringOptions().Contains(key))
+    return other->GetStringOptions()(key);
+
+  return PString::Empty();
+}
+
 #if (OPAL_PACK_VERSION(OPAL_MAJOR, OPAL_MINOR, OPAL_BUILD) >= OPAL_PACK_VERSION(3, 10, 5))
 void T38ModemMediaStream::InternalClose()
 #else
@@ -208,9 +359,14 @@ PBoolean T38ModemMediaStream::Close()
 
     if (IsSink()) {
       PTRACE(2, "T38ModemMediaStream::Close Send statistics:"
-                " sequence=" << currentSequenceNumber <<
-                " lost=" << totallost);
-
+                " sequence=" << reorder.GetExpected() <<
+                " reordered=" << reorder.GetReordered() <<
+                " lost=" << reorder.GetLost() <<
+                " held=" << reorder.GetHeld() <<
+                " added latency=" << reorder.GetHeldTime() << "ms"
+                " (max " << reorder.GetMaxHeldTime() << "ms)");
+
+      t38engine->Cdr().SetReorder(reorder);
       t38engine->CloseIn(EngineBase::HOWNERIN(this));
     } else {
       PTRACE(2, "T38ModemMediaStream::Close Receive statistics:"
@@ -265,7 +421,7 @@ PBoolean T38ModemMediaStream::ReadPacket(RTP_DataFrame & packet)
   if (!isOpen)
     return FALSE;
 
-  T38_IFP ifp;
+  FaxCdr::Cpu cpu(t38engine->Cdr(), TRUE, &t38engine->Metrics(), ModemMetrics::trMedia);
   int res;
 
   packet.SetTimestamp(timestamp);
@@ -273,21 +429,34 @@ PBoolean T38ModemMediaStream::ReadPacket(RTP_DataFrame & packet)
 
   do {
     //PTRACE(4, "T38ModemMediaStream::ReadPacket ...");
-    res = t38engine->PreparePacket(EngineBase::HOWNEROUT(this), ifp);
+    res = t38engine->PreparePacket(EngineBase::HOWNEROUT(this), *ifp);
   } while (currentSequenceNumber == 0 && res < 0);
 
   packet[0] = 0x80;
   packet.SetPayloadType(mediaFormat.GetPayloadType());
 
   if (res > 0) {
-    PTRACE(4, "T38ModemMediaStream::ReadPacket ifp = " << setprecision(2) << ifp);
+    PTRACE(4, "T38ModemMediaStream::ReadPacket ifp = " << setprecision(2) << *ifp);
 
-    PASN_OctetString ifp_packet;
-    ifp_packet.EncodeSubType(ifp);
+    // encode directly to the RTP frame payload
+    packet.SetPayloadSize(maxIfpSize);
 
-    packet.SetPayloadSize(ifp_packet.GetDataLength());
-    memcpy(packet.GetPayloadPtr(), ifp_packet.GetPointer(), ifp_packet.GetDataLength());
+    PINDEX len = IFPCodec::Encode(*ifp, packet.GetPayloadPtr(), maxIfpSize, corrigendumASN);
+
+    if (len < 0) {
+      PTRACE(1, "T38ModemMediaStream::ReadPacket " T38_IFP_NAME " encode failure:\n  ifp = "
+          << setprecision(2) << *ifp);
+      return FALSE;
+    }
+
+    packet.SetPayloadSize(len);
     packet.SetSequenceNumber(WORD(currentSequenceNumber++ & 0xFFFF));
+    BinTrace::Add(t38engine->Metrics().TraceId(), BinTrace::evIfpOut,
+                  packet.GetSequenceNumber() | (corrigendumASN ? BinTrace::argCorrigendum : 0),
+                  packet.GetPayloadPtr(), len);
+    t38engine->Metrics().Add(ModemMetrics::cPacketsSent);
+    t38engine->Cdr().OnSent(len);
+    t38engine->Pacing().Sent(t38engine->GetScheduledOut());
   }
   else
   if (res < 0) {
@@ -298,6 +467,8 @@ PBoolean T38ModemMediaStream::ReadPacket(RTP_DataFrame & packet)
 
     packet.SetPayloadSize(0);
     packet.SetSequenceNumber(WORD((currentSequenceNumber - 1) & 0xFFFF));
+    t38engine->Metrics().Add(ModemMetrics::cPacketsResent);
+    t38engine->Cdr().OnResent(0);
   }
   else {
     return FALSE;
@@ -317,6 +488,8 @@ PBoolean T38ModemMediaStream::WritePacket(RTP_DataFrame & packet)
   if (!isOpen)
     return FALSE;
 
+  FaxCdr::Cpu cpu(t38engine->Cdr(), FALSE, &t38engine->Metrics(), ModemMetrics::trMedia);
+
   PTRACE(5, "T38ModemMediaStream::WritePacket "
             " packet " << packet.GetSequenceNumber() <<
             " size=" << packet.GetPayloadSize() <<
@@ -327,61 +500,64 @@ PBoolean T38ModemMediaStream::WritePacket(RTP_DataFrame & packet)
     return TRUE;
   }
 
-  long packedSequenceNumber = (packet.GetSequenceNumber() & 0xFFFF) + (currentSequenceNumber & ~0xFFFFL);
-  long lost = packedSequenceNumber - currentSequenceNumber;
-
-  if (lost < -0x10000L/2) {
-    lost += 0x10000L;
-    packedSequenceNumber += 0x10000L;
-  }
-  else
-  if (lost > 0x10000L/2) {
-    lost -= 0x10000L;
-    packedSequenceNumber -= 0x10000L;
-  }
-
-  if (lost < 0) {
-    PTRACE(lost == -1 ? 5 : 3,
-        "T38ModemMediaStream::WritePacket: " << (packet.GetPayloadSize() == 0 ? "Fake" : "Repeated") <<
-        " packet " << packedSequenceNumber << " (expected " << currentSequenceNumber << ")");
-
-    if (lost > -10)
-      return TRUE;
-  }
-
   if (packet.GetPayloadSize() == 0) {
-    PTRACE(5, "T38ModemMediaStream::WritePacket: ignored fake packet");
+    PTRACE(5, "T38ModemMediaStream::WritePacket: ignored fake packet " << reorder.Unwrap(packet.GetSequenceNumber()));
     return TRUE;
   }
 
-  PASN_OctetString ifp_packet((const char *)packet.GetPayloadPtr(), packet.GetPayloadSize());
-
-  T38_IFP ifp;
+  return reorder.Receive(packet.GetSequenceNumber(), packet.GetPayloadPtr(), packet.GetPayloadSize(), *this);
+}
 
-  if (!ifp_packet.DecodeSubType(ifp)) {
-    PTRACE(2, "T38ModemMediaStream::WritePacket " T38_IFP_NAME " decode failure: "
-        << PRTHEX(PBYTEArray(ifp_packet)) << "\n  ifp = "
-        << setprecision(2) << ifp);
-    return TRUE;
+void T38ModemMediaStream::OnPut(
+    long seq,
+    ReorderBuffer::PutResult result,
+    const BYTE * pData,
+    PINDEX len,
+    PBoolean /*recovered*/)
+{
+  BinTrace::Add(t38engine->Metrics().TraceId(), BinTrace::evIfpIn,
+                DWORD(WORD(seq)) |
+                    (corrigendumASN ? BinTrace::argCorrigendum : 0) |
+                    (result == ReorderBuffer::prIgnored ? BinTrace::argRepeated : 0),
+                pData, len);
+
+  switch (result) {
+    case ReorderBuffer::prIgnored:
+      PTRACE(seq == reorder.GetExpected() - 1 ? 5 : 3,
+          "T38ModemMediaStream::WritePacket: Repeated"
+          " packet " << seq << " (expected " << reorder.GetExpected() << ")");
+      t38engine->Metrics().Add(ModemMetrics::cPacketsRepeated);
+      t38engine->Cdr().OnRepeated(len);
+      break;
+    case ReorderBuffer::prInOrder:
+      t38engine->Metrics().Add(ModemMetrics::cPacketsReceived);
+      t38engine->Cdr().OnReceived(len);
+      break;
+    default:
+      PTRACE(4, "T38ModemMediaStream::WritePacket: Buffered"
+          " packet " << seq << " (expected " << reorder.GetExpected() << ")");
+      t38engine->Metrics().Add(ModemMetrics::cPacketsReceived);
+      t38engine->Cdr().OnReceived(len);
+      break;
   }
+}
 
-  if (lost != 0) {
-    if (lost < 0 || lost > 10)
-      lost = 1;
-
-#if PTRACING
-    totallost += lost;
-#endif
+PBoolean T38ModemMediaStream::OnLost(int lost)
+{
+  t38engine->Metrics().Add(ModemMetrics::cPacketsLost, lost);
 
-    if (!t38engine->HandlePacketLost(EngineBase::HOWNERIN(this), lost))
-      return FALSE;
+  return t38engine->HandlePacketLost(EngineBase::HOWNERIN(this), lost);
+}
 
-    PTRACE(3, "T38ModemMediaStream::WritePacket: adjusting sequence number to " << packedSequenceNumber);
+PBoolean T38ModemMediaStream::HandleRawIFP(const BYTE * pData, PINDEX len)
+{
+  if (!IFPCodec::Decode(pData, len, *ifp, corrigendumASN)) {
+    PTRACE(2, "T38ModemMediaStream::HandleRawIFP " T38_IFP_NAME " decode failure: "
+        << PRTHEX(PBYTEArray(pData, len, FALSE)));
+    return TRUE;
   }
 
-  currentSequenceNumber = packedSequenceNumber + 1;
-
-  return t38engine->HandlePacket(EngineBase::HOWNERIN(this), ifp);
+  return t38engine->HandlePacket(EngineBase::HOWNERIN(this), *ifp);
 }
 /////////////////////////////////////////////////////////////////////////////
 
@@ -52,6 +52,8 @@
 #define _MY_MODEM_MEDIA_STREAM_H
 
 #include <opal/mediastrm.h>
+#include "../t38engine.h"
+#include "../reorder.h"
 
 #define OPAL_PACK_VERSION(major, minor, build) (((((major) << 8) + (minor)) << 8) + (build))
 
@@ -68,6 +70,7 @@ class AudioModemMediaStream : public OpalMediaStream
       */
     AudioModemMediaStream(
       OpalConnection & conn,
+      const OpalMediaFormat & mediaFormat, ///<  PCM16, G.711 A-law or u-law
       unsigned sessionID,                  ///<  Session number for stream
       PBoolean isSource,                   ///<  Is a source stream
       AudioEngine *engine
@@ -100,12 +103,18 @@ class AudioModemMediaStream : public OpalMediaStream
   //@}
 
   protected:
+    enum Law {
+      lawNone,
+      lawA,
+      lawU
+    };
+
     AudioEngine *audioEngine;
+    Law law;                               ///<  G.711 is converted here, w/o OPAL transcoder
+    PBYTEArray pcm;
 };
 /////////////////////////////////////////////////////////////////////////////
-class T38Engine;
-
-class T38ModemMediaStream : public OpalMediaStream
+class T38ModemMediaStream : public OpalMediaStream, protected ReorderBuffer::Sink
 {
     PCLASSINFO(T38ModemMediaStream, OpalMediaStream);
   public:
@@ -145,11 +154,46 @@ class T38ModemMediaStream : public OpalMediaStream
   //@}
 
   protected:
+    enum { maxIfpSize = 512 };
+
+    /**Get route option of this or other party connection.
+      */
+    PString GetCallStringOption(
+      const PString & key
+    ) const;
+
+    /**Decode raw IFP packet and pass it to the engine.
+      */
+    PBoolean HandleRawIFP(
+      const BYTE * pData,
+      PINDEX len
+    );
+
+  /**@name Overrides of ReorderBuffer::Sink class */
+  //@{
+    virtual void OnPut(
+      long seq,
+      ReorderBuffer::PutResult result,
+      const BYTE * pData,
+      PINDEX len,
+      PBoolean recovered
+    );
+
+    virtual PBoolean OnLost(
+      int lost
+    );
+
+    virtual PBoolean OnPacket(
+      const BYTE * pData,
+      PINDEX len
+    ) { return HandleRawIFP(pData, len); }
+  //@}
+
     long currentSequenceNumber;
-#if PTRACING
-    int totallost;
-#endif
+    PBoolean corrigendumASN;               ///<  ASN.1 variant of IFP packets
+    ReorderBuffer reorder;                 ///<  Used by sink only
     T38Engine * t38engine;
+    T38_IFP * ifp;                         ///<  Reused for each packet
 };
 /////////////////////////////////////////////////////////////////////////////
 
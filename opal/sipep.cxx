@@ -210,6 +210,9 @@ PString MySIPEndPoint::ArgSpec()
     "-sip-t38-udptl-keep-alive-interval:"
     "-sip-t38-max-buffer:"
     "-sip-t38-max-datagram:"
+    "-sip-t38-local-tcf."
+    "-sip-t38-fill-bit-removal."
+    "-sip-t38-transcoding-mmr."
     "-sip-proxy:"
     "-sip-register:"
     "-sip-listen:"
@@ -237,6 +240,12 @@ PStringArray MySIPEndPoint::Descriptions()
       "                            : Set T38FaxMaxBuffer to bytes.\n"
       "  --sip-t38-max-datagram bytes\n"
       "                            : Set T38FaxMaxDatagram to bytes.\n"
+      "  --sip-t38-local-tcf       : Set T38FaxRateManagement to localTCF (do not\n"
+      "                              transfer TCF).\n"
+      "  --sip-t38-fill-bit-removal : Set T38FaxFillBitRemoval (do not transfer\n"
+      "                              fill bits of non-ECM image data).\n"
+      "  --sip-t38-transcoding-mmr : Set T38FaxTranscodingMMR (transfer non-ECM\n"
+      "                              image data as MMR).\n"
       "  --sip-proxy [user:[pwd]@]host\n"
       "                            : Proxy information.\n"
       "  --sip-register [user@]registrar[,pwd[,contact[,realm[,authID]]]]\n"
@@ -325,7 +334,9 @@ PBoolean MySIPEndPoint::Initialise(const PConfigArgs & args)
                              ? args.GetOptionString("sip-t38-udptl-keep-alive-interval")
                              : "0");
 
-  if ( (args.HasOption("sip-t38-max-datagram")) || (args.HasOption("sip-t38-max-buffer")) ) {
+  if ( (args.HasOption("sip-t38-max-datagram")) || (args.HasOption("sip-t38-max-buffer")) ||
+       (args.HasOption("sip-t38-local-tcf")) || (args.HasOption("sip-t38-fill-bit-removal")) ||
+       (args.HasOption("sip-t38-transcoding-mmr")) ) {
     OpalMediaFormat t38 = OpalT38;
 
     if (args.HasOption("sip-t38-max-datagram")) {
@@ -338,6 +349,21 @@ PBoolean MySIPEndPoint::Initialise(const PConfigArgs & args)
       PTRACE(2, "MySIPEndPoint::Initialise Set T38FaxMaxBuffer to " << args.GetOptionString("sip-t38-max-buffer"));
     }
 
+    if (args.HasOption("sip-t38-local-tcf")) {
+      t38.SetOptionValue("T38FaxRateManagement", "localTCF");
+      PTRACE(2, "MySIPEndPoint::Initialise Set T38FaxRateManagement to localTCF");
+    }
+
+    if (args.HasOption("sip-t38-fill-bit-removal")) {
+      t38.SetOptionBoolean("T38FaxFillBitRemoval", true);
+      PTRACE(2, "MySIPEndPoint::Initialise Set T38FaxFillBitRemoval to true");
+    }
+
+    if (args.HasOption("sip-t38-transcoding-mmr")) {
+      t38.SetOptionBoolean("T38FaxTranscodingMMR", true);
+      PTRACE(2, "MySIPEndPoint::Initialise Set T38FaxTranscodingMMR to true");
+    }
+
     OpalMediaFormat::SetRegisteredMediaFormat(t38);
   }
 
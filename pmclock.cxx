@@ -0,0 +1,551 @@
+/*
+ * pmclock.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: pmclock.cxx,v $
+ *
+ */
+
+#include <ptlib.h>
+#include "pmutils.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+static RealClock realClock;
+
+ModemClock *ModemClock::current = &realClock;
+
+void ModemClock::Set(ModemClock *clock)
+{
+  current = (clock != NULL ? clock : &realClock);
+}
+///////////////////////////////////////////////////////////////
+ModemTimer::ModemTimer()
+  : continuous(FALSE),
+    started(FALSE),
+    next(NULL)
+{
+  timer.SetNotifier(PCREATE_NOTIFIER(OnRealTimeout));
+}
+
+ModemTimer::~ModemTimer()
+{
+  ModemClock::Get().StopTimer(*this, TRUE);
+}
+
+void ModemTimer::Run(const PTimeInterval &interval, PBoolean _continuous)
+{
+  ModemClock &clock = ModemClock::Get();
+
+  clock.StopTimer(*this);
+
+  period = interval;
+  continuous = _continuous;
+
+  if (period.GetMilliSeconds() > 0)
+    clock.StartTimer(*this);
+}
+
+void ModemTimer::OnTimeout()
+{
+  if (!notifier.IsNULL())
+    notifier(*this, 0);
+}
+
+void ModemTimer::OnRealTimeout(PTimer & /*from*/, INT /*extra*/)
+{
+  OnTimeout();
+}
+///////////////////////////////////////////////////////////////
+PBoolean ModemDelay::Delay(int ms)
+{
+  ModemClock &clock = ModemClock::Get();
+
+  if (restart) {
+    target = clock.Now();
+    restart = FALSE;
+  }
+
+  target += PTimeInterval(ms);
+
+  PTimeInterval delay = target - clock.Now();
+
+  if (delay.GetMilliSeconds() <= 0)
+    return TRUE;
+
+  clock.Sleep(delay);
+
+  return FALSE;
+}
+///////////////////////////////////////////////////////////////
+void RealClock::Sleep(const PTimeInterval &interval)
+{
+#ifdef P_LINUX
+  PInt64 ms = interval.GetMilliSeconds();
+
+  // more accurate than PThread::Sleep()
+  if (ms > 0 && ms < 1000) {
+    usleep(useconds_t(ms * 1000));
+    return;
+  }
+#endif
+
+  PThread::Sleep(interval);
+}
+
+PBoolean RealClock::Wait(PSyncPoint &syncPoint, const PTimeInterval &timeout)
+{
+  if (timeout == PMaxTimeInterval) {
+    syncPoint.Wait();
+    return TRUE;
+  }
+
+  return syncPoint.Wait(timeout);
+}
+
+void RealClock::StartTimer(ModemTimer &timer)
+{
+  if (timer.continuous)
+    timer.timer.RunContinuous(timer.period);
+  else
+    timer.timer = timer.period;
+}
+
+void RealClock::StopTimer(ModemTimer &timer, PBoolean /*wait*/)
+{
+  timer.timer = 0;
+}
+///////////////////////////////////////////////////////////////
+class VirtualClockThread : public PThread
+{
+    PCLASSINFO(VirtualClockThread, PThread);
+  public:
+    VirtualClockThread(VirtualClock &_clock)
+      : PThread(30000, NoAutoDeleteThread, NormalPriority),
+        clock(_clock)
+    {
+      Resume();
+    }
+
+  protected:
+    virtual void Main() {
+      RenameCurrentThread("VirtualClock");
+      clock.TimerMain();
+    }
+
+    VirtualClock &clock;
+};
+///////////////////////////////////////////////////////////////
+VirtualClock::VirtualClock(const PTime &_start)
+  : start(_start),
+    now(_start),
+    busy(0),
+    advances(0),
+    waiters(NULL),
+    threads(NULL),
+    timers(NULL),
+    firing(NULL),
+    stopping(FALSE)
+{
+  timerThread = new VirtualClockThread(*this);
+}
+
+VirtualClock::~VirtualClock()
+{
+  if (&ModemClock::Get() == this)
+    ModemClock::Set(NULL);
+
+  stopping = TRUE;
+  Signal(timerSyncPoint);
+
+  timerThread->WaitForTermination();
+  delete timerThread;
+
+  while (threads) {
+    Thread *pThread = threads;
+
+    threads = pThread->next;
+    delete pThread;
+  }
+}
+
+PTime VirtualClock::Now()
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  return now;
+}
+
+void VirtualClock::Sleep(const PTimeInterval &interval)
+{
+  if (interval.GetMilliSeconds() <= 0)
+    return;
+
+  Waiter waiter;
+
+  waiter.syncPoint = NULL;
+  waiter.timed = TRUE;
+  waiter.signaled = FALSE;
+
+  mutex.Wait();
+  waiter.due = now + interval;
+  Block(waiter);
+  mutex.Signal();
+
+  waiter.wake.Wait();
+
+  // Wake() releases the waiter under the mutex
+  PWaitAndSignal mutexWait(mutex);
+}
+
+PBoolean VirtualClock::Wait(PSyncPoint &syncPoint, const PTimeInterval &timeout)
+{
+  Waiter waiter;
+
+  waiter.syncPoint = &syncPoint;
+  waiter.timed = (timeout != PMaxTimeInterval);
+  waiter.signaled = FALSE;
+
+  mutex.Wait();
+
+  if (!syncPoint.WillBlock()) {
+    syncPoint.Wait();
+    mutex.Signal();
+    return TRUE;
+  }
+
+  if (waiter.timed && timeout.GetMilliSeconds() <= 0) {
+    mutex.Signal();
+    return FALSE;
+  }
+
+  if (waiter.timed)
+    waiter.due = now + timeout;
+
+  Block(waiter);
+  mutex.Signal();
+
+  waiter.wake.Wait();
+
+  PWaitAndSignal mutexWait(mutex);
+
+  return waiter.signaled;
+}
+
+void VirtualClock::Signal(PSyncPoint &syncPoint)
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  if (!WakeSyncPoint(syncPoint))
+    syncPoint.Signal();
+}
+
+void VirtualClock::StartTimer(ModemTimer &timer)
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  RemoveTimer(timer);
+
+  timer.due = now + timer.period;
+  timer.started = TRUE;
+  timer.next = timers;
+  timers = &timer;
+
+  Advance();
+}
+
+void VirtualClock::StopTimer(ModemTimer &timer, PBoolean wait)
+{
+  mutex.Wait();
+
+  RemoveTimer(timer);
+
+  if (wait && PThread::Current() != timerThread) {
+    while (firing == &timer) {
+      mutex.Signal();
+      PThread::Sleep(1);
+      mutex.Wait();
+    }
+  }
+
+  mutex.Signal();
+}
+
+void VirtualClock::Enter()
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  Thread *pThread = FindThread();
+
+  if (pThread) {
+    pThread->nesting++;
+    return;
+  }
+
+  pThread = new Thread;
+  pThread->id = PThread::GetCurrentThreadId();
+  pThread->nesting = 1;
+  pThread->blocking = 0;
+  pThread->next = threads;
+  threads = pThread;
+
+  busy++;
+}
+
+void VirtualClock::Leave()
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  for (Thread **ppThread = &threads ; *ppThread ; ppThread = &(*ppThread)->next) {
+    Thread *pThread = *ppThread;
+
+    if (pThread->id != PThread::GetCurrentThreadId())
+      continue;
+
+    if (--pThread->nesting > 0)
+      return;
+
+    *ppThread = pThread->next;
+
+    if (pThread->blocking == 0)
+      busy--;
+
+    delete pThread;
+
+    Advance();
+    return;
+  }
+}
+
+void VirtualClock::BeginBlocking()
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  Thread *pThread = FindThread();
+
+  if (pThread && pThread->blocking++ == 0) {
+    busy--;
+    Advance();
+  }
+}
+
+void VirtualClock::EndBlocking()
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  Thread *pThread = FindThread();
+
+  if (pThread && --pThread->blocking == 0)
+    busy++;
+}
+
+PTimeInterval VirtualClock::GetElapsed()
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  return now - start;
+}
+
+long VirtualClock::GetAdvances()
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  return advances;
+}
+
+void VirtualClock::TimerMain()
+{
+  Enter();
+
+  mutex.Wait();
+
+  while (!stopping) {
+    ModemTimer *timer;
+
+    for (timer = timers ; timer ; timer = timer->next) {
+      if (timer->due <= now)
+        break;
+    }
+
+    if (timer == NULL) {
+      mutex.Signal();
+      Wait(timerSyncPoint);
+      mutex.Wait();
+      continue;
+    }
+
+    RemoveTimer(*timer);
+
+    if (timer->continuous) {
+      timer->due = now + timer->period;
+      timer->started = TRUE;
+      timer->next = timers;
+      timers = timer;
+    }
+
+    firing = timer;
+    mutex.Signal();
+
+    timer->OnTimeout();
+
+    mutex.Wait();
+    firing = NULL;
+  }
+
+  mutex.Signal();
+
+  Leave();
+}
+
+VirtualClock::Thread *VirtualClock::FindThread() const
+{
+  PThreadIdentifier id = PThread::GetCurrentThreadId();
+
+  for (Thread *pThread = threads ; pThread ; pThread = pThread->next) {
+    if (pThread->id == id)
+      return pThread;
+  }
+
+  return NULL;
+}
+
+void VirtualClock::Block(Waiter &waiter)
+{
+  Thread *pThread = FindThread();
+
+  waiter.participant = (pThread != NULL && pThread->blocking == 0);
+  waiter.next = waiters;
+  waiters = &waiter;
+
+  if (waiter.participant) {
+    busy--;
+    Advance();
+  }
+}
+
+void VirtualClock::Wake(Waiter &waiter, PBoolean signaled)
+{
+  for (Waiter **ppWaiter = &waiters ; *ppWaiter ; ppWaiter = &(*ppWaiter)->next) {
+    if (*ppWaiter == &waiter) {
+      *ppWaiter = waiter.next;
+      break;
+    }
+  }
+
+  waiter.signaled = signaled;
+
+  if (waiter.participant)
+    busy++;
+
+  waiter.wake.Signal();
+}
+
+PBoolean VirtualClock::WakeSyncPoint(PSyncPoint &syncPoint)
+{
+  for (Waiter *pWaiter = waiters ; pWaiter ; pWaiter = pWaiter->next) {
+    if (pWaiter->syncPoint == &syncPoint) {
+      Wake(*pWaiter, TRUE);
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+void VirtualClock::RemoveTimer(ModemTimer &timer)
+{
+  if (!timer.started)
+    return;
+
+  for (ModemTimer **ppTimer = &timers ; *ppTimer ; ppTimer = &(*ppTimer)->next) {
+    if (*ppTimer == &timer) {
+      *ppTimer = timer.next;
+      break;
+    }
+  }
+
+  timer.started = FALSE;
+  timer.next = NULL;
+}
+
+void VirtualClock::Advance()
+{
+  while (busy == 0) {
+    PBoolean found = FALSE;
+    PTime next;
+
+    for (Waiter *pWaiter = waiters ; pWaiter ; pWaiter = pWaiter->next) {
+      if (pWaiter->timed && (!found || pWaiter->due < next)) {
+        next = pWaiter->due;
+        found = TRUE;
+      }
+    }
+
+    for (ModemTimer *pTimer = timers ; pTimer ; pTimer = pTimer->next) {
+      if (!found || pTimer->due < next) {
+        next = pTimer->due;
+        found = TRUE;
+      }
+    }
+
+    // all are waiting for the threads that are not participants
+    if (!found)
+      break;
+
+    if (next > now) {
+      now = next;
+      advances++;
+    }
+
+    for (;;) {
+      Waiter *pWaiter;
+
+      for (pWaiter = waiters ; pWaiter ; pWaiter = pWaiter->next) {
+        if (pWaiter->timed && pWaiter->due <= now)
+          break;
+      }
+
+      if (pWaiter == NULL)
+        break;
+
+      Wake(*pWaiter, FALSE);
+    }
+
+    PBoolean timerDue = FALSE;
+
+    for (ModemTimer *pTimer = timers ; pTimer ; pTimer = pTimer->next) {
+      if (pTimer->due <= now) {
+        timerDue = TRUE;
+        break;
+      }
+    }
+
+    // the timer thread will fire the timers as soon as it is waiting
+    if (timerDue && !WakeSyncPoint(timerSyncPoint))
+      break;
+  }
+}
+///////////////////////////////////////////////////////////////
+
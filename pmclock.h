@@ -0,0 +1,281 @@
+/*
+ * pmclock.h
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: pmclock.h,v $
+ *
+ */
+
+#ifndef _PMCLOCK_H
+#define _PMCLOCK_H
+
+class ModemTimer;
+
+///////////////////////////////////////////////////////////////
+/**Clock and scheduler of the engines and modems.
+
+   All timing of the engines and modems (current time, sleeps, waits
+   for the sync points and timers) goes through the current clock.
+   By default it's the real clock. A simulation can set an other clock
+   (see VirtualClock) before any engine or modem is created.
+ */
+class ModemClock : public PObject
+{
+    PCLASSINFO(ModemClock, PObject);
+  public:
+  /**@name Construction */
+  //@{
+    /**Get the current clock.
+      */
+    static ModemClock &Get() { return *current; }
+
+    /**Set the current clock (NULL - the real clock).
+      */
+    static void Set(ModemClock *clock);
+  //@}
+
+  /**@name Operations */
+  //@{
+    virtual PTime Now() = 0;
+    virtual void Sleep(const PTimeInterval &interval) = 0;
+
+    /**Wait for syncPoint signaled by Signal().
+       Returns FALSE if timeout.
+      */
+    virtual PBoolean Wait(
+      PSyncPoint &syncPoint,
+      const PTimeInterval &timeout = PMaxTimeInterval
+    ) = 0;
+    virtual void Signal(PSyncPoint &syncPoint) = 0;
+
+    virtual void StartTimer(ModemTimer &timer) = 0;
+    virtual void StopTimer(ModemTimer &timer, PBoolean wait = FALSE) = 0;
+
+    /**The current thread begins/ends running its part of the simulation.
+      */
+    virtual void Enter() {}
+    virtual void Leave() {}
+
+    /**The current thread begins/ends waiting for an other thread not
+       through the clock (for example PThread::WaitForTermination()).
+      */
+    virtual void BeginBlocking() {}
+    virtual void EndBlocking() {}
+  //@}
+
+    /**Calls Enter()/Leave() for the scope.
+      */
+    class Participant
+    {
+      public:
+        Participant() { ModemClock::Get().Enter(); }
+        ~Participant() { ModemClock::Get().Leave(); }
+    };
+
+    /**Calls BeginBlocking()/EndBlocking() for the scope.
+      */
+    class Blocking
+    {
+      public:
+        Blocking() { ModemClock::Get().BeginBlocking(); }
+        ~Blocking() { ModemClock::Get().EndBlocking(); }
+    };
+
+  protected:
+    static ModemClock *current;
+};
+///////////////////////////////////////////////////////////////
+/**Timer driven by the current clock (replacement of PTimer).
+ */
+class ModemTimer : public PObject
+{
+    PCLASSINFO(ModemTimer, PObject);
+  public:
+  /**@name Construction */
+  //@{
+    ModemTimer();
+    ~ModemTimer();
+  //@}
+
+  /**@name Operations */
+  //@{
+    void SetNotifier(const PNotifier &_notifier) { notifier = _notifier; }
+    void RunOnce(const PTimeInterval &interval) { Run(interval, FALSE); }
+    void RunContinuous(const PTimeInterval &interval) { Run(interval, TRUE); }
+    void Stop() { ModemClock::Get().StopTimer(*this); }
+  //@}
+
+  protected:
+    virtual void OnTimeout();
+    void Run(const PTimeInterval &interval, PBoolean _continuous);
+
+    PNotifier notifier;
+    PTimeInterval period;
+    PBoolean continuous;
+
+    // used by RealClock
+    PTimer timer;
+    PDECLARE_NOTIFIER(PTimer, ModemTimer, OnRealTimeout);
+
+    // used by VirtualClock
+    PTime due;
+    PBoolean started;
+    ModemTimer *next;
+
+    friend class RealClock;
+    friend class VirtualClock;
+};
+///////////////////////////////////////////////////////////////
+/**Adaptive delay driven by the current clock (replacement of
+   PAdaptiveDelay).
+ */
+class ModemDelay : public PObject
+{
+    PCLASSINFO(ModemDelay, PObject);
+  public:
+    ModemDelay() : restart(TRUE) {}
+
+    void Restart() { restart = TRUE; }
+
+    /**Wait till ms after the previous target time.
+       Returns TRUE if late.
+      */
+    PBoolean Delay(int ms);
+
+    /**Get the target time of the last Delay().
+      */
+    const PTime &GetTarget() const { return target; }
+
+  protected:
+    PTime target;
+    PBoolean restart;
+};
+///////////////////////////////////////////////////////////////
+/**Real (wall) clock.
+ */
+class RealClock : public ModemClock
+{
+    PCLASSINFO(RealClock, ModemClock);
+  public:
+    PTime Now() { return PTime(); }
+    void Sleep(const PTimeInterval &interval);
+    PBoolean Wait(PSyncPoint &syncPoint, const PTimeInterval &timeout = PMaxTimeInterval);
+    void Signal(PSyncPoint &syncPoint) { syncPoint.Signal(); }
+    void StartTimer(ModemTimer &timer);
+    void StopTimer(ModemTimer &timer, PBoolean wait = FALSE);
+};
+///////////////////////////////////////////////////////////////
+/**Virtual clock for simulations.
+
+   The time does not flow by itself. It jumps to the nearest sleep, wait
+   or timer deadline as soon as all the participant threads (see Enter())
+   are blocked in Sleep() or Wait() of this clock. So the simulated
+   sessions run as fast as the CPU allows and the timing is exact and
+   repeatable.
+
+   All the sync points waited by the participants should be signaled by
+   Signal() of this clock. The threads that are not participants can use
+   the clock too, but the time does not wait for them.
+ */
+class VirtualClock : public ModemClock
+{
+    PCLASSINFO(VirtualClock, ModemClock);
+  public:
+  /**@name Construction */
+  //@{
+    VirtualClock(const PTime &start = PTime());
+    ~VirtualClock();
+  //@}
+
+  /**@name Operations */
+  //@{
+    PTime Now();
+    void Sleep(const PTimeInterval &interval);
+    PBoolean Wait(PSyncPoint &syncPoint, const PTimeInterval &timeout = PMaxTimeInterval);
+    void Signal(PSyncPoint &syncPoint);
+    void StartTimer(ModemTimer &timer);
+    void StopTimer(ModemTimer &timer, PBoolean wait = FALSE);
+    void Enter();
+    void Leave();
+    void BeginBlocking();
+    void EndBlocking();
+  //@}
+
+  /**@name Information */
+  //@{
+    /**Get the virtual time elapsed from the start.
+      */
+    PTimeInterval GetElapsed();
+
+    /**Get the number of the time jumps.
+      */
+    long GetAdvances();
+  //@}
+
+    void TimerMain();
+
+  protected:
+    struct Waiter {
+      PSyncPoint *syncPoint;            ///<  NULL for Sleep()
+      PBoolean timed;
+      PTime due;
+      PBoolean participant;
+      PBoolean signaled;
+      PSyncPoint wake;
+      Waiter *next;
+    };
+
+    struct Thread {
+      PThreadIdentifier id;
+      int nesting;
+      int blocking;
+      Thread *next;
+    };
+
+    Thread *FindThread() const;
+    void Block(Waiter &waiter);
+    void Wake(Waiter &waiter, PBoolean signaled);
+    PBoolean WakeSyncPoint(PSyncPoint &syncPoint);
+    void RemoveTimer(ModemTimer &timer);
+    void Advance();
+
+    PMutex mutex;
+    const PTime start;
+    PTime now;
+    int busy;                           ///<  Number of running participants
+    long advances;
+
+    Waiter *waiters;
+    Thread *threads;
+    ModemTimer *timers;
+
+    PThread *timerThread;
+    PSyncPoint timerSyncPoint;
+    ModemTimer *firing;
+    volatile PBoolean stopping;
+};
+///////////////////////////////////////////////////////////////
+
+#endif  // _PMCLOCK_H
+
@@ -0,0 +1,667 @@
+/*
+ * pmmetrics.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: pmmetrics.cxx,v $
+ *
+ */
+
+#include <ptlib.h>
+#include <ptlib/sockets.h>
+
+#ifndef _WIN32
+  #include <time.h>
+  #include <pthread.h>
+#endif
+
+#include "pmutils.h"
+#include "pmmetrics.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+static const struct {
+  const char *name;
+  const char *help;
+} counterInfo[ModemMetrics::NumCounters] = {
+  { "packets_sent_total",           "T.38 packets sent (not including resent)" },
+  { "packets_received_total",       "T.38 packets received (not including repeated)" },
+  { "packets_resent_total",         "T.38 packets sent repeatedly" },
+  { "packets_repeated_total",       "T.38 packets received repeatedly" },
+  { "packets_lost_total",           "T.38 packets lost" },
+  { "packets_recovered_total",      "T.38 packets recovered from redundancy" },
+  { "redundancy_bytes_sent_total",  "Bytes of secondary IFPs sent" },
+  { "redundancy_bytes_received_total", "Bytes of secondary IFPs received" },
+  { "state_transitions_total",      "Modem engine state transitions" },
+  { "pty_bytes_in_total",           "Bytes read from PTY" },
+  { "pty_bytes_out_total",          "Bytes written to PTY" },
+  { "pty_reads_total",              "read() calls on PTY" },
+  { "pty_writes_total",             "write() calls on PTY" },
+  { "pty_polls_total",              "poll() calls on PTY" },
+  { "t30_frames_sent_total",        "T.30 control frames sent" },
+  { "t30_frames_received_total",    "T.30 control frames received" },
+  { "ecm_ppr_frames_total",         "ECM frames requested to retransmit by PPR" },
+};
+
+static const struct {
+  const char *name;
+  const char *help;
+} gaugeInfo[ModemMetrics::NumGauges] = {
+  { "in_pty_queue_buffers",         "Buffers in inPtyQ" },
+  { "out_pty_queue_buffers",        "Buffers in outPtyQ" },
+  { "buf_out_bytes",                "Bytes in T.38 engine bufOut" },
+};
+
+static const char * const threadRoleNames[ModemMetrics::NumThreadRoles] = {
+  "b", "i", "o", "e", "tx", "rx", "media",
+};
+
+static const char * const sendPathNames[ModemMetrics::NumSendPaths] = {
+  "t38", "audio",
+};
+
+static PMutex registryMutex;            ///<  Guards registry and the running threads
+static ModemMetrics *registry = NULL;
+///////////////////////////////////////////////////////////////
+static PString EscapeLabel(const PString &value)
+{
+  PString res;
+
+  for (PINDEX i = 0 ; i < value.GetLength() ; i++) {
+    char c = value[i];
+
+    switch (c) {
+      case '\\': res += "\\\\"; break;
+      case '"':  res += "\\\""; break;
+      case '\n': res += "\\n";  break;
+      default:   res += c;
+    }
+  }
+
+  return res;
+}
+
+static void PrintHeader(ostream &strm, const PString &name, const char *help, const char *type)
+{
+  strm << "# HELP " << name << ' ' << help << "\n"
+       << "# TYPE " << name << ' ' << type << "\n";
+}
+
+static void PrintHistogram(ostream &strm, const char *family, const PString &label, const HdrHistogram &hist)
+{
+  // the buckets are "less than 2^i us", so the bounds are 1 us less than
+  // the exposed ones
+  for (int i = 0 ; i < ModemMetrics::NumLatencyBuckets ; i++) {
+    strm << family << "_bucket{" << label << ",le=\"" << psprintf("%g", (double)((PInt64)1 << i)/1000000)
+         << "\"} " << hist.GetCountBelow(i) << "\n";
+  }
+
+  PInt64 count = hist.GetCount();
+
+  strm << family << "_bucket{" << label << ",le=\"+Inf\"} " << count << "\n"
+       << family << "_sum{" << label << "} " << psprintf("%.6f", hist.GetSum()/1000000.0) << "\n"
+       << family << "_count{" << label << "} " << count << "\n";
+}
+///////////////////////////////////////////////////////////////
+HdrHistogram::HdrHistogram()
+  : sum(0)
+{
+  for (int i = 0 ; i < NumBuckets ; i++)
+    counts[i] = 0;
+}
+
+int HdrHistogram::Index(PInt64 value)
+{
+  if (value < subCount)
+    return (int)value;
+
+  int msb = subBits;
+
+  while (msb < maxBits - 1 && (value >> (msb + 1)) != 0)
+    msb++;
+
+  return subCount*(msb - subBits + 1) + (int)((value >> (msb - subBits)) & (subCount - 1));
+}
+
+PInt64 HdrHistogram::HighestEquivalent(int index)
+{
+  if (index < subCount)
+    return index;
+
+  int msb = index/subCount - 1 + subBits;
+  PInt64 lowest = ((PInt64)1 << msb) | ((PInt64)(index % subCount) << (msb - subBits));
+
+  return lowest + ((PInt64)1 << (msb - subBits)) - 1;
+}
+
+void HdrHistogram::Record(PInt64 value)
+{
+  if (value < 0)
+    value = 0;
+  else
+  if (value >= ((PInt64)1 << maxBits))
+    value = ((PInt64)1 << maxBits) - 1;
+
+  ModemMetrics::AtomicAdd(counts[Index(value)], 1);
+  ModemMetrics::AtomicAdd(sum, value);
+}
+
+void HdrHistogram::Add(const HdrHistogram &other)
+{
+  for (int i = 0 ; i < NumBuckets ; i++) {
+    PInt64 count = ModemMetrics::AtomicGet(other.counts[i]);
+
+    if (count)
+      ModemMetrics::AtomicAdd(counts[i], count);
+  }
+
+  ModemMetrics::AtomicAdd(sum, ModemMetrics::AtomicGet(other.sum));
+}
+
+PInt64 HdrHistogram::GetCount() const
+{
+  PInt64 count = 0;
+
+  for (int i = 0 ; i < NumBuckets ; i++)
+    count += ModemMetrics::AtomicGet(counts[i]);
+
+  return count;
+}
+
+PInt64 HdrHistogram::GetSum() const
+{
+  return ModemMetrics::AtomicGet(sum);
+}
+
+PInt64 HdrHistogram::GetCountBelow(int bits) const
+{
+  int end = bits >= maxBits ? NumBuckets : Index((PInt64)1 << bits);
+  PInt64 count = 0;
+
+  for (int i = 0 ; i < end ; i++)
+    count += ModemMetrics::AtomicGet(counts[i]);
+
+  return count;
+}
+
+PInt64 HdrHistogram::GetPercentile(double percent) const
+{
+  PInt64 total = GetCount();
+
+  if (total == 0)
+    return 0;
+
+  PInt64 rank = (PInt64)(total*percent/100 + 0.999999);
+
+  if (rank < 1)
+    rank = 1;
+
+  PInt64 count = 0;
+  int last = 0;
+
+  for (int i = 0 ; i < NumBuckets ; i++) {
+    PInt64 n = ModemMetrics::AtomicGet(counts[i]);
+
+    if (n == 0)
+      continue;
+
+    count += n;
+    last = i;
+
+    if (count >= rank)
+      break;
+  }
+
+  return HighestEquivalent(last);
+}
+///////////////////////////////////////////////////////////////
+ModemMetrics::ModemMetrics(const PString &_name)
+  : name(_name)
+  , traceId(BinTrace::ModemId(_name))
+  , latencySum(0)
+  , threads(NULL)
+  , next(NULL)
+{
+  int i;
+
+  for (i = 0 ; i < NumCounters ; i++)
+    counters[i] = 0;
+
+  for (i = 0 ; i < NumGauges ; i++)
+    gauges[i] = 0;
+
+  for (i = 0 ; i <= NumLatencyBuckets ; i++)
+    latencyBuckets[i] = 0;
+
+  for (i = 0 ; i < NumThreadRoles ; i++)
+    threadCpu[i] = 0;
+}
+
+ModemMetrics &ModemMetrics::Get(const PString &name)
+{
+  PWaitAndSignal mutexWait(registryMutex);
+
+  for (ModemMetrics *metrics = registry ; metrics != NULL ; metrics = metrics->next) {
+    if (metrics->name == name)
+      return *metrics;
+  }
+
+  ModemMetrics *metrics = new ModemMetrics(name);
+
+  metrics->next = registry;
+  registry = metrics;
+
+  return *metrics;
+}
+
+void ModemMetrics::ObserveLatency(PInt64 us)
+{
+  int i = 0;
+
+  if (us < 0)
+    us = 0;
+
+  for (PInt64 bound = 1 ; i < NumLatencyBuckets && us > bound ; i++)
+    bound <<= 1;
+
+  AtomicAdd(latencyBuckets[i], 1);
+  AtomicAdd(latencySum, us);
+}
+
+PInt64 ModemMetrics::NowUs()
+{
+#ifdef _WIN32
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER count;
+
+  if (freq.QuadPart == 0)
+    QueryPerformanceFrequency(&freq);
+
+  QueryPerformanceCounter(&count);
+
+  return (PInt64)(count.QuadPart/(freq.QuadPart/1000000.0));
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (PInt64)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#endif
+}
+
+PInt64 ModemMetrics::GetThreadCpu(ThreadRole role) const
+{
+  PWaitAndSignal mutexWait(registryMutex);
+
+  PInt64 ns = AtomicGet(threadCpu[role]);
+
+  for (ThreadCpu *thread = threads ; thread != NULL ; thread = thread->next) {
+    if (thread->role == role)
+      ns += thread->Sample();
+  }
+
+  return ns;
+}
+
+const char *ModemMetrics::GetThreadRoleName(ThreadRole role)
+{
+  return threadRoleNames[role];
+}
+
+void ModemMetrics::PrintAll(ostream &strm)
+{
+  PWaitAndSignal mutexWait(registryMutex);
+
+  ModemMetrics *metrics;
+  int modems = 0;
+  int i;
+
+  for (metrics = registry ; metrics != NULL ; metrics = metrics->next)
+    modems++;
+
+  PrintHeader(strm, "t38modem_modems", "Modems with metrics", "gauge");
+  strm << "t38modem_modems " << modems << "\n";
+
+  for (i = 0 ; i < NumCounters ; i++) {
+    PString family = PString("t38modem_") + counterInfo[i].name;
+    PInt64 total = 0;
+
+    PrintHeader(strm, family, counterInfo[i].help, "counter");
+
+    for (metrics = registry ; metrics != NULL ; metrics = metrics->next) {
+      PInt64 value = metrics->GetCounter((Counter)i);
+
+      strm << family << "{modem=\"" << EscapeLabel(metrics->name) << "\"} " << value << "\n";
+      total += value;
+    }
+
+    family = PString("t38modem_global_") + counterInfo[i].name;
+
+    PrintHeader(strm, family, counterInfo[i].help, "counter");
+    strm << family << ' ' << total << "\n";
+  }
+
+  for (i = 0 ; i < NumGauges ; i++) {
+    PString family = PString("t38modem_") + gaugeInfo[i].name;
+
+    PrintHeader(strm, family, gaugeInfo[i].help, "gauge");
+
+    for (metrics = registry ; metrics != NULL ; metrics = metrics->next)
+      strm << family << "{modem=\"" << EscapeLabel(metrics->name) << "\"} " << metrics->GetGauge((Gauge)i) << "\n";
+  }
+
+  static const char cpuFamily[] = "t38modem_thread_cpu_seconds_total";
+
+  PrintHeader(strm, cpuFamily, "CPU time of modem threads (sampled live)", "counter");
+
+  for (metrics = registry ; metrics != NULL ; metrics = metrics->next) {
+    PInt64 ns[NumThreadRoles];
+
+    for (i = 0 ; i < NumThreadRoles ; i++)
+      ns[i] = AtomicGet(metrics->threadCpu[i]);
+
+    // registryMutex is locked already, so don't use GetThreadCpu()
+    for (ThreadCpu *thread = metrics->threads ; thread != NULL ; thread = thread->next)
+      ns[thread->role] += thread->Sample();
+
+    for (i = 0 ; i < NumThreadRoles ; i++) {
+      strm << cpuFamily << "{modem=\"" << EscapeLabel(metrics->name) << "\",thread=\"" << threadRoleNames[i] << "\"} "
+           << psprintf("%.6f", ns[i]/1000000000.0) << "\n";
+    }
+  }
+
+  static const char latencyFamily[] = "t38modem_callback_latency_seconds";
+
+  PrintHeader(strm, latencyFamily, "Modem callback latency (lock wait and handler)", "histogram");
+
+  for (metrics = registry ; metrics != NULL ; metrics = metrics->next) {
+    PString label = PString("modem=\"") + EscapeLabel(metrics->name) + "\"";
+    PInt64 count = 0;
+
+    for (i = 0 ; i <= NumLatencyBuckets ; i++) {
+      count += AtomicGet(metrics->latencyBuckets[i]);
+
+      strm << latencyFamily << "_bucket{" << label << ",le=\"";
+
+      if (i < NumLatencyBuckets)
+        strm << psprintf("%g", (double)((PInt64)1 << i)/1000000);
+      else
+        strm << "+Inf";
+
+      strm << "\"} " << count << "\n";
+    }
+
+    strm << latencyFamily << "_sum{" << label << "} "
+         << psprintf("%.6f", AtomicGet(metrics->latencySum)/1000000.0) << "\n"
+         << latencyFamily << "_count{" << label << "} " << count << "\n";
+  }
+
+  static const struct {
+    const char *name;
+    const char *help;
+  } pacingInfo[2] = {
+    { "send_lateness_seconds",      "Send time of packets minus the scheduled one" },
+    { "send_jitter_seconds",        "Deviation of send intervals from the scheduled ones" },
+  };
+
+  for (i = 0 ; i < 2 ; i++) {
+    PString family = PString("t38modem_") + pacingInfo[i].name;
+    HdrHistogram global[NumSendPaths];
+
+    PrintHeader(strm, family, pacingInfo[i].help, "histogram");
+
+    for (metrics = registry ; metrics != NULL ; metrics = metrics->next) {
+      const HdrHistogram *hists = (i == 0 ? metrics->sendLateness : metrics->sendJitter);
+
+      for (int path = 0 ; path < NumSendPaths ; path++) {
+        PrintHistogram(strm, family, PString("modem=\"") + EscapeLabel(metrics->name) +
+                                     "\",path=\"" + sendPathNames[path] + "\"", hists[path]);
+        global[path].Add(hists[path]);
+      }
+    }
+
+    family = PString("t38modem_global_") + pacingInfo[i].name;
+
+    PrintHeader(strm, family, pacingInfo[i].help, "histogram");
+
+    for (int path = 0 ; path < NumSendPaths ; path++)
+      PrintHistogram(strm, family, PString("path=\"") + sendPathNames[path] + "\"", global[path]);
+  }
+}
+///////////////////////////////////////////////////////////////
+ModemMetrics::ThreadCpu::ThreadCpu(ModemMetrics &_metrics, ThreadRole _role)
+  : metrics(_metrics)
+  , role(_role)
+  , threadId(PThread::GetCurrentThreadId())
+{
+  PWaitAndSignal mutexWait(registryMutex);
+
+  next = metrics.threads;
+  metrics.threads = this;
+}
+
+ModemMetrics::ThreadCpu::~ThreadCpu()
+{
+  PWaitAndSignal mutexWait(registryMutex);
+
+  for (ThreadCpu **pThread = &metrics.threads ; *pThread != NULL ; pThread = &(*pThread)->next) {
+    if (*pThread == this) {
+      *pThread = next;
+      break;
+    }
+  }
+
+  metrics.AddThreadCpu(role, GetThreadCpuNs());
+}
+
+PInt64 ModemMetrics::ThreadCpu::Sample() const
+{
+  // the thread is running while it's registered
+#ifdef _WIN32
+  HANDLE hThread = OpenThread(THREAD_QUERY_INFORMATION, FALSE, threadId);
+
+  if (hThread == NULL)
+    return 0;
+
+  FILETIME creation, exit, kernel, user;
+  PInt64 ns = 0;
+
+  if (::GetThreadTimes(hThread, &creation, &exit, &kernel, &user)) {
+    // 100 ns units
+    ns = ((((PInt64)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+          (((PInt64)user.dwHighDateTime << 32) | user.dwLowDateTime))*100;
+  }
+
+  CloseHandle(hThread);
+
+  return ns;
+#else
+  clockid_t clockId;
+  struct timespec ts;
+
+  if (pthread_getcpuclockid(threadId, &clockId) != 0 || clock_gettime(clockId, &ts) != 0)
+    return 0;
+
+  return (PInt64)ts.tv_sec*1000000000 + ts.tv_nsec;
+#endif
+}
+///////////////////////////////////////////////////////////////
+ModemMetrics::SendPacing::SendPacing(ModemMetrics &_metrics, SendPath _path)
+  : metrics(_metrics)
+  , path(_path)
+  , lastScheduled(0)
+  , lastSent(-1)
+{
+}
+
+void ModemMetrics::SendPacing::Sent(const PTime &scheduled)
+{
+  PInt64 sent = ModemClock::Get().Now().GetTimestamp();
+  PInt64 due = scheduled.GetTimestamp();
+
+  // the early packets (the delays are checked with ms precision) are
+  // counted as not late
+  lateness.Record(sent - due);
+  metrics.sendLateness[path].Record(sent - due);
+
+  if (lastSent >= 0) {
+    PInt64 diff = (sent - lastSent) - (due - lastScheduled);
+
+    if (diff < 0)
+      diff = -diff;
+
+    jitter.Record(diff);
+    metrics.sendJitter[path].Record(diff);
+  }
+
+  lastScheduled = due;
+  lastSent = sent;
+}
+///////////////////////////////////////////////////////////////
+class MetricsServer : public PThread
+{
+    PCLASSINFO(MetricsServer, PThread);
+  public:
+    MetricsServer() : PThread(30000, AutoDeleteThread, NormalPriority, "Metrics") {}
+
+    PTCPSocket listener;
+
+  protected:
+    enum { requestTimeout = 2000 };      ///<  Max time to receive the request head (ms)
+
+    void Main();
+    void Serve(PTCPSocket &socket);
+};
+
+void MetricsServer::Main()
+{
+  myPTRACE(1, "Metrics: listening on " << listener.GetLocalAddress());
+
+  while (listener.IsOpen()) {
+    PTCPSocket socket;
+
+    if (!socket.Accept(listener)) {
+      myPTRACE(1, "Metrics: accept ERROR " << listener.GetErrorText());
+      PThread::Sleep(1000);
+      continue;
+    }
+
+    Serve(socket);
+  }
+}
+
+void MetricsServer::Serve(PTCPSocket &socket)
+{
+  socket.SetWriteTimeout(requestTimeout);
+
+  // read the request head (the body is not expected), the connections are
+  // served one by one so an idle or slow client is closed after the timeout
+  PTime deadline = PTime() + PTimeInterval(requestTimeout);
+  PString head;
+  char buf[512];
+
+  while (head.Find("\r\n\r\n") == P_MAX_INDEX && head.Find("\n\n") == P_MAX_INDEX) {
+    PTimeInterval left = deadline - PTime();
+
+    if (left <= 0) {
+      myPTRACE(2, "Metrics: close idle connection");
+      return;
+    }
+
+    socket.SetReadTimeout(left);
+
+    if (head.GetLength() > 8192 || !socket.Read(buf, sizeof(buf) - 1))
+      return;
+
+    buf[socket.GetLastReadCount()] = 0;
+    head += buf;
+  }
+
+  PStringArray request = head.Left(head.Find('\n')).Trim().Tokenise(" ", FALSE);
+  PString status;
+  PStringStream body;
+
+  if (request.GetSize() < 2 || request[0] != "GET") {
+    status = "405 Method Not Allowed";
+    body << "Method Not Allowed\n";
+  }
+  else
+  if (request[1] == "/tracedump") {
+    if (BinTrace::IsEnabled()) {
+      status = "200 OK";
+      body << "Dump requested\n";
+      BinTrace::RequestDump("admin request");
+    } else {
+      status = "404 Not Found";
+      body << "Binary trace is not enabled\n";
+    }
+  }
+  else
+  if (request[1] != "/metrics" && request[1].Find("/metrics?") != 0) {
+    status = "404 Not Found";
+    body << "Not Found\n";
+  }
+  else {
+    status = "200 OK";
+    ModemMetrics::PrintAll(body);
+  }
+
+  PStringStream response;
+
+  response << "HTTP/1.0 " << status << "\r\n"
+           << "Content-Type: text/plain; version=0.0.4\r\n"
+           << "Content-Length: " << body.GetLength() << "\r\n"
+           << "Connection: close\r\n"
+           << "\r\n"
+           << body;
+
+  socket.Write((const char *)response, response.GetLength());
+}
+///////////////////////////////////////////////////////////////
+PBoolean ModemMetrics::StartServer(const PString &addrPort)
+{
+  PString addr = "127.0.0.1";
+  PString port = addrPort;
+  PINDEX i = addrPort.FindLast(':');
+
+  if (i != P_MAX_INDEX) {
+    addr = addrPort.Left(i);
+    port = addrPort.Mid(i + 1);
+  }
+
+  MetricsServer *server = new MetricsServer;
+
+  if (!server->listener.Listen(PIPSocket::Address(addr), 5, (WORD)port.AsUnsigned(), PSocket::CanReuseAddress)) {
+    myPTRACE(1, "Metrics: can't listen on " << addrPort << " " << server->listener.GetErrorText());
+    cerr << "Can't listen metrics on " << addrPort << endl;
+    delete server;
+    return FALSE;
+  }
+
+  server->Resume();
+
+  return TRUE;
+}
+///////////////////////////////////////////////////////////////
+
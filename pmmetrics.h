@@ -0,0 +1,317 @@
+/*
+ * pmmetrics.h
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: pmmetrics.h,v $
+ *
+ */
+
+#ifndef _PMMETRICS_H
+#define _PMMETRICS_H
+
+///////////////////////////////////////////////////////////////
+extern PInt64 GetThreadCpuNs();         // see pmutils.h
+///////////////////////////////////////////////////////////////
+/**Log-linear (HDR-style) histogram of non-negative integer values.
+
+   The values below subCount are counted exactly, the larger ones with the
+   relative precision of 1/subCount (each power of two range is split to
+   subCount linear buckets). The values are limited to 2^maxBits - 1.
+
+   The updates are lock-free (atomic add) and can be done from any thread.
+ */
+class HdrHistogram
+{
+  public:
+    enum {
+      subBits = 4,
+      subCount = 1 << subBits,
+      maxBits = 32,
+      NumBuckets = subCount*(maxBits - subBits + 1)
+    };
+
+    HdrHistogram();
+
+    void Record(PInt64 value);
+    void Add(const HdrHistogram &other);
+
+    PInt64 GetCount() const;
+    PInt64 GetSum() const;
+
+    /**Get the count of the values less than 2^bits.
+      */
+    PInt64 GetCountBelow(int bits) const;
+
+    /**Get the highest value equivalent to the percentile (0 if empty).
+      */
+    PInt64 GetPercentile(double percent) const;
+    PInt64 GetMax() const { return GetPercentile(100); }
+
+  protected:
+    static int Index(PInt64 value);
+    static PInt64 HighestEquivalent(int index);
+
+    volatile PInt64 counts[NumBuckets];
+    volatile PInt64 sum;
+};
+///////////////////////////////////////////////////////////////
+/**Run-time counters of a modem.
+
+   There is one object per modem name (ptyName()). The objects are
+   created on first use and never deleted, so the references returned by
+   Get() are valid till exit.
+
+   The updates are lock-free (atomic add or plain store) and can be done
+   from any thread. The registry mutex is used only by Get() and by the
+   output.
+ */
+class ModemMetrics : public PObject
+{
+    PCLASSINFO(ModemMetrics, PObject);
+  public:
+    enum Counter {
+      cPacketsSent,
+      cPacketsReceived,
+      cPacketsResent,                   ///<  Sent repeatedly (same seq)
+      cPacketsRepeated,                 ///<  Received repeatedly (ignored)
+      cPacketsLost,
+      cPacketsRecovered,                ///<  Recovered from redundancy
+      cRedundancyBytesSent,
+      cRedundancyBytesReceived,
+      cStateTransitions,
+      cPtyBytesIn,
+      cPtyBytesOut,
+      cPtyReads,
+      cPtyWrites,
+      cPtyPolls,
+      cT30FramesSent,
+      cT30FramesReceived,
+      cEcmPprFrames,                    ///<  ECM frames requested by PPR
+      NumCounters
+    };
+
+    enum Gauge {
+      gInPtyQ,                          ///<  Buffers in inPtyQ
+      gOutPtyQ,                         ///<  Buffers in outPtyQ
+      gBufOut,                          ///<  Bytes in T38Engine::bufOut
+      NumGauges
+    };
+
+    enum ThreadRole {
+      trBody,                           ///<  (b) PseudoModemBody
+      trPtyIn,                          ///<  (i) reading from PTY
+      trPtyOut,                         ///<  (o) writing to PTY
+      trEngine,                         ///<  (e) ModemEngine
+      trT38Tx,                          ///<  (tx) T.38 sending (h323lib)
+      trT38Rx,                          ///<  (rx) T.38 receiving (h323lib)
+      trMedia,                          ///<  Media stream calls of the OPAL patch threads
+      NumThreadRoles
+    };
+
+    enum SendPath {
+      spT38,                            ///<  T.38 packets (T38Engine::PreparePacket())
+      spAudio,                          ///<  Audio frames (AudioEngine::Read())
+      NumSendPaths
+    };
+
+    enum {
+      NumLatencyBuckets = 24            ///<  Upper bounds 1us ... 2^23us
+    };
+
+  /**@name Construction */
+  //@{
+    /**Get (create if not exists) the metrics of modem name.
+      */
+    static ModemMetrics &Get(const PString &name);
+  //@}
+
+  /**@name Operations */
+  //@{
+    void Add(Counter counter, PInt64 value = 1) { AtomicAdd(counters[counter], value); }
+    void Set(Gauge gauge, PInt64 value) { gauges[gauge] = value; }
+
+    /**Add the callback latency (microseconds) to the histogram.
+      */
+    void ObserveLatency(PInt64 us);
+
+    /**Get the monotonic real time in microseconds (not the ModemClock
+       time, so the latencies are real under a virtual clock too).
+      */
+    static PInt64 NowUs();
+
+    void AddThreadCpu(ThreadRole role, PInt64 ns) { AtomicAdd(threadCpu[role], ns); }
+  //@}
+
+  /**@name Information */
+  //@{
+    const PString &Name() const { return name; }
+    WORD TraceId() const { return traceId; }      ///<  BinTrace::ModemId() of name
+    PInt64 GetCounter(Counter counter) const { return AtomicGet(counters[counter]); }
+    PInt64 GetGauge(Gauge gauge) const { return AtomicGet(gauges[gauge]); }
+
+    /**Get the CPU time (ns) of the threads of role, including the current
+       CPU time of the running threads (sampled now).
+      */
+    PInt64 GetThreadCpu(ThreadRole role) const;
+
+    static const char *GetThreadRoleName(ThreadRole role);
+
+    /**Output all the metrics of all modems in the Prometheus text
+       exposition format (version 0.0.4).
+      */
+    static void PrintAll(ostream &strm);
+
+    /**Start the HTTP server of GET /metrics (see PrintAll()) on
+       [addr:]port (default address is 127.0.0.1).
+       Returns FALSE if can't listen.
+      */
+    static PBoolean StartServer(const PString &addrPort);
+  //@}
+
+    /**Measures the callback latency for the scope.
+      */
+    class Latency
+    {
+      public:
+        Latency(ModemMetrics &_metrics) : metrics(_metrics), start(NowUs()) {}
+        ~Latency() { metrics.ObserveLatency(NowUs() - start); }
+
+      protected:
+        ModemMetrics &metrics;
+        const PInt64 start;
+    };
+
+    /**Registers the current thread for the scope (the thread body), so its
+       CPU time is sampled live and added to the role at the end.
+      */
+    class ThreadCpu
+    {
+      public:
+        ThreadCpu(ModemMetrics &_metrics, ThreadRole _role);
+        ~ThreadCpu();
+
+      protected:
+        PInt64 Sample() const;
+
+        ModemMetrics &metrics;
+        const ThreadRole role;
+        const PThreadIdentifier threadId;
+        ThreadCpu *next;
+
+      friend class ModemMetrics;
+    };
+
+    /**Adds the CPU time of the current thread for the scope (for the
+       threads not owned by t38modem).
+      */
+    class Cpu
+    {
+      public:
+        Cpu(ModemMetrics &_metrics, ThreadRole _role) : metrics(_metrics), role(_role), start(GetThreadCpuNs()) {}
+        ~Cpu() { metrics.AddThreadCpu(role, GetThreadCpuNs() - start); }
+
+      protected:
+        ModemMetrics &metrics;
+        const ThreadRole role;
+        const PInt64 start;
+    };
+
+    /**Measures the pacing of a send path of a call: the lateness of each
+       packet (the send time minus the scheduled one) and the inter-packet
+       jitter (the difference between the actual and the scheduled interval
+       from the previous packet). The times are ModemClock microseconds.
+
+       The histograms of the object are of the call, the ones of the modem
+       are updated too. Should be used by the send thread only.
+      */
+    class SendPacing
+    {
+      public:
+        SendPacing(ModemMetrics &_metrics, SendPath _path);
+
+        /**Observe the packet sent now that was scheduled to be sent at
+           scheduled.
+          */
+        void Sent(const PTime &scheduled);
+
+        const HdrHistogram &Lateness() const { return lateness; }
+        const HdrHistogram &Jitter() const { return jitter; }
+
+      protected:
+        ModemMetrics &metrics;
+        const SendPath path;
+        PInt64 lastScheduled;
+        PInt64 lastSent;                ///<  -1 before the first packet
+        HdrHistogram lateness;
+        HdrHistogram jitter;
+    };
+
+  protected:
+    ModemMetrics(const PString &_name);
+
+    static void AtomicAdd(volatile PInt64 &var, PInt64 value);
+    static PInt64 AtomicGet(const volatile PInt64 &var);
+
+    const PString name;
+    const WORD traceId;
+
+    volatile PInt64 counters[NumCounters];
+    volatile PInt64 gauges[NumGauges];
+
+    volatile PInt64 latencyBuckets[NumLatencyBuckets + 1];  ///<  the last one is +Inf
+    volatile PInt64 latencySum;                             ///<  microseconds
+
+    volatile PInt64 threadCpu[NumThreadRoles];              ///<  ns of the ended threads and scopes
+    ThreadCpu *threads;                                     ///<  Running threads
+
+    HdrHistogram sendLateness[NumSendPaths];                ///<  microseconds
+    HdrHistogram sendJitter[NumSendPaths];                  ///<  microseconds
+
+    ModemMetrics *next;
+
+  friend class HdrHistogram;
+};
+
+inline void ModemMetrics::AtomicAdd(volatile PInt64 &var, PInt64 value)
+{
+#ifdef _WIN32
+  InterlockedExchangeAdd64((volatile LONGLONG *)&var, value);
+#else
+  __sync_fetch_and_add(&var, value);
+#endif
+}
+
+inline PInt64 ModemMetrics::AtomicGet(const volatile PInt64 &var)
+{
+  // atomic read of 64-bit value on 32-bit platforms too
+#ifdef _WIN32
+  return InterlockedCompareExchange64((volatile LONGLONG *)&var, 0, 0);
+#else
+  return __sync_fetch_and_add((volatile PInt64 *)&var, 0);
+#endif
+}
+///////////////////////////////////////////////////////////////
+
+#endif  // _PMMETRICS_H
+
@@ -590,9 +590,9 @@ class Profile
 
 static const Profile Profiles[1];
 ///////////////////////////////////////////////////////////////
-class Timeout : public PTimer
+class Timeout : public ModemTimer
 {
-    PCLASSINFO(Timeout, PTimer);
+    PCLASSINFO(Timeout, ModemTimer);
   public:
     Timeout(const PNotifier &callback, PBoolean _continuous = FALSE)
         : state(0), continuous(_continuous) {
@@ -606,14 +606,14 @@ class Timeout : public PTimer
         RunContinuous(period);
         OnTimeout();
       } else {
-        PTimer::operator=(period);
+        RunOnce(period);
       }
     }
 
     void Stop() {
       PWaitAndSignal mutexWait(Mutex);
       state = 0;
-      PTimer::operator=(0);
+      ModemTimer::Stop();
     }
 
     PBoolean Get() {
@@ -629,7 +629,7 @@ class Timeout : public PTimer
       PWaitAndSignal mutexWait(Mutex);
       if( state == 1 )
         state = 2;
-      PTimer::OnTimeout();
+      ModemTimer::OnTimeout();
     }
 
     int state;
@@ -827,7 +827,7 @@ class ModemEngineBody : public PObject
 
     PBoolean IsReady() const {
       PWaitAndSignal mutexWait(Mutex);
-      return state == stCommand && !off_hook && callState == cstCleared && (PTime() - lastOnHookActivity) > 5*1000;
+      return state == stCommand && !off_hook && callState == cstCleared && (ModemClock::Get().Now() - lastOnHookActivity) > 5*1000;
     }
 
     PBoolean isOutBufFull() const {
@@ -937,9 +937,10 @@ class ModemEngineBody : public PObject
     void _DetachEngine(ModemClassEngine mce);
     void _ClearCall();
 
-    int NextSeq() { return seq = ++seq & EngineBase::cbpUserDataMask; }
+    int NextSeq() { return seq = (seq + 1) & EngineBase::cbpUserDataMask; }
 
     ModemEngine &parent;
+    ModemMetrics &metrics;
 
     EngineBase *activeEngines[mceNumberOfItems];
     EngineBase *currentClassEngine;
@@ -961,6 +962,7 @@ class ModemEngineBody : public PObject
     int seq;
 
     PBoolean forceFaxMode;
+    PBoolean faxSignalDetected;
     PBoolean connectionEstablished;
 
     PBoolean off_hook;
@@ -979,11 +981,15 @@ class ModemEngineBody : public PObject
     State state;
     int subState;
 
-    #define TRACE_STATE(level, header) \
+    #define TRACE_STATE(level, header) do { \
+        BinTrace::Add(metrics.TraceId(), BinTrace::evModemState, \
+                      BinTrace::StateArg(off_hook, callState, callSubState, state, subState), \
+                      header, sizeof(header) - 1); \
         PTRACE(level, header \
                   " " << (off_hook ? "off" : "on") << "-hook" \
                   " " << CallStateAndSubState(callState, callSubState) << \
-                  " " << StateAndSubState(state, subState))
+                  " " << StateAndSubState(state, subState)); \
+    } while (0)
 
     PBoolean OffHook() {
       if (!off_hook) {
@@ -1015,6 +1021,7 @@ class ModemEngineBody : public PObject
       if (state != newState || subState != newSubState) {
         state = newState;
         subState = newSubState;
+        metrics.Add(ModemMetrics::cStateTransitions);
         TRACE_STATE(4, "ModemEngineBody::SetState:");
       }
     }
@@ -1157,7 +1164,10 @@ PBoolean ModemEngine::Request(PStringToString &request) const
 
 void ModemEngine::Main()
 {
+  ModemClock::Participant participant;
+
   RenameCurrentThread(ptyName() + "(e)");
+  ModemMetrics::ThreadCpu threadCpu(ModemMetrics::Get(ptyName()), ModemMetrics::trEngine);
 
   myPTRACE(1, "<-> Started");
   if( !body ) {
@@ -1248,6 +1258,7 @@ Profile &Profile::SetVoiceProfile(const Profile &p) {
 ///////////////////////////////////////////////////////////////
 ModemEngineBody::ModemEngineBody(ModemEngine &_parent, const PNotifier &_callbackEndPoint)
   : parent(_parent),
+    metrics(ModemMetrics::Get(_parent.ptyName())),
     currentClassEngine(NULL),
     callbackEndPoint(_callbackEndPoint),
 #ifdef _MSC_VER
@@ -1263,6 +1274,7 @@ ModemEngineBody::ModemEngineBody(ModemEngine &_parent, const PNotifier &_callbac
     timeout(timerCallback),
     seq(0),
     forceFaxMode(FALSE),
+    faxSignalDetected(FALSE),
     connectionEstablished(FALSE),
     off_hook(FALSE),
     lockReleasingState(0),
@@ -1300,7 +1312,7 @@ void ModemEngineBody::OnParentStop()
 
 void ModemEngineBody::OnHook()
 {
-  lastOnHookActivity = PTime();
+  lastOnHookActivity = ModemClock::Get().Now();
 
   if (off_hook) {
     for (int i = 0 ; i < mceNumberOfItems ; i++) {
@@ -1313,6 +1325,7 @@ void ModemEngineBody::OnHook()
     off_hook = FALSE;
     callDirection = cdUndefined;
     forceFaxMode = FALSE;
+    faxSignalDetected = FALSE;
     state = stCommand;
     subState = 0;
     _DetachEngine(mceT38);
@@ -1400,7 +1413,7 @@ PBoolean ModemEngineBody::Request(PStringToString &request)
       SrcNum(request("srcnum"));
       SrcName(request("srcname"));
       DstNum(request("dstnum"));
-      callTime = PTime();
+      callTime = ModemClock::Get().Now();
       P.RingCount(0);
       timerRing.Start(5000);
       request.SetAt("response", "confirm");
@@ -1600,7 +1613,7 @@ void ModemEngineBody::_DetachEngine(ModemClassEngine mce)
   if (!CallToken().IsEmpty() && activeEngines[mce]->SendingNotCompleted()) {
     Mutex.Signal();
     myPTRACE(2, "ModemEngineBody::_DetachEngine: sending is not completed for " << mce);
-    PThread::Sleep(100);
+    ModemClock::Get().Sleep(100);
     Mutex.Wait();
 
     if (activeEngines[mce] == NULL)
@@ -1617,7 +1630,7 @@ void ModemEngineBody::_DetachEngine(ModemClassEngine mce)
     }
 
     Mutex.Signal();
-    PThread::Sleep(20);
+    ModemClock::Get().Sleep(20);
     Mutex.Wait();
 
     if (activeEngines[mce] == NULL)
@@ -1663,6 +1676,26 @@ void ModemEngineBody::OnEngineCallback(PObject & PTRACE_PARAM(from), INT extra)
       }
       break;
     }
+    case EngineBase::cbpFaxSignal: {
+      PWaitAndSignal mutexWait(Mutex);
+
+      switch (state) {
+        case stConnectHandle:
+          if (subState == chConnectionEstablishDelay) {
+            myPTRACE(2, "ModemEngineBody::OnEngineCallback fax signal, skip delay before request mode");
+            SetSubState(chConnectionEstablished);
+            timeout.Stop();
+          }
+          break;
+        case stReqModeAckWait:
+          if (!forceFaxMode)
+            faxSignalDetected = TRUE;
+          break;
+        default:
+          break;
+      }
+      break;
+    }
     case EngineBase::cbpReset:
     case EngineBase::cbpOutBufNoFull:
     case EngineBase::cbpUpdateState:
@@ -1860,7 +1893,7 @@ PBoolean ModemEngineBody::HandleClass1Cmd(const char **ppCmd, PString &resp, PBo
                     }
 
                     if (!res)
-                      PThread::Sleep(100);	// workaround
+                      ModemClock::Get().Sleep(100);	// workaround
                     return res;
                   }
                 default:
@@ -2130,7 +2163,7 @@ PBoolean ModemEngineBody::HandleClass8Cmd(const char **ppCmd, PString &resp, PBo
         }
 
         if (!res)
-          PThread::Sleep(100);	// workaround
+          ModemClock::Get().Sleep(100);	// workaround
 
         return res;
       } else {
@@ -3686,7 +3719,7 @@ void ModemEngineBody::HandleData(const PBYTEArray &buf, PBYTEArray &bresp)
         case stCommand:
           if (!off_hook) {
             PWaitAndSignal mutexWait(Mutex);
-            lastOnHookActivity = PTime();
+            lastOnHookActivity = ModemClock::Get().Now();
           }
 
           while (state == stCommand && len > 0) {
@@ -3941,6 +3974,26 @@ void ModemEngineBody::CheckState(PBYTEArray & bresp)
     }
   }
 
+  if (faxSignalDetected) {
+    faxSignalDetected = FALSE;
+
+    if (state == stReqModeAckWait && !forceFaxMode) {
+      PStringToString request;
+
+      request.SetAt("modemtoken", parent.modemToken());
+      request.SetAt("command", "requestmode");
+      request.SetAt("calltoken", CallToken());
+      request.SetAt("mode", "fax-detected");
+
+      Mutex.Signal();
+      callbackEndPoint(request, 4);
+      Mutex.Wait();
+
+      if (state == stReqModeAckWait && request("response") == "confirm")
+        timeout.Start(10000);
+    }
+  }
+
   if (timeout.Get()) {
     switch( state ) {
       case stReqModeAckWait:
@@ -3978,7 +4031,7 @@ void ModemEngineBody::CheckState(PBYTEArray & bresp)
         if (engine->RecvUserInput(&c, 1) <= 0)
           break;
 
-        if (!P.ModemClassId() == EngineBase::mcAudio)
+        if (P.ModemClassId() != EngineBase::mcAudio)
           continue;
 
         switch (c) {
@@ -4350,7 +4403,7 @@ void ModemEngineBody::CheckState(PBYTEArray & bresp)
 
                     if (dms) {
                       Mutex.Signal();
-                      PThread::Sleep(dms * 10);
+                      ModemClock::Get().Sleep(dms * 10);
                       Mutex.Wait();
                     }
 
@@ -99,7 +99,8 @@ PseudoModemBody::PseudoModemBody(const PString &_tty, const PString &_route, con
   : PseudoModem(_tty),
     route(_route),
     callbackEndPoint(_callbackEndPoint),
-    engine(NULL)
+    engine(NULL),
+    metrics(NULL)
 {
 }
 
@@ -170,6 +171,7 @@ void PseudoModemBody::ToPtyQ(const void *buf, PINDEX count, PBoolean OutQ)
       if( len > free )
         len = free;
       PtyQ.Enqueue(new PBYTEArray((const BYTE *)buf, len));
+      metrics->Set(OutQ ? ModemMetrics::gOutPtyQ : ModemMetrics::gInPtyQ, PtyQ.GetCount());
       buf = (const BYTE *)buf + len;
       count -= len;
     }
@@ -195,16 +197,30 @@ void PseudoModemBody::ToPtyQ(const void *buf, PINDEX count, PBoolean OutQ)
       myPTRACE(2, "PseudoModemBody::ToPtyQ(" << (OutQ ? "outPtyQ" : "inPtyQ") << ")"
         << " busy=" << busy << " count=" << count << " delay=" << delay);
     }
-    PThread::Sleep(delay);
+    ModemClock::Get().Sleep(delay);
     if( stop ) break;
   }
 }
 
+PBYTEArray *PseudoModemBody::FromPtyQ(PBoolean OutQ)
+{
+  PBYTEArrayQ &PtyQ = OutQ ? outPtyQ : inPtyQ;
+  PBYTEArray *buf = PtyQ.Dequeue();
+
+  if (buf)
+    metrics->Set(OutQ ? ModemMetrics::gOutPtyQ : ModemMetrics::gInPtyQ, PtyQ.GetCount());
+
+  return buf;
+}
+
 PBoolean PseudoModemBody::StartAll()
 {
   if (engine)
     return TRUE;
 
+  if (!metrics)
+    metrics = &ModemMetrics::Get(ptyName());
+
   if ((engine = new ModemEngine(*this)) != NULL) {
     engine->Resume();
     return TRUE;
@@ -217,13 +233,20 @@ void PseudoModemBody::StopAll()
 {
   if (engine) {
     engine->SignalStop();
-    engine->WaitForTermination();
+    {
+      ModemClock::Blocking blocking;
+      engine->WaitForTermination();
+    }
     PWaitAndSignal mutexWait(Mutex);
     delete engine;
     engine = NULL;
   }
   outPtyQ.Clean();
   inPtyQ.Clean();
+  if (metrics) {
+    metrics->Set(ModemMetrics::gOutPtyQ, 0);
+    metrics->Set(ModemMetrics::gInPtyQ, 0);
+  }
   childstop = FALSE;
 }
 
@@ -238,7 +261,10 @@ PBoolean PseudoModemBody::AddModem() const
 
 void PseudoModemBody::Main()
 {
+  ModemClock::Participant participant;
+
   RenameCurrentThread(ptyName() + "(b)");
+  ModemMetrics::ThreadCpu threadCpu(ModemMetrics::Get(ptyName()), ModemMetrics::trBody);
 
   myPTRACE(2, "Started for " << ttyPath() <<
               " (accepts " << (route.IsEmpty() ? PString("all") : route) << ")");
@@ -84,10 +84,12 @@ class PseudoModemBody : public PseudoModem
 
   /**@name Operations */
   //@{
-    PBYTEArray *FromInPtyQ() { return inPtyQ.Dequeue(); }
+    PBYTEArray *FromInPtyQ() { return FromPtyQ(FALSE); }
     void ToOutPtyQ(const void *buf, PINDEX count) { ToPtyQ(buf, count, TRUE); };
   //@}
 
+    ModemMetrics &Metrics() const { return *metrics; }
+
     virtual PBoolean IsReady() const;
     PBoolean CheckRoute(const PString &number) const;
     PBoolean Request(PStringToString &request) const;
@@ -105,7 +107,7 @@ class PseudoModemBody : public PseudoModem
     virtual void MainLoop() = 0;
 
     PBoolean AddModem() const;
-    PBYTEArray *FromOutPtyQ() { return outPtyQ.Dequeue(); }
+    PBYTEArray *FromOutPtyQ() { return FromPtyQ(TRUE); }
     void ToInPtyQ(PBYTEArray *buf) { inPtyQ.Enqueue(buf); }
     void ToInPtyQ(const void *buf, PINDEX count) { ToPtyQ(buf, count, FALSE); };
 
@@ -114,10 +116,12 @@ class PseudoModemBody : public PseudoModem
   private:
     void Main();
     void ToPtyQ(const void *buf, PINDEX count, PBoolean OutQ);
+    PBYTEArray *FromPtyQ(PBoolean OutQ);
 
     PString route;
     const PNotifier callbackEndPoint;
     ModemEngine *engine;
+    ModemMetrics *metrics;
 
     PBYTEArrayQ outPtyQ;
     PBYTEArrayQ inPtyQ;
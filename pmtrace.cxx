@@ -0,0 +1,397 @@
+/*
+ * pmtrace.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: pmtrace.cxx,v $
+ *
+ */
+
+#include <ptlib.h>
+
+#ifndef _WIN32
+  #include <time.h>
+  #include <signal.h>
+  #include <pthread.h>
+#endif
+
+#include "pmutils.h"
+#include "pmtrace.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+#ifdef _WIN32
+  #define MemoryBarrierFull() MemoryBarrier()
+  // the volatile stores have the release semantics with MSVC
+  #define StoreRelease(var, value) ((var) = (value))
+#else
+  #define MemoryBarrierFull() __sync_synchronize()
+  #define StoreRelease(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#endif
+///////////////////////////////////////////////////////////////
+struct TraceRing {
+  BinTrace::Record records[BinTrace::ringSize];
+  volatile DWORD count;                 ///<  Records written (the next one is count % ringSize)
+  PBoolean used;                        ///<  Owned by a thread
+  PString threadName;
+};
+
+static PMutex ringsMutex;               ///<  Guards rings, numRings and modemNames
+static TraceRing *rings[BinTrace::maxRings];
+static int numRings = 0;
+static PStringArray modemNames;
+
+#ifdef _WIN32
+static DWORD ringKey = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t ringKey;
+static volatile sig_atomic_t sigDump = 0;
+#endif
+
+volatile PBoolean BinTrace::enabled = FALSE;
+///////////////////////////////////////////////////////////////
+#ifdef _WIN32
+static VOID WINAPI ReleaseRing(PVOID data)
+#else
+static void ReleaseRing(void *data)
+#endif
+{
+  if (data == NULL)
+    return;
+
+  PWaitAndSignal mutexWait(ringsMutex);
+
+  ((TraceRing *)data)->used = FALSE;
+}
+
+static TraceRing *AcquireRing()
+{
+  PWaitAndSignal mutexWait(ringsMutex);
+
+  // reuse the free ring with the oldest last record (the data of the
+  // recently ended threads are kept as long as possible)
+
+  TraceRing *ring = NULL;
+
+  for (int i = 0 ; i < numRings ; i++) {
+    TraceRing *r = rings[i];
+
+    if (r->used)
+      continue;
+
+    if (ring == NULL || r->count == 0 ||
+        (ring->count != 0 &&
+         r->records[(r->count - 1) % BinTrace::ringSize].time <
+         ring->records[(ring->count - 1) % BinTrace::ringSize].time))
+    {
+      ring = r;
+    }
+  }
+
+  if (ring == NULL) {
+    if (numRings >= BinTrace::maxRings)
+      return NULL;
+
+    ring = rings[numRings++] = new TraceRing;
+  }
+
+  ring->count = 0;
+  ring->used = TRUE;
+
+  PThread *thread = PThread::Current();
+
+  ring->threadName = (thread != NULL ? thread->GetThreadName() : PString("unknown"));
+
+#ifdef _WIN32
+  FlsSetValue(ringKey, ring);
+#else
+  pthread_setspecific(ringKey, ring);
+#endif
+
+  return ring;
+}
+
+static void PutString(PFile &file, const PString &str)
+{
+  DWORD len = str.GetLength();
+
+  file.Write(&len, sizeof(len));
+  file.Write((const char *)str, len);
+}
+///////////////////////////////////////////////////////////////
+class TraceDumper : public PThread
+{
+    PCLASSINFO(TraceDumper, PThread);
+  public:
+    TraceDumper(const PString &_path)
+      : PThread(30000, NoAutoDeleteThread, LowPriority, "TraceDump")
+      , path(_path)
+    {}
+
+    void Request(const PString &reason);
+
+    static TraceDumper *dumper;
+
+  protected:
+    void Main();
+    void Dump(const PString &reason);
+
+    const PString path;
+
+    PMutex mutex;
+    PStringList reasons;
+    PSyncPoint syncPoint;
+};
+
+TraceDumper *TraceDumper::dumper = NULL;
+
+void TraceDumper::Request(const PString &reason)
+{
+  {
+    PWaitAndSignal mutexWait(mutex);
+    reasons.AppendString(reason);
+  }
+
+  syncPoint.Signal();
+}
+
+void TraceDumper::Main()
+{
+  myPTRACE(1, "BinTrace: dumps to " << path);
+
+  for (;;) {
+    // the signal handler can't signal the sync point, so poll its flag
+    syncPoint.Wait(1000);
+
+    PString reason;
+
+#ifndef _WIN32
+    if (sigDump) {
+      sigDump = 0;
+      reason = "signal";
+    }
+#endif
+
+    {
+      PWaitAndSignal mutexWait(mutex);
+
+      // the requests received while the previous dump was written are
+      // coalesced to one dump
+      for (PINDEX i = 0 ; i < reasons.GetSize() ; i++) {
+        if (!reason.IsEmpty())
+          reason += ", ";
+
+        reason += reasons[i];
+      }
+
+      reasons.RemoveAll();
+    }
+
+    if (!reason.IsEmpty())
+      Dump(reason);
+  }
+}
+
+void TraceDumper::Dump(const PString &reason)
+{
+  PFile file;
+
+  if (!file.Open(path, PFile::WriteOnly, PFile::Create)) {
+    myPTRACE(1, "BinTrace: can't open " << path << " " << file.GetErrorText());
+    return;
+  }
+
+  file.SetPosition(0, PFile::End);
+
+  PWaitAndSignal mutexWait(ringsMutex);
+
+  BinTrace::DumpHeader header;
+
+  memcpy(header.magic, "T38TRACE", sizeof(header.magic));
+  header.version = BinTrace::dumpVersion;
+  header.recordSize = sizeof(BinTrace::Record);
+  header.wallUs = PTime().GetTimestamp();
+  header.time = BinTrace::NowNs();
+  header.modems = modemNames.GetSize();
+  header.rings = numRings;
+
+  int i;
+
+  file.Write(&header, sizeof(header));
+  PutString(file, reason);
+
+  for (i = 0 ; i < modemNames.GetSize() ; i++)
+    PutString(file, modemNames[i]);
+
+  BinTrace::Record *records = new BinTrace::Record[BinTrace::ringSize];
+  PInt64 total = 0;
+
+  for (i = 0 ; i < numRings ; i++) {
+    TraceRing *ring = rings[i];
+
+    // the owner thread continues to write, so copy the ring and then
+    // drop the records that could be overwritten while copying
+
+    DWORD end = ring->count;
+    MemoryBarrierFull();
+
+    DWORD begin = end > BinTrace::ringSize ? end - BinTrace::ringSize : 0;
+
+    for (DWORD n = begin ; n != end ; n++)
+      records[n - begin] = ring->records[n % BinTrace::ringSize];
+
+    MemoryBarrierFull();
+    DWORD now = ring->count;
+
+    DWORD first = begin;
+
+    if (now + 1 > BinTrace::ringSize && now + 1 - BinTrace::ringSize > first)
+      first = now + 1 - BinTrace::ringSize;
+
+    DWORD num = first < end ? end - first : 0;
+
+    PutString(file, ring->threadName + (ring->used ? "" : " (ended)"));
+    file.Write(&num, sizeof(num));
+    file.Write(records + (first - begin), num*sizeof(BinTrace::Record));
+
+    total += num;
+  }
+
+  delete [] records;
+
+  myPTRACE(1, "BinTrace: dumped " << total << " records of " << header.rings
+              << " threads (" << reason << ")");
+}
+///////////////////////////////////////////////////////////////
+#ifndef _WIN32
+static void OnSignalDump(int)
+{
+  sigDump = 1;
+}
+#endif
+
+PBoolean BinTrace::Enable(const PString &path)
+{
+  if (TraceDumper::dumper != NULL)
+    return TRUE;
+
+#ifdef _WIN32
+  ringKey = FlsAlloc(ReleaseRing);
+
+  if (ringKey == FLS_OUT_OF_INDEXES)
+    return FALSE;
+#else
+  if (pthread_key_create(&ringKey, ReleaseRing) != 0)
+    return FALSE;
+
+  signal(SIGUSR2, OnSignalDump);
+#endif
+
+  TraceDumper::dumper = new TraceDumper(path);
+  TraceDumper::dumper->Resume();
+
+  enabled = TRUE;
+
+  return TRUE;
+}
+
+WORD BinTrace::ModemId(const PString &name)
+{
+  PWaitAndSignal mutexWait(ringsMutex);
+
+  PINDEX i = modemNames.GetStringsIndex(name);
+
+  if (i == P_MAX_INDEX) {
+    i = modemNames.GetSize();
+
+    if (i > 0xFFFF)
+      return 0xFFFF;
+
+    modemNames.AppendString(name);
+  }
+
+  return (WORD)i;
+}
+
+void BinTrace::Add(WORD modem, Event event, DWORD arg, const void *data, PINDEX len)
+{
+  if (!enabled)
+    return;
+
+#ifdef _WIN32
+  TraceRing *ring = (TraceRing *)FlsGetValue(ringKey);
+#else
+  TraceRing *ring = (TraceRing *)pthread_getspecific(ringKey);
+#endif
+
+  if (ring == NULL && (ring = AcquireRing()) == NULL)
+    return;
+
+  DWORD n = ring->count;
+  Record &record = ring->records[n % ringSize];
+
+  if (len > maxData)
+    len = maxData;
+
+  record.time = NowNs();
+  record.modem = modem;
+  record.event = (BYTE)event;
+  record.len = (BYTE)len;
+  record.arg = arg;
+
+  if (len > 0)
+    memcpy(record.data, data, len);
+
+  // the record must be complete before it's counted (see TraceDumper::Dump())
+  StoreRelease(ring->count, n + 1);
+}
+
+void BinTrace::RequestDump(const PString &reason)
+{
+  if (TraceDumper::dumper != NULL)
+    TraceDumper::dumper->Request(reason);
+}
+
+PInt64 BinTrace::NowNs()
+{
+#ifdef _WIN32
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER count;
+
+  if (freq.QuadPart == 0)
+    QueryPerformanceFrequency(&freq);
+
+  QueryPerformanceCounter(&count);
+
+  return (PInt64)(count.QuadPart*(1000000000.0/freq.QuadPart));
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (PInt64)ts.tv_sec*1000000000 + ts.tv_nsec;
+#endif
+}
+///////////////////////////////////////////////////////////////
+
@@ -0,0 +1,141 @@
+/*
+ * pmtrace.h
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: pmtrace.h,v $
+ *
+ */
+
+#ifndef _PMTRACE_H
+#define _PMTRACE_H
+
+///////////////////////////////////////////////////////////////
+/**Binary trace ring.
+
+   Each thread has its own ring of fixed size records, so Add() takes no
+   locks and does not format anything. The rings are written to the dump
+   file only on request (RequestDump()) by the background thread and the
+   dump is rendered to the text by the t38trace program.
+
+   The rings of ended threads are kept (and reused by new threads), so the
+   last events of a failed call are in the dump after the call is cleared.
+ */
+class BinTrace
+{
+  public:
+    enum Event {
+      evIfpIn,                          ///<  Raw IFP received (arg - seq, flags)
+      evIfpOut,                         ///<  Raw IFP sent (arg - seq, flags)
+      evIfpLost,                        ///<  IFPs lost (arg - number)
+      evModemState,                     ///<  Modem engine state (arg - see StateArg())
+      evPtyIn,                          ///<  Data read from PTY (arg - full length)
+      evPtyOut,                         ///<  Data written to PTY (arg - full length)
+      NumEvents
+    };
+
+    enum {
+      argSeqMask      = 0xFFFF,
+      argCorrigendum  = 0x10000,        ///<  IFP is encoded with the CORRIGENDUM No. 1 ASN.1
+      argRepeated     = 0x20000,        ///<  IFP is a repetition (resent or received again)
+    };
+
+    enum {
+      maxData = 48,                     ///<  Bytes of payload in the record
+      ringSize = 1024,                  ///<  Records in the ring of thread
+      maxRings = 512                    ///<  Rings (allocated on first use)
+    };
+
+    /**The record (64 bytes), written to the dump as is.
+      */
+    struct Record {
+      PInt64 time;                      ///<  Monotonic time, ns
+      WORD modem;                       ///<  ModemId()
+      BYTE event;
+      BYTE len;                         ///<  Bytes in data
+      DWORD arg;
+      BYTE data[maxData];
+    };
+
+  /**@name Operations */
+  //@{
+    /**Enable the rings and the dumps to the file path (appended).
+       On POSIX systems SIGUSR2 requests the dump.
+       Returns FALSE if can't start.
+      */
+    static PBoolean Enable(const PString &path);
+
+    static PBoolean IsEnabled() { return enabled; }
+
+    /**Get (assign if not exists) the id of modem name.
+      */
+    static WORD ModemId(const PString &name);
+
+    /**Add the event to the ring of current thread. Only the first maxData
+       bytes of data are stored.
+      */
+    static void Add(WORD modem, Event event, DWORD arg, const void *data = NULL, PINDEX len = 0);
+
+    /**Request the dump of all rings (written asynchronously).
+      */
+    static void RequestDump(const PString &reason);
+
+    /**Pack the modem engine states to arg of evModemState.
+      */
+    static DWORD StateArg(PBoolean offHook, int callState, int callSubState, int state, int subState) {
+      return (offHook ? 0x80000000 : 0) |
+             ((callState & 0x7F) << 24) | ((callSubState & 0xFF) << 16) |
+             ((state & 0xFF) << 8) | (subState & 0xFF);
+    }
+
+    /**Get the monotonic real time in nanoseconds.
+      */
+    static PInt64 NowNs();
+  //@}
+
+  /**@name Dump file */
+  //@{
+    /**The dump is the header, the reason, the modem names and the rings.
+       The strings are DWORD length and chars. Each ring is the thread name,
+       DWORD number of records and the records (oldest first).
+      */
+    struct DumpHeader {
+      char magic[8];                    ///<  "T38TRACE"
+      DWORD version;
+      DWORD recordSize;                 ///<  sizeof(Record)
+      PInt64 wallUs;                    ///<  Real time of dump, us since 1970
+      PInt64 time;                      ///<  NowNs() of dump
+      DWORD modems;
+      DWORD rings;
+    };
+
+    enum { dumpVersion = 1 };
+  //@}
+
+  protected:
+    static volatile PBoolean enabled;
+};
+///////////////////////////////////////////////////////////////
+
+#endif  // _PMTRACE_H
+
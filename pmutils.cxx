@@ -77,6 +77,11 @@
  */
 
 #include <ptlib.h>
+
+#ifndef _WIN32
+  #include <time.h>
+#endif
+
 #include "pmutils.h"
 
 #define new PNEW
@@ -104,7 +109,7 @@ void ModemThread::SignalStop() {
 void ModemThread::WaitDataReady()
 {
   do {
-    dataReadySyncPoint.Wait();
+    ModemClock::Get().Wait(dataReadySyncPoint);
   } while(!dataReadySyncPoint.WillBlock());
 }
 ///////////////////////////////////////////////////////////////
@@ -271,6 +276,37 @@ const PString GetThreadTimes(const char *head, const char *tail)
   }
   return "";
 }
+#else
+const PString GetThreadTimes(const char *head, const char *tail)
+{
+  PInt64 ns = GetThreadCpuNs();
+
+  if (ns > 0)
+    return psprintf("%scpu=%.3f%s", head, ns/1000000000.0, tail);
+
+  return "";
+}
 #endif
+
+PInt64 GetThreadCpuNs()
+{
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+
+  if (!::GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+    return 0;
+
+  // 100 ns units
+  return ((((PInt64)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+          (((PInt64)user.dwHighDateTime << 32) | user.dwLowDateTime))*100;
+#else
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return 0;
+
+  return (PInt64)ts.tv_sec*1000000000 + ts.tv_nsec;
+#endif
+}
 ///////////////////////////////////////////////////////////////
 
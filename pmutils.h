@@ -95,6 +95,10 @@
 #ifndef _PMUTILS_H
 #define _PMUTILS_H
 
+#include "pmclock.h"
+#include "pmtrace.h"
+#include "pmmetrics.h"
+
 ///////////////////////////////////////////////////////////////
 class ModemThread : public PThread
 {
@@ -107,7 +111,7 @@ class ModemThread : public PThread
 
   /**@name Operations */
   //@{
-    void SignalDataReady() { dataReadySyncPoint.Signal(); }
+    void SignalDataReady() { ModemClock::Get().Signal(dataReadySyncPoint); }
     void SignalChildStop();
     virtual void SignalStop();
   //@}
@@ -206,6 +210,7 @@ class DataStream : public PObject
     int GetDiag() const { return diag; }
     DataStream &SetDiag(int _diag) { diag = _diag; return *this; }
     PBoolean isFull() const { return threshold && threshold < busy; }
+    PINDEX GetBusy() const { return busy; }
     virtual void Clean();
 
   private:
@@ -284,16 +289,22 @@ extern void RenameCurrentThread(const PString &newname);
 #define RenameCurrentThread(newname)
 #endif /* PTRACING */
 
-#ifdef PROCESS_PER_THREAD
 extern const PString GetThreadTimes(const char *head = "", const char *tail = "");
-#else
-inline const PString GetThreadTimes(const char *head = "", const char *tail = "");
 
-inline const PString GetThreadTimes(const char *, const char *)
+/**Get the CPU time of the current thread in nanoseconds.
+  */
+extern PInt64 GetThreadCpuNs();
+///////////////////////////////////////////////////////////////
+/**Reverse the order of the bits of the byte (the counters in the FIF of
+   the ECM frames are transmitted LSB first).
+  */
+inline BYTE ReverseBits(BYTE b)
 {
-  return "";
+  b = BYTE(((b & 0xF0) >> 4) | ((b & 0x0F) << 4));
+  b = BYTE(((b & 0xCC) >> 2) | ((b & 0x33) << 2));
+  b = BYTE(((b & 0xAA) >> 1) | ((b & 0x55) << 1));
+  return b;
 }
-#endif
 ///////////////////////////////////////////////////////////////
 
 #endif  // _PMUTILS_H
@@ -0,0 +1,271 @@
+/*
+ * reorder.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: reorder.cxx,v $
+ *
+ */
+
+#include <ptlib.h>
+#include "pmutils.h"
+#include "reorder.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+ReorderBuffer::ReorderBuffer()
+  : depth(0)
+  , delay(0)
+{
+  Reset();
+}
+
+void ReorderBuffer::SetDepth(int _depth, int _delay)
+{
+  if (_depth < 0)
+    _depth = 0;
+  else
+  if (_depth > maxDepth)
+    _depth = maxDepth;
+
+  depth = _depth;
+  delay = _delay > 0 ? _delay : 0;
+
+  PTRACE(3, "ReorderBuffer::SetDepth depth=" << depth << " delay=" << delay);
+}
+
+void ReorderBuffer::Reset()
+{
+  expected = 0;
+  highest = -1;
+  count = 0;
+  pendingLost = 0;
+
+  reordered = 0;
+  recovered = 0;
+  totallost = 0;
+  held = 0;
+  heldTime = 0;
+  maxHeldTime = 0;
+
+  for (PINDEX i = 0 ; i < numSlots ; i++)
+    slots[i].seq = -1;
+}
+
+long ReorderBuffer::Unwrap(WORD seq) const
+{
+  long res = (seq & 0xFFFF) + (expected & ~0xFFFFL);
+  long diff = res - expected;
+
+  if (diff < -0x10000L/2)
+    res += 0x10000L;
+  else
+  if (diff > 0x10000L/2)
+    res -= 0x10000L;
+
+  return res;
+}
+
+void ReorderBuffer::Resync(long seq, int lost)
+{
+  PTRACE(3, "ReorderBuffer::Resync " << expected << " -> " << seq
+         << " lost=" << lost << " dropped=" << count);
+
+  for (PINDEX i = 0 ; i < numSlots ; i++)
+    slots[i].seq = -1;
+
+  pendingLost += lost;
+  count = 0;
+  expected = seq;
+  highest = seq - 1;
+}
+
+ReorderBuffer::PutResult ReorderBuffer::Put(long seq, const BYTE * pData, PINDEX len, PBoolean _recovered)
+{
+  long diff = seq - expected;
+
+  if (diff < 0) {
+    if (diff > -maxJump)
+      return prIgnored;
+
+    // the sequence was restarted by sender
+    Resync(seq, 1);
+  }
+  else
+  if (diff > maxJump) {
+    // the sequence was restarted or switched by sender (not a loss of the
+    // whole span), so it's reported as one lost packet
+    Resync(seq, 1);
+  }
+  else
+  if (SlotOf(seq).seq == seq) {
+    return prIgnored;
+  }
+
+  PBoolean late = (seq < highest);
+
+  if (seq > highest)
+    highest = seq;
+
+  if (seq == expected && count == 0 && pendingLost == 0) {
+    if (_recovered)
+      recovered++;
+
+    expected++;
+    return prInOrder;
+  }
+
+  if (len > maxSize) {
+    PTRACE(2, "ReorderBuffer::Put packet " << seq << " is too big (" << len << " bytes)");
+    return prIgnored;
+  }
+
+  if (_recovered)
+    recovered++;
+  else
+  if (late)
+    reordered++;
+
+  Slot & slot = SlotOf(seq);
+
+  slot.seq = seq;
+  slot.len = len;
+  slot.arrived = ModemClock::Get().Now();
+  memcpy(slot.data, pData, len);
+  count++;
+
+  return prBuffered;
+}
+
+PTime ReorderBuffer::Oldest() const
+{
+  // the arrival times are from ModemClock, so don't start from PTime()
+  PTime oldest = ModemClock::Get().Now();
+
+  for (PINDEX i = 0 ; i < numSlots ; i++) {
+    if (slots[i].seq >= 0 && slots[i].arrived < oldest)
+      oldest = slots[i].arrived;
+  }
+
+  return oldest;
+}
+
+PBoolean ReorderBuffer::Get(const BYTE * & pData, PINDEX & len, int & lost)
+{
+  if (count == 0)
+    return FALSE;
+
+  Slot *pSlot = &SlotOf(expected);
+
+  if (pSlot->seq != expected) {
+    if (count <= depth && (delay <= 0 || (ModemClock::Get().Now() - Oldest()).GetMilliSeconds() < delay))
+      return FALSE;
+
+    long first = expected + 1;
+
+    while (SlotOf(first).seq != first)
+      first++;
+
+    PTRACE(3, "ReorderBuffer::Get gap " << expected << "-" << (first - 1) << " is lost");
+
+    pendingLost += int(first - expected);
+    expected = first;
+    pSlot = &SlotOf(first);
+  }
+
+  lost = pendingLost;
+  totallost += pendingLost;
+  pendingLost = 0;
+
+  pData = pSlot->data;
+  len = pSlot->len;
+  pSlot->seq = -1;
+  count--;
+  expected++;
+
+  long ms = (long)(ModemClock::Get().Now() - pSlot->arrived).GetMilliSeconds();
+
+  if (ms > 0) {
+    held++;
+    heldTime += ms;
+
+    if (maxHeldTime < ms)
+      maxHeldTime = ms;
+  }
+
+  return TRUE;
+}
+
+int ReorderBuffer::GetTimeout() const
+{
+  if (count == 0 || delay <= 0)
+    return -1;
+
+  long ms = delay - (long)(ModemClock::Get().Now() - Oldest()).GetMilliSeconds();
+
+  return ms > 0 ? int(ms) : 0;
+}
+
+PBoolean ReorderBuffer::Receive(WORD seq, const BYTE * pData, PINDEX len, Sink & sink, PBoolean recovered)
+{
+  if (len == 0)
+    return TRUE;
+
+  long useq = Unwrap(seq);
+  PutResult result = Put(useq, pData, len, recovered);
+
+  sink.OnPut(useq, result, pData, len, recovered);
+
+  switch (result) {
+    case prIgnored:
+      return TRUE;
+    case prInOrder:
+      if (!sink.OnPacket(pData, len))
+        return FALSE;
+      break;
+    default:
+      break;
+  }
+
+  return Flush(sink);
+}
+
+PBoolean ReorderBuffer::Flush(Sink & sink)
+{
+  const BYTE *pData;
+  PINDEX len;
+  int lost;
+
+  while (Get(pData, len, lost)) {
+    if (lost > 0 && !sink.OnLost(lost))
+      return FALSE;
+
+    if (!sink.OnPacket(pData, len))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+///////////////////////////////////////////////////////////////
+
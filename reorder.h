@@ -0,0 +1,232 @@
+/*
+ * reorder.h
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: reorder.h,v $
+ *
+ */
+
+#ifndef _REORDER_H
+#define _REORDER_H
+
+///////////////////////////////////////////////////////////////
+/**Bounded reorder buffer for incoming raw IFP packets.
+
+   A gap in the sequence numbers is held open while no more than depth
+   packets are waiting behind it and the oldest of them is waiting less
+   than delay milliseconds. The gap can be filled by a late packet or by a
+   packet recovered from the redundancy. After that the missing packets
+   are declared lost.
+
+   With depth 0 (default) any gap is declared lost immediately.
+
+   A jump of the sequence number by more than maxJump packets in either
+   direction (restart of the sender or switch of the stream) drops the
+   waiting packets and re-synchronizes the sequence. It's reported as one
+   lost packet, as the gaps in the sequence were handled before.
+ */
+class ReorderBuffer
+{
+  public:
+    enum {
+      maxDepth = 8,                        ///<  Max depth in packets
+      maxSize = 512                        ///<  Max size of raw IFP packet
+    };
+
+    enum PutResult {
+      prIgnored,                           ///<  Repeated, too late or too big packet
+      prInOrder,                           ///<  Next expected packet, not buffered
+      prBuffered                           ///<  Packet was copied to the buffer
+    };
+
+    /**Receiver of the packets passed in order by Receive() and Flush().
+      */
+    class Sink
+    {
+      public:
+        virtual ~Sink() {}
+
+        /**Called after the packet was put to the buffer (before any packet
+           is passed to OnPacket()).
+          */
+        virtual void OnPut(
+          long /*seq*/,
+          PutResult /*result*/,
+          const BYTE * /*pData*/,
+          PINDEX /*len*/,
+          PBoolean /*recovered*/
+        ) {}
+
+        /**Handle the packets declared lost. Returns FALSE to stop.
+          */
+        virtual PBoolean OnLost(
+          int lost
+        ) = 0;
+
+        /**Handle the next packet in order. Returns FALSE to stop.
+          */
+        virtual PBoolean OnPacket(
+          const BYTE * pData,
+          PINDEX len
+        ) = 0;
+    };
+
+  /**@name Construction */
+  //@{
+    ReorderBuffer();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Set depth in packets (0-8) and max hold time in milliseconds.
+       If delay <= 0 then the gap is held while the depth is not exceeded.
+      */
+    void SetDepth(
+      int depth,
+      int delay
+    );
+
+    int GetDepth() const { return depth; }
+    int GetDelay() const { return delay; }
+
+    /**Clear the buffer and the statistics.
+      */
+    void Reset();
+
+    /**Get next expected sequence number.
+      */
+    long GetExpected() const { return expected; }
+
+    /**Unwrap 16-bit sequence number relative to the next expected one.
+      */
+    long Unwrap(
+      WORD seq
+    ) const;
+
+    /**Put the packet with unwrapped sequence number seq.
+
+       If the packet is the next expected one and nothing is waiting in the
+       buffer then the packet is not copied and prInOrder is returned. The
+       caller should handle the packet itself and call Get() after that.
+
+       The recovered should be TRUE for the packets from the redundancy.
+      */
+    PutResult Put(
+      long seq,
+      const BYTE * pData,
+      PINDEX len,
+      PBoolean recovered = FALSE
+    );
+
+    /**Get the next packet in order.
+
+       Returns FALSE if the next packet is not ready yet. Otherwise returns
+       TRUE with the number of packets declared lost before it in lost (it
+       should be reported before handling the packet). The data pointer is
+       valid up to the next call of Put() or Reset().
+      */
+    PBoolean Get(
+      const BYTE * & pData,
+      PINDEX & len,
+      int & lost
+    );
+
+    /**Get number of milliseconds while the oldest waiting packet can be
+       held yet or -1 if no packets are waiting or the time is not limited.
+      */
+    int GetTimeout() const;
+
+    /**Receive the packet with 16-bit sequence number seq (the receiving
+       path of UDPTL and RTP streams): unwrap the sequence number, put the
+       packet and pass the packets ready in order to sink. The next
+       expected packet is passed without copying. Empty packets are
+       ignored.
+
+       Returns FALSE if the sink stopped.
+      */
+    PBoolean Receive(
+      WORD seq,
+      const BYTE * pData,
+      PINDEX len,
+      Sink & sink,
+      PBoolean recovered = FALSE
+    );
+
+    /**Pass the packets ready in order to sink (the lost packets are
+       reported before the packet after them). Should be called when
+       GetTimeout() expired.
+
+       Returns FALSE if the sink stopped.
+      */
+    PBoolean Flush(
+      Sink & sink
+    );
+  //@}
+
+  /**@name Statistics */
+  //@{
+    long GetReordered() const { return reordered; }
+    long GetRecovered() const { return recovered; }
+    long GetLost() const { return totallost; }
+    long GetHeld() const { return held; }
+    long GetHeldTime() const { return heldTime; }
+    long GetMaxHeldTime() const { return maxHeldTime; }
+  //@}
+
+  protected:
+    enum { maxJump = 10 };                 ///<  Bigger jumps re-synchronize sequence
+    enum { numSlots = 16 };                ///<  Power of 2, > maxJump
+
+    struct Slot {
+      long seq;
+      PINDEX len;
+      PTime arrived;
+      BYTE data[maxSize];
+    };
+
+    Slot & SlotOf(long seq) { return slots[seq & (numSlots - 1)]; }
+    void Resync(long seq, int lost);
+    PTime Oldest() const;
+
+    int depth;
+    int delay;
+
+    long expected;
+    long highest;
+    int count;
+    int pendingLost;
+
+    long reordered;
+    long recovered;
+    long totallost;
+    long held;
+    long heldTime;
+    long maxHeldTime;
+
+    Slot slots[numSlots];
+};
+///////////////////////////////////////////////////////////////
+
+#endif  // _REORDER_H
+
@@ -52,41 +52,330 @@
 #define new PNEW
 
 ///////////////////////////////////////////////////////////////
-void T30::v21End(PBoolean myPTRACE_PARAM(sent))
+static int CountBits(BYTE b)
 {
-  int size = v21frame.GetSize();
-  PString msg;
+  int count = 0;
 
-  if (size < 3)
-    msg = "too short";
+  for (; b ; b &= BYTE(b - 1))
+    count++;
+
+  return count;
+}
+
+static T30::FrameType PostMessage(BYTE fcf)
+{
+  switch (fcf & 0x7F) {
+    case 0x71: return T30::ftEOM;
+    case 0x72: return T30::ftMPS;
+    case 0x74: return T30::ftEOP;
+    case 0x79: return T30::ftPRI_EOM;
+    case 0x7A: return T30::ftPRI_MPS;
+    case 0x7C: return T30::ftPRI_EOP;
+  }
+
+  return T30::ftNone;
+}
+///////////////////////////////////////////////////////////////
+T30::T30()
+  : frameSize(0)
+  , truncated(FALSE)
+  , frameType(ftNone)
+  , frameSent(FALSE)
+  , cfr(FALSE)
+  , ecm(FALSE)
+  , tcf(tcfNone)
+  , remoteBitRate(0)
+  , remoteEcm(FALSE)
+  , bitRate(0)
+  , minScanTime(20)
+  , mr(FALSE)
+  , fine(FALSE)
+  , width(1728)
+  , ecmBlockFrames(0)
+  , ecmPprFrames1(0)
+  , ecmBlocks(0)
+  , ecmPprs(0)
+  , ecmPprFrames(0)
+  , postMessage(FALSE)
+  , lastPostMessage(ftNone)
+  , pages(0)
+  , completed(FALSE)
+  , numEvents(0)
+{
+  for (int i = 0 ; i < ftNumTypes ; i++)
+    frameCount[i] = 0;
+}
+
+const char *T30::getFrameName(FrameType type)
+{
+  static const char * const names[ftNumTypes] = {
+    "none", "unknown",
+    "NSF", "CSI", "DIS",
+    "NSC", "CIG", "DTC",
+    "NSS", "TSI", "DCS",
+    "CFR", "FTT",
+    "EOM", "MPS", "EOP",
+    "PRI-EOM", "PRI-MPS", "PRI-EOP",
+    "MCF", "RTP", "RTN", "PIP", "PIN",
+    "PPS", "PPR", "CTC", "CTR",
+    "RR", "RNR", "EOR", "ERR",
+    "CRP", "DCN"
+  };
+
+  if (type < 0 || type >= ftNumTypes)
+    return "?";
+
+  return names[type];
+}
+
+void T30::AddEvent(FrameType type, PBoolean tcfData, PBoolean sent)
+{
+  if (numEvents >= maxEvents)
+    return;
+
+  Event &event = events[numEvents++];
+
+  event.frameType = type;
+  event.tcf = tcfData;
+  event.sent = sent;
+  event.time = ModemClock::Get().Now();
+}
+
+void T30::hsBegin(PBoolean sent)
+{
+  AddEvent(ftNone, tcf == (sent ? tcfOut : tcfIn), sent);
+}
+
+void T30::v21Data(const void *pBuf, PINDEX len)
+{
+  if (len > maxFrameSize - frameSize) {
+    len = maxFrameSize - frameSize;
+    truncated = TRUE;
+  }
+
+  memcpy(frame + frameSize, pBuf, len);
+  frameSize += len;
+}
+
+void T30::DecodeDIS()
+{
+  remoteBitRate = 0;
+
+  if (hasFif(2)) {
+    switch ((fif(1) >> 2) & 0x0F) {   // bits 11-14
+      case 0x0: remoteBitRate = 2400;  break;
+      case 0x4: remoteBitRate = 4800;  break;
+      case 0x8:
+      case 0xC: remoteBitRate = 9600;  break;
+      case 0xD: remoteBitRate = 14400; break;
+    }
+  }
+
+  remoteEcm = (hasFif(4) && (fif(2) & 1) && (fif(3) & 0x20));
+}
+
+void T30::DecodeDCS()
+{
+  ecm = (hasFif(4) && (fif(2) & 1) && (fif(3) & 0x20));
+
+  if (hasFif(2)) {
+    switch ((fif(1) >> 2) & 0x0F) {   // bits 11-14
+      case 0x0: bitRate = 2400;  break;
+      case 0x4: bitRate = 4800;  break;
+      case 0x8:
+      case 0x9: bitRate = 9600;  break;
+      case 0xC:
+      case 0xD: bitRate = 7200;  break;
+      case 0x1: bitRate = 14400; break;
+      case 0x5: bitRate = 12000; break;
+      default:  bitRate = 0;
+    }
+
+    fine = (fif(1) & 0x02) != 0;   // bit 15
+    mr = (fif(1) & 0x01) != 0;     // bit 16
+  }
+
+  if (hasFif(3)) {
+    switch (fif(2) & 0xC0) {   // bits 17-18
+      case 0x40: width = 2432; break;
+      case 0x80: width = 2048; break;
+      default:   width = 1728;
+    }
+
+    switch (fif(2) & 0x0E) {   // bits 21-23
+      case 0x00: minScanTime = 20; break;
+      case 0x02: minScanTime = 40; break;
+      case 0x04: minScanTime = 10; break;
+      case 0x08: minScanTime = 5;  break;
+      case 0x0E: minScanTime = 0;  break;
+      default:   minScanTime = 40;
+    }
+  }
+}
+
+void T30::v21End(PBoolean sent)
+{
+  tcf = tcfNone;
+  frameType = ftUnknown;
+  frameSent = sent;
+
+  if (frameSize >= 3 && frame[0] == 0xFF && (frame[1] & 0xF7) == 0xC0) {
+    switch (frame[2]) {
+      case 0x04: frameType = ftNSF; break;
+      case 0x02: frameType = ftCSI; break;
+      case 0x01: frameType = ftDIS; break;
+      case 0x84: frameType = ftNSC; break;
+      case 0x82: frameType = ftCIG; break;
+      case 0x81: frameType = ftDTC; break;
+      default:
+        switch (frame[2] & 0x7F) {
+          case 0x44: frameType = ftNSS; break;
+          case 0x42: frameType = ftTSI; break;
+          case 0x41: frameType = ftDCS; break;
+          case 0x21: frameType = ftCFR; break;
+          case 0x22: frameType = ftFTT; break;
+          case 0x71: frameType = ftEOM; break;
+          case 0x72: frameType = ftMPS; break;
+          case 0x74: frameType = ftEOP; break;
+          case 0x79: frameType = ftPRI_EOM; break;
+          case 0x7A: frameType = ftPRI_MPS; break;
+          case 0x7C: frameType = ftPRI_EOP; break;
+          case 0x31: frameType = ftMCF; break;
+          case 0x33: frameType = ftRTP; break;
+          case 0x32: frameType = ftRTN; break;
+          case 0x35: frameType = ftPIP; break;
+          case 0x34: frameType = ftPIN; break;
+          case 0x7D: frameType = ftPPS; break;
+          case 0x3D: frameType = ftPPR; break;
+          case 0x48: frameType = ftCTC; break;
+          case 0x23: frameType = ftCTR; break;
+          case 0x76: frameType = ftRR;  break;
+          case 0x37: frameType = ftRNR; break;
+          case 0x73: frameType = ftEOR; break;
+          case 0x38: frameType = ftERR; break;
+          case 0x58: frameType = ftCRP; break;
+          case 0x5F: frameType = ftDCN; break;
+        }
+    }
+  }
+
+  frameCount[frameType]++;
+
+  if (frameType != ftUnknown)
+    AddEvent(frameType, FALSE, sent);
+
+  switch (frameType) {
+    case ftDIS:
+    case ftDTC:
+      DecodeDIS();
+      break;
+    case ftDCS:
+      DecodeDCS();
+      cfr = FALSE;
+      tcf = sent ? tcfOut : tcfIn;
+      break;
+    case ftCFR:
+      cfr = TRUE;
+      break;
+    case ftEOM:
+    case ftMPS:
+    case ftEOP:
+    case ftPRI_EOM:
+    case ftPRI_MPS:
+    case ftPRI_EOP:
+      postMessage = TRUE;
+      lastPostMessage = frameType;
+      break;
+    case ftMCF:
+    case ftRTP:
+    case ftPIP:
+      if (postMessage) {
+        postMessage = FALSE;
+        pages++;
+
+        if (frameType == ftMCF && (lastPostMessage == ftEOP || lastPostMessage == ftPRI_EOP))
+          completed = TRUE;
+      }
+      break;
+    case ftPPS:
+      if (hasFif(4)) {
+        // counters are transmitted LSB first
+        ecmBlockFrames = ReverseBits(fif(3)) + 1;
+        ecmBlocks++;
+      }
+      lastPostMessage = hasFif(1) ? PostMessage(fif(0)) : ftNone;
+      postMessage = (lastPostMessage != ftNone);
+      break;
+    case ftPPR:
+      ecmPprFrames1 = 0;
+
+      for (PINDEX i = 3 ; i < frameSize ; i++)
+        ecmPprFrames1 += CountBits(frame[i]);
+
+      ecmPprs++;
+      ecmPprFrames += ecmPprFrames1;
+      break;
+    default:
+      break;
+  }
+
+  myPTRACE(2, (sent ? "-->" : "<--") << " v21frame " << *this
+              << PRTHEX(PBYTEArray(frame, frameSize)));
+}
+
+void T30::PrintFrame(ostream &strm) const
+{
+  if (frameSize < 3)
+    strm << "too short";
   else
-  if (v21frame[0] != 0xFF)
-    msg = "w/o address field";
+  if (frame[0] != 0xFF)
+    strm << "w/o address field";
   else
-  if ((v21frame[1] & 0xF7) != 0xC0)
-    msg = "w/o control field";
-  else {
-    switch (v21frame[2]) {
-      case 0x41:
-      case 0x41 | 0x80:
-        msg = "DCS";
-        if (v21frame.GetSize() > 3+3 && (v21frame[3+2] & 1) && (v21frame[3+3] & 0x20)) {
-          ecm = TRUE;
-          msg += " with ECM";
-        } else {
-          ecm = FALSE;
-        }
+  if ((frame[1] & 0xF7) != 0xC0)
+    strm << "w/o control field";
+  else
+    strm << getFrameName(frameType);
 
-        cfr = FALSE;
-        break;
-      case 0x21:
-      case 0x21 | 0x80:
-        msg = "CFR";
-        cfr = TRUE;
-        break;
-    }
+  switch (frameType) {
+    case ftDIS:
+    case ftDTC:
+      if (remoteBitRate)
+        strm << " " << remoteBitRate << " bps";
+      if (remoteEcm)
+        strm << " with ECM";
+      break;
+    case ftDCS:
+      if (bitRate)
+        strm << " " << bitRate << " bps";
+      if (ecm)
+        strm << " with ECM";
+      if (hasFif(3)) {
+        strm << " " << (mr ? "MR" : "MH")
+             << " " << width << " pels"
+             << " " << minScanTime << "ms scan line";
+      }
+      break;
+    case ftPPS:
+      if (hasFif(4)) {
+        FrameType pm = PostMessage(fif(0));
+
+        strm << "-" << (pm == ftNone ? "NULL" : getFrameName(pm))
+             << " page " << (unsigned)ReverseBits(fif(1))
+             << " block " << (unsigned)ReverseBits(fif(2))
+             << " frames " << ecmBlockFrames;
+      }
+      break;
+    case ftPPR:
+      strm << " " << ecmPprFrames1 << " of " << ecmBlockFrames << " frames"
+           << " (" << ecmPprs << " PPR, " << ecmPprFrames << " frames in "
+           << ecmBlocks << " blocks)";
+      break;
+    default:
+      break;
   }
-  myPTRACE(2, PString(sent ? "-->" : "<--") << " v21frame " << msg << PRTHEX(v21frame));
+
+  if (truncated)
+    strm << " (truncated)";
 }
 ///////////////////////////////////////////////////////////////
 
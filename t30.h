@@ -47,19 +47,159 @@
 #include "pmutils.h"
 
 ///////////////////////////////////////////////////////////////
+/**Monitor of T.30 control frames sent or received with V.21.
+
+   The frame is collected to the fixed buffer (no allocations on the data
+   path) and decoded by v21End(). The type of the last frame and some
+   parameters of the session are available to the engine after that.
+ */
 class T30
 {
   public:
-    T30() : cfr(FALSE), ecm(FALSE) {}
-    void v21Begin() { v21frame = PBYTEArray(); }
-    void v21Data(void *pBuf, PINDEX len) { v21frame.Concatenate(PBYTEArray((BYTE *)pBuf, len)); }
+    enum FrameType {
+      ftNone,
+      ftUnknown,
+      ftNSF, ftCSI, ftDIS,                 ///<  Initial identification
+      ftNSC, ftCIG, ftDTC,                 ///<  Command to send
+      ftNSS, ftTSI, ftDCS,                 ///<  Command to receive
+      ftCFR, ftFTT,                        ///<  Responses to training
+      ftEOM, ftMPS, ftEOP,                 ///<  Post-message commands
+      ftPRI_EOM, ftPRI_MPS, ftPRI_EOP,
+      ftMCF, ftRTP, ftRTN, ftPIP, ftPIN,   ///<  Post-message responses
+      ftPPS, ftPPR, ftCTC, ftCTR,          ///<  ECM commands and responses
+      ftRR, ftRNR, ftEOR, ftERR,
+      ftCRP, ftDCN,
+      ftNumTypes
+    };
+
+    enum { maxFrameSize = 256 };
+    enum { maxEvents = 64 };
+
+    /**Event of the phase timeline: a control frame or the start of the high
+       speed data (frameType is ftNone, TCF or image data).
+      */
+    struct Event {
+      FrameType frameType;
+      PBoolean tcf;
+      PBoolean sent;
+      PTime time;
+    };
+
+    T30();
+
+    void v21Begin() { frameSize = 0; truncated = FALSE; }
+    void v21Data(const void *pBuf, PINDEX len);
     void v21End(PBoolean sent);
+    void hsBegin(PBoolean sent);
     PBoolean hdlcOnly() const { return cfr && ecm; }
 
+    /**Returns the type of the last frame and TRUE if it was sent.
+      */
+    FrameType getFrameType() const { return frameType; }
+    PBoolean isFrameSent() const { return frameSent; }
+
+    /**Returns the number of frames of type decoded in the call.
+      */
+    long getFrameCount(FrameType type) const { return frameCount[type]; }
+
+    static const char *getFrameName(FrameType type);
+
+    /**Returns TRUE if the next high speed data is TCF sent or received
+       after DCS.
+      */
+    PBoolean isTcfOut() const { return tcf == tcfOut; }
+    PBoolean isTcfIn() const { return tcf == tcfIn; }
+    void tcfDone() { tcf = tcfNone; }
+
+    /**Returns the max bit rate from the last DIS or DTC or 0 if unknown.
+      */
+    int getRemoteBitRate() const { return remoteBitRate; }
+    PBoolean isRemoteEcm() const { return remoteEcm; }
+
+    /**Returns the bit rate from the last DCS or 0 if unknown.
+      */
+    int getBitRate() const { return bitRate; }
+    PBoolean isEcm() const { return ecm; }
+
+    /**Returns minimum scan line time in ms from the last DCS.
+      */
+    int getMinScanTime() const { return minScanTime; }
+
+    /**Returns image parameters from the last DCS.
+      */
+    PBoolean isMR() const { return mr; }
+    PBoolean isFine() const { return fine; }
+    int getWidth() const { return width; }
+
+    /**Returns ECM statistics: number of blocks (PPS), number of PPR
+       responses and number of frames requested to retransmit by them.
+      */
+    long getEcmBlocks() const { return ecmBlocks; }
+    long getEcmPprs() const { return ecmPprs; }
+    long getEcmPprFrames() const { return ecmPprFrames; }
+
+    /**Returns the number of frames requested to retransmit by the last PPR.
+      */
+    int getPprFrames() const { return ecmPprFrames1; }
+
+    /**Returns the number of pages confirmed by MCF, RTP or PIP.
+      */
+    long getPages() const { return pages; }
+
+    /**Returns TRUE if the page transfer was started (DCS) but the last page
+       was not confirmed by MCF to EOP.
+      */
+    PBoolean isFailed() const { return frameCount[ftDCS] > 0 && !completed; }
+
+    /**Returns the phase timeline of the call (first maxEvents events).
+      */
+    PINDEX getEventCount() const { return numEvents; }
+    const Event &getEvent(PINDEX i) const { return events[i]; }
+
   private:
-    PBYTEArray v21frame;
+    enum { tcfNone, tcfOut, tcfIn };
+
+    BYTE fif(PINDEX i) const { return 3 + i < frameSize ? frame[3 + i] : BYTE(0); }
+    PBoolean hasFif(PINDEX len) const { return 3 + len <= frameSize; }
+
+    void DecodeDIS();
+    void DecodeDCS();
+    void AddEvent(FrameType type, PBoolean tcfData, PBoolean sent);
+    void PrintFrame(ostream &strm) const;
+
+    friend ostream & operator<<(ostream &strm, const T30 &t30) { t30.PrintFrame(strm); return strm; }
+
+    BYTE frame[maxFrameSize];
+    PINDEX frameSize;
+    PBoolean truncated;
+    FrameType frameType;
+    PBoolean frameSent;
+    long frameCount[ftNumTypes];
+
     PBoolean cfr;
     PBoolean ecm;
+    int tcf;
+    int remoteBitRate;
+    PBoolean remoteEcm;
+    int bitRate;
+    int minScanTime;
+    PBoolean mr;
+    PBoolean fine;
+    int width;
+
+    int ecmBlockFrames;
+    int ecmPprFrames1;
+    long ecmBlocks;
+    long ecmPprs;
+    long ecmPprFrames;
+
+    PBoolean postMessage;
+    FrameType lastPostMessage;
+    long pages;
+    PBoolean completed;
+
+    Event events[maxEvents];
+    PINDEX numEvents;
 };
 ///////////////////////////////////////////////////////////////
 
@@ -55,6 +55,7 @@
  */
 
 #include <ptlib.h>
+#include <math.h>
 #include "pmutils.h"
 #include "t30tone.h"
 
@@ -66,206 +67,317 @@
 typedef	PInt16                    SIMPLE_TYPE;
 #define BYTES_PER_SIMPLE          sizeof(SIMPLE_TYPE)
 #define SIMPLES_PER_SEC           8000
+#define FRAME_MSEC                20
+#define TWO_PI                    (3.1415926535897932384626433832795029L*2)
 ///////////////////////////////////////////////////////////////
 #define CNG_HZ                    1100
 #define CNG_ON_MSEC               500
 #define CNG_OFF_MSEC              3000
+#define CED_HZ                    2100
+#define CED_ON_MSEC               500
+#define CED_OFF_MSEC_MAX          20
+#define ANSAM_HZ                  15
+#define ANSAM_DEPTH_PERCENTS_MIN  8     // 20% depth is 17% after 20 ms averaging
+#define V21_MARK_HZ               1650
+#define V21_SPACE_HZ              1850
+#define V21_ON_MSEC               200
+#define V21_TONE_PERCENTS_MIN    3
 ///////////////////////////////////////////////////////////////
-#define CNG_FILTER_BUF_LEN ((((SIMPLES_PER_SEC + CNG_HZ - 1)/CNG_HZ + 1)/2)*2)
-
-#define tone_trace(cng_filter_buf, power, cng_power, cng_power_norm)
-#ifndef tone_trace
-static void tone_trace(const long *cng_filter_buf, long power, long cng_power, long cng_power_norm)
-{
-  PString str;
-
-  for (PINDEX i = 0 ; i < CNG_FILTER_BUF_LEN ; i++) {
-    str += PString(cng_filter_buf[i]);
-    str += " ";
-  }
+#define CNG_ON_FRAMES_MIN         ((CNG_ON_MSEC*60)/(FRAME_MSEC*100))
+#define CNG_ON_FRAMES_MAX         ((CNG_ON_MSEC*140)/(FRAME_MSEC*100))
+#define CNG_OFF_FRAMES_MIN        ((CNG_OFF_MSEC*30)/(FRAME_MSEC*100))
+#define CED_ON_FRAMES_MIN         (CED_ON_MSEC/FRAME_MSEC)
+#define CED_OFF_FRAMES_MAX        (CED_OFF_MSEC_MAX/FRAME_MSEC)
+#define ANSAM_AMPS_MIN            (CED_ON_FRAMES_MIN/2)
+#define V21_ON_FRAMES_MIN         (V21_ON_MSEC/FRAME_MSEC)
+///////////////////////////////////////////////////////////////
+enum {
+  toneCNG,
+  toneCED,
+  toneV21Mark,
+  toneV21Space
+};
 
-  myPTRACE(1, str << " pw=" << power << " cng_pw=" << cng_power << " norm=" << cng_power_norm);
-}
-#endif
+static const int toneHz[] = {
+  CNG_HZ,
+  CED_HZ,
+  V21_MARK_HZ,
+  V21_SPACE_HZ
+};
 
 enum {
   cng_phase_off_head,
   cng_phase_on,
-  cng_phase_off_tail,
+  cng_phase_off_tail
 };
 
 T30ToneDetect::T30ToneDetect()
+  : threshold(50)
+  , minLevel(100)
+  , power(0)
+  , count(0)
+  , cng_on_count(0)
+  , cng_off_count(0)
+  , cng_phase(cng_phase_off_head)
+  , ced_on_count(0)
+  , ced_off_count(0)
+  , ced_frames(0)
+  , ced_reversals(0)
+  , ced_re(0)
+  , ced_im(0)
+  , ced_amp_pending(FALSE)
+  , ced_amp(0)
+  , ced_env_count(0)
+  , ced_env_sum(0)
+  , ced_env_cos(0)
+  , ced_env_sin(0)
+  , ced_ref_cos(0)
+  , ced_ref_sin(0)
+  , v21_on_count(0)
 {
-  cng_filter_buf = new long[CNG_FILTER_BUF_LEN];
-  memset(cng_filter_buf, 0, CNG_FILTER_BUF_LEN*sizeof(cng_filter_buf[0]));
+  // all tones have integer number of periods in the frame
 
-  index = 0;
-  power = 0;
+  for (int i = 0 ; i < numTones ; i++) {
+    double w = double((toneHz[i]*TWO_PI)/SIMPLES_PER_SEC);
 
-  cng_on_count = 0;
-  cng_off_count = 0;
-  cng_phase = cng_phase_off_head;
+    cosw[i] = (float)cos(w);
+    sinw[i] = (float)sin(w);
+    coef[i] = 2*cosw[i];
+    s1[i] = s2[i] = 0;
+  }
 }
 
 T30ToneDetect::~T30ToneDetect()
 {
-  delete [] cng_filter_buf;
 }
 
-#define CNG_FILTER_CHUNK_LEN	20
-#define CNG_ON_CHUNKS_MIN	(((CNG_HZ*CNG_ON_MSEC)*60)/((CNG_FILTER_CHUNK_LEN*1000)*100))
-#define CNG_ON_CHUNKS_MAX	(((CNG_HZ*CNG_ON_MSEC)*140)/((CNG_FILTER_CHUNK_LEN*1000)*100))
-#define CNG_OFF_CHUNKS_MIN	(((CNG_HZ*CNG_OFF_MSEC)*30)/((CNG_FILTER_CHUNK_LEN*1000)*100))
+void T30ToneDetect::SetThreshold(int percents, int level)
+{
+  threshold = percents;
+  minLevel = level;
+}
 
-PBoolean T30ToneDetect::Write(const void * buffer, PINDEX len)
+int T30ToneDetect::Write(const void * buffer, PINDEX len)
 {
-  PBoolean detected = FALSE;
+  int events = 0;
 
-  SIMPLE_TYPE *pBuf = (SIMPLE_TYPE *)buffer;
+  const SIMPLE_TYPE *pBuf = (const SIMPLE_TYPE *)buffer;
   len /= BYTES_PER_SIMPLE;
 
   while (len) {
-    PINDEX iBuf = 0;
+    PINDEX n = frameLen - count;
 
-    // filter CNG and calculate total power
+    if (n > len)
+      n = len;
 
-    PINDEX index0 = index;
+    for (PINDEX i = 0 ; i < n ; i++) {
+      float x = pBuf[i];
 
-    while (index < CNG_FILTER_BUF_LEN*CNG_FILTER_CHUNK_LEN) {
-      iBuf = ((index - index0)*SIMPLES_PER_SEC)/(CNG_FILTER_BUF_LEN*CNG_HZ);
+      power += x*x;
 
-      if (iBuf >= len)
-        return detected;
+      for (int t = 0 ; t < numTones ; t++) {
+        float s = x + coef[t]*s1[t] - s2[t];
 
-      SIMPLE_TYPE pw = pBuf[iBuf];
+        s2[t] = s1[t];
+        s1[t] = s;
+      }
+    }
 
-      cng_filter_buf[index%CNG_FILTER_BUF_LEN] += pw;
+    pBuf += n;
+    len -= n;
+    count += n;
 
-      if (pw < 0)
-        power -= pw;
-      else
-        power += pw;
+    if (count < frameLen)
+      break;
 
-      index++;
-    }
+    // the frame is complete
 
-    // calculate CNG power
+    float re[numTones];
+    float im[numTones];
+    float pw[numTones];
+    int tonesOn = 0;
 
-    PINDEX i;
-    long cng_power_cur = 0;
+    for (int t = 0 ; t < numTones ; t++) {
+      re[t] = s1[t] - s2[t]*cosw[t];
+      im[t] = s2[t]*sinw[t];
 
-    for (i = 0 ; i < CNG_FILTER_BUF_LEN/2 ; i++)
-      cng_power_cur += cng_filter_buf[i];
+      // 2*|X|^2/N is equal to the frame power for the pure tone
+      pw[t] = (2*(re[t]*re[t] + im[t]*im[t]))/frameLen;
 
-    for (; i < CNG_FILTER_BUF_LEN ; i++)
-      cng_power_cur -= cng_filter_buf[i];
+      s1[t] = s2[t] = 0;
+    }
 
-    long cng_power;
+    if (power >= float(minLevel)*minLevel*frameLen) {
+      if (pw[toneCNG]*100 >= power*threshold)
+        tonesOn |= (1 << toneCNG);
 
-    if (cng_power_cur < 0)
-      cng_power = -cng_power_cur;
-    else
-      cng_power = cng_power_cur;
+      if (pw[toneCED]*100 >= power*threshold)
+        tonesOn |= (1 << toneCED);
 
-    for (i = 1 ; i < CNG_FILTER_BUF_LEN/2 ; i++) {
-      cng_power_cur -= cng_filter_buf[i]*2;
-      cng_power_cur += cng_filter_buf[i + CNG_FILTER_BUF_LEN/2]*2;
+      // FSK spreads V.21 flags beyond the mark and space bins
 
-      if (cng_power_cur < 0) {
-        if (cng_power < -cng_power_cur)
-          cng_power = -cng_power_cur;
-      } else {
-        if (cng_power < cng_power_cur)
-          cng_power = cng_power_cur;
+      if ((pw[toneV21Mark] + pw[toneV21Space])*200 >= power*threshold &&
+          pw[toneV21Space]*100 >= power*V21_TONE_PERCENTS_MIN &&
+          pw[toneV21Mark]*100 >= power*V21_TONE_PERCENTS_MIN)
+      {
+        tonesOn |= (1 << toneV21Mark) | (1 << toneV21Space);
       }
     }
 
-    long cng_power_norm = cng_power * 1000;
-
-    if (power > 1)
-      cng_power_norm /= power;
-
-    if (cng_on_count > 1)
-      cng_power_norm = (cng_power_norm*140)/100;
-    if (cng_off_count > 1)
-      cng_power_norm = (cng_power_norm*80)/100;
+    events |= DetectFrame(tonesOn, re, im);
 
-    if (cng_power_norm > 500) {
-      cng_on_count++;
+    power = 0;
+    count = 0;
+  }
 
-      switch (cng_phase) {
-        case cng_phase_off_head:
-          if (cng_off_count >= CNG_OFF_CHUNKS_MIN)
-            cng_phase = cng_phase_on;
-          else
-            cng_phase = cng_phase_off_head;
-          break;
+  return events;
+}
 
-        case cng_phase_on:
-          break;
+int T30ToneDetect::DetectFrame(int tonesOn, const float *re, const float *im)
+{
+  int events = 0;
+
+  // CNG
+
+  if (tonesOn & (1 << toneCNG)) {
+    cng_on_count++;
+
+    switch (cng_phase) {
+      case cng_phase_off_head:
+        if (cng_off_count >= CNG_OFF_FRAMES_MIN)
+          cng_phase = cng_phase_on;
+        break;
+      case cng_phase_on:
+        break;
+      default:
+        cng_phase = cng_phase_off_head;
+    }
 
-        case cng_phase_off_tail:
+    if (cng_off_count) {
+      myPTRACE(2, "cng_off_count=" << cng_off_count);
+      cng_off_count = 0;
+    }
+  } else {
+    cng_off_count++;
+
+    switch (cng_phase) {
+      case cng_phase_off_head:
+        break;
+      case cng_phase_on:
+        if (cng_on_count >= CNG_ON_FRAMES_MIN && cng_on_count <= CNG_ON_FRAMES_MAX)
+          cng_phase = cng_phase_off_tail;
+        else
           cng_phase = cng_phase_off_head;
-          break;
-
-        default:
+        break;
+      case cng_phase_off_tail:
+        if (cng_off_count >= CNG_OFF_FRAMES_MIN) {
+          myPTRACE(1, "Detected CNG");
           cng_phase = cng_phase_off_head;
-      }
+          events |= evCNG;
+        }
+        break;
+      default:
+        cng_phase = cng_phase_off_head;
+    }
 
-      if (cng_off_count) {
-        myPTRACE(2, "cng_off_count=" << cng_off_count);
-        cng_off_count = 0;
-      }
+    if (cng_on_count) {
+      myPTRACE(2, "cng_on_count=" << cng_on_count);
+      cng_on_count = 0;
+    }
+  }
 
-      tone_trace(cng_filter_buf, power, cng_power, cng_power_norm);
+  // CED/ANSam
+
+  if (tonesOn & (1 << toneCED)) {
+    float amp = (float)sqrt(re[toneCED]*re[toneCED] + im[toneCED]*im[toneCED]);
+
+    if (ced_on_count == 0) {
+      // the first frame is partial
+      ced_frames = 0;
+      ced_reversals = 0;
+      ced_amp_pending = FALSE;
+      ced_env_count = 0;
+      ced_env_sum = ced_env_cos = ced_env_sin = 0;
+      ced_ref_cos = ced_ref_sin = 0;
+    } else
+    // the phase is continuous between frames if there is no reversal
+    if (re[toneCED]*ced_re + im[toneCED]*ced_im < 0) {
+      // the reversal is in this frame or in the end of the previous one
+      ced_reversals++;
+      ced_amp_pending = FALSE;
     } else {
-      cng_off_count++;
-
-      switch (cng_phase) {
-        case cng_phase_off_head:
-          break;
-
-        case cng_phase_on:
-          if (cng_on_count >= CNG_ON_CHUNKS_MIN && cng_on_count <= CNG_ON_CHUNKS_MAX)
-            cng_phase = cng_phase_off_tail;
-          else
-            cng_phase = cng_phase_off_head;
-          break;
-
-        case cng_phase_off_tail:
-          if (cng_off_count >= CNG_OFF_CHUNKS_MIN) {
-            myPTRACE(1, "Detected CNG");
-            cng_phase = cng_phase_off_head;
-            detected = TRUE;
-          }
-          break;
-
-        default:
-          cng_phase = cng_phase_off_head;
-      }
-
-      if (cng_on_count) {
-        myPTRACE(2, "cng_on_count=" << cng_on_count);
-        tone_trace(cng_filter_buf, power, cng_power, cng_power_norm);
+      if (ced_amp_pending)
+        AddCedAmp(ced_amp);
 
-        cng_on_count = 0;
-      }
+      ced_amp_pending = TRUE;
     }
 
-    // reatart filter
+    ced_re = re[toneCED];
+    ced_im = im[toneCED];
+    ced_amp = amp;
+    ced_off_count = 0;
+    ced_frames++;
 
-    memset(cng_filter_buf, 0, CNG_FILTER_BUF_LEN*sizeof(cng_filter_buf[0]));
-    index = 0;
-    power = 0;
+    if (++ced_on_count == CED_ON_FRAMES_MIN) {
+      // 15 Hz amplitude modulation: the 15 Hz component of the frame
+      // amplitudes (the mean is removed, since some frames are skipped)
+      float depth = 0;
+
+      if (ced_env_count >= ANSAM_AMPS_MIN && ced_env_sum > 0) {
+        float mean = ced_env_sum/ced_env_count;
+        float c = ced_env_cos - mean*ced_ref_cos;
+        float s = ced_env_sin - mean*ced_ref_sin;
 
-    // next chunk
+        depth = (float)(2*sqrt(c*c + s*s)/ced_env_sum);
+      }
 
-    iBuf++;
-    pBuf += iBuf;
-    len -= iBuf;
+      if (depth*100 >= ANSAM_DEPTH_PERCENTS_MIN) {
+        myPTRACE(1, "Detected ANSam (reversals=" << ced_reversals << " depth=" << depth << ")");
+        events |= evANSam;
+      } else {
+        myPTRACE(1, "Detected CED (reversals=" << ced_reversals << " depth=" << depth << ")");
+        events |= evCED;
+      }
+    }
+  } else if (ced_on_count) {
+    if (++ced_off_count > CED_OFF_FRAMES_MAX) {
+      myPTRACE(2, "ced_on_count=" << ced_on_count << " reversals=" << ced_reversals);
+      ced_on_count = 0;
+    } else {
+      // the reversal in the middle of the frame cancels the tone
+      ced_amp_pending = FALSE;
+      ced_frames++;
+    }
+  }
+
+  // V.21 flags
+
+  if ((tonesOn & ((1 << toneV21Mark) | (1 << toneV21Space))) == ((1 << toneV21Mark) | (1 << toneV21Space))) {
+    if (++v21_on_count == V21_ON_FRAMES_MIN) {
+      myPTRACE(1, "Detected V.21 flags");
+      events |= evV21;
+    }
+  } else if (v21_on_count) {
+    myPTRACE(2, "v21_on_count=" << v21_on_count);
+    v21_on_count = 0;
   }
 
-  return detected;
+  return events;
+}
+
+void T30ToneDetect::AddCedAmp(float amp)
+{
+  // the amplitude of the previous frame
+  double w = (double(ANSAM_HZ*TWO_PI)*FRAME_MSEC*(ced_frames - 1))/1000;
+  float c = (float)cos(w);
+  float s = (float)sin(w);
+
+  ced_env_count++;
+  ced_env_sum += amp;
+  ced_env_cos += amp*c;
+  ced_env_sin += amp*s;
+  ced_ref_cos += c;
+  ced_ref_sin += s;
 }
 ///////////////////////////////////////////////////////////////
 
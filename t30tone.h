@@ -51,25 +51,88 @@
 #define _T30TONE_H
 
 ///////////////////////////////////////////////////////////////
+/**Detector of fax tones in 8000 Hz PCM16 audio.
+
+   The audio is processed by 20 ms frames with a bank of Goertzel filters
+   tuned to 1100 Hz (CNG), 2100 Hz (CED/ANSam) and 1650/1850 Hz (V.21
+   channel 2). A tone is on in the frame if its power is not less than
+   threshold percents of the frame power and the frame level is not less
+   than the min level. The cadence of the tones is validated by counting
+   the frames.
+
+   The 2100 Hz tone is ANSam if the frame amplitudes have the 15 Hz
+   component. The first frame of the tone and the frames around the
+   phase reversals are partial, so they are not used for that. The
+   single frame gaps (reversals in the middle of the frame) do not break
+   the tone.
+ */
 class T30ToneDetect : public PObject
 {
   PCLASSINFO(T30ToneDetect, PObject);
 
   public:
+    enum {
+      evCNG   = 0x01,                      ///<  1100 Hz 0.5 s on, 3 s off
+      evCED   = 0x02,                      ///<  2100 Hz
+      evANSam = 0x04,                      ///<  2100 Hz modulated with 15 Hz
+      evV21   = 0x08                       ///<  V.21 channel 2 HDLC flags
+    };
 
     T30ToneDetect();
     ~T30ToneDetect();
 
-    PBoolean Write(const void * buffer, PINDEX len);
+    /**Set detection threshold in percents of the frame power (default
+       50) and min frame level in RMS (default 100).
+      */
+    void SetThreshold(
+      int percents,
+      int minLevel
+    );
+
+    /**Process the audio and return the mask of detected events.
+      */
+    int Write(const void * buffer, PINDEX len);
 
   protected:
+    enum {
+      frameLen = 160,                      ///<  20 ms
+      numTones = 4
+    };
+
+    int DetectFrame(int tonesOn, const float *re, const float *im);
+    void AddCedAmp(float amp);
+
+    int threshold;
+    int minLevel;
+
+    float coef[numTones];
+    float cosw[numTones];
+    float sinw[numTones];
+    float s1[numTones];
+    float s2[numTones];
+    float power;
+    PINDEX count;
 
-    long *cng_filter_buf;
-    PINDEX index;
-    long power;
     int cng_on_count;
     int cng_off_count;
     int cng_phase;
+
+    int ced_on_count;
+    int ced_off_count;
+    int ced_frames;
+    int ced_reversals;
+    float ced_re;
+    float ced_im;
+    PBoolean ced_amp_pending;
+    float ced_amp;
+    int ced_env_count;
+    float ced_env_sum;
+    float ced_env_cos;
+    float ced_env_sin;
+    float ced_ref_cos;
+    float ced_ref_sin;
+
+    int v21_on_count;
 };
 ///////////////////////////////////////////////////////////////
 
@@ -0,0 +1,868 @@
+/*
+ * t38bench.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: t38bench.cxx,v $
+ *
+ */
+
+/*
+ * Microbenchmarks for the byte level kernels (FCS, HDLC, DLE, G.711,
+ * DataStream, ToneGenerator and T.30 monitor) and the hot path metrics
+ * and trace.
+ *
+ * Each benchmark is repeated with growing number of iterations until it
+ * runs at least --min-time seconds. The results are written in JSON (the
+ * same layout as Google Benchmark uses) to be compared across releases.
+ */
+
+#include <ptlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "version.h"
+#include "pmutils.h"
+#include "fcs.h"
+#include "hdlc.h"
+#include "dle.h"
+#include "tone_gen.h"
+#include "t30.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+#include "g711.c"
+///////////////////////////////////////////////////////////////
+#define TWO_PI                    (3.1415926535897932384626433832795029*2)
+
+enum {
+  ETX = 0x03,
+  DLE = 0x10
+};
+
+static double ClockSeconds(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/**Keeps the results of the benchmarks alive.
+  */
+static volatile unsigned long benchSink;
+///////////////////////////////////////////////////////////////
+/**Seeded xorshift generator, the inputs are the same on each run.
+  */
+class Random
+{
+  public:
+    Random(unsigned long seed) : state(seed ? seed : 1) {}
+
+    unsigned long Next() {
+      state ^= (state << 13) & 0xFFFFFFFF;
+      state ^= state >> 17;
+      state ^= (state << 5) & 0xFFFFFFFF;
+      return state & 0xFFFFFFFF;
+    }
+
+    unsigned long Next(unsigned long range) { return range ? Next() % range : 0; }
+
+  protected:
+    unsigned long state;
+};
+///////////////////////////////////////////////////////////////
+/**Modified Huffman writer (the first bit is the least significant one
+   as in the Class 1 stream).
+  */
+class T4Writer
+{
+  public:
+    T4Writer(PBYTEArray &_data) : data(_data), count(0), cur(0), bits(0), lineBits(0) {}
+
+    void Put(unsigned code, int len) {
+      lineBits += len;
+
+      while (len--) {
+        if ((code >> len) & 1)
+          cur |= BYTE(1 << bits);
+
+        if (++bits == 8) {
+          data[count++] = cur;
+          cur = 0;
+          bits = 0;
+        }
+      }
+    }
+
+    /**Put EOL with fill bits to get at least minBits per line.
+      */
+    void PutEol(int minBits) {
+      while (lineBits + 12 < minBits)
+        Put(0, 1);
+
+      Put(0x001, 12);
+      lineBits = 0;
+    }
+
+    void Flush() {
+      if (bits)
+        data[count++] = cur;
+
+      data.SetSize(count);
+    }
+
+  protected:
+    PBYTEArray &data;
+    PINDEX count;
+    BYTE cur;
+    int bits;
+    int lineBits;
+};
+///////////////////////////////////////////////////////////////
+/**Inputs modeling the real traffic.
+  */
+class BenchInputs
+{
+  public:
+    BenchInputs(unsigned long seed);
+
+    PBYTEArray t4Page;          ///<  T.4 MH lines with fill (non-ECM page)
+    PBYTEArray dteStream;       ///<  t4Page as sent by DTE (DLE shielded, DLE ETX)
+    PBYTEArray v21Frame;        ///<  DIS w/o FCS
+    PBYTEArray ecmFrame;        ///<  FCD w/o FCS
+    PBYTEArray v21Raw;          ///<  v21Frame with flags, FCS and bit stuffing
+    PBYTEArray ecmRaw;          ///<  ecmFrame with flags, FCS and bit stuffing
+    PShortArray voice;          ///<  1 sec of voice like audio
+    PBYTEArray alaw;
+    PBYTEArray ulaw;
+
+  protected:
+    static void MakeRaw(const PBYTEArray &frame, PBYTEArray &raw);
+};
+
+BenchInputs::BenchInputs(unsigned long seed)
+{
+  Random rnd(seed);
+
+  // T.4 page: 1100 lines, 10% of lines with text like runs,
+  // fill up to 20 ms scan time at 9600 bit/s
+
+  {
+    T4Writer t4(t4Page);
+
+    static const struct { unsigned code; int len; } whites[] = {
+      { 0x13, 5 },  // 8
+      { 0x14, 5 },  // 9
+      { 0x07, 5 },  // 10
+      { 0x08, 5 },  // 11
+    };
+    static const struct { unsigned code; int len; } blacks[] = {
+      { 0x03, 2 },  // 2
+      { 0x02, 2 },  // 3
+      { 0x03, 3 },  // 4
+      { 0x02, 4 },  // 6
+    };
+
+    for (int i = 0 ; i < 1100 ; i++) {
+      t4.PutEol(9600*20/1000);
+
+      if (rnd.Next(100) < 10) {
+        int pixels = 0;
+
+        while (pixels < 1728 - 20) {
+          int w = int(rnd.Next(4));
+          int b = int(rnd.Next(4));
+
+          t4.Put(whites[w].code, whites[w].len);
+          t4.Put(blacks[b].code, blacks[b].len);
+          pixels += (w + 8) + (b < 3 ? b + 2 : 6);
+        }
+
+        // white rest
+        static const BYTE termWhite[21][2] = {
+          { 0x35, 8 }, { 0x07, 6 }, { 0x07, 4 }, { 0x08, 4 }, { 0x0B, 4 },
+          { 0x0C, 4 }, { 0x0E, 4 }, { 0x0F, 4 }, { 0x13, 5 }, { 0x14, 5 },
+          { 0x07, 5 }, { 0x08, 5 }, { 0x08, 6 }, { 0x03, 6 }, { 0x34, 6 },
+          { 0x35, 6 }, { 0x2A, 6 }, { 0x2B, 6 }, { 0x27, 7 }, { 0x0C, 7 },
+          { 0x08, 7 },
+        };
+
+        int rest = 1728 - pixels;
+
+        t4.Put(termWhite[rest][0], termWhite[rest][1]);
+      } else {
+        t4.Put(0x9B, 9);        // white 1728
+        t4.Put(0x35, 8);        // white 0
+      }
+    }
+
+    for (int i = 0 ; i < 6 ; i++)
+      t4.PutEol(0);             // RTC
+
+    t4.Flush();
+  }
+
+  // DTE stream
+
+  {
+    PINDEX len = 0;
+
+    for (PINDEX i = 0 ; i < t4Page.GetSize() ; i++) {
+      if (t4Page[i] == DLE)
+        dteStream[len++] = DLE;
+
+      dteStream[len++] = t4Page[i];
+    }
+
+    dteStream[len++] = DLE;
+    dteStream[len++] = ETX;
+  }
+
+  // HDLC frames (bit order as in t30.cxx)
+
+  static const BYTE dis[] = { 0xFF, 0xC8, 0x01, 0x00, 0x74, 0x01, 0x20 };
+
+  v21Frame = PBYTEArray(dis, sizeof(dis));
+
+  ecmFrame.SetSize(4 + 256);
+  ecmFrame[0] = 0xFF;
+  ecmFrame[1] = 0xC0;
+  ecmFrame[2] = 0x60;
+  ecmFrame[3] = 0x00;
+  memcpy(ecmFrame.GetPointer() + 4, (const BYTE *)t4Page + 1024, 256);
+
+  MakeRaw(v21Frame, v21Raw);
+  MakeRaw(ecmFrame, ecmRaw);
+
+  // voice: three formants with slow amplitude modulation and noise
+
+  voice.SetSize(8000);
+
+  for (PINDEX i = 0 ; i < voice.GetSize() ; i++) {
+    double t = i/8000.0;
+    double env = 0.5 + 0.5*sin(TWO_PI*3*t);
+    double s = 0.6*sin(TWO_PI*500*t) + 0.3*sin(TWO_PI*1500*t) + 0.1*sin(TWO_PI*2500*t);
+
+    voice[i] = PInt16(env*s*12000 + (int(rnd.Next(2001)) - 1000));
+  }
+
+  alaw.SetSize(voice.GetSize());
+  ulaw.SetSize(voice.GetSize());
+
+  for (PINDEX i = 0 ; i < voice.GetSize() ; i++) {
+    alaw[i] = BYTE(linear2alaw(voice[i]));
+    ulaw[i] = BYTE(linear2ulaw(voice[i]));
+  }
+}
+
+void BenchInputs::MakeRaw(const PBYTEArray &frame, PBYTEArray &raw)
+{
+  DataStream in;
+  HDLC hdlc;
+  BYTE buf[256];
+  PINDEX len = 0;
+  int count;
+
+  in.PutData(frame, frame.GetSize());
+  in.PutEof();
+
+  hdlc.PutHdlcData(&in);
+  hdlc.GetRawStart(2);
+
+  while ((count = hdlc.GetData(buf, sizeof(buf))) >= 0) {
+    memcpy(raw.GetPointer(len + count) + len, buf, count);
+    len += count;
+  }
+
+  raw.SetSize(len);
+}
+///////////////////////////////////////////////////////////////
+class BenchState
+{
+  public:
+    BenchState(const BenchInputs &_in, PInt64 _iterations)
+      : in(_in), iterations(_iterations), bytes(0) {}
+
+    const BenchInputs &in;
+    const PInt64 iterations;
+    PInt64 bytes;               ///<  Processed bytes (for bytes_per_second)
+};
+
+typedef void (*BenchFunction)(BenchState &state, int arg);
+
+struct BenchEntry {
+  const char *name;
+  BenchFunction function;
+  int arg;
+};
+///////////////////////////////////////////////////////////////
+static const PBYTEArray &FrameArg(const BenchInputs &in, int arg)
+{
+  switch (arg) {
+    case 0:  return in.v21Frame;
+    case 1:  return in.ecmFrame;
+    default: return in.t4Page;
+  }
+}
+
+static void BenchFcs(BenchState &state, int arg)
+{
+  const PBYTEArray &data = FrameArg(state.in, arg);
+
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    FCS fcs;
+
+    fcs.build(data, data.GetSize());
+    benchSink += WORD(fcs);
+  }
+
+  state.bytes = state.iterations*data.GetSize();
+}
+
+static void BenchHdlcEncode(BenchState &state, int arg)
+{
+  const PBYTEArray &frame = FrameArg(state.in, arg);
+  BYTE buf[256];
+
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    DataStream in;
+    HDLC hdlc;
+    int count;
+
+    in.PutData(frame, frame.GetSize());
+    in.PutEof();
+
+    hdlc.PutHdlcData(&in);
+    hdlc.GetRawStart(2);
+
+    while ((count = hdlc.GetData(buf, sizeof(buf))) >= 0)
+      benchSink += count;
+  }
+
+  state.bytes = state.iterations*frame.GetSize();
+}
+
+static void BenchHdlcDecode(BenchState &state, int arg)
+{
+  const PBYTEArray &raw = arg ? state.in.ecmRaw : state.in.v21Raw;
+  BYTE buf[256];
+
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    DataStream in;
+    HDLC hdlc;
+    int count;
+
+    in.PutData(raw, raw.GetSize());
+    in.PutEof();
+
+    hdlc.PutRawData(&in);
+    hdlc.GetHdlcStart(TRUE);
+
+    while ((count = hdlc.GetData(buf, sizeof(buf))) >= 0)
+      benchSink += count;
+
+    benchSink += hdlc.isFcsOK();
+  }
+
+  state.bytes = state.iterations*raw.GetSize();
+}
+
+static void BenchDlePut(BenchState &state, int arg)
+{
+  const PBYTEArray &stream = state.in.dteStream;
+  BYTE buf[1024];
+
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    DLEData dle;
+    int count;
+
+    dle.BitRev(arg != 0);
+
+    // the data come from the pty by 1K chunks
+    for (PINDEX done = 0 ; done < stream.GetSize() ; done += 1024)
+      dle.PutDleData((const BYTE *)stream + done, PMIN(stream.GetSize() - done, 1024));
+
+    while ((count = dle.GetData(buf, sizeof(buf))) > 0)
+      benchSink += count;
+  }
+
+  state.bytes = state.iterations*stream.GetSize();
+}
+
+static void BenchDleGet(BenchState &state, int arg)
+{
+  const PBYTEArray &page = state.in.t4Page;
+  BYTE buf[1024];
+
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    DLEData dle;
+    int count;
+
+    dle.BitRev(arg != 0);
+    dle.PutData(page, page.GetSize());
+    dle.PutEof();
+
+    while ((count = dle.GetDleData(buf, sizeof(buf))) >= 0)
+      benchSink += count;
+  }
+
+  state.bytes = state.iterations*page.GetSize();
+}
+
+static void BenchG711Encode(BenchState &state, int arg)
+{
+  const PShortArray &voice = state.in.voice;
+
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    unsigned long sum = 0;
+
+    if (arg) {
+      for (PINDEX j = 0 ; j < voice.GetSize() ; j++)
+        sum += linear2ulaw(voice[j]);
+    } else {
+      for (PINDEX j = 0 ; j < voice.GetSize() ; j++)
+        sum += linear2alaw(voice[j]);
+    }
+
+    benchSink += sum;
+  }
+
+  state.bytes = state.iterations*voice.GetSize()*sizeof(PInt16);
+}
+
+static void BenchG711Decode(BenchState &state, int arg)
+{
+  const PBYTEArray &data = arg ? state.in.ulaw : state.in.alaw;
+
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    unsigned long sum = 0;
+
+    if (arg) {
+      for (PINDEX j = 0 ; j < data.GetSize() ; j++)
+        sum += ulaw2linear(data[j]);
+    } else {
+      for (PINDEX j = 0 ; j < data.GetSize() ; j++)
+        sum += alaw2linear(data[j]);
+    }
+
+    benchSink += sum;
+  }
+
+  state.bytes = state.iterations*data.GetSize();
+}
+
+static void BenchDataStream(BenchState &state, int chunk)
+{
+  const PBYTEArray &page = state.in.t4Page;
+  BYTE buf[4096];
+
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    DataStream stream;
+    int count;
+
+    for (PINDEX done = 0 ; done < page.GetSize() ; done += chunk)
+      stream.PutData((const BYTE *)page + done, PMIN(page.GetSize() - done, chunk));
+
+    stream.PutEof();
+
+    while ((count = stream.GetData(buf, chunk)) >= 0)
+      benchSink += count;
+  }
+
+  state.bytes = state.iterations*page.GetSize();
+}
+
+static void BenchToneGenerator(BenchState &state, int type)
+{
+  ToneGenerator tone((ToneGenerator::ToneType)type);
+  PInt16 buf[160];
+
+  // 1 sec by 20 ms
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    for (int j = 0 ; j < 50 ; j++) {
+      tone.Read(buf, sizeof(buf));
+      benchSink += buf[0];
+    }
+  }
+
+  state.bytes = state.iterations*50*sizeof(buf);
+}
+
+/**T.30 frames of an ECM session with one PPR (bit order as in t30.cxx).
+  */
+static const BYTE t30Dis[] = { 0xFF, 0xC8, 0x01, 0x00, 0x74, 0x01, 0x20 };
+static const BYTE t30Dcs[] = { 0xFF, 0xC8, 0xC1, 0x00, 0x74, 0x01, 0x20 };
+static const BYTE t30Cfr[] = { 0xFF, 0xC8, 0x21 };
+static const BYTE t30Pps[] = { 0xFF, 0xC8, 0xFD, 0x74, 0x00, 0x00, 0xFF };
+static const BYTE t30Ppr[] = { 0xFF, 0xC8, 0x3D,
+  0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+static const BYTE t30Mcf[] = { 0xFF, 0xC8, 0x31 };
+static const BYTE t30Dcn[] = { 0xFF, 0xC8, 0xDF };
+
+static const struct {
+  const BYTE *data;
+  PINDEX len;
+} t30Session[] = {
+  { t30Dis, sizeof(t30Dis) },
+  { t30Dcs, sizeof(t30Dcs) },
+  { t30Cfr, sizeof(t30Cfr) },
+  { t30Pps, sizeof(t30Pps) },
+  { t30Ppr, sizeof(t30Ppr) },
+  { t30Pps, sizeof(t30Pps) },
+  { t30Mcf, sizeof(t30Mcf) },
+  { t30Dcn, sizeof(t30Dcn) },
+};
+
+/**The T.30 monitor as it was before the fixed frame buffer: the frame is
+   concatenated by copies and only DCS and CFR are decoded.
+  */
+class T30Concatenate
+{
+  public:
+    T30Concatenate() : cfr(FALSE), ecm(FALSE) {}
+
+    void v21Begin() { v21frame = PBYTEArray(); }
+    void v21Data(const void *pBuf, PINDEX len) { v21frame.Concatenate(PBYTEArray((const BYTE *)pBuf, len)); }
+
+    void v21End(PBoolean /*sent*/) {
+      PString msg;
+
+      if (v21frame.GetSize() < 3)
+        msg = "too short";
+      else
+      if (v21frame[0] != 0xFF)
+        msg = "w/o address field";
+      else
+      if ((v21frame[1] & 0xF7) != 0xC0)
+        msg = "w/o control field";
+      else {
+        switch (v21frame[2]) {
+          case 0x41:
+          case 0x41 | 0x80:
+            msg = "DCS";
+            ecm = (v21frame.GetSize() > 3+3 && (v21frame[3+2] & 1) && (v21frame[3+3] & 0x20));
+            cfr = FALSE;
+            break;
+          case 0x21:
+          case 0x21 | 0x80:
+            msg = "CFR";
+            cfr = TRUE;
+            break;
+        }
+      }
+
+      benchSink += msg.GetLength();
+    }
+
+    PBoolean hdlcOnly() const { return cfr && ecm; }
+
+  protected:
+    PBYTEArray v21frame;
+    PBoolean cfr;
+    PBoolean ecm;
+};
+
+// the frames come from the IFP packets by chunk bytes
+template <class Monitor>
+static void BenchT30Session(BenchState &state, Monitor &monitor, PINDEX chunk)
+{
+  PINDEX bytes = 0;
+
+  for (PINDEX f = 0 ; f < (PINDEX)PARRAYSIZE(t30Session) ; f++)
+    bytes += t30Session[f].len;
+
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    for (PINDEX f = 0 ; f < (PINDEX)PARRAYSIZE(t30Session) ; f++) {
+      const BYTE *pData = t30Session[f].data;
+      PINDEX len = t30Session[f].len;
+
+      monitor.v21Begin();
+
+      for (PINDEX done = 0 ; done < len ; done += chunk)
+        monitor.v21Data(pData + done, PMIN(len - done, chunk));
+
+      monitor.v21End((f & 1) != 0);
+      benchSink += monitor.hdlcOnly();
+    }
+  }
+
+  state.bytes = state.iterations*bytes;
+}
+
+static void BenchT30Parse(BenchState &state, int chunk)
+{
+  T30 t30;
+
+  BenchT30Session(state, t30, chunk);
+}
+
+static void BenchT30Concatenate(BenchState &state, int chunk)
+{
+  T30Concatenate t30;
+
+  BenchT30Session(state, t30, chunk);
+}
+
+enum {
+  metricsAdd,
+  metricsSet,
+  metricsLatency,
+  metricsPacing,
+};
+
+// the cost of one update of the metrics added to the hot paths
+static void BenchMetrics(BenchState &state, int op)
+{
+  ModemMetrics &metrics = ModemMetrics::Get("bench");
+  ModemMetrics::SendPacing pacing(metrics, ModemMetrics::spT38);
+  PTime scheduled = ModemClock::Get().Now();
+
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    switch (op) {
+      case metricsAdd:
+        metrics.Add(ModemMetrics::cPtyBytesIn, i & 0xFF);
+        break;
+      case metricsSet:
+        metrics.Set(ModemMetrics::gBufOut, i & 0xFF);
+        break;
+      case metricsPacing:
+        pacing.Sent(scheduled);
+        break;
+      default:
+        {
+          ModemMetrics::Latency latency(metrics);
+          benchSink++;
+        }
+    }
+  }
+
+  benchSink += (unsigned)metrics.GetCounter(ModemMetrics::cPtyBytesIn);
+}
+
+enum {
+  traceDisabled,
+  traceIfp,
+  traceState,
+};
+
+// the cost of one BinTrace::Add() added to the hot paths (the rings are
+// enabled by the first enabled benchmark, so the disabled one goes first)
+static void BenchTrace(BenchState &state, int op)
+{
+  static const BYTE ifp[] = {
+    0xC0, 0x01, 0x80, 0x00, 0x0E, 0xFF, 0xC8, 0x01, 0x00, 0x46, 0x1F, 0x00, 0x2C, 0x31, 0x41, 0x59
+  };
+  static const char header[] = "ModemEngineBody::SetState:";
+
+  if (op != traceDisabled)
+    BinTrace::Enable("/dev/null");
+
+  WORD modem = BinTrace::ModemId("bench");
+
+  for (PInt64 i = 0 ; i < state.iterations ; i++) {
+    if (op == traceState)
+      BinTrace::Add(modem, BinTrace::evModemState, BinTrace::StateArg(TRUE, 3, 0, int(i & 0x0F), 0), header, sizeof(header) - 1);
+    else
+      BinTrace::Add(modem, BinTrace::evIfpOut, DWORD(i & BinTrace::argSeqMask), ifp, sizeof(ifp));
+  }
+}
+///////////////////////////////////////////////////////////////
+static const BenchEntry benchmarks[] = {
+  { "FCS/build/v21_frame",            BenchFcs,             0 },
+  { "FCS/build/ecm_frame",            BenchFcs,             1 },
+  { "FCS/build/t4_page",              BenchFcs,             2 },
+  { "HDLC/hdlc_to_raw/v21_frame",     BenchHdlcEncode,      0 },
+  { "HDLC/hdlc_to_raw/ecm_frame",     BenchHdlcEncode,      1 },
+  { "HDLC/raw_to_hdlc/v21_frame",     BenchHdlcDecode,      0 },
+  { "HDLC/raw_to_hdlc/ecm_frame",     BenchHdlcDecode,      1 },
+  { "DLE/PutDleData/t4_page",         BenchDlePut,          0 },
+  { "DLE/PutDleData/t4_page/bitrev",  BenchDlePut,          1 },
+  { "DLE/GetDleData/t4_page",         BenchDleGet,          0 },
+  { "DLE/GetDleData/t4_page/bitrev",  BenchDleGet,          1 },
+  { "G711/alaw_encode/voice",         BenchG711Encode,      0 },
+  { "G711/ulaw_encode/voice",         BenchG711Encode,      1 },
+  { "G711/alaw_decode/voice",         BenchG711Decode,      0 },
+  { "G711/ulaw_decode/voice",         BenchG711Decode,      1 },
+  { "DataStream/put_get/1",           BenchDataStream,      1 },
+  { "DataStream/put_get/16",          BenchDataStream,      16 },
+  { "DataStream/put_get/256",         BenchDataStream,      256 },
+  { "DataStream/put_get/1024",        BenchDataStream,      1024 },
+  { "DataStream/put_get/4096",        BenchDataStream,      4096 },
+  { "ToneGenerator/Read/cng",         BenchToneGenerator,   ToneGenerator::ttCng },
+  { "ToneGenerator/Read/ced",         BenchToneGenerator,   ToneGenerator::ttCed },
+  { "ToneGenerator/Read/ring",        BenchToneGenerator,   ToneGenerator::ttRing },
+  { "ToneGenerator/Read/busy",        BenchToneGenerator,   ToneGenerator::ttBusy },
+  { "T30/parse/session/2",            BenchT30Parse,        2 },
+  { "T30/parse/session/32",           BenchT30Parse,        32 },
+  { "T30/concatenate/session/2",      BenchT30Concatenate,  2 },
+  { "T30/concatenate/session/32",     BenchT30Concatenate,  32 },
+  { "Metrics/Add",                    BenchMetrics,         metricsAdd },
+  { "Metrics/Set",                    BenchMetrics,         metricsSet },
+  { "Metrics/Latency",                BenchMetrics,         metricsLatency },
+  { "Metrics/Pacing",                 BenchMetrics,         metricsPacing },
+  { "Trace/Add/disabled",             BenchTrace,           traceDisabled },
+  { "Trace/Add/ifp",                  BenchTrace,           traceIfp },
+  { "Trace/Add/state",                BenchTrace,           traceState },
+};
+///////////////////////////////////////////////////////////////
+class T38Bench : public PProcess
+{
+  PCLASSINFO(T38Bench, PProcess)
+
+  public:
+    T38Bench();
+
+    void Main();
+};
+
+PCREATE_PROCESS(T38Bench);
+///////////////////////////////////////////////////////////////
+T38Bench::T38Bench()
+  : PProcess("Vyacheslav Frolov", "T38Bench",
+             MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER)
+{
+}
+
+void T38Bench::Main()
+{
+  PArgList &args = GetArguments();
+
+  args.Parse(
+             "f-filter:"
+             "m-min-time:"
+             "s-seed:"
+             "o-output:"
+             "l-list."
+             "h-help."
+          , FALSE);
+
+  if (args.HasOption('h')) {
+    cout <<
+        "Usage:\n"
+        "  " << GetName() << " [options]\n"
+        "\n"
+        "Options:\n"
+        "  -f --filter str           : Run only benchmarks with str in the name.\n"
+        "  -m --min-time secs        : Min run time of each benchmark (default 0.5).\n"
+        "  -s --seed num             : Seed of the inputs (default 1).\n"
+        "  -o --output file          : Write JSON to file, default is stdout.\n"
+        "  -l --list                 : List benchmarks.\n"
+        "  -h --help                 : Display this help message.\n"
+        << endl;
+    return;
+  }
+
+  const PINDEX numBenchmarks = PARRAYSIZE(benchmarks);
+
+  if (args.HasOption('l')) {
+    for (PINDEX i = 0 ; i < numBenchmarks ; i++)
+      cout << benchmarks[i].name << endl;
+    return;
+  }
+
+  PString filter = args.GetOptionString('f');
+  double minTime = args.HasOption('m') ? args.GetOptionString('m').AsReal() : 0.5;
+  unsigned long seed = args.HasOption('s') ? (unsigned long)args.GetOptionString('s').AsUnsigned() : 1;
+
+  PTextFile file;
+
+  if (args.HasOption('o') && !file.Open(args.GetOptionString('o'), PFile::WriteOnly)) {
+    cerr << "Can't open " << args.GetOptionString('o') << endl;
+    return;
+  }
+
+  ostream &out = file.IsOpen() ? (ostream &)file : cout;
+
+  BenchInputs inputs(seed);
+
+  out << "{\n"
+         "  \"context\": {\n"
+         "    \"executable\": \"" << GetName() << "\",\n"
+         "    \"version\": \"" << GetVersion(TRUE) << "\",\n"
+         "    \"date\": \"" << PTime().AsString(PTime::ShortISO8601) << "\",\n"
+         "    \"min_time\": " << minTime << ",\n"
+         "    \"seed\": " << seed << "\n"
+         "  },\n"
+         "  \"benchmarks\": [";
+
+  PBoolean first = TRUE;
+
+  for (PINDEX i = 0 ; i < numBenchmarks ; i++) {
+    const BenchEntry &entry = benchmarks[i];
+
+    if (!filter.IsEmpty() && PString(entry.name).Find(filter) == P_MAX_INDEX)
+      continue;
+
+    PInt64 iterations = 1;
+    double real, cpu;
+    PInt64 bytes;
+
+    for (;;) {
+      BenchState state(inputs, iterations);
+
+      double real0 = ClockSeconds(CLOCK_MONOTONIC);
+      double cpu0 = ClockSeconds(CLOCK_PROCESS_CPUTIME_ID);
+
+      entry.function(state, entry.arg);
+
+      real = ClockSeconds(CLOCK_MONOTONIC) - real0;
+      cpu = ClockSeconds(CLOCK_PROCESS_CPUTIME_ID) - cpu0;
+      bytes = state.bytes;
+
+      if (real >= minTime || iterations >= (PInt64(1) << 40))
+        break;
+
+      // predict the number of iterations for minTime (like Google Benchmark)
+      double multiplier = real > 0 ? minTime*1.4/real : 10;
+
+      if (multiplier > 10)
+        multiplier = 10;
+
+      PInt64 next = PInt64(iterations*multiplier);
+
+      iterations = next > iterations ? next : iterations + 1;
+    }
+
+    out << (first ? "\n" : ",\n")
+        << "    {\n"
+           "      \"name\": \"" << entry.name << "\",\n"
+           "      \"iterations\": " << iterations << ",\n"
+           "      \"real_time\": " << real*1e9/iterations << ",\n"
+           "      \"cpu_time\": " << cpu*1e9/iterations << ",\n"
+           "      \"time_unit\": \"ns\",\n"
+           "      \"bytes_per_second\": " << (real > 0 ? bytes/real : 0.0) << "\n"
+           "    }";
+
+    out.flush();
+    first = FALSE;
+  }
+
+  out << "\n  ]\n}" << endl;
+}
+///////////////////////////////////////////////////////////////
+
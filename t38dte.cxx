@@ -0,0 +1,774 @@
+/*
+ * t38dte.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: t38dte.cxx,v $
+ *
+ */
+
+/*
+ * Class 1 fax application simulator.
+ *
+ * Opens the tty devices of a running t38modem (the ones given to its
+ * --ptty option) and runs scripted Class 1 sessions through them: the
+ * caller dials, sends TSI/DCS, TCF and non-ECM pages streamed with the
+ * line rate (AT+FTM), the answerer answers, sends DIS, CFR and MCF and
+ * receives the pages (AT+FRM). The command latency, the effective data
+ * rate, the transmit underruns, the receive stalls and the number of
+ * the system calls are measured per modem. Each modem is driven by its
+ * own thread with blocking I/O, so several hundred modems per host are
+ * fine (mind the limit of open files).
+ */
+
+#include <ptlib.h>
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "version.h"
+#include "pmutils.h"
+#include "dtescript.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+static PInt64 NowUs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return PInt64(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+///////////////////////////////////////////////////////////////
+class DteConfig
+{
+  public:
+    DteConfig()
+      : sessions(1), pages(2), pageLines(1100), density(5), mod(146),
+        prefill(500), chunk(20), stall(300), role(0) {}
+
+    int sessions;               ///<  Sessions per caller
+    int pages;                  ///<  Pages per session
+    int pageLines;
+    int density;                ///<  Percents of non-blank lines
+    int mod;                    ///<  For AT+FTM/AT+FRM of the pages
+    int prefill;                ///<  Page data written ahead of the line rate in ms
+    int chunk;                  ///<  Period of the paced writes in ms
+    int stall;                  ///<  Min receive gap counted as stall in ms
+    int role;                   ///<  0 - pairs, 1 - callers only, 2 - answerers only
+    PString dial;               ///<  Number template (%d - pair index)
+    PString ptsDir;
+    PBYTEArray page;
+};
+///////////////////////////////////////////////////////////////
+/**Counters of one modem.
+  */
+class DteStats
+{
+  public:
+    DteStats()
+      : sessions(0), failures(0), pages(0),
+        reads(0), writes(0), polls(0),
+        txStreams(0), txBytes(0), txUs(0), underruns(0),
+        rxStreams(0), rxBytes(0), rxUs(0), stalls(0),
+        rateMin(0), rateMax(0),
+        cmdLatency(100) {}
+
+    void AddRate(double rate) {
+      if (txStreams + rxStreams == 1 || rateMin > rate)
+        rateMin = rate;
+
+      if (txStreams + rxStreams == 1 || rateMax < rate)
+        rateMax = rate;
+    }
+
+    long sessions;
+    long failures;
+    long pages;
+
+    long reads;
+    long writes;
+    long polls;
+
+    long txStreams;
+    PInt64 txBytes;
+    PInt64 txUs;                ///<  From CONNECT to OK of AT+FTM
+    long underruns;             ///<  Page data written later than the line rate needs
+
+    long rxStreams;
+    PInt64 rxBytes;
+    PInt64 rxUs;                ///<  From the first byte to <DLE><ETX> of AT+FRM
+    long stalls;                ///<  Receive gaps longer than DteConfig::stall
+
+    double rateMin;             ///<  Min effective/nominal rate of a stream
+    double rateMax;             ///<  Max effective/nominal rate of a stream
+
+    Histogram cmdLatency;       ///<  Local commands (w/o waiting for remote) in us
+};
+///////////////////////////////////////////////////////////////
+/**Scripted Class 1 DTE on a tty of t38modem.
+  */
+class DteThread : public ModemThread, protected DteScript
+{
+    PCLASSINFO(DteThread, ModemThread);
+  public:
+    DteThread(
+      const PString &_tty,
+      int _index,
+      PBoolean _caller,
+      const PString &_number,
+      const DteConfig &_config
+    );
+    ~DteThread();
+
+    void SetPartner(DteThread *_partner) { partner = _partner; }
+    PBoolean IsDone() const { return done; }
+
+    const PString &Name() const { return tty; }
+    const DteStats &Stats() const { return stats; }
+    PBoolean IsCaller() const { return caller; }
+
+  protected:
+    virtual void Main();
+
+    PBoolean Open();
+    void Close();
+
+    PBoolean Poll(short events, int timeout);
+    PBoolean WritePaced(const PBYTEArray &data);
+
+    virtual const BYTE *Read(PINDEX &len, int timeout);
+    virtual PBoolean Write(const void *pBuf, PINDEX count);
+    virtual PBoolean NoMoreCalls();
+    virtual PBoolean SendPage(const PBYTEArray &page);
+    virtual void OnLocalCommand(PInt64 us);
+    virtual void OnRecvPage(PINDEX len, PInt64 us, int stalls);
+    virtual void OnPage(PBoolean sender, PInt64 us);
+
+    const PString tty;
+    const int index;
+    const PBoolean caller;
+    const PString number;
+    const DteConfig &config;
+
+    DteThread *partner;
+    volatile PBoolean done;
+    int fd;
+
+    BYTE inBuf[1024];
+
+    DteStats stats;
+};
+///////////////////////////////////////////////////////////////
+DteThread::DteThread(
+    const PString &_tty,
+    int _index,
+    PBoolean _caller,
+    const PString &_number,
+    const DteConfig &_config)
+  : DteScript(_tty, _config.mod, FALSE, _config.stall),
+    tty(_tty),
+    index(_index),
+    caller(_caller),
+    number(_number),
+    config(_config),
+    partner(NULL),
+    done(FALSE),
+    fd(-1)
+{
+}
+
+DteThread::~DteThread()
+{
+  Close();
+}
+
+PBoolean DteThread::Open()
+{
+  PString path;
+
+  if (tty[0] == '+') {
+    path = config.ptsDir;
+
+    if (!path.IsEmpty() && path.Right(1) != "/")
+      path += "/";
+
+    path += tty.Mid(1);
+  }
+  else
+  if (tty[0] != '/')
+    path = "/dev/" + tty;
+  else
+    path = tty;
+
+  if ((fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK)) < 0) {
+    int err = errno;
+    cerr << "Could not open " << path << ": " << strerror(err) << endl;
+    return FALSE;
+  }
+
+  struct termios Termios;
+
+  if (::tcgetattr(fd, &Termios) != 0) {
+    int err = errno;
+    myPTRACE(1, tty << " DTE tcgetattr ERROR: " << strerror(err));
+    Close();
+    return FALSE;
+  }
+
+  cfmakeraw(&Termios);
+  Termios.c_cc[VMIN] = 1;
+  Termios.c_cc[VTIME] = 0;
+
+  if (::tcsetattr(fd, TCSANOW, &Termios) != 0) {
+    int err = errno;
+    myPTRACE(1, tty << " DTE tcsetattr ERROR: " << strerror(err));
+    Close();
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+void DteThread::Close()
+{
+  if (fd < 0)
+    return;
+
+  ::close(fd);
+  fd = -1;
+}
+
+/**Wait for the events not longer than timeout ms (and not longer than
+   0.2 sec to check the stop request).
+  */
+PBoolean DteThread::Poll(short events, int timeout)
+{
+  pollfd pollfd;
+
+  pollfd.fd = fd;
+  pollfd.events = events;
+  pollfd.revents = 0;
+
+  stats.polls++;
+
+  return ::poll(&pollfd, 1, PMIN(timeout, 200)) > 0;
+}
+
+const BYTE *DteThread::Read(PINDEX &len, int timeout)
+{
+  PInt64 end = NowUs() + PInt64(timeout)*1000;
+
+  for (;;) {
+    if (stop)
+      return NULL;
+
+    stats.reads++;
+
+    int res = ::read(fd, inBuf, sizeof(inBuf));
+
+    if (res > 0) {
+      len = res;
+      return inBuf;
+    }
+
+    if (res < 0 && errno != EAGAIN && errno != EINTR) {
+      int err = errno;
+      myPTRACE(1, tty << " DTE read ERROR: " << strerror(err));
+      return NULL;
+    }
+
+    PInt64 left = end - NowUs();
+
+    if (left <= 0)
+      return NULL;
+
+    Poll(POLLIN, int(left/1000) + 1);
+  }
+}
+
+PBoolean DteThread::Write(const void *pBuf, PINDEX count)
+{
+  const BYTE *p = (const BYTE *)pBuf;
+
+  while (count > 0) {
+    if (stop)
+      return FALSE;
+
+    stats.writes++;
+
+    int len = ::write(fd, p, count);
+
+    if (len > 0) {
+      p += len;
+      count -= len;
+      continue;
+    }
+
+    if (len < 0 && errno != EAGAIN && errno != EINTR) {
+      int err = errno;
+      myPTRACE(1, tty << " DTE write ERROR: " << strerror(err));
+      return FALSE;
+    }
+
+    Poll(POLLOUT, 200);
+  }
+
+  return TRUE;
+}
+
+/**Write the data with DLE stuffing paced to the line rate (prefill ms
+   ahead) and <DLE><ETX> at the end. Counts the underruns (the data written
+   later than the modem needs it).
+  */
+PBoolean DteThread::WritePaced(const PBYTEArray &data)
+{
+  PInt64 start = NowUs();
+  PINDEX size = data.GetSize();
+  PINDEX written = 0;
+  PBoolean late = FALSE;
+
+  while (written < size) {
+    PInt64 elapsed = NowUs() - start;
+    PINDEX need = PINDEX((elapsed/1000 + config.prefill + config.chunk)*br/8000);
+
+    if (need > size)
+      need = size;
+
+    // the modem has sent all the data written before
+    if (written > 0 && PInt64(written)*8000000/br < elapsed) {
+      if (!late) {
+        stats.underruns++;
+        late = TRUE;
+      }
+    } else {
+      late = FALSE;
+    }
+
+    if (need > written) {
+      if (!WriteDle((const BYTE *)data + written, need - written, FALSE))
+        return FALSE;
+
+      written = need;
+    }
+
+    if (written < size)
+      PThread::Sleep(config.chunk);
+  }
+
+  return WriteDle(NULL, 0);
+}
+
+PBoolean DteThread::NoMoreCalls()
+{
+  return stop || (partner && partner->IsDone());
+}
+
+PBoolean DteThread::SendPage(const PBYTEArray &page)
+{
+  PInt64 begin = NowUs();
+
+  if (!WritePaced(page) || Result() != "OK")
+    return FALSE;
+
+  PInt64 us = NowUs() - begin;
+
+  stats.txStreams++;
+  stats.txBytes += page.GetSize();
+  stats.txUs += us;
+
+  if (us > 0)
+    stats.AddRate(page.GetSize()*8000000.0/us/br);
+
+  return TRUE;
+}
+
+void DteThread::OnLocalCommand(PInt64 us)
+{
+  stats.cmdLatency.Add(us);
+}
+
+void DteThread::OnRecvPage(PINDEX len, PInt64 us, int stalls)
+{
+  stats.rxStreams++;
+  stats.rxBytes += len;
+  stats.rxUs += us;
+  stats.stalls += stalls;
+
+  if (us > 0)
+    stats.AddRate(len*8000000.0/us/br);
+}
+
+void DteThread::OnPage(PBoolean /*sender*/, PInt64 /*us*/)
+{
+  stats.pages++;
+}
+
+void DteThread::Main()
+{
+  RenameCurrentThread(tty + "(d)");
+  myPTRACE(1, "DTE Started");
+
+  if (Open() && ExpectLocal("E0", "OK") && ExpectLocal("+FCLASS=1", "OK")) {
+    if (caller) {
+      for (int i = 0 ; i < config.sessions && !stop ; i++) {
+        if (Sender(number, config.page, config.pages)) {
+          stats.sessions++;
+          continue;
+        }
+
+        stats.failures++;
+        myPTRACE(1, "DTE session " << i << " failed");
+        HangUp();
+        PThread::Sleep(1000);
+      }
+    } else {
+      for (int i = 0 ; partner || i < config.sessions ; i++) {
+        int res = Receiver();
+
+        if (res < 0)
+          break;
+
+        if (res > 0) {
+          stats.sessions++;
+          continue;
+        }
+
+        stats.failures++;
+        myPTRACE(1, "DTE receiver error");
+        HangUp();
+      }
+    }
+  }
+
+  done = TRUE;
+  Close();
+
+  myPTRACE(1, "DTE Stopped" << GetThreadTimes(", CPU usage: "));
+}
+///////////////////////////////////////////////////////////////
+class T38Dte : public PProcess
+{
+  PCLASSINFO(T38Dte, PProcess)
+
+  public:
+    T38Dte();
+
+    void Main();
+
+  protected:
+    void Report(DteThread **dtes, int numDtes, int br, double elapsed, PBoolean verbose);
+};
+
+PCREATE_PROCESS(T38Dte);
+///////////////////////////////////////////////////////////////
+T38Dte::T38Dte()
+  : PProcess("Vyacheslav Frolov", "T38Dte",
+             MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER)
+{
+}
+
+void T38Dte::Main()
+{
+  PArgList &args = GetArguments();
+
+  args.Parse(
+             "p-ptty:"
+             "-pts-dir:"
+             "d-dial:"
+             "r-role:"
+             "s-sessions:"
+             "n-pages:"
+             "-page-lines:"
+             "-density:"
+             "m-mod:"
+             "-prefill:"
+             "-chunk:"
+             "-stall:"
+             "v-verbose."
+             "h-help."
+#if PTRACING
+             "t-trace."
+             "o-output:"
+#endif
+          , FALSE);
+
+#if PTRACING
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::DateAndTime | PTrace::Thread | PTrace::Blocks);
+#endif
+
+  if (args.HasOption('h') || !args.HasOption('p')) {
+    cout <<
+        "Usage:\n"
+        "  " << GetName() << " [options] -p [num@]tty[,...]\n"
+        "\n"
+        "Options:\n"
+        "  -p --ptty [num@]tty[,...] : The ttys of t38modem (the same format as for\n"
+        "                              t38modem). Can be used multiple times.\n"
+        "     --pts-dir dir          : Base directory for the ttys with '+'.\n"
+        "  -r --role role            : pairs - the even ttys call the odd ones\n"
+        "                              (default), call - all ttys call,\n"
+        "                              answer - all ttys answer.\n"
+        "  -d --dial num             : Number to dial (%d will be replaced by the\n"
+        "                              pair index). Default is num@ of the answering\n"
+        "                              tty for pairs.\n"
+        "  -s --sessions num         : Sessions per caller (default 1).\n"
+        "  -n --pages num            : Pages per session (default 2).\n"
+        "     --page-lines num       : Scan lines per page (default 1100).\n"
+        "     --density num          : Percents of non-blank lines (default 5).\n"
+        "  -m --mod num              : AT+FTM/AT+FRM modulation (default 146).\n"
+        "     --prefill ms           : Page data written ahead (default 500).\n"
+        "     --chunk ms             : Period of paced writes (default 20).\n"
+        "     --stall ms             : Min receive gap counted as stall (default 300).\n"
+        "  -v --verbose              : Report each modem.\n"
+#if PTRACING
+        "  -t --trace                : Enable trace, use multiple times for more detail.\n"
+        "  -o --output file          : File for trace output, default is stderr.\n"
+#endif
+        "  -h --help                 : Display this help message.\n"
+        << endl;
+    return;
+  }
+
+  DteConfig config;
+
+  if (args.HasOption("pts-dir"))
+    config.ptsDir = args.GetOptionString("pts-dir");
+
+  if (args.HasOption('d'))
+    config.dial = args.GetOptionString('d');
+
+  if (args.HasOption('r')) {
+    PString role = args.GetOptionString('r');
+
+    if (role == "pairs")
+      config.role = 0;
+    else
+    if (role == "call")
+      config.role = 1;
+    else
+    if (role == "answer")
+      config.role = 2;
+    else {
+      cerr << "Unknown role " << role << endl;
+      return;
+    }
+  }
+
+  if (args.HasOption('s'))
+    config.sessions = (int)args.GetOptionString('s').AsInteger();
+
+  if (args.HasOption('n'))
+    config.pages = (int)args.GetOptionString('n').AsInteger();
+
+  if (args.HasOption("page-lines"))
+    config.pageLines = (int)args.GetOptionString("page-lines").AsInteger();
+
+  if (args.HasOption("density"))
+    config.density = (int)args.GetOptionString("density").AsInteger();
+
+  if (args.HasOption('m'))
+    config.mod = (int)args.GetOptionString('m').AsInteger();
+
+  if (args.HasOption("prefill"))
+    config.prefill = (int)args.GetOptionString("prefill").AsInteger();
+
+  if (args.HasOption("chunk"))
+    config.chunk = (int)args.GetOptionString("chunk").AsInteger();
+
+  if (args.HasOption("stall"))
+    config.stall = (int)args.GetOptionString("stall").AsInteger();
+
+  if (DteScript::FindMod(config.mod) == NULL) {
+    cerr << "Unknown modulation " << config.mod << endl;
+    return;
+  }
+
+  if (config.chunk < 1)
+    config.chunk = 1;
+
+  if (config.role == 1 && config.dial.IsEmpty()) {
+    cerr << "The number to dial is not set" << endl;
+    return;
+  }
+
+  DteScript::MakePage(config.page, config.pageLines, config.density);
+
+  // the same format as t38modem's --ptty: [num@]tty[,...]
+
+  PStringArray ttys;
+  PStringArray nums;
+  PStringArray ptty = args.GetOptionString('p').Tokenise(",\r\n ", FALSE);
+
+  for (PINDEX i = 0 ; i < ptty.GetSize() ; i++) {
+    PStringArray atty = ptty[i].Tokenise("@", FALSE);
+
+    if (atty.GetSize() == 2) {
+      nums.AppendString(atty[0]);
+      ttys.AppendString(atty[1]);
+    }
+    else
+    if (atty.GetSize() == 1) {
+      nums.AppendString(PString());
+      ttys.AppendString(atty[0]);
+    }
+  }
+
+  int numDtes = (int)ttys.GetSize();
+
+  if (config.role == 0 && (numDtes & 1)) {
+    cerr << "Odd number of ttys for pairs" << endl;
+    return;
+  }
+
+  DteThread **dtes = new DteThread *[numDtes];
+
+  for (int i = 0 ; i < numDtes ; i++) {
+    PBoolean caller = config.role == 1 || (config.role == 0 && (i & 1) == 0);
+    PString number;
+
+    if (caller) {
+      int pair = config.role == 0 ? i/2 : i;
+
+      if (!config.dial.IsEmpty()) {
+        number = config.dial;
+        number.Replace("%d", PString(PString::Signed, pair), TRUE);
+      } else
+        number = nums[i + 1];
+
+      if (number.IsEmpty()) {
+        cerr << "The number to dial from " << ttys[i] << " is not set" << endl;
+        numDtes = i;
+        break;
+      }
+    }
+
+    dtes[i] = new DteThread(ttys[i], i, caller, number, config);
+  }
+
+  if (config.role == 0) {
+    for (int i = 1 ; i < numDtes ; i += 2)
+      dtes[i]->SetPartner(dtes[i - 1]);
+  }
+
+  PInt64 begin = NowUs();
+
+  for (int i = 0 ; i < numDtes ; i++)
+    dtes[i]->Resume();
+
+  for (int i = 0 ; i < numDtes ; i++)
+    dtes[i]->WaitForTermination();
+
+  Report(dtes, numDtes, DteScript::FindMod(config.mod)->br, (NowUs() - begin)/1e6, args.HasOption('v'));
+
+  for (int i = 0 ; i < numDtes ; i++)
+    delete dtes[i];
+
+  delete [] dtes;
+}
+
+void T38Dte::Report(DteThread **dtes, int numDtes, int br, double elapsed, PBoolean verbose)
+{
+  DteStats total;
+
+  if (elapsed <= 0)
+    elapsed = 1e-6;
+
+  cout << setprecision(3) << setiosflags(ios::fixed);
+
+  for (int i = 0 ; i < numDtes ; i++) {
+    const DteStats &stats = dtes[i]->Stats();
+
+    if (verbose) {
+      cout << dtes[i]->Name() << (dtes[i]->IsCaller() ? " call" : " answer")
+           << " sessions=" << stats.sessions << "/" << (stats.sessions + stats.failures)
+           << " pages=" << stats.pages
+           << " cmd-us: p50=" << stats.cmdLatency.Percentile(50)
+           << " p99=" << stats.cmdLatency.Percentile(99)
+           << " max=" << stats.cmdLatency.GetMax()
+           << " rate=" << stats.rateMin << "-" << stats.rateMax
+           << " underruns=" << stats.underruns
+           << " stalls=" << stats.stalls
+           << " syscalls=" << (stats.reads + stats.writes + stats.polls)
+           << "\n";
+    }
+
+    if (total.txStreams + total.rxStreams == 0 || (stats.txStreams + stats.rxStreams > 0 && total.rateMin > stats.rateMin))
+      total.rateMin = stats.rateMin;
+
+    if (total.rateMax < stats.rateMax)
+      total.rateMax = stats.rateMax;
+
+    total.sessions += stats.sessions;
+    total.failures += stats.failures;
+    total.pages += stats.pages;
+    total.reads += stats.reads;
+    total.writes += stats.writes;
+    total.polls += stats.polls;
+    total.txStreams += stats.txStreams;
+    total.txBytes += stats.txBytes;
+    total.txUs += stats.txUs;
+    total.underruns += stats.underruns;
+    total.rxStreams += stats.rxStreams;
+    total.rxBytes += stats.rxBytes;
+    total.rxUs += stats.rxUs;
+    total.stalls += stats.stalls;
+    total.cmdLatency.Add(stats.cmdLatency);
+  }
+
+  long syscalls = total.reads + total.writes + total.polls;
+
+  cout << "modems=" << numDtes
+       << " sessions=" << total.sessions << "/" << (total.sessions + total.failures)
+       << " pages=" << total.pages
+       << " elapsed=" << elapsed << "s"
+       << " pages/s=" << total.pages/elapsed
+       << "\n  command latency us:"
+       << " p50=" << total.cmdLatency.Percentile(50)
+       << " p90=" << total.cmdLatency.Percentile(90)
+       << " p99=" << total.cmdLatency.Percentile(99)
+       << " max=" << total.cmdLatency.GetMax()
+       << " (" << total.cmdLatency.GetCount() << " commands)"
+       << "\n  data rate (effective/nominal):"
+       << " tx=" << (total.txUs ? total.txBytes*8000000.0/total.txUs/br : 0.0)
+       << " rx=" << (total.rxUs ? total.rxBytes*8000000.0/total.rxUs/br : 0.0)
+       << " min=" << total.rateMin
+       << " max=" << total.rateMax
+       << "\n  underruns=" << total.underruns << "/" << total.txStreams
+       << " stalls=" << total.stalls << "/" << total.rxStreams
+       << "\n  syscalls=" << syscalls
+       << " (read=" << total.reads << " write=" << total.writes << " poll=" << total.polls << ")"
+       << " per page=" << (total.pages ? double(syscalls)/total.pages : 0.0)
+       << " per second=" << syscalls/elapsed
+       << endl;
+}
+///////////////////////////////////////////////////////////////
+
@@ -281,12 +281,9 @@
 #define T38D(msg_data) T38_Type_of_msg_data::msg_data
 #define T38F(field_type) T38_Data_Field_subtype_field_type::field_type
 #define msMaxOutDelay (msPerOut*5)
+#define brMaxOut 14400      // max bit rate of mods[]
+#define msPerOutCurrent() (ModParsOut.msgType == T38D(e_v21) ? int(msPerOut) : msPerOutData)
 
-#ifdef P_LINUX
-  #define mySleep(ms) usleep((ms) * 1000L)
-#else
-  #define mySleep(ms) PThread::Sleep(ms)
-#endif
 ///////////////////////////////////////////////////////////////
 enum StateOut {
   stOutIdle,
@@ -522,12 +519,6 @@ static void t38indicator(T38_IFP &ifp, unsigned type)
     (T38_Type_of_msg_t30_indicator &)ifp.m_type_of_msg = type;
 }
 
-#ifdef OPTIMIZE_CORRIGENDUM_IFP
-  #define T38_DATA_FIELD T38_Data_Field_subtype
-#else
-  #define T38_DATA_FIELD T38_PreCorrigendum_Data_Field_subtype
-#endif
-
 static T38_DATA_FIELD &t38data(T38_IFP &ifp, unsigned type, unsigned field_type)
 {
     ifp.m_type_of_msg.SetTag(T38_Type_of_msg::e_data);
@@ -550,6 +541,27 @@ static void t38data(T38_IFP &ifp, unsigned type, unsigned field_type, const PBYT
     }
 }
 ///////////////////////////////////////////////////////////////
+/*
+ * Put locally generated TCF (T.38 data rate management method 1)
+ */
+static void PutLocalTcf(ModStream &modStream, PBoolean good)
+{
+  // 1.5 s of zeros at the training rate
+  PINDEX len = (modStream.ModPars.br * 1500)/(8*1000);
+  PBYTEArray tcf(len);
+
+  if (!good) {
+    // the network is lossy so spoil TCF to get FTT and fallback
+    for (PINDEX i = 0 ; i < len ; i += 10)
+      tcf[i] = 0xFF;
+  }
+
+  myPTRACE(2, "PutLocalTcf " << len << " bytes " << (good ? "good" : "bad"));
+
+  modStream.PutData(tcf, len);
+  modStream.PutEof(EngineBase::diagNoCarrier);
+}
+///////////////////////////////////////////////////////////////
 class FakePreparePacketThread : public PThread
 {
     PCLASSINFO(FakePreparePacketThread, PThread);
@@ -576,6 +588,8 @@ class FakePreparePacketThread : public PThread
 
 void FakePreparePacketThread::Main()
 {
+  ModemClock::Participant participant;
+
   PTRACE(3, t38engine.Name() << " FakePreparePacketThread::Main started");
 
   t38engine.OpenOut(EngineBase::HOWNEROUT(this), TRUE);
@@ -608,10 +622,11 @@ void FakePreparePacketThread::Main()
 }
 ///////////////////////////////////////////////////////////////
 T38Engine::T38Engine(const PString &_name)
-  : EngineBase(_name + " T38Engine")
+  : EngineBase(_name, "T38Engine")
   , bufOut(2048)
   , preparePacketTimeout(-1)
   , preparePacketPeriod(-1)
+  , msPerOutData(msPerOut)
   , preparePacketDelay()
   , stateOut(stOutNoSig)
   , onIdleOut(dtNone)
@@ -621,28 +636,55 @@ T38Engine::T38Engine(const PString &_name)
   , startedTimeOutBufEmpty(FALSE)
   , timeOutBufEmpty()
   , timeDelayEndOut()
+  , scheduledOut()
   , timeBeginOut()
   , countOut(0)
   , moreFramesOut(FALSE)
   , hdlcOut()
+  , localTcfOut(FALSE)
+  , suppressOut(FALSE)
+  , fillBitRemovalOut(FALSE)
+  , removeFillOut(FALSE)
+  , fillOut()
+  , transcodingMMROut(FALSE)
+  , transcodeOut(FALSE)
+  , t4Out()
   , callbackParamIn(cbpReset)
   , isCarrierIn(0)
 #if PTRACING
   , timeBeginIn()
 #endif
   , countIn(0)
+  , localTcfIn(FALSE)
+  , lostIn(0)
+  , lostInTcf(0)
+  , fillBitRemovalIn(FALSE)
+  , insertFillIn(FALSE)
+  , fillIn()
+  , transcodingMMRIn(FALSE)
+  , transcodeIn(FALSE)
+  , t4In()
   , t30()
+  , cdr()
+  , sendPacing(metrics, ModemMetrics::spT38)
   , modStreamIn(NULL)
   , modStreamInSaved(NULL)
   , stateModem(stmIdle)
 {
   PTRACE(2, name << " T38Engine");
+
+  cdr.StartThreadCpu(metrics);
 }
 
 T38Engine::~T38Engine()
 {
   PTRACE(1, name << " ~T38Engine");
 
+  cdr.Submit(metrics, sendPacing, t30);
+
+  if (t30.isFailed())
+    BinTrace::RequestDump("call failure on " + metrics.Name());
+
   if (modStreamIn != NULL)
     delete modStreamIn;
 
@@ -653,11 +695,20 @@ T38Engine::~T38Engine()
 void T38Engine::OnOpenIn()
 {
   EngineBase::OnOpenIn();
+  localTcfIn = FALSE;
+  fillBitRemovalIn = FALSE;
+  insertFillIn = FALSE;
+  transcodingMMRIn = FALSE;
+  transcodeIn = FALSE;
 }
 
 void T38Engine::OnOpenOut()
 {
   EngineBase::OnOpenOut();
+  msPerOutData = msPerOut;
+  localTcfOut = FALSE;
+  fillBitRemovalOut = FALSE;
+  transcodingMMROut = FALSE;
 }
 
 void T38Engine::OnCloseIn()
@@ -731,6 +782,26 @@ void T38Engine::OnDetach()
 {
   EngineBase::OnDetach();
   SignalOutDataReady();
+
+#if PTRACING
+  if (myCanTrace(2)) {
+    PString frames;
+
+    for (int i = T30::ftUnknown ; i < T30::ftNumTypes ; i++) {
+      if (t30.getFrameCount(T30::FrameType(i)))
+        frames += psprintf(" %s=%ld", T30::getFrameName(T30::FrameType(i)), t30.getFrameCount(T30::FrameType(i)));
+    }
+
+    if (!frames.IsEmpty())
+      myPTRACE(2, name << " T.30 frames:" << frames);
+  }
+#endif
+
+  if (t30.getEcmBlocks()) {
+    myPTRACE(2, name << " ECM blocks=" << t30.getEcmBlocks()
+                     << " PPR=" << t30.getEcmPprs()
+                     << " retransmitted frames=" << t30.getEcmPprFrames());
+  }
 }
 
 void T38Engine::OnChangeModemClass()
@@ -828,6 +899,7 @@ PBoolean T38Engine::SendStart(DataType _dataType, int param)
   }
 
   bufOut.Clean();		// reset eof
+  metrics.Set(ModemMetrics::gBufOut, 0);
   stateModem = stmOutMoreData;
   SignalOutDataReady();
   return TRUE;
@@ -847,6 +919,7 @@ int T38Engine::Send(const void *pBuf, PINDEX count)
 
   PWaitAndSignal mutexWait(Mutex);
   int res = bufOut.PutData(pBuf, count);
+  metrics.Set(ModemMetrics::gBufOut, bufOut.GetBusy());
   if (res < 0) {
     myPTRACE(1, name << " Send res(" << res << ") < 0");
   }
@@ -991,8 +1064,6 @@ PBoolean T38Engine::RecvStart(int _callbackParam)
 
   if (modStreamIn != NULL) {
     if (modStreamIn->PopBuf()) {
-      if (modStreamIn->ModPars.msgType == T38D(e_v21))
-        t30.v21Begin();
       stateModem = stmInRecvData;
       return TRUE;
     }
@@ -1024,17 +1095,8 @@ int T38Engine::Recv(void *pBuf, PINDEX count)
     return -1;
   }
 
-  int len = modStreamIn->GetData(pBuf, count);
-
-  if (modStreamIn->ModPars.msgType == T38D(e_v21)) {
-    if (len > 0)
-      t30.v21Data(pBuf, len);
-    else
-    if (len < 0)
-      t30.v21End(FALSE);
-  }
-
-  return len;
+  // the received T.30 frames are monitored by HandlePacket()
+  return modStreamIn->GetData(pBuf, count);
 }
 
 int T38Engine::RecvDiag() const
@@ -1083,7 +1145,7 @@ PBoolean T38Engine::SendingNotCompleted() const
   if (stateOut != stOutIdle)
     return TRUE;
 
-  if (delaySignalOut && timeBeginOut > PTime())
+  if (delaySignalOut && timeBeginOut > ModemClock::Get().Now())
     return TRUE;
 
   return FALSE;
@@ -1091,7 +1153,7 @@ PBoolean T38Engine::SendingNotCompleted() const
 ///////////////////////////////////////////////////////////////
 void T38Engine::SetPreparePacketTimeout(HOWNEROUT hOwner, int timeout, int period)
 {
-  PAssert((timeout == 0 && period > 0) || (timeout != 0 && period < 0), "Invalid timeout/period");
+  PAssert(timeout == 0 || period < 0, "Invalid timeout/period");
 
   if (hOwnerOut != hOwner)
     return;
@@ -1108,6 +1170,117 @@ void T38Engine::SetPreparePacketTimeout(HOWNEROUT hOwner, int timeout, int perio
     preparePacketDelay.Restart();
 }
 ///////////////////////////////////////////////////////////////
+void T38Engine::SetPacketInterval(HOWNEROUT hOwner, int interval)
+{
+  if (hOwnerOut != hOwner)
+    return;
+
+  PWaitAndSignal mutexWait(Mutex);
+
+  if (hOwnerOut != hOwner)
+    return;
+
+  if (interval < msPerOutMin)
+    interval = msPerOutMin;
+  else
+  if (interval > msPerOutMax)
+    interval = msPerOutMax;
+
+  myPTRACE(3, name << " SetPacketInterval " << interval << " ms");
+
+  msPerOutData = interval;
+}
+///////////////////////////////////////////////////////////////
+void T38Engine::SetLocalTcfOut(HOWNEROUT hOwner, PBoolean localTcf)
+{
+  if (hOwnerOut != hOwner)
+    return;
+
+  PWaitAndSignal mutexWait(Mutex);
+
+  if (hOwnerOut != hOwner)
+    return;
+
+  localTcfOut = localTcf;
+
+  myPTRACE(3, name << " SetLocalTcfOut " << localTcfOut);
+}
+
+void T38Engine::SetLocalTcfIn(HOWNERIN hOwner, PBoolean localTcf)
+{
+  if (hOwnerIn != hOwner)
+    return;
+
+  PWaitAndSignal mutexWait(Mutex);
+
+  if (hOwnerIn != hOwner)
+    return;
+
+  localTcfIn = localTcf;
+
+  myPTRACE(3, name << " SetLocalTcfIn " << localTcfIn);
+}
+
+void T38Engine::SetFillBitRemovalOut(HOWNEROUT hOwner, PBoolean fillBitRemoval)
+{
+  if (hOwnerOut != hOwner)
+    return;
+
+  PWaitAndSignal mutexWait(Mutex);
+
+  if (hOwnerOut != hOwner)
+    return;
+
+  fillBitRemovalOut = fillBitRemoval;
+
+  myPTRACE(3, name << " SetFillBitRemovalOut " << fillBitRemovalOut);
+}
+
+void T38Engine::SetFillBitRemovalIn(HOWNERIN hOwner, PBoolean fillBitRemoval)
+{
+  if (hOwnerIn != hOwner)
+    return;
+
+  PWaitAndSignal mutexWait(Mutex);
+
+  if (hOwnerIn != hOwner)
+    return;
+
+  fillBitRemovalIn = fillBitRemoval;
+
+  myPTRACE(3, name << " SetFillBitRemovalIn " << fillBitRemovalIn);
+}
+
+void T38Engine::SetTranscodingMMROut(HOWNEROUT hOwner, PBoolean transcodingMMR)
+{
+  if (hOwnerOut != hOwner)
+    return;
+
+  PWaitAndSignal mutexWait(Mutex);
+
+  if (hOwnerOut != hOwner)
+    return;
+
+  transcodingMMROut = transcodingMMR;
+
+  myPTRACE(3, name << " SetTranscodingMMROut " << transcodingMMROut);
+}
+
+void T38Engine::SetTranscodingMMRIn(HOWNERIN hOwner, PBoolean transcodingMMR)
+{
+  if (hOwnerIn != hOwner)
+    return;
+
+  PWaitAndSignal mutexWait(Mutex);
+
+  if (hOwnerIn != hOwner)
+    return;
+
+  transcodingMMRIn = transcodingMMR;
+
+  myPTRACE(3, name << " SetTranscodingMMRIn " << transcodingMMRIn);
+}
+///////////////////////////////////////////////////////////////
 int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
 {
   if (hOwnerOut != hOwner || !IsModemOpen())
@@ -1132,31 +1305,47 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
         return FALSE;
 
       preparePacketDelay.Restart();
+
+      // don't count the idle time before the first packet as late
+      PTime now = ModemClock::Get().Now();
+
+      if (timeDelayEndOut < now)
+        timeDelayEndOut = now;
     }
   }
 
   //myPTRACE(1, name << " PreparePacket begin stM=" << stateModem << " stO=" << stateOut);
 
-  ifp = T38_IFP();
+  ifp.RemoveOptionalField(T38_IFPPacket::e_data_field);
+  ifp.m_data_field.SetSize(0);
+
   PBoolean doDalay = TRUE;
-  PTime preparePacketTimeoutEnd = (preparePacketTimeout > 0 ? (PTime() + preparePacketTimeout) : PTime(0));
+  PTime preparePacketTimeoutEnd = (preparePacketTimeout > 0 ? (ModemClock::Get().Now() + preparePacketTimeout) : PTime(0));
+
+  scheduledOut = timeDelayEndOut;
 
   if (preparePacketPeriod > 0) {
     preparePacketDelay.Delay(preparePacketPeriod);
 
     if (hOwnerOut != hOwner || !IsModemOpen())
       return 0;
+
+    if (scheduledOut < preparePacketDelay.GetTarget())
+      scheduledOut = preparePacketDelay.GetTarget();
   }
 
   for(;;) {
     PBoolean redo = FALSE;
 
     if (doDalay) {
+      if (scheduledOut < timeDelayEndOut)
+        scheduledOut = timeDelayEndOut;
+
       //PTRACE(1, name << " +++++ stM=" << stateModem << " stO=" << stateOut << " "
       //       << timeDelayEndOut.AsString("hh:mm:ss.uuu\t", PTime::Local));
 
       for (;;) {
-        PTimeInterval delay = timeDelayEndOut - PTime();
+        PTimeInterval delay = timeDelayEndOut - ModemClock::Get().Now();
 
         if (delay.GetMilliSeconds() <= 0)
           break;
@@ -1165,7 +1354,7 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
           if (preparePacketTimeout == 0)
             return -1;
 
-          PTimeInterval timeout = preparePacketTimeoutEnd - PTime();
+          PTimeInterval timeout = preparePacketTimeoutEnd - ModemClock::Get().Now();
 
           if (timeout.GetMilliSeconds() <= 0)
             return -1;
@@ -1177,7 +1366,7 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
         if (delay.GetMilliSeconds() > msMaxOutDelay)
           delay = msMaxOutDelay;
 
-        mySleep(delay.GetMilliSeconds());
+        ModemClock::Get().Sleep(delay);
 
         if (hOwnerOut != hOwner || !IsModemOpen())
           return 0;
@@ -1201,7 +1390,7 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
           switch (stateOut) {
             case stOutIdle:
               if (delaySignalOut) {
-                if (ModParsOut.dataType != dtSilence && timeBeginOut > PTime()) {
+                if (ModParsOut.dataType != dtSilence && timeBeginOut > ModemClock::Get().Now()) {
                   redo = TRUE;
                   myPTRACE(4, name << " PreparePacket delaySignalOut");
                   break;
@@ -1233,10 +1422,10 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
                 if (waitms) {
                   if (isCarrierIn == 1) {
                     isCarrierIn = 2;
-                    timeBeginOut = PTime() + PTimeInterval(waitms);
+                    timeBeginOut = ModemClock::Get().Now() + PTimeInterval(waitms);
                     redo = TRUE;
                     break;
-                  } else if (timeBeginOut > PTime()) {
+                  } else if (timeBeginOut > ModemClock::Get().Now()) {
                     redo = TRUE;
                     break;
                   } else {
@@ -1293,10 +1482,33 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
               stateOut = stOutData;
               countOut = 0;
               startedTimeOutBufEmpty = FALSE;
-              timeBeginOut = PTime();
+              timeBeginOut = ModemClock::Get().Now();
               hdlcOut = HDLC();
               if (ModParsOut.msgType == T38D(e_v21))
                 t30.v21Begin();
+              else
+                t30.hsBegin(TRUE);
+
+              suppressOut = (localTcfOut && t30.isTcfOut() &&
+                             ModParsOut.msgType != T38D(e_v21) && ModParsOut.dataTypeT38 == dtRaw);
+
+              // TCF has no EOLs so only the image data is filtered
+              transcodeOut = (transcodingMMROut && !t30.isTcfOut() &&
+                              ModParsOut.msgType != T38D(e_v21) && ModParsOut.dataTypeT38 == dtRaw);
+
+              removeFillOut = (fillBitRemovalOut && !transcodeOut && !t30.isTcfOut() &&
+                               ModParsOut.msgType != T38D(e_v21) && ModParsOut.dataTypeT38 == dtRaw);
+
+              if (transcodeOut)
+                t4Out.Start(t30.isMR() ? T4Transcoder::cMR : T4Transcoder::cMH, T4Transcoder::cMMR, t30.getWidth());
+
+              if (removeFillOut)
+                fillOut.Start(-1);
+
+              if (suppressOut) {
+                myPTRACE(2, name << " PreparePacket local TCF, data will not be transferred");
+                t30.tcfDone();
+              }
 
               switch (ModParsOut.dataType) {
                 case dtHdlc:
@@ -1331,12 +1543,13 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
             ////////////////////////////////////////////////////
             case stOutData:
               {
-                BYTE b[(msPerOut * 14400)/(8*1000)];
-                PINDEX len = (msPerOut * ModParsOut.br)/(8*1000);
+                BYTE b[(msPerOutMax * brMaxOut)/(8*1000)];
+                PINDEX len = (msPerOutCurrent() * ModParsOut.br)/(8*1000);
                 if (len > PINDEX(sizeof(b)))
                   len = sizeof(b);
                 PBoolean wasFull = bufOut.isFull();
                 int count = hdlcOut.GetData(b, len);
+                metrics.Set(ModemMetrics::gBufOut, bufOut.GetBusy());
                 if (wasFull && !bufOut.isFull()) {
                   ModemCallbackWithUnlock(cbpOutBufNoFull);
 
@@ -1373,11 +1586,11 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
                     }
                     else
                     if (!startedTimeOutBufEmpty) {
-                      timeOutBufEmpty = PTime() + PTimeInterval(5000);
+                      timeOutBufEmpty = ModemClock::Get().Now() + PTimeInterval(5000);
                       startedTimeOutBufEmpty = TRUE;
                     }
                     else
-                    if (timeOutBufEmpty <= PTime()) {
+                    if (timeOutBufEmpty <= ModemClock::Get().Now()) {
                       ModemCallbackWithUnlock(cbpOutBufEmpty);
 
                       if (hOwnerOut != hOwner || !IsModemOpen())
@@ -1396,6 +1609,27 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
                         t38data(ifp, ModParsOut.msgType, T38F(e_hdlc_data), PBYTEArray(b, count));
                         break;
                       case dtRaw:
+                        if (suppressOut) {
+                          // local TCF, only pace the DTE's data
+                          redo = TRUE;
+                          break;
+                        }
+                        if (transcodeOut || removeFillOut) {
+                          PBYTEArray data;
+
+                          if (transcodeOut)
+                            t4Out.Transcode(b, count, data);
+                          else
+                            fillOut.Filter(b, count, data);
+
+                          if (data.GetSize() == 0) {
+                            // nothing to send yet
+                            redo = TRUE;
+                            break;
+                          }
+                          t38data(ifp, ModParsOut.msgType, T38F(e_t4_non_ecm_data), data);
+                          break;
+                        }
                         t38data(ifp, ModParsOut.msgType, T38F(e_t4_non_ecm_data), PBYTEArray(b, count));
                         break;
                       default:
@@ -1411,6 +1645,7 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
             case stOutHdlcFcs:
               if (ModParsOut.msgType == T38D(e_v21)) {
                 t30.v21End(TRUE);
+                OnT30Frame(t30);
                 t30.v21Begin();
               }
 
@@ -1468,7 +1703,7 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
             case stOutDataNoSig:
 #if PTRACING
               if (myCanTrace(3) || (myCanTrace(2) && ModParsOut.dataType == dtRaw)) {
-                PInt64 msTime = (PTime() - timeBeginOut).GetMilliSeconds();
+                PInt64 msTime = (ModemClock::Get().Now() - timeBeginOut).GetMilliSeconds();
                 myPTRACE(2, name << " Sent " << hdlcOut.getRawCount() << " bytes in " << msTime << " ms ("
                   << (PInt64(hdlcOut.getRawCount()) * 8 * 1000)/(msTime ? msTime : 1) << " bits/s)");
               }
@@ -1483,7 +1718,31 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
                   t38data(ifp, ModParsOut.msgType, T38F(e_hdlc_sig_end));
                   break;
                 case dtRaw:
-                  t38data(ifp, ModParsOut.msgType, T38F(e_t4_non_ecm_sig_end));
+                  if (suppressOut)
+                    redo = TRUE;
+                  else
+                  if (transcodeOut) {
+                    PBYTEArray data;
+
+                    t4Out.Flush(data);
+                    t38data(ifp, ModParsOut.msgType, T38F(e_t4_non_ecm_sig_end), data);
+
+                    myPTRACE(2, name << " MMR transcoding: " << t4Out.GetLines() << " lines ("
+                        << t4Out.GetErrors() << " bad), "
+                        << t4Out.GetCountIn() << " bytes -> " << t4Out.GetCountOut() << " bytes");
+                  }
+                  else
+                  if (removeFillOut) {
+                    PBYTEArray data;
+
+                    fillOut.Flush(data);
+                    t38data(ifp, ModParsOut.msgType, T38F(e_t4_non_ecm_sig_end), data);
+
+                    myPTRACE(2, name << " Fill bits removal: " << fillOut.GetLines() << " EOLs, "
+                        << fillOut.GetCountIn() << " bytes -> " << fillOut.GetCountOut() << " bytes");
+                  }
+                  else
+                    t38data(ifp, ModParsOut.msgType, T38F(e_t4_non_ecm_sig_end));
                   break;
                 default:
                   myPTRACE(1, name << " PreparePacket stOutDataNoSig bad dataTypeT38="
@@ -1503,7 +1762,7 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
               t38indicator(ifp, T38I(e_no_signal));
               stateOut = stOutIdle;
               delaySignalOut = TRUE;
-              timeBeginOut = PTime() + PTimeInterval(75);
+              timeBeginOut = ModemClock::Get().Now() + PTimeInterval(75);
               break;
             default:
               myPTRACE(1, name << " PreparePacket bad stateOut=" << stateOut);
@@ -1530,13 +1789,13 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
         if (preparePacketTimeout == 0)
           return -1;
 
-        PTimeInterval timeout = preparePacketTimeoutEnd - PTime();
+        PTimeInterval timeout = preparePacketTimeoutEnd - ModemClock::Get().Now();
 
         if (timeout.GetMilliSeconds() <= 0 || !WaitOutDataReady(timeout.GetMilliSeconds()))
           return -1;
       } else {
         if (startedTimeOutBufEmpty) {
-          PInt64 timeout = (timeOutBufEmpty - PTime()).GetMilliSeconds() + 1;
+          PInt64 timeout = (timeOutBufEmpty - ModemClock::Get().Now()).GetMilliSeconds() + 1;
 
           if (timeout > 0)
             WaitOutDataReady(timeout);
@@ -1548,6 +1807,14 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
       if (hOwnerOut != hOwner || !IsModemOpen())
         return 0;
 
+      {
+        // the delay of the DTE data is not a pacing delay
+        PTime now = ModemClock::Get().Now();
+
+        if (scheduledOut < now)
+          scheduledOut = now;
+      }
+
       {
         PWaitAndSignal mutexWait(Mutex);
 
@@ -1557,31 +1824,31 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
         if (stateOut == stOutData) {
 #if PTRACING
           if (myCanTrace(3) || (myCanTrace(2) && ModParsOut.dataType == dtRaw)) {
-            PInt64 msTime = (PTime() - timeBeginOut).GetMilliSeconds();
+            PInt64 msTime = (ModemClock::Get().Now() - timeBeginOut).GetMilliSeconds();
             myPTRACE(2, name << " Sent " << hdlcOut.getRawCount() << " bytes in " << msTime << " ms ("
               << (PInt64(hdlcOut.getRawCount()) * 8 * 1000)/(msTime ? msTime : 1) << " bits/s)");
           }
 #endif
           myPTRACE(1, name << " PreparePacket DTE's data delay, reset " << hdlcOut.getRawCount());
           hdlcOut.resetRawCount();
-          timeBeginOut = PTime() - PTimeInterval(msPerOut);
+          timeBeginOut = ModemClock::Get().Now() - PTimeInterval(msPerOutCurrent());
           doDalay = FALSE;
         }
       }
     }
 
     switch (stateOut) {
-      case stOutIdle:          timeDelayEndOut = PTime() + msPerOut; break;
-      case stOutCedWait:       timeDelayEndOut = PTime() + ModParsOut.lenInd; break;
-      case stOutSilenceWait:   timeDelayEndOut = PTime() + ModParsOut.lenInd; break;
-      case stOutIndWait:       timeDelayEndOut = PTime() + ModParsOut.lenInd; break;
+      case stOutIdle:          timeDelayEndOut = ModemClock::Get().Now() + msPerOut; break;
+      case stOutCedWait:       timeDelayEndOut = ModemClock::Get().Now() + ModParsOut.lenInd; break;
+      case stOutSilenceWait:   timeDelayEndOut = ModemClock::Get().Now() + ModParsOut.lenInd; break;
+      case stOutIndWait:       timeDelayEndOut = ModemClock::Get().Now() + ModParsOut.lenInd; break;
       case stOutData:
       case stOutHdlcFcs:
-        timeDelayEndOut = timeBeginOut + (PInt64(hdlcOut.getRawCount()) * 8 * 1000)/ModParsOut.br + msPerOut;
+        timeDelayEndOut = timeBeginOut + (PInt64(hdlcOut.getRawCount()) * 8 * 1000)/ModParsOut.br + msPerOutCurrent();
         break;
-      case stOutDataNoSig:     timeDelayEndOut = PTime() + msPerOut; break;
-      case stOutNoSig:         timeDelayEndOut = PTime() + msPerOut; break;
-      default:                 timeDelayEndOut = PTime();
+      case stOutDataNoSig:     timeDelayEndOut = ModemClock::Get().Now() + msPerOut; break;
+      case stOutNoSig:         timeDelayEndOut = ModemClock::Get().Now() + msPerOut; break;
+      default:                 timeDelayEndOut = ModemClock::Get().Now();
     }
 
     if (!redo)
@@ -1591,9 +1858,10 @@ int T38Engine::PreparePacket(HOWNEROUT hOwner, T38_IFP & ifp)
   return 1;
 }
 ///////////////////////////////////////////////////////////////
-PBoolean T38Engine::HandlePacketLost(HOWNERIN hOwner, unsigned myPTRACE_PARAM(nLost))
+PBoolean T38Engine::HandlePacketLost(HOWNERIN hOwner, unsigned nLost)
 {
   myPTRACE(1, name << " HandlePacketLost " << nLost);
+  BinTrace::Add(metrics.TraceId(), BinTrace::evIfpLost, nLost);
 
   if (hOwnerIn != hOwner || !IsModemOpen())
     return FALSE;
@@ -1603,6 +1871,8 @@ PBoolean T38Engine::HandlePacketLost(HOWNERIN hOwner, unsigned myPTRACE_PARAM(nL
   if (hOwnerIn != hOwner || !IsModemOpen())
     return FALSE;
 
+  lostIn += nLost;
+
   ModStream *modStream = modStreamIn;
 
   if( modStream == NULL || modStream->lastBuf == NULL ) {
@@ -1641,9 +1911,9 @@ PBoolean T38Engine::HandlePacket(HOWNERIN hOwner, const T38_IFP & ifp)
     case T38_Type_of_msg::e_t30_indicator: {
       T38_Type_of_msg_t30_indicator type_of_msg = ifp.m_type_of_msg;
 
-      if ((modStreamIn != NULL) && (modStreamIn->lastBuf != NULL &&
+      if ((modStreamIn != NULL && modStreamIn->lastBuf != NULL &&
             modStreamIn->ModPars.ind == type_of_msg) ||
-          (modStreamInSaved != NULL) && (modStreamInSaved->lastBuf != NULL &&
+          (modStreamInSaved != NULL && modStreamInSaved->lastBuf != NULL &&
             modStreamInSaved->ModPars.ind == type_of_msg))
       {
         myPTRACE(3, name << " HandlePacket ignored repeated indicator " << type_of_msg);
@@ -1729,6 +1999,30 @@ PBoolean T38Engine::HandlePacket(HOWNERIN hOwner, const T38_IFP & ifp)
           modStreamInSaved->PushBuf();
           countIn = 0;
 
+          if (type_of_msg != T38I(e_v21_preamble))
+            t30.hsBegin(FALSE);
+          else
+            t30.v21Begin();
+
+          transcodeIn = (transcodingMMRIn && !t30.isTcfIn() && type_of_msg != T38I(e_v21_preamble));
+
+          // MMR has no fill bits so the transcoded data always need them
+          insertFillIn = ((fillBitRemovalIn || transcodeIn) &&
+                          !t30.isTcfIn() && type_of_msg != T38I(e_v21_preamble));
+
+          if (transcodeIn) {
+            t4In.Start(T4Transcoder::cMMR, t30.isMR() ? T4Transcoder::cMR : T4Transcoder::cMH,
+                       t30.getWidth(), t30.isFine() ? 4 : 2);
+          }
+
+          if (insertFillIn)
+            fillIn.Start((modStreamInSaved->ModPars.br * t30.getMinScanTime())/1000);
+
+          if (localTcfIn && t30.isTcfIn() && type_of_msg != T38I(e_v21_preamble)) {
+            t30.tcfDone();
+            PutLocalTcf(*modStreamInSaved, lostIn == lostInTcf);
+          }
+
           if (stateModem == stmInWaitSilence) {
             stateModem = stmIdle;
             ModemCallbackWithUnlock(callbackParamIn);
@@ -1804,11 +2098,33 @@ PBoolean T38Engine::HandlePacket(HOWNERIN hOwner, const T38_IFP & ifp)
                   case T38F(e_t4_non_ecm_sig_end):
                     if (Data_Field.HasOptionalField(T38_Data_Field_subtype::e_field_data)) {
                       int size = Data_Field.m_field_data.GetSize();
-                      if(modStream != NULL)
-                        modStream->PutData(Data_Field.m_field_data, size);
+
+                      if (type_of_msg == T38D(e_v21))
+                        t30.v21Data(Data_Field.m_field_data, size);
+
+                      if(modStream != NULL) {
+                        if (insertFillIn && (Data_Field.m_field_type == T38F(e_t4_non_ecm_data) ||
+                                             Data_Field.m_field_type == T38F(e_t4_non_ecm_sig_end)))
+                        {
+                          PBYTEArray data;
+
+                          if (transcodeIn) {
+                            PBYTEArray t4;
+
+                            t4In.Transcode(Data_Field.m_field_data, size, t4);
+                            fillIn.Filter(t4, t4.GetSize(), data);
+                          } else {
+                            fillIn.Filter(Data_Field.m_field_data, size, data);
+                          }
+
+                          modStream->PutData(data, data.GetSize());
+                        } else {
+                          modStream->PutData(Data_Field.m_field_data, size);
+                        }
+                      }
 #if PTRACING
                       if (!countIn)
-                        timeBeginIn = PTime();
+                        timeBeginIn = ModemClock::Get().Now();
 #endif
                       countIn += size;
                     }
@@ -1831,11 +2147,59 @@ PBoolean T38Engine::HandlePacket(HOWNERIN hOwner, const T38_IFP & ifp)
                     }
                     break;
                 }
+                if (type_of_msg == T38D(e_v21)) {
+                  /*
+                   * Monitor T.30 here and not on reading by DTE, so the
+                   * local TCF is armed by DCS even if DTE is late
+                   */
+                  switch (Data_Field.m_field_type) {
+                    case T38F(e_hdlc_fcs_OK):
+                    case T38F(e_hdlc_fcs_OK_sig_end):
+                      t30.v21End(FALSE);
+                      OnT30Frame(t30);
+
+                      if (t30.isTcfIn())
+                        lostInTcf = lostIn;
+                    case T38F(e_hdlc_fcs_BAD):
+                    case T38F(e_hdlc_fcs_BAD_sig_end):
+                    case T38F(e_hdlc_sig_end):
+                      t30.v21Begin();
+                      break;
+                    default:
+                      break;
+                  }
+                }
                 switch( Data_Field.m_field_type ) {	// Handle sig_end
                   case T38F(e_t4_non_ecm_sig_end):
+                    if (insertFillIn) {
+                      if (modStream != NULL) {
+                        PBYTEArray data;
+
+                        if (transcodeIn) {
+                          PBYTEArray t4;
+
+                          t4In.Flush(t4);
+                          fillIn.Filter(t4, t4.GetSize(), data);
+                        }
+
+                        fillIn.Flush(data);
+                        modStream->PutData(data, data.GetSize());
+                      }
+
+                      if (transcodeIn) {
+                        myPTRACE(2, name << " MMR transcoding: " << t4In.GetLines() << " lines ("
+                            << t4In.GetErrors() << " bad), "
+                            << t4In.GetCountIn() << " bytes -> " << t4In.GetCountOut() << " bytes");
+                        transcodeIn = FALSE;
+                      }
+
+                      myPTRACE(2, name << " Fill bits insertion: " << fillIn.GetLines() << " EOLs, "
+                          << fillIn.GetCountIn() << " bytes -> " << fillIn.GetCountOut() << " bytes");
+                      insertFillIn = FALSE;
+                    }
 #if PTRACING
                     if (myCanTrace(2)) {
-                      PInt64 msTime = (PTime() - timeBeginIn).GetMilliSeconds();
+                      PInt64 msTime = (ModemClock::Get().Now() - timeBeginIn).GetMilliSeconds();
                       myPTRACE(2, name << " Received " << countIn << " bytes in " << msTime << " ms ("
                         << (PInt64(countIn) * 8 * 1000)/(msTime ? msTime : 1) << " bits/s)");
                     }
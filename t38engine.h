@@ -167,9 +167,11 @@
 #define _T38ENGINE_H
 
 #include "pmutils.h"
-#include <ptclib/delaychan.h>
 #include "hdlc.h"
 #include "t30.h"
+#include "faxcdr.h"
+#include "t4fill.h"
+#include "t4codec.h"
 #include "enginebase.h"
 
 ///////////////////////////////////////////////////////////////
@@ -196,13 +198,13 @@ class MODPARS
     int br;
 };
 ///////////////////////////////////////////////////////////////
-#ifdef OPTIMIZE_CORRIGENDUM_IFP
-  #define T38_IFP       T38_IFPPacket
-  #define T38_IFP_NAME  "IFP"
-#else
-  #define T38_IFP       T38_PreCorrigendum_IFPPacket
-  #define T38_IFP_NAME  "Pre-corrigendum IFP"
-#endif
+/*
+ * The ASN.1 variant (original T.38 (06/98) Annex A or CORRIGENDUM No. 1 fix)
+ * is selected per call by IFPCodec, so the same representation is used for both
+ */
+#define T38_IFP               T38_IFPPacket
+#define T38_IFP_NAME          "IFP"
+#define T38_DATA_FIELD        T38_Data_Field_subtype
 ///////////////////////////////////////////////////////////////
 class ModStream;
 class T38_IFP;
@@ -213,7 +215,11 @@ class T38Engine : public EngineBase
 
   public:
 
-    enum { msPerOut = 30 };
+    enum {
+      msPerOut          = 30,   // default packetization interval
+      msPerOutMin       = 20,
+      msPerOutMax       = 100,
+    };
 
   /**@name Construction */
   //@{
@@ -248,6 +254,9 @@ class T38Engine : public EngineBase
     );
 
     /**Set outgoing T.38 packet prepare timeout.
+
+       If timeout is 0 and period is -1 then PreparePacket() returns only the
+       packets ready to be sent without delay.
       */
     void SetPreparePacketTimeout(
       HOWNEROUT hOwner,
@@ -255,6 +264,92 @@ class T38Engine : public EngineBase
       int period = -1
     );
 
+    /**Set packetization interval for outgoing high speed data.
+
+       The V.21 control frames and indicators are always packetized with
+       msPerOut interval. The interval is limited to msPerOutMin..msPerOutMax
+       and it's reset to msPerOut on each OpenOut().
+      */
+    void SetPacketInterval(
+      HOWNEROUT hOwner,
+      int interval
+    );
+
+    /**Get packetization interval for outgoing high speed data.
+      */
+    int GetPacketInterval() const { return msPerOutData; }
+
+    /**Enable local TCF (T.38 data rate management method 1) for outgoing
+       data.
+
+       If enabled then TCF sent by fax application after DCS is not
+       transferred, only the training indicator is sent. It's reset to
+       disabled on each OpenOut().
+      */
+    void SetLocalTcfOut(
+      HOWNEROUT hOwner,
+      PBoolean localTcf
+    );
+
+    /**Enable local TCF (T.38 data rate management method 1) for incoming
+       data.
+
+       If enabled then TCF is generated locally for fax application on
+       receiving the training indicator after DCS. If some packets were lost
+       after receiving DCS then the generated TCF will be bad. It's reset to
+       disabled on each OpenIn().
+      */
+    void SetLocalTcfIn(
+      HOWNERIN hOwner,
+      PBoolean localTcf
+    );
+
+    /**Enable fill bits removal (T38FaxFillBitRemoval) for outgoing non-ECM
+       image data.
+
+       If enabled then the fill bits before EOL are removed from the data
+       sent by fax application. It's reset to disabled on each OpenOut().
+      */
+    void SetFillBitRemovalOut(
+      HOWNEROUT hOwner,
+      PBoolean fillBitRemoval
+    );
+
+    /**Enable fill bits insertion (T38FaxFillBitRemoval) for incoming non-ECM
+       image data.
+
+       If enabled then the fill bits are inserted before EOL to meet the
+       minimum scan line time from the received DCS. It's reset to disabled
+       on each OpenIn().
+      */
+    void SetFillBitRemovalIn(
+      HOWNERIN hOwner,
+      PBoolean fillBitRemoval
+    );
+
+    /**Enable transcoding (T38FaxTranscodingMMR) of outgoing non-ECM image
+       data.
+
+       If enabled then the MH/MR data sent by fax application is transcoded
+       to MMR. It's reset to disabled on each OpenOut().
+      */
+    void SetTranscodingMMROut(
+      HOWNEROUT hOwner,
+      PBoolean transcodingMMR
+    );
+
+    /**Enable transcoding (T38FaxTranscodingMMR) of incoming non-ECM image
+       data.
+
+       If enabled then the received MMR data is transcoded to MH/MR (as it
+       was requested by the received DCS) with the fill bits inserted. It's
+       reset to disabled on each OpenIn().
+      */
+    void SetTranscodingMMRIn(
+      HOWNERIN hOwner,
+      PBoolean transcodingMMR
+    );
+
     /**Handle incoming T.38 packet.
 
        If returns FALSE, then the reading loop should be terminated.
@@ -272,6 +367,22 @@ class T38Engine : public EngineBase
       HOWNERIN hOwner,
       unsigned nLost
     );
+
+    /**Get the QoS record of the call. It's written on destruction of
+       the engine (on end of the call).
+      */
+    FaxCdr &Cdr() { return cdr; }
+
+    /**Get the time the last packet prepared by PreparePacket() was
+       scheduled to be sent at (the end of the pacing delay, or the arrival
+       of the DTE data if PreparePacket() waited for it).
+      */
+    const PTime &GetScheduledOut() const { return scheduledOut; }
+
+    /**Get the send pacing of the call. The send loop should call
+       Sent(GetScheduledOut()) on sending each prepared packet.
+      */
+    ModemMetrics::SendPacing &Pacing() { return sendPacing; }
   //@}
 
   protected:
@@ -287,10 +398,10 @@ class T38Engine : public EngineBase
     virtual void OnChangeEnableFakeOut();
 
   private:
-    void SignalOutDataReady() { outDataReadySyncPoint.Signal(); }
-    void WaitOutDataReady() { outDataReadySyncPoint.Wait(); }
+    void SignalOutDataReady() { ModemClock::Get().Signal(outDataReadySyncPoint); }
+    void WaitOutDataReady() { ModemClock::Get().Wait(outDataReadySyncPoint); }
     PBoolean WaitOutDataReady(const PTimeInterval & timeout) {
-      return outDataReadySyncPoint.Wait(timeout);
+      return ModemClock::Get().Wait(outDataReadySyncPoint, timeout);
     }
 
   private:
@@ -298,8 +409,9 @@ class T38Engine : public EngineBase
 
     int preparePacketTimeout;
     int preparePacketPeriod;
+    int msPerOutData;
 
-    PAdaptiveDelay preparePacketDelay;
+    ModemDelay preparePacketDelay;
 
     int stateOut;
     DataType onIdleOut;
@@ -309,10 +421,19 @@ class T38Engine : public EngineBase
     PBoolean startedTimeOutBufEmpty;
     PTime timeOutBufEmpty;
     PTime timeDelayEndOut;
+    PTime scheduledOut;
     PTime timeBeginOut;
     PINDEX countOut;
     PBoolean moreFramesOut;
     HDLC hdlcOut;
+    PBoolean localTcfOut;
+    PBoolean suppressOut;                  ///<  Do not transfer current data (local TCF)
+    PBoolean fillBitRemovalOut;
+    PBoolean removeFillOut;                ///<  Remove fill bits from current data
+    T4FillBits fillOut;
+    PBoolean transcodingMMROut;
+    PBoolean transcodeOut;                 ///<  Transcode current data to MMR
+    T4Transcoder t4Out;
 
     int callbackParamIn;
     volatile int isCarrierIn;
@@ -320,8 +441,19 @@ class T38Engine : public EngineBase
     PTime timeBeginIn;
 #endif
     PINDEX countIn;
+    PBoolean localTcfIn;
+    unsigned lostIn;
+    unsigned lostInTcf;
+    PBoolean fillBitRemovalIn;
+    PBoolean insertFillIn;                 ///<  Insert fill bits to current data
+    T4FillBits fillIn;
+    PBoolean transcodingMMRIn;
+    PBoolean transcodeIn;                  ///<  Transcode current data from MMR
+    T4Transcoder t4In;
 
     T30 t30;
+    FaxCdr cdr;
+    ModemMetrics::SendPacing sendPacing;
 
     ModStream *modStreamIn;
     ModStream *modStreamInSaved;
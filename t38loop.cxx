@@ -0,0 +1,1225 @@
+/*
+ * t38loop.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: t38loop.cxx,v $
+ *
+ */
+
+/*
+ * In-process T.38 loopback benchmark.
+ *
+ * N pairs of pseudo modems (ModemEngineBody + T38Engine) are connected
+ * back-to-back through in-memory UDPTL channels with configurable loss,
+ * reordering and delay. Both ends of each pair are driven by scripted
+ * Class 1 sessions (AT+FTH/FRH, AT+FTM/FRM, ECM or non-ECM, multi-page).
+ * No network and no pty devices are used. With --virtual the sessions
+ * run in virtual time (see VirtualClock) as fast as the CPU allows.
+ */
+
+#include <ptlib.h>
+
+#ifdef USE_OPAL
+  #include <opal/buildopts.h>
+  #include <asn/t38.h>
+#else
+  #include <t38.h>
+#endif
+
+#include <time.h>
+#include <sys/resource.h>
+
+#include "version.h"
+#include "pmodemi.h"
+#include "t38engine.h"
+#include "audio.h"
+#include "ifpcodec.h"
+#include "reorder.h"
+#include "dtescript.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+static PInt64 NowUs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return PInt64(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+/**Time of the simulation in us (virtual with --virtual).
+  */
+static PInt64 SimUs()
+{
+  return ModemClock::Get().Now().GetTimestamp();
+}
+
+static double CpuSeconds()
+{
+  struct rusage ru;
+
+  if (getrusage(RUSAGE_SELF, &ru) != 0)
+    return 0;
+
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6 +
+         ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6;
+}
+///////////////////////////////////////////////////////////////
+class LoopConfig
+{
+  public:
+    LoopConfig()
+      : sessions(1), pages(2), ecm(FALSE), pageLines(1100), density(5),
+        loss(0), reorder(0), delay(0), jitter(0),
+        reorderDepth(0), reorderDelay(0), virtualTime(FALSE) {}
+
+    int sessions;               ///<  Sessions per pair
+    int pages;                  ///<  Pages per session
+    PBoolean ecm;
+    int pageLines;
+    int density;                ///<  Percents of non-blank lines
+    int loss;                   ///<  In 1/1000 of packets
+    int reorder;                ///<  In 1/1000 of packets
+    int delay;                  ///<  One way delay in ms
+    int jitter;                 ///<  Max extra delay in ms
+    int reorderDepth;
+    int reorderDelay;
+    PBoolean virtualTime;
+};
+///////////////////////////////////////////////////////////////
+class LoopStats
+{
+  public:
+    LoopStats()
+      : packets(0), bytes(0), dropped(0), delayed(0),
+        lost(0), reordered(0), recovered(0),
+        pages(0), sessions(0), failures(0), receiverErrors(0),
+        packetLatency(100), pageLatency(10000) {}
+
+    PMutex mutex;
+
+    long packets;
+    long bytes;
+    long dropped;
+    long delayed;
+    long lost;
+    long reordered;
+    long recovered;
+
+    long pages;
+    long sessions;
+    long failures;
+    long receiverErrors;
+
+    Histogram packetLatency;    ///<  From PreparePacket() to HandlePacket() in us
+    Histogram pageLatency;      ///<  From the page start to MCF in us
+};
+///////////////////////////////////////////////////////////////
+/**One direction of the in-memory UDPTL link.
+
+   The writer thread prepares the packets with the source engine, encodes
+   them and puts them to the delay line. The reader thread takes them at
+   the due time and passes them to the destination engine through
+   ReorderBuffer::Receive() in the same way as T38ModemMediaStream does.
+ */
+class LoopChannel : public PObject, protected ReorderBuffer::Sink
+{
+    PCLASSINFO(LoopChannel, PObject);
+  public:
+    LoopChannel(
+      const LoopConfig &_config,
+      LoopStats &_stats,
+      T38Engine &_src,
+      T38Engine &_dst,
+      unsigned long seed
+    );
+    ~LoopChannel();
+
+    void Start();
+    void Stop();
+
+    void WriteLoop();
+    void ReadLoop();
+
+  protected:
+    enum { maxPackets = 64 };
+
+    struct Packet {
+      PBoolean used;
+      long seq;
+      PInt64 sent;
+      PInt64 due;
+      PINDEX len;
+      BYTE data[ReorderBuffer::maxSize];
+    };
+
+    unsigned long Random(unsigned long range);
+    void Put(long seq, const BYTE *pData, PINDEX len, PInt64 sent, PInt64 due);
+    int Get(Packet &packet);
+
+    virtual PBoolean OnLost(int lost);
+    virtual PBoolean OnPacket(const BYTE *pData, PINDEX len);
+
+    const LoopConfig &config;
+    LoopStats &stats;
+    T38Engine &src;
+    T38Engine &dst;
+
+    unsigned long rnd;
+    volatile PBoolean stop;
+
+    PMutex mutex;
+    PSyncPoint ready;
+    Packet packets[maxPackets];
+
+    ReorderBuffer reorder;
+    T38_IFP ifp;                        ///<  Used by reader only
+
+    PThread *writer;
+    PThread *reader;
+};
+///////////////////////////////////////////////////////////////
+class LoopThread : public PThread
+{
+    PCLASSINFO(LoopThread, PThread);
+  public:
+    LoopThread(LoopChannel &_channel, PBoolean _writer)
+      : PThread(30000, NoAutoDeleteThread),
+        channel(_channel),
+        writer(_writer)
+    {
+      Resume();
+    }
+
+  protected:
+    virtual void Main() {
+      ModemClock::Participant participant;
+
+      if (writer)
+        channel.WriteLoop();
+      else
+        channel.ReadLoop();
+    }
+
+    LoopChannel &channel;
+    PBoolean writer;
+};
+///////////////////////////////////////////////////////////////
+LoopChannel::LoopChannel(
+    const LoopConfig &_config,
+    LoopStats &_stats,
+    T38Engine &_src,
+    T38Engine &_dst,
+    unsigned long seed)
+  : config(_config),
+    stats(_stats),
+    src(_src),
+    dst(_dst),
+    rnd(seed ? seed : 1),
+    stop(FALSE),
+    writer(NULL),
+    reader(NULL)
+{
+  for (PINDEX i = 0 ; i < maxPackets ; i++)
+    packets[i].used = FALSE;
+
+  if (config.reorderDepth > 0)
+    reorder.SetDepth(config.reorderDepth, config.reorderDelay);
+}
+
+LoopChannel::~LoopChannel()
+{
+  Stop();
+}
+
+void LoopChannel::Start()
+{
+  src.OpenOut(EngineBase::HOWNEROUT(this));
+  src.SetPreparePacketTimeout(EngineBase::HOWNEROUT(this), -1);
+  dst.OpenIn(EngineBase::HOWNERIN(this));
+
+  writer = new LoopThread(*this, TRUE);
+  reader = new LoopThread(*this, FALSE);
+}
+
+void LoopChannel::Stop()
+{
+  stop = TRUE;
+  ModemClock::Get().Signal(ready);
+
+  src.CloseOut(EngineBase::HOWNEROUT(this));
+  dst.CloseIn(EngineBase::HOWNERIN(this));
+
+  ModemClock::Blocking blocking;
+
+  if (writer) {
+    writer->WaitForTermination();
+    delete writer;
+    writer = NULL;
+  }
+
+  if (reader) {
+    reader->WaitForTermination();
+    delete reader;
+    reader = NULL;
+  }
+}
+
+unsigned long LoopChannel::Random(unsigned long range)
+{
+  rnd ^= (rnd << 13) & 0xFFFFFFFF;
+  rnd ^= rnd >> 17;
+  rnd ^= (rnd << 5) & 0xFFFFFFFF;
+
+  return range ? (rnd & 0x7FFFFFFF) % range : 0;
+}
+
+void LoopChannel::Put(long seq, const BYTE *pData, PINDEX len, PInt64 sent, PInt64 due)
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  for (PINDEX i = 0 ; i < maxPackets ; i++) {
+    Packet &packet = packets[i];
+
+    if (!packet.used) {
+      packet.used = TRUE;
+      packet.seq = seq;
+      packet.sent = sent;
+      packet.due = due;
+      packet.len = len;
+      memcpy(packet.data, pData, len);
+      ModemClock::Get().Signal(ready);
+      return;
+    }
+  }
+
+  PWaitAndSignal mutexWaitStats(stats.mutex);
+  stats.dropped++;
+}
+
+int LoopChannel::Get(Packet &packet)
+{
+  PWaitAndSignal mutexWait(mutex);
+
+  Packet *pFirst = NULL;
+
+  for (PINDEX i = 0 ; i < maxPackets ; i++) {
+    if (packets[i].used && (pFirst == NULL || packets[i].due < pFirst->due))
+      pFirst = &packets[i];
+  }
+
+  if (pFirst == NULL)
+    return -1;
+
+  PInt64 wait = pFirst->due - SimUs();
+
+  if (wait > 0)
+    return int(wait/1000) + 1;
+
+  packet.seq = pFirst->seq;
+  packet.sent = pFirst->sent;
+  packet.len = pFirst->len;
+  memcpy(packet.data, pFirst->data, pFirst->len);
+  pFirst->used = FALSE;
+
+  return 0;
+}
+
+void LoopChannel::WriteLoop()
+{
+  T38_IFP ifp;
+  BYTE buf[ReorderBuffer::maxSize];
+  long seq = 0;
+
+  while (!stop) {
+    int res = src.PreparePacket(EngineBase::HOWNEROUT(this), ifp);
+
+    if (res == 0)
+      break;
+
+    if (res < 0)
+      continue;
+
+    PINDEX len = IFPCodec::Encode(ifp, buf, sizeof(buf), TRUE);
+
+    if (len < 0) {
+      myPTRACE(1, src.Name() << " LoopChannel::WriteLoop " T38_IFP_NAME " encode failure");
+      continue;
+    }
+
+    PInt64 now = SimUs();
+    PBoolean drop = (Random(1000) < (unsigned long)config.loss);
+    PBoolean delayed = (!drop && Random(1000) < (unsigned long)config.reorder);
+
+    {
+      PWaitAndSignal mutexWait(stats.mutex);
+
+      stats.packets++;
+      stats.bytes += len;
+
+      if (drop)
+        stats.dropped++;
+
+      if (delayed)
+        stats.delayed++;
+    }
+
+    if (!drop) {
+      PInt64 due = now + PInt64(config.delay)*1000 + Random(config.jitter*1000);
+
+      // hold back behind the next two packets
+      if (delayed)
+        due += PInt64(src.GetPacketInterval())*2*1000;
+
+      Put(seq, buf, len, now, due);
+    }
+
+    seq++;
+  }
+
+  myPTRACE(2, src.Name() << " LoopChannel::WriteLoop stopped, sent " << seq << " packets");
+}
+
+PBoolean LoopChannel::OnLost(int lost)
+{
+  return dst.HandlePacketLost(EngineBase::HOWNERIN(this), lost);
+}
+
+PBoolean LoopChannel::OnPacket(const BYTE *pData, PINDEX len)
+{
+  if (!IFPCodec::Decode(pData, len, ifp, TRUE)) {
+    myPTRACE(1, dst.Name() << " LoopChannel::OnPacket " T38_IFP_NAME " decode failure");
+    return TRUE;
+  }
+
+  return dst.HandlePacket(EngineBase::HOWNERIN(this), ifp);
+}
+
+void LoopChannel::ReadLoop()
+{
+  Packet packet;
+
+  while (!stop) {
+    int wait = Get(packet);
+
+    if (wait) {
+      int timeout = reorder.GetTimeout();
+
+      if (timeout >= 0 && (wait < 0 || timeout < wait))
+        wait = timeout;
+
+      ModemClock::Get().Wait(ready, PTimeInterval(wait < 0 ? 100 : (wait > 0 ? wait : 1)));
+
+      if (!reorder.Flush(*this))
+        break;
+
+      continue;
+    }
+
+    stats.packetLatency.Add(SimUs() - packet.sent);
+
+    if (!reorder.Receive(WORD(packet.seq & 0xFFFF), packet.data, packet.len, *this)) {
+      stop = TRUE;
+      break;
+    }
+  }
+
+  PWaitAndSignal mutexWait(stats.mutex);
+
+  stats.lost += reorder.GetLost();
+  stats.reordered += reorder.GetReordered();
+  stats.recovered += reorder.GetRecovered();
+}
+///////////////////////////////////////////////////////////////
+class LoopPair;
+class LoopModem;
+
+/**Scripted Class 1 DTE. The caller sends the pages, the other one
+   receives them.
+ */
+class LoopDte : public ModemThreadChild, protected DteScript
+{
+    PCLASSINFO(LoopDte, ModemThreadChild);
+  public:
+    LoopDte(LoopModem &_parent, LoopPair &_pair, PBoolean _caller);
+    ~LoopDte();
+
+  protected:
+    LoopModem &Parent() const;
+    virtual void Main();
+
+    virtual const BYTE *Read(PINDEX &len, int timeout);
+    virtual PBoolean Write(const void *pBuf, PINDEX count);
+    virtual PBoolean NoMoreCalls();
+    virtual void OnPage(PBoolean sender, PInt64 us);
+
+    LoopPair &pair;
+    PBoolean caller;
+    PBYTEArray *inBuf;
+};
+///////////////////////////////////////////////////////////////
+class LoopModem : public PseudoModemBody
+{
+    PCLASSINFO(LoopModem, PseudoModemBody);
+  public:
+    LoopModem(
+      const PString &_name,
+      LoopPair &_pair,
+      PBoolean _caller,
+      const PNotifier &_callbackEndPoint
+    );
+    ~LoopModem();
+
+    PBYTEArray *FromModem() { return FromOutPtyQ(); }
+    void ToModem(const void *pBuf, PINDEX count) { ToInPtyQ(pBuf, count); }
+
+  protected:
+    const PString &ttyPath() const { return ttypath; }
+    ModemThreadChild *GetPtyNotifier() { return dte; }
+    PBoolean StartAll();
+    void StopAll();
+    void MainLoop();
+
+    PString ttypath;
+    LoopPair &pair;
+    PBoolean caller;
+    LoopDte *dte;
+};
+///////////////////////////////////////////////////////////////
+class LoopPair : public PObject
+{
+    PCLASSINFO(LoopPair, PObject);
+  public:
+    LoopPair(
+      int _index,
+      const LoopConfig &_config,
+      LoopStats &_stats,
+      const PBYTEArray &_page,
+      const PNotifier &callbackEndPoint
+    );
+    ~LoopPair();
+
+    void Start();
+    void WaitForTermination();
+    void ClearCall();
+
+    const int index;
+    const LoopConfig &config;
+    LoopStats &stats;
+    const PBYTEArray &page;
+
+    LoopModem *modems[2];             ///<  [0] - caller (sender), [1] - answerer
+
+    PMutex mutex;
+    PString callToken;
+    long calls;
+    T38Engine *t38[2];
+    AudioEngine *audio[2];
+    LoopChannel *channels[2];
+    volatile PBoolean senderDone;
+};
+///////////////////////////////////////////////////////////////
+LoopModem::LoopModem(
+    const PString &_name,
+    LoopPair &_pair,
+    PBoolean _caller,
+    const PNotifier &_callbackEndPoint)
+  : PseudoModemBody(_name, PString(), _callbackEndPoint),
+    ttypath(_name),
+    pair(_pair),
+    caller(_caller),
+    dte(NULL)
+{
+  ptyname = _name;
+  valid = TRUE;
+}
+
+LoopModem::~LoopModem()
+{
+  StopAll();
+}
+
+PBoolean LoopModem::StartAll()
+{
+  if ((dte = new LoopDte(*this, pair, caller)) != NULL && PseudoModemBody::StartAll()) {
+    dte->Resume();
+    return TRUE;
+  }
+
+  StopAll();
+  return FALSE;
+}
+
+void LoopModem::StopAll()
+{
+  if (dte) {
+    dte->SignalStop();
+    {
+      ModemClock::Blocking blocking;
+      dte->WaitForTermination();
+    }
+    PWaitAndSignal mutexWait(Mutex);
+    delete dte;
+    dte = NULL;
+  }
+
+  PseudoModemBody::StopAll();
+}
+
+void LoopModem::MainLoop()
+{
+  if (StartAll()) {
+    while (!stop && !childstop)
+      WaitDataReady();
+  }
+
+  StopAll();
+}
+///////////////////////////////////////////////////////////////
+inline LoopModem &LoopDte::Parent() const
+{
+  return (LoopModem &)parent;
+}
+
+LoopDte::LoopDte(LoopModem &_parent, LoopPair &_pair, PBoolean _caller)
+  : ModemThreadChild(_parent),
+    DteScript(_parent.ptyName(), 146, _pair.config.ecm),
+    pair(_pair),
+    caller(_caller),
+    inBuf(NULL)
+{
+}
+
+LoopDte::~LoopDte()
+{
+  if (inBuf)
+    delete inBuf;
+}
+
+const BYTE *LoopDte::Read(PINDEX &len, int timeout)
+{
+  PInt64 end = SimUs() + PInt64(timeout)*1000;
+
+  for (;;) {
+    if (inBuf) {
+      delete inBuf;
+      inBuf = NULL;
+    }
+
+    if (stop)
+      return NULL;
+
+    if ((inBuf = Parent().FromModem()) != NULL) {
+      if ((len = inBuf->GetSize()) > 0)
+        return *inBuf;
+
+      continue;
+    }
+
+    PInt64 left = end - SimUs();
+
+    if (left <= 0)
+      return NULL;
+
+    ModemClock::Get().Wait(dataReadySyncPoint, PTimeInterval(left/1000 + 1));
+  }
+}
+
+PBoolean LoopDte::Write(const void *pBuf, PINDEX count)
+{
+  Parent().ToModem(pBuf, count);
+
+  return TRUE;
+}
+
+PBoolean LoopDte::NoMoreCalls()
+{
+  return pair.senderDone || stop;
+}
+
+void LoopDte::OnPage(PBoolean sender, PInt64 us)
+{
+  if (!sender)
+    return;
+
+  pair.stats.pageLatency.Add(us);
+
+  PWaitAndSignal mutexWait(pair.stats.mutex);
+  pair.stats.pages++;
+}
+
+void LoopDte::Main()
+{
+  ModemClock::Participant participant;
+
+  RenameCurrentThread(Parent().ptyName() + "(d)");
+  myPTRACE(1, "DTE Started");
+
+  if (Expect("E0", "OK") && Expect("+FCLASS=1", "OK")) {
+    if (caller) {
+      for (int i = 0 ; i < pair.config.sessions && !stop ; i++) {
+        PBoolean ok = Sender(PString(PString::Signed, pair.index), pair.page, pair.config.pages, 50);
+
+        {
+          PWaitAndSignal mutexWait(pair.stats.mutex);
+
+          if (ok)
+            pair.stats.sessions++;
+          else
+            pair.stats.failures++;
+        }
+
+        if (!ok) {
+          myPTRACE(1, "DTE session " << i << " failed");
+          HangUp();
+          ModemClock::Get().Sleep(1000);
+        }
+      }
+    } else {
+      for (;;) {
+        int res = Receiver();
+
+        if (res < 0)
+          break;
+
+        if (res == 0) {
+          myPTRACE(1, "DTE receiver error");
+          {
+            PWaitAndSignal mutexWait(pair.stats.mutex);
+            pair.stats.receiverErrors++;
+          }
+          HangUp();
+        }
+      }
+    }
+  }
+
+  if (caller)
+    pair.senderDone = TRUE;
+
+  myPTRACE(1, "DTE Stopped" << GetThreadTimes(", CPU usage: "));
+
+  SignalStop();
+}
+///////////////////////////////////////////////////////////////
+LoopPair::LoopPair(
+    int _index,
+    const LoopConfig &_config,
+    LoopStats &_stats,
+    const PBYTEArray &_page,
+    const PNotifier &callbackEndPoint)
+  : index(_index),
+    config(_config),
+    stats(_stats),
+    page(_page),
+    calls(0),
+    senderDone(FALSE)
+{
+  modems[0] = new LoopModem(psprintf("loop%d-s", index), *this, TRUE, callbackEndPoint);
+  modems[1] = new LoopModem(psprintf("loop%d-r", index), *this, FALSE, callbackEndPoint);
+
+  for (int i = 0 ; i < 2 ; i++) {
+    t38[i] = NULL;
+    audio[i] = NULL;
+    channels[i] = NULL;
+  }
+}
+
+LoopPair::~LoopPair()
+{
+  ClearCall();
+
+  for (int i = 0 ; i < 2 ; i++)
+    delete modems[i];
+}
+
+void LoopPair::Start()
+{
+  for (int i = 0 ; i < 2 ; i++)
+    modems[i]->Resume();
+}
+
+void LoopPair::WaitForTermination()
+{
+  for (int i = 0 ; i < 2 ; i++)
+    modems[i]->WaitForTermination();
+}
+
+void LoopPair::ClearCall()
+{
+  LoopChannel *_channels[2];
+  EngineBase *engines[4];
+
+  {
+    PWaitAndSignal mutexWait(mutex);
+
+    callToken = PString();
+
+    for (int i = 0 ; i < 2 ; i++) {
+      _channels[i] = channels[i];
+      channels[i] = NULL;
+      engines[i] = t38[i];
+      t38[i] = NULL;
+      engines[i + 2] = audio[i];
+      audio[i] = NULL;
+    }
+  }
+
+  for (int i = 0 ; i < 2 ; i++) {
+    if (_channels[i])
+      delete _channels[i];
+  }
+
+  for (int i = 0 ; i < 4 ; i++) {
+    if (engines[i])
+      ReferenceObject::DelPointer(engines[i]);
+  }
+}
+///////////////////////////////////////////////////////////////
+/**Replaces the OPAL endpoint. The calls are routed from the caller of
+   each pair to its answerer and the T.38 engines are connected with
+   LoopChannel on the mode request.
+ */
+class LoopEndPoint : public PObject
+{
+    PCLASSINFO(LoopEndPoint, PObject);
+  public:
+    LoopEndPoint(const LoopConfig &_config, LoopStats &_stats, int _numPairs);
+    ~LoopEndPoint();
+
+    void Run();
+
+  protected:
+    PDECLARE_NOTIFIER(PObject, LoopEndPoint, OnMyCallback);
+
+    LoopPair *FindPair(const PString &modemToken, int &side) const;
+
+    const LoopConfig &config;
+    LoopStats &stats;
+    const int numPairs;
+    LoopPair **pairs;
+    PBYTEArray page;
+};
+///////////////////////////////////////////////////////////////
+LoopEndPoint::LoopEndPoint(const LoopConfig &_config, LoopStats &_stats, int _numPairs)
+  : config(_config),
+    stats(_stats),
+    numPairs(_numPairs),
+    pairs(new LoopPair *[_numPairs])
+{
+  DteScript::MakePage(page, config.pageLines, config.density);
+
+  for (int i = 0 ; i < numPairs ; i++)
+    pairs[i] = new LoopPair(i, config, stats, page, PCREATE_NOTIFIER(OnMyCallback));
+}
+
+LoopEndPoint::~LoopEndPoint()
+{
+  for (int i = 0 ; i < numPairs ; i++)
+    delete pairs[i];
+
+  delete [] pairs;
+}
+
+void LoopEndPoint::Run()
+{
+  for (int i = 0 ; i < numPairs ; i++)
+    pairs[i]->Start();
+
+  for (int i = 0 ; i < numPairs ; i++)
+    pairs[i]->WaitForTermination();
+}
+
+LoopPair *LoopEndPoint::FindPair(const PString &modemToken, int &side) const
+{
+  // modem tokens are loop<index>-s and loop<index>-r
+  int i = (int)modemToken.Mid(4).AsInteger();
+
+  if (modemToken.Left(4) != "loop" || i < 0 || i >= numPairs)
+    return NULL;
+
+  side = (modemToken.Right(1) == "s") ? 0 : 1;
+
+  return pairs[i];
+}
+
+void LoopEndPoint::OnMyCallback(PObject &from, INT myPTRACE_PARAM(extra))
+{
+  if (!PIsDescendant(&from, PStringToString))
+    return;
+
+  PStringToString &request = (PStringToString &)from;
+  PString command = request("command");
+
+  myPTRACE(2, "LoopEndPoint::OnMyCallback command=" << command << " extra=" << extra);
+
+  PString modemToken = request("modemtoken");
+  PString response = "reject";
+  int side;
+  LoopPair *pair = FindPair(modemToken, side);
+
+  if (pair == NULL) {
+    myPTRACE(1, "LoopEndPoint::OnMyCallback unknown modem " << modemToken);
+  }
+  else
+  if (command == "dial") {
+    PString callToken;
+
+    {
+      PWaitAndSignal mutexWait(pair->mutex);
+
+      if (side == 0 && pair->callToken.IsEmpty())
+        pair->callToken = callToken = psprintf("call%d-%ld", pair->index, ++pair->calls);
+    }
+
+    if (!callToken.IsEmpty()) {
+      PStringToString call;
+
+      call.SetAt("command", "call");
+      call.SetAt("calltoken", callToken);
+      call.SetAt("srcnum", psprintf("%d", 1000 + pair->index));
+      call.SetAt("srcname", modemToken);
+      call.SetAt("dstnum", request("number"));
+
+      if (pair->modems[1]->Request(call) && call("response") == "confirm") {
+        request.SetAt("calltoken", callToken);
+        response = "confirm";
+      } else {
+        PWaitAndSignal mutexWait(pair->mutex);
+
+        if (pair->callToken == callToken)
+          pair->callToken = PString();
+      }
+    }
+  }
+  else
+  if (command == "answer") {
+    PString callToken = request("calltoken");
+
+    if (callToken == pair->callToken) {
+      for (int i = 0 ; i < 2 ; i++) {
+        AudioEngine *engine = pair->modems[i]->NewPtrAudioEngine();
+
+        PWaitAndSignal mutexWait(pair->mutex);
+
+        if (pair->audio[i] == NULL)
+          pair->audio[i] = engine;
+        else
+        if (engine)
+          ReferenceObject::DelPointer(engine);
+      }
+
+      PStringToString established;
+
+      established.SetAt("command", "established");
+      established.SetAt("calltoken", callToken);
+
+      for (int i = 1 ; i >= 0 ; i--) {
+        if (!pair->modems[i]->Request(established) || established("response") != "confirm") {
+          myPTRACE(1, "LoopEndPoint::OnMyCallback established rejected by " << pair->modems[i]->modemToken());
+        }
+      }
+
+      response = "confirm";
+    }
+  }
+  else
+  if (command == "requestmode") {
+    if (request("calltoken") == pair->callToken) {
+      T38Engine *engine = pair->modems[side]->NewPtrT38Engine();
+
+      if (engine) {
+        PWaitAndSignal mutexWait(pair->mutex);
+
+        if (pair->t38[side] == NULL)
+          pair->t38[side] = engine;
+        else
+          ReferenceObject::DelPointer(engine);
+
+        if (pair->t38[0] && pair->t38[1] && pair->channels[0] == NULL) {
+          for (int i = 0 ; i < 2 ; i++) {
+            pair->channels[i] = new LoopChannel(config, stats, *pair->t38[i], *pair->t38[1 - i],
+                                                (unsigned long)(pair->index*2 + i + 1));
+            pair->channels[i]->Start();
+          }
+        }
+
+        response = "confirm";
+      }
+    }
+  }
+  else
+  if (command == "clearcall") {
+    PString callToken = request("calltoken");
+
+    if (!callToken.IsEmpty() && callToken == pair->callToken) {
+      pair->ClearCall();
+
+      PStringToString clear;
+
+      clear.SetAt("command", "clearcall");
+      clear.SetAt("calltoken", callToken);
+      pair->modems[1 - side]->Request(clear);
+    }
+
+    response = "confirm";
+  }
+  else
+  if (command == "addmodem") {
+    response = "confirm";
+  }
+
+  request.SetAt("response", response);
+
+  myPTRACE(2, "LoopEndPoint::OnMyCallback request={\n" << request << "}");
+}
+///////////////////////////////////////////////////////////////
+class T38Loop : public PProcess
+{
+  PCLASSINFO(T38Loop, PProcess)
+
+  public:
+    T38Loop();
+
+    void Main();
+
+  protected:
+    double Run(const LoopConfig &config, int numPairs);
+};
+
+PCREATE_PROCESS(T38Loop);
+///////////////////////////////////////////////////////////////
+T38Loop::T38Loop()
+  : PProcess("Vyacheslav Frolov", "T38Loop",
+             MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER)
+{
+}
+
+void T38Loop::Main()
+{
+  PArgList &args = GetArguments();
+
+  args.Parse(
+             "p-pairs:"
+             "s-sessions:"
+             "n-pages:"
+             "e-ecm."
+             "-page-lines:"
+             "-density:"
+             "l-loss:"
+             "r-reorder:"
+             "d-delay:"
+             "j-jitter:"
+             "-reorder-depth:"
+             "-reorder-delay:"
+             "R-ramp."
+             "V-virtual."
+             "h-help."
+#if PTRACING
+             "t-trace."
+             "o-output:"
+#endif
+          , FALSE);
+
+#if PTRACING
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::DateAndTime | PTrace::Thread | PTrace::Blocks);
+#endif
+
+  if (args.HasOption('h')) {
+    cout <<
+        "Usage:\n"
+        "  " << GetName() << " [options]\n"
+        "\n"
+        "Options:\n"
+        "  -p --pairs num            : Number of modem pairs (default 1).\n"
+        "  -R --ramp                 : Run with 1, 2, 4, ... pairs up to --pairs and\n"
+        "                              stop when the pages/s stops growing.\n"
+        "  -V --virtual              : Run in virtual time (as fast as possible).\n"
+        "  -s --sessions num         : Sessions per pair (default 1).\n"
+        "  -n --pages num            : Pages per session (default 2).\n"
+        "  -e --ecm                  : Use ECM.\n"
+        "     --page-lines num       : Scan lines per page (default 1100).\n"
+        "     --density num          : Percents of non-blank lines (default 5).\n"
+        "  -l --loss num             : Lost packets in 1/1000 (default 0).\n"
+        "  -r --reorder num          : Reordered packets in 1/1000 (default 0).\n"
+        "  -d --delay ms             : One way delay (default 0).\n"
+        "  -j --jitter ms            : Max random extra delay (default 0).\n"
+        "     --reorder-depth num    : Depth of receive reorder buffer (default 0).\n"
+        "     --reorder-delay ms     : Max hold time of reorder buffer (default 0).\n"
+#if PTRACING
+        "  -t --trace                : Enable trace, use multiple times for more detail.\n"
+        "  -o --output file          : File for trace output, default is stderr.\n"
+#endif
+        "  -h --help                 : Display this help message.\n"
+        "\n"
+        "The exit code is 1 if any session failed.\n"
+        << endl;
+    return;
+  }
+
+  LoopConfig config;
+
+  if (args.HasOption('s'))
+    config.sessions = (int)args.GetOptionString('s').AsInteger();
+
+  if (args.HasOption('n'))
+    config.pages = (int)args.GetOptionString('n').AsInteger();
+
+  config.ecm = args.HasOption('e');
+  config.virtualTime = args.HasOption('V');
+
+  if (args.HasOption("page-lines"))
+    config.pageLines = (int)args.GetOptionString("page-lines").AsInteger();
+
+  if (args.HasOption("density"))
+    config.density = (int)args.GetOptionString("density").AsInteger();
+
+  if (args.HasOption('l'))
+    config.loss = (int)args.GetOptionString('l').AsInteger();
+
+  if (args.HasOption('r'))
+    config.reorder = (int)args.GetOptionString('r').AsInteger();
+
+  if (args.HasOption('d'))
+    config.delay = (int)args.GetOptionString('d').AsInteger();
+
+  if (args.HasOption('j'))
+    config.jitter = (int)args.GetOptionString('j').AsInteger();
+
+  if (args.HasOption("reorder-depth"))
+    config.reorderDepth = (int)args.GetOptionString("reorder-depth").AsInteger();
+
+  if (args.HasOption("reorder-delay"))
+    config.reorderDelay = (int)args.GetOptionString("reorder-delay").AsInteger();
+
+  int numPairs = args.HasOption('p') ? (int)args.GetOptionString('p').AsInteger() : 1;
+
+  if (numPairs < 1)
+    numPairs = 1;
+
+  if (!args.HasOption('R')) {
+    Run(config, numPairs);
+    return;
+  }
+
+  double best = 0;
+
+  for (int n = 1 ;; n = PMIN(n*2, numPairs)) {
+    double rate = Run(config, n);
+
+    if (n >= numPairs)
+      break;
+
+    if (rate < best*1.05) {
+      cout << "Saturated at " << n << " pairs" << endl;
+      break;
+    }
+
+    if (best < rate)
+      best = rate;
+  }
+}
+
+double T38Loop::Run(const LoopConfig &config, int numPairs)
+{
+  LoopStats stats;
+  VirtualClock *clock = NULL;
+
+  if (config.virtualTime) {
+    clock = new VirtualClock;
+    ModemClock::Set(clock);
+  }
+
+  double cpu = CpuSeconds();
+  PInt64 begin = NowUs();
+
+  {
+    LoopEndPoint endpoint(config, stats, numPairs);
+
+    endpoint.Run();
+  }
+
+  double elapsed = (NowUs() - begin)/1e6;
+  double simulated = elapsed;
+  long advances = 0;
+
+  if (clock) {
+    simulated = clock->GetElapsed().GetMilliSeconds()/1000.0;
+    advances = clock->GetAdvances();
+    ModemClock::Set(NULL);
+    delete clock;
+  }
+
+  cpu = CpuSeconds() - cpu;
+
+  if (elapsed <= 0)
+    elapsed = 1e-6;
+
+  double rate = stats.pages/elapsed;
+
+  cout << setprecision(3) << setiosflags(ios::fixed)
+       << "pairs=" << numPairs
+       << " sessions=" << stats.sessions << "/" << (stats.sessions + stats.failures)
+       << " receiver-errors=" << stats.receiverErrors
+       << " pages=" << stats.pages
+       << " elapsed=" << elapsed << "s";
+
+  if (config.virtualTime)
+    cout << " simulated=" << simulated << "s (x" << simulated/elapsed << ", " << advances << " jumps)";
+
+  cout
+       << "\n  pages/s=" << rate
+       << " cpu=" << cpu << "s"
+       << " cpu/page=" << (stats.pages ? cpu*1000/stats.pages : 0.0) << "ms"
+       << " packets/s=" << stats.packets/elapsed
+       << " bytes/s=" << stats.bytes/elapsed
+       << "\n  packets=" << stats.packets
+       << " dropped=" << stats.dropped
+       << " delayed=" << stats.delayed
+       << " lost=" << stats.lost
+       << " reordered=" << stats.reordered
+       << " recovered=" << stats.recovered
+       << "\n  packet latency us:"
+       << " p50=" << stats.packetLatency.Percentile(50)
+       << " p90=" << stats.packetLatency.Percentile(90)
+       << " p99=" << stats.packetLatency.Percentile(99)
+       << " max=" << stats.packetLatency.GetMax()
+       << "\n  page latency ms:"
+       << " p50=" << stats.pageLatency.Percentile(50)/1000
+       << " p90=" << stats.pageLatency.Percentile(90)/1000
+       << " p99=" << stats.pageLatency.Percentile(99)/1000
+       << " max=" << stats.pageLatency.GetMax()/1000
+       << endl;
+
+  if (stats.failures || stats.receiverErrors || stats.sessions < long(numPairs)*config.sessions)
+    SetTerminationValue(1);
+
+  return rate;
+}
+///////////////////////////////////////////////////////////////
+
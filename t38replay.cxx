@@ -0,0 +1,1461 @@
+/*
+ * t38replay.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: t38replay.cxx,v $
+ *
+ */
+
+/*
+ * Replay of captured T.38 streams.
+ *
+ * The UDPTL (T.38 Annex A) and RTP (T.38 Annex B) streams are extracted
+ * from a pcap file and each direction is fed to its own T38Engine the
+ * same way as T38ModemMediaStream::WritePacket() does (the shared
+ * ReorderBuffer::Receive(), IFP decoding, HandlePacket() and
+ * HandlePacketLost()). The received data is read by a null fax application
+ * (RecvWait()/RecvStart()/Recv()) and discarded. The packets are replayed
+ * in virtual time (default), with the original timing or as fast as
+ * possible.
+ */
+
+#include <ptlib.h>
+
+#ifdef USE_OPAL
+  #include <opal/buildopts.h>
+  #include <asn/t38.h>
+#else
+  #include <t38.h>
+#endif
+
+#include <time.h>
+
+#include "version.h"
+#include "pmutils.h"
+#include "t38engine.h"
+#include "ifpcodec.h"
+#include "reorder.h"
+
+#define new PNEW
+
+#define T38I(t30_indicator) T38_Type_of_msg_t30_indicator::t30_indicator
+
+///////////////////////////////////////////////////////////////
+static PInt64 NowUs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return PInt64(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+static WORD Get16(const BYTE *p)
+{
+  return WORD((p[0] << 8) | p[1]);
+}
+///////////////////////////////////////////////////////////////
+/**Class 1 modulation (+FRH/+FRM parameter) of the T.30 indicator or 0.
+  */
+static int IndicatorMod(unsigned indicator)
+{
+  static const struct {
+    unsigned indicator;
+    int mod;
+  } indMods[] = {
+    { T38I(e_v21_preamble),               3 },
+    { T38I(e_v27_2400_training),         24 },
+    { T38I(e_v27_4800_training),         48 },
+    { T38I(e_v29_7200_training),         72 },
+    { T38I(e_v17_7200_long_training),    73 },
+    { T38I(e_v17_7200_short_training),   74 },
+    { T38I(e_v29_9600_training),         96 },
+    { T38I(e_v17_9600_long_training),    97 },
+    { T38I(e_v17_9600_short_training),   98 },
+    { T38I(e_v17_12000_long_training),  121 },
+    { T38I(e_v17_12000_short_training), 122 },
+    { T38I(e_v17_14400_long_training),  145 },
+    { T38I(e_v17_14400_short_training), 146 },
+  };
+
+  for (PINDEX i = 0 ; i < PINDEX(sizeof(indMods)/sizeof(indMods[0])) ; i++) {
+    if (indMods[i].indicator == indicator)
+      return indMods[i].mod;
+  }
+
+  return 0;
+}
+///////////////////////////////////////////////////////////////
+/**Thread CPU time accounting per processing stage.
+
+   All the stages run in the replay thread (the callbacks of the engine
+   are called from HandlePacket()), so the CPU time of the thread between
+   two switches belongs to the stage switched from.
+ */
+class StageProfiler
+{
+  public:
+    enum Stage {
+      stRead,                           ///<  pcap file reading
+      stParse,                          ///<  link, IP, UDP, UDPTL and RTP headers
+      stReorder,                        ///<  ReorderBuffer
+      stDecode,                         ///<  IFPCodec::Decode()
+      stEngine,                         ///<  T38Engine::HandlePacket()
+      stSink,                           ///<  RecvWait()/RecvStart()/Recv()
+      stNumStages
+    };
+
+    StageProfiler() : current(stRead), last(GetThreadCpuNs()) {
+      for (int i = 0 ; i < stNumStages ; i++)
+        ns[i] = 0;
+    }
+
+    /**Account the CPU time to the current stage and switch to the stage.
+       Returns the previous stage.
+      */
+    Stage Switch(Stage stage) {
+      PInt64 now = GetThreadCpuNs();
+      Stage prev = current;
+
+      ns[current] += now - last;
+      last = now;
+      current = stage;
+
+      return prev;
+    }
+
+    PInt64 GetNs(int stage) const { return ns[stage]; }
+
+    static const char *Name(int stage) {
+      static const char * const names[stNumStages] = {
+        "read", "parse", "reorder", "decode", "engine", "sink"
+      };
+
+      return names[stage];
+    }
+
+  protected:
+    Stage current;
+    PInt64 last;
+    PInt64 ns[stNumStages];
+};
+///////////////////////////////////////////////////////////////
+class ReplayConfig
+{
+  public:
+    enum Timing {
+      tmVirtual,                        ///<  As fast as possible in virtual time
+      tmReal,                           ///<  Original timing
+      tmNone,                           ///<  As fast as possible in real time
+    };
+
+    ReplayConfig()
+      : timing(tmVirtual), port(0), rtpPayloadType(-1), corrigendum(-1),
+        reorderDepth(0), reorderDelay(0) {}
+
+    Timing timing;
+    int port;                           ///<  0 - any
+    int rtpPayloadType;                 ///<  -1 - any dynamic
+    int corrigendum;                    ///<  -1 - auto
+    int reorderDepth;
+    int reorderDelay;
+};
+///////////////////////////////////////////////////////////////
+/**Reader of the classic (not pcapng) capture files.
+  */
+class PcapReader
+{
+  public:
+    enum { maxRecord = 0x40000 };
+
+    PcapReader() : swapped(FALSE), nano(FALSE), linkType(-1) {}
+
+    PBoolean Open(const PFilePath &fileName);
+
+    /**Read the next record with the capture time in us.
+       Returns FALSE at the end of the file or on error (see GetError()).
+      */
+    PBoolean Next(PInt64 &timeUs, const BYTE * &pData, PINDEX &len);
+
+    int GetLinkType() const { return linkType; }
+    const PString &GetError() const { return error; }
+
+  protected:
+    PBoolean ReadExact(void *pBuf, PINDEX len);
+    DWORD Get32(const BYTE *p) const;
+
+    PFile file;
+    PBoolean swapped;
+    PBoolean nano;
+    int linkType;
+    PString error;
+    PBYTEArray record;
+};
+
+PBoolean PcapReader::Open(const PFilePath &fileName)
+{
+  if (!file.Open(fileName, PFile::ReadOnly)) {
+    error = "can't open " + fileName;
+    return FALSE;
+  }
+
+  BYTE hdr[24];
+
+  if (!ReadExact(hdr, sizeof(hdr))) {
+    error = "too short file";
+    return FALSE;
+  }
+
+  DWORD magic = DWORD((hdr[0] << 24) | (hdr[1] << 16) | (hdr[2] << 8) | hdr[3]);
+
+  switch (magic) {
+    case 0xa1b2c3d4: swapped = FALSE; nano = FALSE; break;
+    case 0xd4c3b2a1: swapped = TRUE;  nano = FALSE; break;
+    case 0xa1b23c4d: swapped = FALSE; nano = TRUE;  break;
+    case 0x4d3cb2a1: swapped = TRUE;  nano = TRUE;  break;
+    case 0x0a0d0d0a:
+      error = "pcapng is not supported, convert it with 'editcap -F pcap'";
+      return FALSE;
+    default:
+      error = "not a pcap file";
+      return FALSE;
+  }
+
+  linkType = int(Get32(hdr + 20) & 0x0FFFFFFF);
+
+  switch (linkType) {
+    case 0:
+    case 1:
+    case 12:
+    case 14:
+    case 101:
+    case 113:
+    case 276:
+      break;
+    default:
+      error = psprintf("link type %d is not supported", linkType);
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+PBoolean PcapReader::Next(PInt64 &timeUs, const BYTE * &pData, PINDEX &len)
+{
+  BYTE hdr[16];
+
+  if (!ReadExact(hdr, sizeof(hdr)))
+    return FALSE;
+
+  DWORD inclLen = Get32(hdr + 8);
+
+  if (inclLen > maxRecord) {
+    error = psprintf("bad record length %u", (unsigned)inclLen);
+    return FALSE;
+  }
+
+  if (!ReadExact(record.GetPointer(PINDEX(inclLen) + 1), PINDEX(inclLen))) {
+    error = "truncated record";
+    return FALSE;
+  }
+
+  DWORD frac = Get32(hdr + 4);
+
+  timeUs = PInt64(Get32(hdr))*1000000 + (nano ? frac/1000 : frac);
+  pData = record;
+  len = PINDEX(inclLen);
+
+  return TRUE;
+}
+
+PBoolean PcapReader::ReadExact(void *pBuf, PINDEX len)
+{
+  return len == 0 || (file.Read(pBuf, len) && file.GetLastReadCount() == len);
+}
+
+DWORD PcapReader::Get32(const BYTE *p) const
+{
+  if (swapped)
+    return DWORD((p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0]);
+
+  return DWORD((p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+///////////////////////////////////////////////////////////////
+/**Source and destination of an UDP datagram.
+  */
+class FlowKey
+{
+  public:
+    FlowKey() : family(0), srcPort(0), dstPort(0) {
+      memset(src, 0, sizeof(src));
+      memset(dst, 0, sizeof(dst));
+    }
+
+    PBoolean operator==(const FlowKey &other) const {
+      return family == other.family &&
+             srcPort == other.srcPort && dstPort == other.dstPort &&
+             memcmp(src, other.src, sizeof(src)) == 0 &&
+             memcmp(dst, other.dst, sizeof(dst)) == 0;
+    }
+
+    PString AsString() const {
+      return AddrAsString(src, srcPort) + " -> " + AddrAsString(dst, dstPort);
+    }
+
+    int family;                         ///<  4 or 6
+    BYTE src[16];
+    BYTE dst[16];
+    WORD srcPort;
+    WORD dstPort;
+
+  protected:
+    PString AddrAsString(const BYTE *addr, WORD port) const {
+      if (family == 4)
+        return psprintf("%u.%u.%u.%u:%u", addr[0], addr[1], addr[2], addr[3], port);
+
+      PString str = "[";
+
+      for (int i = 0 ; i < 16 ; i += 2)
+        str += psprintf(i ? ":%x" : "%x", Get16(addr + i));
+
+      return str + psprintf("]:%u", port);
+    }
+};
+///////////////////////////////////////////////////////////////
+class CaptureStats
+{
+  public:
+    CaptureStats()
+      : records(0), udp(0), notUdp(0), fragments(0), truncated(0),
+        unclassified(0), filtered(0) {}
+
+    long records;
+    long udp;
+    long notUdp;                        ///<  Not IP or not UDP
+    long fragments;                     ///<  Fragmented IPv4 (skipped)
+    long truncated;
+    long unclassified;                  ///<  UDP datagrams of not T.38 flows
+    long filtered;                      ///<  UDP datagrams not matching --port
+};
+
+/**Extract UDP payload from the captured frame.
+   Returns FALSE if it's not an UDP datagram (counted in stats).
+  */
+static PBoolean ParseFrame(
+  int linkType,
+  const BYTE *p,
+  PINDEX len,
+  FlowKey &key,
+  const BYTE * &pPayload,
+  PINDEX &payloadLen,
+  CaptureStats &stats)
+{
+  int version = 0;
+
+  switch (linkType) {
+    case 1: {                           // Ethernet
+      if (len < 14)
+        break;
+
+      WORD type = Get16(p + 12);
+
+      p += 14;
+      len -= 14;
+
+      while ((type == 0x8100 || type == 0x88a8) && len >= 4) {
+        type = Get16(p + 2);
+        p += 4;
+        len -= 4;
+      }
+
+      version = type == 0x0800 ? 4 : type == 0x86dd ? 6 : -1;
+      break;
+    }
+    case 113: {                         // Linux cooked
+      if (len < 16)
+        break;
+
+      WORD type = Get16(p + 14);
+
+      p += 16;
+      len -= 16;
+      version = type == 0x0800 ? 4 : type == 0x86dd ? 6 : -1;
+      break;
+    }
+    case 276: {                         // Linux cooked v2
+      if (len < 20)
+        break;
+
+      WORD type = Get16(p);
+
+      p += 20;
+      len -= 20;
+      version = type == 0x0800 ? 4 : type == 0x86dd ? 6 : -1;
+      break;
+    }
+    case 0:                             // BSD loopback
+      if (len < 4)
+        break;
+
+      p += 4;
+      len -= 4;
+      // fall through
+    case 12:
+    case 14:
+    case 101:                           // Raw IP
+      if (len > 0)
+        version = p[0] >> 4;
+      break;
+    default:
+      break;
+  }
+
+  if (version == 0) {
+    stats.truncated++;
+    return FALSE;
+  }
+
+  if (version == 4) {
+    if (len < 20) {
+      stats.truncated++;
+      return FALSE;
+    }
+
+    PINDEX ihl = (p[0] & 0x0F)*4;
+    PINDEX total = Get16(p + 2);
+
+    if (p[9] != 17) {
+      stats.notUdp++;
+      return FALSE;
+    }
+
+    if ((Get16(p + 6) & 0x3FFF) != 0) {
+      stats.fragments++;
+      return FALSE;
+    }
+
+    if (ihl < 20 || total < ihl || total > len) {
+      stats.truncated++;
+      return FALSE;
+    }
+
+    key.family = 4;
+    memcpy(key.src, p + 12, 4);
+    memcpy(key.dst, p + 16, 4);
+    p += ihl;
+    len = total - ihl;
+  }
+  else
+  if (version == 6) {
+    if (len < 40) {
+      stats.truncated++;
+      return FALSE;
+    }
+
+    PINDEX payload = Get16(p + 4);
+
+    if (p[6] != 17) {
+      stats.notUdp++;
+      return FALSE;
+    }
+
+    if (payload > len - 40) {
+      stats.truncated++;
+      return FALSE;
+    }
+
+    key.family = 6;
+    memcpy(key.src, p + 8, 16);
+    memcpy(key.dst, p + 24, 16);
+    p += 40;
+    len = payload;
+  }
+  else {
+    stats.notUdp++;
+    return FALSE;
+  }
+
+  if (len < 8 || Get16(p + 4) < 8 || Get16(p + 4) > len) {
+    stats.truncated++;
+    return FALSE;
+  }
+
+  key.srcPort = Get16(p);
+  key.dstPort = Get16(p + 2);
+  pPayload = p + 8;
+  payloadLen = Get16(p + 4) - 8;
+  stats.udp++;
+
+  return TRUE;
+}
+///////////////////////////////////////////////////////////////
+/**Aligned PER UDPTL packet (T.38 Annex A).
+  */
+class UdptlPacket
+{
+  public:
+    enum { maxSecondary = 16 };
+
+    /**Parse the packet. The data is not copied.
+       Returns FALSE if the packet is malformed or fragmented.
+      */
+    PBoolean Parse(const BYTE *p, PINDEX len);
+
+    WORD seq;
+    const BYTE *primary;
+    PINDEX primaryLen;
+    PBoolean fec;
+    int numSecondary;                   ///<  seq - 1, seq - 2, ...
+    const BYTE *secondary[maxSecondary];
+    PINDEX secondaryLen[maxSecondary];
+
+  protected:
+    static PBoolean GetLength(const BYTE * &p, const BYTE *end, PINDEX &len);
+    static PBoolean GetOpenType(const BYTE * &p, const BYTE *end, const BYTE * &pData, PINDEX &len);
+};
+
+PBoolean UdptlPacket::Parse(const BYTE *p, PINDEX len)
+{
+  const BYTE *end = p + len;
+
+  if (len < 3)
+    return FALSE;
+
+  seq = Get16(p);
+  p += 2;
+
+  if (!GetOpenType(p, end, primary, primaryLen) || primaryLen == 0)
+    return FALSE;
+
+  if (p >= end)
+    return FALSE;
+
+  fec = (*p & 0x80) != 0;
+  numSecondary = 0;
+
+  if ((*p++ & 0x7F) != 0)
+    return FALSE;
+
+  PINDEX count;
+
+  if (fec) {
+    PINDEX npacketsLen;
+
+    if (!GetLength(p, end, npacketsLen) || npacketsLen == 0 || npacketsLen > end - p)
+      return FALSE;
+
+    p += npacketsLen;
+
+    if (!GetLength(p, end, count))
+      return FALSE;
+
+    for (PINDEX i = 0 ; i < count ; i++) {
+      const BYTE *pData;
+      PINDEX dataLen;
+
+      if (!GetOpenType(p, end, pData, dataLen))
+        return FALSE;
+    }
+  } else {
+    if (!GetLength(p, end, count))
+      return FALSE;
+
+    for (PINDEX i = 0 ; i < count ; i++) {
+      const BYTE *pData;
+      PINDEX dataLen;
+
+      if (!GetOpenType(p, end, pData, dataLen))
+        return FALSE;
+
+      if (numSecondary < maxSecondary) {
+        secondary[numSecondary] = pData;
+        secondaryLen[numSecondary] = dataLen;
+        numSecondary++;
+      }
+    }
+  }
+
+  return p == end;
+}
+
+PBoolean UdptlPacket::GetLength(const BYTE * &p, const BYTE *end, PINDEX &len)
+{
+  if (p >= end)
+    return FALSE;
+
+  if ((*p & 0x80) == 0) {
+    len = *p++;
+    return TRUE;
+  }
+
+  if ((*p & 0xC0) == 0x80 && end - p >= 2) {
+    len = ((p[0] & 0x3F) << 8) | p[1];
+    p += 2;
+    return TRUE;
+  }
+
+  return FALSE;                         // fragmentation is not supported
+}
+
+PBoolean UdptlPacket::GetOpenType(const BYTE * &p, const BYTE *end, const BYTE * &pData, PINDEX &len)
+{
+  if (!GetLength(p, end, len) || len > end - p)
+    return FALSE;
+
+  pData = p;
+  p += len;
+
+  return TRUE;
+}
+///////////////////////////////////////////////////////////////
+/**RTP packet with T.38 payload (T.38 Annex B).
+  */
+static PBoolean ParseRtp(
+  const BYTE *p,
+  PINDEX len,
+  WORD &seq,
+  int &payloadType,
+  const BYTE * &pPayload,
+  PINDEX &payloadLen)
+{
+  if (len < 12 || (p[0] >> 6) != 2)
+    return FALSE;
+
+  PINDEX hdr = 12 + (p[0] & 0x0F)*4;
+
+  if (hdr > len)
+    return FALSE;
+
+  if (p[0] & 0x10) {
+    if (hdr + 4 > len)
+      return FALSE;
+
+    hdr += 4 + Get16(p + hdr + 2)*4;
+
+    if (hdr > len)
+      return FALSE;
+  }
+
+  PINDEX padding = 0;
+
+  if (p[0] & 0x20) {
+    padding = p[len - 1];
+
+    if (padding == 0 || hdr + padding > len)
+      return FALSE;
+  }
+
+  seq = Get16(p + 2);
+  payloadType = p[1] & 0x7F;
+  pPayload = p + hdr;
+  payloadLen = len - hdr - padding;
+
+  return TRUE;
+}
+///////////////////////////////////////////////////////////////
+/**One direction of the captured T.38 session.
+
+   Replicates the receiving path of T38ModemMediaStream and reads the
+   received data with a null fax application.
+ */
+class ReplayStream : public PObject, protected ReorderBuffer::Sink
+{
+    PCLASSINFO(ReplayStream, PObject);
+  public:
+    enum Kind {
+      kUnknown,
+      kUdptl,
+      kRtp,
+      kIgnored,
+    };
+
+  /**@name Construction */
+  //@{
+    ReplayStream(
+      const FlowKey &_key,
+      const ReplayConfig &_config,
+      StageProfiler &_profiler
+    );
+    ~ReplayStream();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Handle UDP payload of the flow.
+      */
+    void HandleDatagram(const BYTE *pData, PINDEX len);
+
+    /**Handle the packets released by the reorder buffer on timeout.
+      */
+    void Flush();
+
+    /**Get reorder buffer timeout in ms or -1.
+      */
+    int GetTimeout() const { return kind == kUdptl || kind == kRtp ? reorder.GetTimeout() : -1; }
+
+    void Close();
+  //@}
+
+    const FlowKey &GetKey() const { return key; }
+    Kind GetKind() const { return kind; }
+    long GetIfps() const { return ifps; }
+
+    void PrintOn(ostream &strm) const;
+
+  protected:
+    enum SinkState {
+      ssIdle,
+      ssWait,
+      ssReady,
+      ssRecv,
+    };
+
+    enum { cbpReady = 1 };
+
+    PBoolean Classify(const BYTE *pData, PINDEX len);
+    PBoolean DecodeIFP(const BYTE *pData, PINDEX len, T38_IFP &_ifp);
+    void WritePacket(WORD seq, const BYTE *pData, PINDEX len, PBoolean recovered);
+    void HandleRawIFP(const BYTE *pData, PINDEX len);
+
+    virtual void OnPut(long seq, ReorderBuffer::PutResult result, const BYTE *pData, PINDEX len, PBoolean recovered);
+    virtual PBoolean OnLost(int lost);
+    virtual PBoolean OnPacket(const BYTE *pData, PINDEX len);
+    void Drain();
+    void StopWait();
+
+    PDECLARE_NOTIFIER(PObject, ReplayStream, OnEngineCallback);
+    const PNotifier engineCallback;
+
+    const FlowKey key;
+    const ReplayConfig &config;
+    StageProfiler &profiler;
+
+    Kind kind;
+    int probes;
+    int corrigendum;                    ///<  -1 - not detected yet
+    int payloadType;
+
+    T38Engine *engine;
+    ReorderBuffer reorder;
+    T38_IFP ifp;
+
+    SinkState sinkState;
+    int wantMod;                        ///<  From the last indicator
+    int waitMod;                        ///<  Of the current RecvWait()
+    volatile PBoolean ready;
+
+    long datagrams;
+    long malformed;
+    long ifps;
+    long decodeErrors;
+    long redundant;
+    long lostEvents;
+    long frames;
+    long badFrames;
+    long hdlcBytes;
+    long imageStreams;
+    long imageBytes;
+};
+
+ReplayStream::ReplayStream(
+    const FlowKey &_key,
+    const ReplayConfig &_config,
+    StageProfiler &_profiler)
+  :
+#ifdef _MSC_VER
+#pragma warning(disable:4355) // warning C4355: 'this' : used in base member initializer list
+#endif
+    engineCallback(PCREATE_NOTIFIER(OnEngineCallback)),
+#ifdef _MSC_VER
+#pragma warning(default:4355)
+#endif
+    key(_key),
+    config(_config),
+    profiler(_profiler),
+    kind(kUnknown),
+    probes(0),
+    corrigendum(_config.corrigendum),
+    payloadType(-1),
+    engine(NULL),
+    sinkState(ssIdle),
+    wantMod(0),
+    waitMod(0),
+    ready(FALSE),
+    datagrams(0),
+    malformed(0),
+    ifps(0),
+    decodeErrors(0),
+    redundant(0),
+    lostEvents(0),
+    frames(0),
+    badFrames(0),
+    hdlcBytes(0),
+    imageStreams(0),
+    imageBytes(0)
+{
+  if (config.reorderDepth > 0 || config.reorderDelay > 0) {
+    reorder.SetDepth(config.reorderDepth > 0 ? config.reorderDepth : ReorderBuffer::maxDepth,
+                     config.reorderDelay);
+  }
+}
+
+ReplayStream::~ReplayStream()
+{
+  Close();
+}
+
+void ReplayStream::Close()
+{
+  if (!engine)
+    return;
+
+  if (sinkState != ssIdle)
+    engine->RecvStop();
+
+  engine->CloseIn(EngineBase::HOWNERIN(this));
+
+  if (engine->TryLockModemCallback()) {
+    engine->Detach(engineCallback);
+    engine->UnlockModemCallback();
+  }
+
+  ReferenceObject::DelPointer(engine);
+  engine = NULL;
+}
+
+PBoolean ReplayStream::DecodeIFP(const BYTE *pData, PINDEX len, T38_IFP &_ifp)
+{
+  if (corrigendum >= 0)
+    return IFPCodec::Decode(pData, len, _ifp, corrigendum != 0);
+
+  // not detected yet
+  if (IFPCodec::Decode(pData, len, _ifp, TRUE))
+    return TRUE;
+
+  return IFPCodec::Decode(pData, len, _ifp, FALSE);
+}
+
+PBoolean ReplayStream::Classify(const BYTE *pData, PINDEX len)
+{
+  UdptlPacket udptl;
+
+  if (udptl.Parse(pData, len) && DecodeIFP(udptl.primary, udptl.primaryLen, ifp)) {
+    kind = kUdptl;
+  } else {
+    WORD seq;
+    int pt;
+    const BYTE *pPayload;
+    PINDEX payloadLen;
+
+    if (!ParseRtp(pData, len, seq, pt, pPayload, payloadLen) || payloadLen == 0)
+      return FALSE;
+
+    if (config.rtpPayloadType >= 0 ? pt != config.rtpPayloadType : pt < 96)
+      return FALSE;
+
+    if (!DecodeIFP(pPayload, payloadLen, ifp))
+      return FALSE;
+
+    kind = kRtp;
+    payloadType = pt;
+  }
+
+  engine = new T38Engine(key.AsString());
+
+  if (engine->TryLockModemCallback()) {
+    engine->Attach(engineCallback);
+    engine->UnlockModemCallback();
+  }
+
+  engine->ChangeModemClass(EngineBase::mcFax);
+  engine->OpenIn(EngineBase::HOWNERIN(this));
+
+  myPTRACE(1, "ReplayStream::Classify " << key.AsString() << " is " << (kind == kUdptl ? "UDPTL" : "RTP"));
+
+  return TRUE;
+}
+
+void ReplayStream::HandleDatagram(const BYTE *pData, PINDEX len)
+{
+  if (kind == kIgnored)
+    return;
+
+  if (kind == kUnknown && !Classify(pData, len)) {
+    if (++probes >= 10)
+      kind = kIgnored;
+
+    return;
+  }
+
+  datagrams++;
+
+  if (kind == kRtp) {
+    WORD seq;
+    int pt;
+    const BYTE *pPayload;
+    PINDEX payloadLen;
+
+    if (!ParseRtp(pData, len, seq, pt, pPayload, payloadLen)) {
+      malformed++;
+      return;
+    }
+
+    if (pt != payloadType) {
+      myPTRACE(5, "ReplayStream::HandleDatagram ignored packet with mismatched payload type");
+      return;
+    }
+
+    WritePacket(seq, pPayload, payloadLen, FALSE);
+    return;
+  }
+
+  UdptlPacket udptl;
+
+  if (!udptl.Parse(pData, len)) {
+    malformed++;
+    return;
+  }
+
+  // the oldest recovered packets first
+  for (int i = udptl.numSecondary ; i > 0 ; i--) {
+    if (udptl.secondaryLen[i - 1] > 0)
+      WritePacket(WORD(udptl.seq - i), udptl.secondary[i - 1], udptl.secondaryLen[i - 1], TRUE);
+  }
+
+  WritePacket(udptl.seq, udptl.primary, udptl.primaryLen, FALSE);
+}
+
+void ReplayStream::WritePacket(WORD seq, const BYTE *pData, PINDEX len, PBoolean recovered)
+{
+  StageProfiler::Stage prev = profiler.Switch(StageProfiler::stReorder);
+
+  reorder.Receive(seq, pData, len, *this, recovered);
+  profiler.Switch(prev);
+}
+
+void ReplayStream::Flush()
+{
+  if (!engine)
+    return;
+
+  StageProfiler::Stage prev = profiler.Switch(StageProfiler::stReorder);
+
+  reorder.Flush(*this);
+  profiler.Switch(prev);
+}
+
+void ReplayStream::OnPut(long seq, ReorderBuffer::PutResult result, const BYTE * /*pData*/, PINDEX /*len*/, PBoolean recovered)
+{
+  if (result != ReorderBuffer::prIgnored)
+    return;
+
+  if (recovered)
+    redundant++;
+  else
+    myPTRACE(3, "ReplayStream::WritePacket: Repeated packet " << seq << " (expected " << reorder.GetExpected() << ")");
+}
+
+PBoolean ReplayStream::OnLost(int lost)
+{
+  StageProfiler::Stage prev = profiler.Switch(StageProfiler::stEngine);
+
+  lostEvents++;
+  engine->HandlePacketLost(EngineBase::HOWNERIN(this), lost);
+  Drain();
+  profiler.Switch(prev);
+
+  return TRUE;
+}
+
+PBoolean ReplayStream::OnPacket(const BYTE *pData, PINDEX len)
+{
+  HandleRawIFP(pData, len);
+
+  return TRUE;
+}
+
+void ReplayStream::HandleRawIFP(const BYTE *pData, PINDEX len)
+{
+  StageProfiler::Stage prev = profiler.Switch(StageProfiler::stDecode);
+
+  if (!DecodeIFP(pData, len, ifp)) {
+    myPTRACE(2, "ReplayStream::HandleRawIFP decode failure: " << PRTHEX(PBYTEArray(pData, len, FALSE)));
+    decodeErrors++;
+    profiler.Switch(prev);
+    return;
+  }
+
+  if (corrigendum < 0)
+    corrigendum = IFPCodec::Decode(pData, len, ifp, TRUE) ? 1 : 0;
+
+  ifps++;
+
+  if (ifp.m_type_of_msg.GetTag() == T38_Type_of_msg::e_t30_indicator) {
+    T38_Type_of_msg_t30_indicator indicator = ifp.m_type_of_msg;
+
+    wantMod = IndicatorMod(indicator);
+
+    if (sinkState == ssWait && waitMod != wantMod)
+      StopWait();
+  }
+
+  profiler.Switch(StageProfiler::stEngine);
+  engine->HandlePacket(EngineBase::HOWNERIN(this), ifp);
+  Drain();
+  profiler.Switch(prev);
+}
+
+void ReplayStream::StopWait()
+{
+  engine->RecvStop();
+  sinkState = ssIdle;
+}
+
+void ReplayStream::Drain()
+{
+  StageProfiler::Stage prev = profiler.Switch(StageProfiler::stSink);
+  BYTE buf[1024];
+
+  for (int i = 0 ; i < 256 ; i++) {
+    switch (sinkState) {
+      case ssIdle: {
+        if (wantMod == 0)
+          break;
+
+        PBoolean done = FALSE;
+
+        ready = FALSE;
+        waitMod = wantMod;
+
+        if (!engine->RecvWait(waitMod == 3 ? EngineBase::dtHdlc : EngineBase::dtRaw, waitMod, cbpReady, done)) {
+          wantMod = 0;
+          break;
+        }
+
+        sinkState = done ? ssReady : ssWait;
+        continue;
+      }
+      case ssWait:
+        if (!ready)
+          break;
+
+        sinkState = ssReady;
+        continue;
+      case ssReady:
+        if (!engine->RecvStart(cbpReady)) {
+          sinkState = ssIdle;
+          wantMod = 0;
+          break;
+        }
+
+        sinkState = ssRecv;
+
+        if (engine->RecvDiag() & EngineBase::diagDiffSig) {
+          StopWait();
+          continue;
+        }
+
+        if (waitMod != 3)
+          imageStreams++;
+
+        continue;
+      case ssRecv: {
+        int count = engine->Recv(buf, sizeof(buf));
+
+        if (count == 0)
+          break;
+
+        if (count > 0) {
+          if (waitMod == 3)
+            hdlcBytes += count;
+          else
+            imageBytes += count;
+
+          continue;
+        }
+
+        int diag = engine->RecvDiag();
+
+        if (waitMod == 3) {
+          frames++;
+
+          if (diag & EngineBase::diagErrorMask)
+            badFrames++;
+        }
+
+        StopWait();
+
+        if (diag & EngineBase::diagNoCarrier)
+          wantMod = 0;
+
+        continue;
+      }
+    }
+
+    break;
+  }
+
+  profiler.Switch(prev);
+}
+
+void ReplayStream::OnEngineCallback(PObject & PTRACE_PARAM(from), INT extra)
+{
+  PTRACE(4, "ReplayStream::OnEngineCallback " << from.GetClass() << " " << EngineBase::ModemCallbackParam(extra));
+
+  if (extra == cbpReady)
+    ready = TRUE;
+}
+
+void ReplayStream::PrintOn(ostream &strm) const
+{
+  strm << key.AsString() << " " << (kind == kUdptl ? "UDPTL" : "RTP")
+       << (corrigendum == 0 ? " (original ASN.1)" : "")
+       << "\n  datagrams=" << datagrams
+       << " malformed=" << malformed
+       << " ifps=" << ifps
+       << " decode-errors=" << decodeErrors
+       << "\n  recovered=" << reorder.GetRecovered()
+       << " redundant=" << redundant
+       << " lost=" << reorder.GetLost()
+       << " (" << lostEvents << " gaps)"
+       << " reordered=" << reorder.GetReordered()
+       << "\n  frames=" << frames
+       << " bad-frames=" << badFrames
+       << " hdlc-bytes=" << hdlcBytes
+       << " image-streams=" << imageStreams
+       << " image-bytes=" << imageBytes;
+}
+///////////////////////////////////////////////////////////////
+class T38Replay : public PProcess
+{
+  PCLASSINFO(T38Replay, PProcess)
+
+  public:
+    T38Replay();
+
+    void Main();
+
+  protected:
+    enum { maxStreams = 64 };
+
+    void Run(const PFilePath &fileName, const ReplayConfig &config);
+    void SleepUntil(PInt64 targetUs, ReplayStream * const *streams, int numStreams);
+};
+
+PCREATE_PROCESS(T38Replay);
+///////////////////////////////////////////////////////////////
+T38Replay::T38Replay()
+  : PProcess("Vyacheslav Frolov", "T38Replay",
+             MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER)
+{
+}
+
+void T38Replay::Main()
+{
+  PArgList &args = GetArguments();
+
+  args.Parse(
+             "T-timing:"
+             "p-port:"
+             "P-rtp-pt:"
+             "C-corrigendum."
+             "O-old-asn."
+             "-reorder-depth:"
+             "-reorder-delay:"
+             "h-help."
+#if PTRACING
+             "t-trace."
+             "o-output:"
+#endif
+          , FALSE);
+
+#if PTRACING
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::DateAndTime | PTrace::Thread | PTrace::Blocks);
+#endif
+
+  if (args.HasOption('h') || args.GetCount() != 1) {
+    cout <<
+        "Usage:\n"
+        "  " << GetName() << " [options] file.pcap\n"
+        "\n"
+        "Options:\n"
+        "  -T --timing mode          : virtual - as fast as possible in virtual time\n"
+        "                              (default), real - original timing,\n"
+        "                              none - as fast as possible in real time.\n"
+        "  -p --port num             : Replay only datagrams from or to UDP port num.\n"
+        "  -P --rtp-pt num           : RTP payload type of T.38 (default any dynamic).\n"
+        "  -C --corrigendum          : Decode with CORRIGENDUM No. 1 ASN.1 only.\n"
+        "  -O --old-asn              : Decode with original ASN.1 only.\n"
+        "                              Default is to detect it per stream.\n"
+        "     --reorder-depth num    : Depth of receive reorder buffer (default 0).\n"
+        "     --reorder-delay ms     : Max hold time of reorder buffer (default 0).\n"
+#if PTRACING
+        "  -t --trace                : Enable trace, use multiple times for more detail.\n"
+        "  -o --output file          : File for trace output, default is stderr.\n"
+#endif
+        "  -h --help                 : Display this help message.\n"
+        << endl;
+    return;
+  }
+
+  ReplayConfig config;
+
+  if (args.HasOption('T')) {
+    PString timing = args.GetOptionString('T');
+
+    if (timing == "virtual")
+      config.timing = ReplayConfig::tmVirtual;
+    else
+    if (timing == "real")
+      config.timing = ReplayConfig::tmReal;
+    else
+    if (timing == "none")
+      config.timing = ReplayConfig::tmNone;
+    else {
+      cerr << "Unknown timing mode " << timing << endl;
+      return;
+    }
+  }
+
+  if (args.HasOption('p'))
+    config.port = (int)args.GetOptionString('p').AsInteger();
+
+  if (args.HasOption('P'))
+    config.rtpPayloadType = (int)args.GetOptionString('P').AsInteger();
+
+  if (args.HasOption('C'))
+    config.corrigendum = 1;
+  else
+  if (args.HasOption('O'))
+    config.corrigendum = 0;
+
+  if (args.HasOption("reorder-depth"))
+    config.reorderDepth = (int)args.GetOptionString("reorder-depth").AsInteger();
+
+  if (args.HasOption("reorder-delay"))
+    config.reorderDelay = (int)args.GetOptionString("reorder-delay").AsInteger();
+
+  Run(args[0], config);
+}
+
+/**Sleep (in the current clock) up to targetUs handling the reorder
+   buffer timeouts on the way.
+  */
+void T38Replay::SleepUntil(PInt64 targetUs, ReplayStream * const *streams, int numStreams)
+{
+  for (;;) {
+    for (int i = 0 ; i < numStreams ; i++)
+      streams[i]->Flush();
+
+    PInt64 waitMs = (targetUs - ModemClock::Get().Now().GetTimestamp())/1000;
+
+    if (waitMs <= 0)
+      return;
+
+    for (int i = 0 ; i < numStreams ; i++) {
+      int timeout = streams[i]->GetTimeout();
+
+      if (timeout >= 0 && waitMs > timeout + 1)
+        waitMs = timeout + 1;
+    }
+
+    ModemClock::Get().Sleep(PTimeInterval(waitMs));
+  }
+}
+
+void T38Replay::Run(const PFilePath &fileName, const ReplayConfig &config)
+{
+  PcapReader reader;
+
+  if (!reader.Open(fileName)) {
+    cerr << fileName << ": " << reader.GetError() << endl;
+    return;
+  }
+
+  StageProfiler profiler;
+  CaptureStats stats;
+  ReplayStream *streams[maxStreams];
+  int numStreams = 0;
+  VirtualClock *clock = NULL;
+  PInt64 firstUs = 0;
+  PInt64 lastUs = 0;
+  PInt64 baseUs = 0;
+  PInt64 begin = NowUs();
+
+  PInt64 timeUs;
+  const BYTE *pData;
+  PINDEX len;
+
+  profiler.Switch(StageProfiler::stRead);
+
+  while (reader.Next(timeUs, pData, len)) {
+    profiler.Switch(StageProfiler::stParse);
+
+    if (stats.records++ == 0) {
+      if (config.timing == ReplayConfig::tmVirtual) {
+        clock = new VirtualClock(PTime(time_t(timeUs/1000000), long(timeUs%1000000)));
+        ModemClock::Set(clock);
+        ModemClock::Get().Enter();
+      }
+
+      firstUs = timeUs;
+      baseUs = ModemClock::Get().Now().GetTimestamp();
+    }
+
+    if (timeUs > lastUs)
+      lastUs = timeUs;
+
+    if (config.timing != ReplayConfig::tmNone)
+      SleepUntil(baseUs + (timeUs - firstUs), streams, numStreams);
+
+    FlowKey key;
+    const BYTE *pPayload;
+    PINDEX payloadLen;
+
+    if (!ParseFrame(reader.GetLinkType(), pData, len, key, pPayload, payloadLen, stats)) {
+      profiler.Switch(StageProfiler::stRead);
+      continue;
+    }
+
+    if (config.port && key.srcPort != config.port && key.dstPort != config.port) {
+      stats.filtered++;
+      profiler.Switch(StageProfiler::stRead);
+      continue;
+    }
+
+    ReplayStream *stream = NULL;
+
+    for (int i = 0 ; i < numStreams ; i++) {
+      if (streams[i]->GetKey() == key) {
+        stream = streams[i];
+        break;
+      }
+    }
+
+    if (!stream && numStreams < maxStreams)
+      stream = streams[numStreams++] = new ReplayStream(key, config, profiler);
+
+    if (stream)
+      stream->HandleDatagram(pPayload, payloadLen);
+
+    if (!stream || stream->GetKind() == ReplayStream::kUnknown || stream->GetKind() == ReplayStream::kIgnored)
+      stats.unclassified++;
+
+    profiler.Switch(StageProfiler::stRead);
+  }
+
+  profiler.Switch(StageProfiler::stReorder);
+
+  if (!reader.GetError().IsEmpty())
+    cerr << fileName << ": " << reader.GetError() << endl;
+
+  // release the packets held by the reorder buffers
+  for (;;) {
+    int timeout = -1;
+
+    for (int i = 0 ; i < numStreams ; i++) {
+      int t = streams[i]->GetTimeout();
+
+      if (t >= 0 && (timeout < 0 || t < timeout))
+        timeout = t;
+    }
+
+    if (timeout < 0)
+      break;
+
+    SleepUntil(ModemClock::Get().Now().GetTimestamp() + PInt64(timeout + 1)*1000, streams, numStreams);
+  }
+
+  profiler.Switch(StageProfiler::stSink);
+
+  for (int i = 0 ; i < numStreams ; i++)
+    streams[i]->Close();
+
+  profiler.Switch(StageProfiler::stRead);
+
+  double elapsed = (NowUs() - begin)/1e6;
+  double captured = (lastUs - firstUs)/1e6;
+  long ifps = 0;
+  long packets = 0;
+
+  if (elapsed <= 0)
+    elapsed = 1e-6;
+
+  cout << setprecision(3) << setiosflags(ios::fixed);
+
+  for (int i = 0 ; i < numStreams ; i++) {
+    if (streams[i]->GetKind() == ReplayStream::kUdptl || streams[i]->GetKind() == ReplayStream::kRtp) {
+      cout << *streams[i] << "\n";
+      ifps += streams[i]->GetIfps();
+    }
+  }
+
+  packets = stats.udp - stats.filtered - stats.unclassified;
+
+  cout << "records=" << stats.records
+       << " udp=" << stats.udp
+       << " not-udp=" << stats.notUdp
+       << " fragments=" << stats.fragments
+       << " truncated=" << stats.truncated
+       << " filtered=" << stats.filtered
+       << " unclassified=" << stats.unclassified
+       << "\nelapsed=" << elapsed << "s"
+       << " captured=" << captured << "s";
+
+  if (clock)
+    cout << " (x" << captured/elapsed << ", " << clock->GetAdvances() << " jumps)";
+
+  cout << " packets/s=" << packets/elapsed
+       << " ifps/s=" << ifps/elapsed
+       << "\ncpu per stage:";
+
+  PInt64 total = 0;
+
+  for (int i = 0 ; i < StageProfiler::stNumStages ; i++)
+    total += profiler.GetNs(i);
+
+  for (int i = 0 ; i < StageProfiler::stNumStages ; i++) {
+    cout << "\n  " << setw(8) << StageProfiler::Name(i)
+         << " " << setw(10) << profiler.GetNs(i)/1e6 << "ms"
+         << " " << setw(8) << (packets ? double(profiler.GetNs(i))/packets : 0.0) << "ns/packet";
+  }
+
+  cout << "\n  " << setw(8) << "total"
+       << " " << setw(10) << total/1e6 << "ms"
+       << " " << setw(8) << (packets ? double(total)/packets : 0.0) << "ns/packet"
+       << endl;
+
+  for (int i = 0 ; i < numStreams ; i++)
+    delete streams[i];
+
+  if (clock) {
+    ModemClock::Get().Leave();
+    ModemClock::Set(NULL);
+    delete clock;
+  }
+}
+///////////////////////////////////////////////////////////////
+
@@ -0,0 +1,557 @@
+/*
+ * t38test.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: t38test.cxx,v $
+ *
+ */
+
+/*
+ * Unit tests of the self-contained parts of the modem (make check).
+ *
+ * Each test is a function that checks the results with CHECK() and
+ * CHECK_EQUAL(). The exit code is 1 if any check failed.
+ */
+
+#include <ptlib.h>
+#include <math.h>
+
+#include "version.h"
+#include "pmutils.h"
+#include "reorder.h"
+#include "t30tone.h"
+#include "fcs.h"
+#include "v21.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+struct TestState {
+  TestState(const char *_name) : name(_name), failures(0) {}
+
+  const char *name;
+  int failures;
+};
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      cerr << __FILE__ << ":" << __LINE__ << ": " << state.name         \
+           << ": CHECK(" #cond ") failed" << endl;                      \
+      state.failures++;                                                 \
+    }                                                                   \
+  } while (0)
+
+#define CHECK_EQUAL(actual, expected)                                   \
+  do {                                                                  \
+    long a_ = long(actual);                                             \
+    long e_ = long(expected);                                           \
+    if (a_ != e_) {                                                     \
+      cerr << __FILE__ << ":" << __LINE__ << ": " << state.name         \
+           << ": " #actual " is " << a_ << ", expected " << e_ << endl; \
+      state.failures++;                                                 \
+    }                                                                   \
+  } while (0)
+
+typedef void (*TestFunction)(TestState &state);
+
+struct TestEntry {
+  const char *name;
+  TestFunction function;
+};
+///////////////////////////////////////////////////////////////
+static ReorderBuffer::PutResult PutSeq(ReorderBuffer &reorder, long seq)
+{
+  BYTE data = BYTE(seq);
+
+  return reorder.Put(reorder.Unwrap(WORD(seq)), &data, 1);
+}
+
+/**Get the next packet, returns its sequence (low byte) or -1.
+  */
+static int GetSeq(ReorderBuffer &reorder, int &lost)
+{
+  const BYTE *pData;
+  PINDEX len;
+
+  lost = -1;
+
+  if (!reorder.Get(pData, len, lost))
+    return -1;
+
+  return len == 1 ? pData[0] : -2;
+}
+
+static void TestReorderInOrder(TestState &state)
+{
+  ReorderBuffer reorder;
+  int lost;
+
+  reorder.SetDepth(4, 0);
+
+  for (long seq = 0 ; seq < 5 ; seq++) {
+    CHECK_EQUAL(PutSeq(reorder, seq), ReorderBuffer::prInOrder);
+    CHECK_EQUAL(GetSeq(reorder, lost), -1);
+  }
+
+  CHECK_EQUAL(PutSeq(reorder, 3), ReorderBuffer::prIgnored);
+  CHECK_EQUAL(reorder.GetExpected(), 5);
+  CHECK_EQUAL(reorder.GetLost(), 0);
+}
+
+static void TestReorderGap(TestState &state)
+{
+  ReorderBuffer reorder;
+  int lost;
+
+  reorder.SetDepth(2, 0);
+
+  CHECK_EQUAL(PutSeq(reorder, 0), ReorderBuffer::prInOrder);
+
+  // the gap is held while the depth is not exceeded
+  CHECK_EQUAL(PutSeq(reorder, 2), ReorderBuffer::prBuffered);
+  CHECK_EQUAL(GetSeq(reorder, lost), -1);
+
+  // and it's filled by the late packet
+  CHECK_EQUAL(PutSeq(reorder, 1), ReorderBuffer::prBuffered);
+  CHECK_EQUAL(GetSeq(reorder, lost), 1);
+  CHECK_EQUAL(lost, 0);
+  CHECK_EQUAL(GetSeq(reorder, lost), 2);
+  CHECK_EQUAL(lost, 0);
+  CHECK_EQUAL(reorder.GetReordered(), 1);
+
+  // the gap is declared lost when the depth is exceeded
+  CHECK_EQUAL(PutSeq(reorder, 5), ReorderBuffer::prBuffered);
+  CHECK_EQUAL(PutSeq(reorder, 6), ReorderBuffer::prBuffered);
+  CHECK_EQUAL(GetSeq(reorder, lost), -1);
+  CHECK_EQUAL(PutSeq(reorder, 7), ReorderBuffer::prBuffered);
+  CHECK_EQUAL(GetSeq(reorder, lost), 5);
+  CHECK_EQUAL(lost, 2);
+  CHECK_EQUAL(GetSeq(reorder, lost), 6);
+  CHECK_EQUAL(lost, 0);
+  CHECK_EQUAL(GetSeq(reorder, lost), 7);
+  CHECK_EQUAL(reorder.GetLost(), 2);
+}
+
+/**The hold time is measured with ModemClock (the virtual clock is ahead
+   of the wall clock here).
+  */
+static void TestReorderVirtualDelay(TestState &state)
+{
+  VirtualClock clock(PTime() + PTimeInterval(0, 0, 0, 0, 1));
+
+  ModemClock::Set(&clock);
+
+  ModemClock::Participant participant;
+  ReorderBuffer reorder;
+  int lost;
+
+  reorder.SetDepth(4, 40);
+
+  CHECK_EQUAL(PutSeq(reorder, 0), ReorderBuffer::prInOrder);
+  CHECK_EQUAL(PutSeq(reorder, 2), ReorderBuffer::prBuffered);
+  CHECK_EQUAL(GetSeq(reorder, lost), -1);
+  CHECK_EQUAL(reorder.GetTimeout(), 40);
+
+  // held while the delay is not expired
+  clock.Sleep(39);
+  CHECK_EQUAL(GetSeq(reorder, lost), -1);
+  CHECK_EQUAL(reorder.GetTimeout(), 1);
+  CHECK_EQUAL(reorder.GetLost(), 0);
+
+  // and declared lost after that
+  clock.Sleep(1);
+  CHECK_EQUAL(reorder.GetTimeout(), 0);
+  CHECK_EQUAL(GetSeq(reorder, lost), 2);
+  CHECK_EQUAL(lost, 1);
+  CHECK_EQUAL(reorder.GetLost(), 1);
+}
+
+static void TestReorderLargeJump(TestState &state)
+{
+  ReorderBuffer reorder;
+  int lost;
+
+  reorder.SetDepth(4, 0);
+
+  CHECK_EQUAL(PutSeq(reorder, 0), ReorderBuffer::prInOrder);
+  CHECK_EQUAL(PutSeq(reorder, 1), ReorderBuffer::prInOrder);
+
+  // the waiting packet is dropped and the jump is one lost packet
+  CHECK_EQUAL(PutSeq(reorder, 3), ReorderBuffer::prBuffered);
+  CHECK_EQUAL(PutSeq(reorder, 1000), ReorderBuffer::prBuffered);
+  CHECK_EQUAL(GetSeq(reorder, lost), 1000 & 0xFF);
+  CHECK_EQUAL(lost, 1);
+  CHECK_EQUAL(GetSeq(reorder, lost), -1);
+  CHECK_EQUAL(reorder.GetExpected(), 1001);
+
+  CHECK_EQUAL(PutSeq(reorder, 1001), ReorderBuffer::prInOrder);
+  CHECK_EQUAL(GetSeq(reorder, lost), -1);
+
+  // the restart of the sequence
+  CHECK_EQUAL(PutSeq(reorder, 0), ReorderBuffer::prBuffered);
+  CHECK_EQUAL(GetSeq(reorder, lost), 0);
+  CHECK_EQUAL(lost, 1);
+  CHECK_EQUAL(reorder.GetExpected(), 1);
+
+  CHECK_EQUAL(reorder.GetLost(), 2);
+}
+
+static void TestReorderWrap(TestState &state)
+{
+  ReorderBuffer reorder;
+  int lost;
+
+  reorder.SetDepth(4, 0);
+
+  for (long seq = 0 ; seq <= 0xFFFF ; seq++) {
+    if (PutSeq(reorder, seq) != ReorderBuffer::prInOrder) {
+      CHECK_EQUAL(seq, -1);
+      break;
+    }
+  }
+
+  CHECK_EQUAL(PutSeq(reorder, 0x10001), ReorderBuffer::prBuffered);
+  CHECK_EQUAL(PutSeq(reorder, 0x10000), ReorderBuffer::prBuffered);
+  CHECK_EQUAL(GetSeq(reorder, lost), 0x00);
+  CHECK_EQUAL(lost, 0);
+  CHECK_EQUAL(GetSeq(reorder, lost), 0x01);
+  CHECK_EQUAL(lost, 0);
+  CHECK_EQUAL(reorder.GetExpected(), 0x10002);
+  CHECK_EQUAL(reorder.GetLost(), 0);
+}
+/**Records the packets (low byte of sequence) and the lost counts (as
+   negative numbers) passed by ReorderBuffer::Receive().
+  */
+class TestSink : public ReorderBuffer::Sink
+{
+  public:
+    TestSink() : count(0), puts(0), stopAt(-1) {}
+
+    virtual void OnPut(long, ReorderBuffer::PutResult, const BYTE *, PINDEX, PBoolean) { puts++; }
+    virtual PBoolean OnLost(int lost) { Add(-lost); return TRUE; }
+    virtual PBoolean OnPacket(const BYTE *pData, PINDEX) { Add(pData[0]); return pData[0] != stopAt; }
+
+    void Add(int value) {
+      if (count < (int)PARRAYSIZE(events))
+        events[count++] = value;
+    }
+
+    int events[16];
+    int count;
+    int puts;
+    int stopAt;
+};
+
+static PBoolean ReceiveSeq(ReorderBuffer &reorder, TestSink &sink, long seq, PBoolean recovered = FALSE)
+{
+  BYTE data = BYTE(seq);
+
+  return reorder.Receive(WORD(seq), &data, 1, sink, recovered);
+}
+
+static void TestReorderReceive(TestState &state)
+{
+  ReorderBuffer reorder;
+  TestSink sink;
+
+  reorder.SetDepth(2, 0);
+
+  CHECK(ReceiveSeq(reorder, sink, 0));
+  CHECK(ReceiveSeq(reorder, sink, 2));
+  CHECK(ReceiveSeq(reorder, sink, 1, TRUE));
+  CHECK(ReceiveSeq(reorder, sink, 1));          // repeated
+  CHECK(reorder.Receive(3, NULL, 0, sink));     // empty (ignored)
+  CHECK(ReceiveSeq(reorder, sink, 4));
+  CHECK(ReceiveSeq(reorder, sink, 5));
+  CHECK(ReceiveSeq(reorder, sink, 6));
+
+  // the lost packet 3 is reported before 4
+  CHECK_EQUAL(sink.puts, 7);
+  CHECK_EQUAL(sink.count, 7);
+  CHECK_EQUAL(sink.events[0], 0);
+  CHECK_EQUAL(sink.events[1], 1);
+  CHECK_EQUAL(sink.events[2], 2);
+  CHECK_EQUAL(sink.events[3], -1);
+  CHECK_EQUAL(sink.events[4], 4);
+  CHECK_EQUAL(sink.events[5], 5);
+  CHECK_EQUAL(sink.events[6], 6);
+  CHECK_EQUAL(reorder.GetRecovered(), 1);
+
+  // the sink stops
+  sink.stopAt = 7;
+  CHECK(!ReceiveSeq(reorder, sink, 7));
+  CHECK_EQUAL(sink.count, 8);
+  CHECK_EQUAL(sink.events[7], 7);
+  CHECK(reorder.Flush(sink));
+  CHECK_EQUAL(sink.count, 8);
+}
+///////////////////////////////////////////////////////////////
+/**Feed 4 s of 2100 Hz tone (with 15 Hz 20% amplitude modulation if am)
+   starting after offset samples of silence, with phase reversals every
+   450 ms if reversals. Returns the mask of detected events.
+  */
+static int DetectCed(int offset, PBoolean reversals, PBoolean am)
+{
+  const double pi = 3.1415926535897932384626433832795029;
+  T30ToneDetect detect;
+  PInt16 buf[240];                      // not aligned to the 20 ms frames
+  int events = 0;
+
+  for (int n = 0 ; n < 4*8000 ; ) {
+    for (PINDEX i = 0 ; i < (PINDEX)PARRAYSIZE(buf) ; i++, n++) {
+      if (n < offset) {
+        buf[i] = 0;
+        continue;
+      }
+
+      int t = n - offset;
+      double phase = (reversals && (t/3600) % 2) ? pi : 0;
+      double amp = am ? 8000*(1 + 0.2*sin(2*pi*15*t/8000)) : 8000;
+
+      buf[i] = PInt16(amp*sin(2*pi*2100*t/8000 + phase));
+    }
+
+    events |= detect.Write(buf, sizeof(buf));
+  }
+
+  return events;
+}
+
+static void TestToneCed(TestState &state)
+{
+  for (int offset = 0 ; offset < 160 ; offset += 20)
+    CHECK_EQUAL(DetectCed(offset, FALSE, FALSE), T30ToneDetect::evCED);
+}
+
+static void TestToneCedReversals(TestState &state)
+{
+  for (int offset = 0 ; offset < 160 ; offset += 20)
+    CHECK_EQUAL(DetectCed(offset, TRUE, FALSE), T30ToneDetect::evCED);
+}
+
+static void TestToneAnsam(TestState &state)
+{
+  for (int offset = 0 ; offset < 160 ; offset += 20) {
+    CHECK_EQUAL(DetectCed(offset, FALSE, TRUE), T30ToneDetect::evANSam);
+    CHECK_EQUAL(DetectCed(offset, TRUE, TRUE), T30ToneDetect::evANSam);
+  }
+}
+///////////////////////////////////////////////////////////////
+/**V.21 channel 2 FSK generator of HDLC frames (the bits of the bytes
+   are sent MSB first as in the raw data of HDLC class).
+  */
+class V21Generator
+{
+  public:
+    V21Generator() : phase(0), bitPhase(0), ones(0), count(0) {}
+
+    void Flags(int num) {
+      for (int i = 0 ; i < num ; i++) {
+        for (BYTE m = 0x80 ; m ; m >>= 1)
+          Bit(0x7E & m);
+      }
+      ones = 0;
+    }
+
+    void Frame(const BYTE *pData, PINDEX len, PBoolean badFcs = FALSE) {
+      FCS fcs;
+
+      fcs.build(pData, len);
+
+      WORD f = WORD(badFcs ? ~WORD(fcs) : WORD(fcs));
+
+      for (PINDEX i = 0 ; i < len ; i++)
+        Byte(pData[i]);
+
+      Byte(BYTE(f >> 8));
+      Byte(BYTE(f));
+    }
+
+    const PInt16 *GetSamples(PINDEX &num) const { num = count; return samples; }
+
+  protected:
+    void Byte(BYTE b) {
+      for (BYTE m = 0x80 ; m ; m >>= 1) {
+        Bit(b & m);
+
+        if (!(b & m))
+          ones = 0;
+        else
+        if (++ones == 5) {
+          Bit(0);       // stuffed zero
+          ones = 0;
+        }
+      }
+    }
+
+    void Bit(int bit) {
+      const double pi = 3.1415926535897932384626433832795029;
+      double step = 2*pi*(bit ? 1650 : 1850)/8000;
+
+      for (; bitPhase < 8000 ; bitPhase += 300) {
+        if (count < (PINDEX)PARRAYSIZE(samples))
+          samples[count++] = PInt16(8000*sin(phase));
+
+        phase += step;
+      }
+
+      bitPhase -= 8000;
+    }
+
+    double phase;
+    int bitPhase;
+    int ones;
+    PINDEX count;
+    PInt16 samples[8000*3];
+};
+
+static void TestV21Frames(TestState &state)
+{
+  static const BYTE dis[] = { 0xFF, 0xC8, 0x01, 0x00, 0x77, 0x1F, 0x01, 0x7E };
+  static const BYTE dcn[] = { 0xFF, 0xC8, 0x5F };
+
+  V21Generator gen;
+
+  gen.Flags(30);
+  gen.Frame(dis, sizeof(dis));
+  gen.Flags(1);
+  gen.Frame(dcn, sizeof(dcn), TRUE);
+  gen.Flags(1);
+  gen.Frame(dcn, sizeof(dcn));
+  gen.Flags(3);
+
+  V21Receiver receiver;
+  const PInt16 *pSamples;
+  PINDEX count;
+  PINDEX done;
+  int frames = 0;
+
+  for (pSamples = gen.GetSamples(count) ; receiver.Write(pSamples, count, done) ; pSamples += done, count -= done) {
+    PINDEX size;
+    const BYTE *pFrame = receiver.GetFrame(size);
+
+    if (frames == 0) {
+      CHECK_EQUAL(size, sizeof(dis));
+      CHECK(size == sizeof(dis) && memcmp(pFrame, dis, size) == 0);
+    } else {
+      CHECK_EQUAL(size, sizeof(dcn));
+      CHECK(size == sizeof(dcn) && memcmp(pFrame, dcn, size) == 0);
+    }
+
+    frames++;
+  }
+
+  CHECK_EQUAL(frames, 2);
+  CHECK_EQUAL(receiver.GetFrames(), 2);
+  CHECK_EQUAL(receiver.GetBadFrames(), 1);
+}
+///////////////////////////////////////////////////////////////
+static const TestEntry tests[] = {
+  { "ReorderBuffer/in_order",         TestReorderInOrder },
+  { "ReorderBuffer/gap",              TestReorderGap },
+  { "ReorderBuffer/virtual_delay",    TestReorderVirtualDelay },
+  { "ReorderBuffer/large_jump",       TestReorderLargeJump },
+  { "ReorderBuffer/wrap",             TestReorderWrap },
+  { "ReorderBuffer/receive",          TestReorderReceive },
+  { "T30ToneDetect/ced",              TestToneCed },
+  { "T30ToneDetect/ced_reversals",    TestToneCedReversals },
+  { "T30ToneDetect/ansam",            TestToneAnsam },
+  { "V21Receiver/frames",             TestV21Frames },
+};
+///////////////////////////////////////////////////////////////
+class T38Test : public PProcess
+{
+  PCLASSINFO(T38Test, PProcess)
+
+  public:
+    T38Test();
+
+    void Main();
+};
+
+PCREATE_PROCESS(T38Test);
+///////////////////////////////////////////////////////////////
+T38Test::T38Test()
+  : PProcess("Vyacheslav Frolov", "T38Test",
+             MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER)
+{
+}
+
+void T38Test::Main()
+{
+  PArgList &args = GetArguments();
+
+  args.Parse(
+             "f-filter:"
+             "l-list."
+             "h-help."
+          , FALSE);
+
+  if (args.HasOption('h')) {
+    cout <<
+        "Usage:\n"
+        "  " << GetName() << " [options]\n"
+        "\n"
+        "Options:\n"
+        "  -f --filter str           : Run only tests with str in the name.\n"
+        "  -l --list                 : List tests.\n"
+        "  -h --help                 : Display this help message.\n"
+        << endl;
+    return;
+  }
+
+  const PINDEX numTests = PARRAYSIZE(tests);
+
+  if (args.HasOption('l')) {
+    for (PINDEX i = 0 ; i < numTests ; i++)
+      cout << tests[i].name << endl;
+    return;
+  }
+
+  PString filter = args.GetOptionString('f');
+  int run = 0;
+  int failed = 0;
+
+  for (PINDEX i = 0 ; i < numTests ; i++) {
+    if (!filter.IsEmpty() && PString(tests[i].name).Find(filter) == P_MAX_INDEX)
+      continue;
+
+    TestState state(tests[i].name);
+
+    tests[i].function(state);
+
+    cout << (state.failures ? "FAIL " : "PASS ") << tests[i].name << endl;
+
+    run++;
+
+    if (state.failures)
+      failed++;
+  }
+
+  cout << run - failed << " of " << run << " tests passed" << endl;
+
+  SetTerminationValue(failed ? 1 : 0);
+}
+///////////////////////////////////////////////////////////////
@@ -0,0 +1,305 @@
+/*
+ * t38trace.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: t38trace.cxx,v $
+ *
+ */
+
+/*
+ * Decoder of the binary trace dumps (see BinTrace).
+ *
+ * The records of all threads of each dump are merged by time and rendered
+ * in the text of the corresponding PTRACE lines (the IFPs are decoded and
+ * printed the same way as setprecision(2) << ifp does).
+ */
+
+#include <ptlib.h>
+
+#ifdef USE_OPAL
+  #include <opal/buildopts.h>
+  #include <asn/t38.h>
+#else
+  #include <t38.h>
+#endif
+
+#include "version.h"
+#include "pmutils.h"
+#include "t38engine.h"
+#include "ifpcodec.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+struct TraceLine {
+  BinTrace::Record record;
+  PINDEX thread;
+};
+
+static int CompareLines(const void *a, const void *b)
+{
+  PInt64 ta = ((const TraceLine *)a)->record.time;
+  PInt64 tb = ((const TraceLine *)b)->record.time;
+
+  return ta < tb ? -1 : ta > tb ? 1 : 0;
+}
+
+static PBoolean GetString(PFile &file, PString &str)
+{
+  DWORD len;
+
+  if (!file.Read(&len, sizeof(len)) || file.GetLastReadCount() != sizeof(len) || len > 0x10000)
+    return FALSE;
+
+  if (len == 0) {
+    str = PString();
+    return TRUE;
+  }
+
+  PBYTEArray buf(len);
+
+  if (!file.Read(buf.GetPointer(), len) || file.GetLastReadCount() != (PINDEX)len)
+    return FALSE;
+
+  str = PString((const char *)(const BYTE *)buf, len);
+
+  return TRUE;
+}
+///////////////////////////////////////////////////////////////
+class T38Trace : public PProcess
+{
+  PCLASSINFO(T38Trace, PProcess)
+
+  public:
+    T38Trace();
+
+    void Main();
+
+  protected:
+    PBoolean Decode(PFile &file);
+    void Print(const BinTrace::Record &record, const PString &threadName);
+
+    PString modemFilter;
+    PStringArray modemNames;
+    PInt64 wallUs;
+    PInt64 time;
+};
+
+PCREATE_PROCESS(T38Trace);
+///////////////////////////////////////////////////////////////
+T38Trace::T38Trace()
+  : PProcess("Vyacheslav Frolov", "T38Trace",
+             MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER)
+  , wallUs(0)
+  , time(0)
+{
+}
+
+void T38Trace::Main()
+{
+  PArgList &args = GetArguments();
+
+  args.Parse(
+             "m-modem:"
+             "h-help."
+          , FALSE);
+
+  if (args.HasOption('h') || args.GetCount() != 1) {
+    cout <<
+        "Usage:\n"
+        "  " << GetName() << " [options] file\n"
+        "\n"
+        "Options:\n"
+        "  -m --modem name           : Output the records of modem name only.\n"
+        "  -h --help                 : Display this help message.\n"
+        << endl;
+    return;
+  }
+
+  if (args.HasOption('m'))
+    modemFilter = args.GetOptionString('m');
+
+  PFile file;
+
+  if (!file.Open(args[0], PFile::ReadOnly, PFile::MustExist)) {
+    cerr << "Can't open " << args[0] << endl;
+    return;
+  }
+
+  int dumps = 0;
+
+  while (file.GetPosition() < file.GetLength()) {
+    if (!Decode(file)) {
+      cerr << "Bad dump at offset " << file.GetPosition() << endl;
+      break;
+    }
+
+    dumps++;
+  }
+
+  if (dumps == 0)
+    cerr << "No dumps in " << args[0] << endl;
+}
+
+PBoolean T38Trace::Decode(PFile &file)
+{
+  BinTrace::DumpHeader header;
+
+  if (!file.Read(&header, sizeof(header)) || file.GetLastReadCount() != sizeof(header))
+    return FALSE;
+
+  if (memcmp(header.magic, "T38TRACE", sizeof(header.magic)) != 0 ||
+      header.version != BinTrace::dumpVersion ||
+      header.recordSize != sizeof(BinTrace::Record))
+  {
+    return FALSE;
+  }
+
+  wallUs = header.wallUs;
+  time = header.time;
+
+  PString reason;
+
+  if (!GetString(file, reason))
+    return FALSE;
+
+  modemNames.SetSize(header.modems);
+
+  DWORD i;
+
+  for (i = 0 ; i < header.modems ; i++) {
+    if (!GetString(file, modemNames[i]))
+      return FALSE;
+  }
+
+  PStringArray threadNames(header.rings);
+  PArray<PBYTEArray> rings;
+  PINDEX total = 0;
+
+  for (i = 0 ; i < header.rings ; i++) {
+    DWORD num;
+
+    if (!GetString(file, threadNames[i]))
+      return FALSE;
+
+    if (!file.Read(&num, sizeof(num)) || file.GetLastReadCount() != sizeof(num) || num > BinTrace::ringSize)
+      return FALSE;
+
+    PBYTEArray *ring = new PBYTEArray(num*sizeof(BinTrace::Record));
+
+    rings.Append(ring);
+
+    if (num > 0 && (!file.Read(ring->GetPointer(), ring->GetSize()) ||
+                    file.GetLastReadCount() != ring->GetSize()))
+    {
+      return FALSE;
+    }
+
+    total += num;
+  }
+
+  // merge the rings by time
+
+  TraceLine *lines = new TraceLine[total];
+  PINDEX n = 0;
+
+  for (i = 0 ; i < header.rings ; i++) {
+    const BinTrace::Record *records = (const BinTrace::Record *)(const BYTE *)rings[i];
+    PINDEX num = rings[i].GetSize()/sizeof(BinTrace::Record);
+
+    for (PINDEX j = 0 ; j < num ; j++) {
+      lines[n].record = records[j];
+      lines[n].thread = i;
+      n++;
+    }
+  }
+
+  qsort(lines, total, sizeof(TraceLine), CompareLines);
+
+  cout << "=== " << PTime(wallUs/1000000, long(wallUs%1000000)).AsString("yyyy/MM/dd hh:mm:ss.uuu")
+       << " dump of " << total << " records (" << reason << ")" << endl;
+
+  for (n = 0 ; n < total ; n++)
+    Print(lines[n].record, threadNames[lines[n].thread]);
+
+  delete [] lines;
+
+  return TRUE;
+}
+
+void T38Trace::Print(const BinTrace::Record &record, const PString &threadName)
+{
+  PString modem = record.modem < modemNames.GetSize() ? modemNames[record.modem] : psprintf("modem%u", record.modem);
+
+  if (!modemFilter.IsEmpty() && modem != modemFilter)
+    return;
+
+  PInt64 us = wallUs + (record.time - time)/1000;
+
+  cout << PTime(us/1000000, long(us%1000000)).AsString("yyyy/MM/dd hh:mm:ss.uuu")
+       << '\t' << threadName << '\t' << modem << ' ';
+
+  PBYTEArray data(record.data, record.len);
+
+  switch (record.event) {
+    case BinTrace::evIfpIn:
+    case BinTrace::evIfpOut: {
+        PBoolean in = (record.event == BinTrace::evIfpIn);
+        PBoolean repeated = (record.arg & BinTrace::argRepeated) != 0;
+        T38_IFP ifp;
+
+        cout << (in ? "Received ifp" : repeated ? "Sending PDU again:" : "Sending PDU:")
+             << " seq=" << (record.arg & BinTrace::argSeqMask)
+             << (in && repeated ? " (repeated)" : "");
+
+        if (IFPCodec::Decode(record.data, record.len, ifp, (record.arg & BinTrace::argCorrigendum) != 0))
+          cout << "\n  ifp = " << setprecision(2) << ifp;
+        else
+          cout << (record.len == BinTrace::maxData ? " (truncated)" : " (decode failure)") << PRTHEX(data);
+
+        break;
+      }
+    case BinTrace::evIfpLost:
+      cout << "T38Engine HandlePacketLost " << record.arg;
+      break;
+    case BinTrace::evModemState:
+      // the header is the text of the TRACE_STATE() line, the states are
+      // the values of the enums of pmodeme.cxx
+      cout << PString((const char *)record.data, record.len)
+           << ' ' << ((record.arg & 0x80000000) ? "off" : "on") << "-hook"
+           << " callState=" << ((record.arg >> 24) & 0x7F) << '.' << ((record.arg >> 16) & 0xFF)
+           << " state=" << ((record.arg >> 8) & 0xFF) << '.' << (record.arg & 0xFF);
+      break;
+    case BinTrace::evPtyIn:
+    case BinTrace::evPtyOut:
+      cout << (record.event == BinTrace::evPtyIn ? "--> " : "<-- ") << record.arg << " bytes" << PRTHEX(data);
+      break;
+    default:
+      cout << "event " << (unsigned)record.event << " arg=" << record.arg << PRTHEX(data);
+  }
+
+  cout << endl;
+}
+///////////////////////////////////////////////////////////////
+
@@ -0,0 +1,725 @@
+/*
+ * t4codec.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: t4codec.cxx,v $
+ *
+ */
+
+#include <ptlib.h>
+#include "t4codec.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+struct T4Code {
+  WORD code;
+  BYTE len;
+};
+
+static const T4Code whiteTerm[64] = {
+  { 0x035,  8 }, { 0x007,  6 }, { 0x007,  4 }, { 0x008,  4 },           // 0
+  { 0x00B,  4 }, { 0x00C,  4 }, { 0x00E,  4 }, { 0x00F,  4 },           // 4
+  { 0x013,  5 }, { 0x014,  5 }, { 0x007,  5 }, { 0x008,  5 },           // 8
+  { 0x008,  6 }, { 0x003,  6 }, { 0x034,  6 }, { 0x035,  6 },           // 12
+  { 0x02A,  6 }, { 0x02B,  6 }, { 0x027,  7 }, { 0x00C,  7 },           // 16
+  { 0x008,  7 }, { 0x017,  7 }, { 0x003,  7 }, { 0x004,  7 },           // 20
+  { 0x028,  7 }, { 0x02B,  7 }, { 0x013,  7 }, { 0x024,  7 },           // 24
+  { 0x018,  7 }, { 0x002,  8 }, { 0x003,  8 }, { 0x01A,  8 },           // 28
+  { 0x01B,  8 }, { 0x012,  8 }, { 0x013,  8 }, { 0x014,  8 },           // 32
+  { 0x015,  8 }, { 0x016,  8 }, { 0x017,  8 }, { 0x028,  8 },           // 36
+  { 0x029,  8 }, { 0x02A,  8 }, { 0x02B,  8 }, { 0x02C,  8 },           // 40
+  { 0x02D,  8 }, { 0x004,  8 }, { 0x005,  8 }, { 0x00A,  8 },           // 44
+  { 0x00B,  8 }, { 0x052,  8 }, { 0x053,  8 }, { 0x054,  8 },           // 48
+  { 0x055,  8 }, { 0x024,  8 }, { 0x025,  8 }, { 0x058,  8 },           // 52
+  { 0x059,  8 }, { 0x05A,  8 }, { 0x05B,  8 }, { 0x04A,  8 },           // 56
+  { 0x04B,  8 }, { 0x032,  8 }, { 0x033,  8 }, { 0x034,  8 }            // 60
+};
+
+static const T4Code blackTerm[64] = {
+  { 0x037, 10 }, { 0x002,  3 }, { 0x003,  2 }, { 0x002,  2 },           // 0
+  { 0x003,  3 }, { 0x003,  4 }, { 0x002,  4 }, { 0x003,  5 },           // 4
+  { 0x005,  6 }, { 0x004,  6 }, { 0x004,  7 }, { 0x005,  7 },           // 8
+  { 0x007,  7 }, { 0x004,  8 }, { 0x007,  8 }, { 0x018,  9 },           // 12
+  { 0x017, 10 }, { 0x018, 10 }, { 0x008, 10 }, { 0x067, 11 },           // 16
+  { 0x068, 11 }, { 0x06C, 11 }, { 0x037, 11 }, { 0x028, 11 },           // 20
+  { 0x017, 11 }, { 0x018, 11 }, { 0x0CA, 12 }, { 0x0CB, 12 },           // 24
+  { 0x0CC, 12 }, { 0x0CD, 12 }, { 0x068, 12 }, { 0x069, 12 },           // 28
+  { 0x06A, 12 }, { 0x06B, 12 }, { 0x0D2, 12 }, { 0x0D3, 12 },           // 32
+  { 0x0D4, 12 }, { 0x0D5, 12 }, { 0x0D6, 12 }, { 0x0D7, 12 },           // 36
+  { 0x06C, 12 }, { 0x06D, 12 }, { 0x0DA, 12 }, { 0x0DB, 12 },           // 40
+  { 0x054, 12 }, { 0x055, 12 }, { 0x056, 12 }, { 0x057, 12 },           // 44
+  { 0x064, 12 }, { 0x065, 12 }, { 0x052, 12 }, { 0x053, 12 },           // 48
+  { 0x024, 12 }, { 0x037, 12 }, { 0x038, 12 }, { 0x027, 12 },           // 52
+  { 0x028, 12 }, { 0x058, 12 }, { 0x059, 12 }, { 0x02B, 12 },           // 56
+  { 0x02C, 12 }, { 0x05A, 12 }, { 0x066, 12 }, { 0x067, 12 }            // 60
+};
+
+static const T4Code whiteMakeup[27] = {
+  { 0x01B,  5 }, { 0x012,  5 }, { 0x017,  6 }, { 0x037,  7 },           // 64
+  { 0x036,  8 }, { 0x037,  8 }, { 0x064,  8 }, { 0x065,  8 },           // 320
+  { 0x068,  8 }, { 0x067,  8 }, { 0x0CC,  9 }, { 0x0CD,  9 },           // 576
+  { 0x0D2,  9 }, { 0x0D3,  9 }, { 0x0D4,  9 }, { 0x0D5,  9 },           // 832
+  { 0x0D6,  9 }, { 0x0D7,  9 }, { 0x0D8,  9 }, { 0x0D9,  9 },           // 1088
+  { 0x0DA,  9 }, { 0x0DB,  9 }, { 0x098,  9 }, { 0x099,  9 },           // 1344
+  { 0x09A,  9 }, { 0x018,  6 }, { 0x09B,  9 }                           // 1600
+};
+
+static const T4Code blackMakeup[27] = {
+  { 0x00F, 10 }, { 0x0C8, 12 }, { 0x0C9, 12 }, { 0x05B, 12 },           // 64
+  { 0x033, 12 }, { 0x034, 12 }, { 0x035, 12 }, { 0x06C, 13 },           // 320
+  { 0x06D, 13 }, { 0x04A, 13 }, { 0x04B, 13 }, { 0x04C, 13 },           // 576
+  { 0x04D, 13 }, { 0x072, 13 }, { 0x073, 13 }, { 0x074, 13 },           // 832
+  { 0x075, 13 }, { 0x076, 13 }, { 0x077, 13 }, { 0x052, 13 },           // 1088
+  { 0x053, 13 }, { 0x054, 13 }, { 0x055, 13 }, { 0x05A, 13 },           // 1344
+  { 0x05B, 13 }, { 0x064, 13 }, { 0x065, 13 }                           // 1600
+};
+
+static const T4Code extMakeup[13] = {
+  { 0x008, 11 }, { 0x00C, 11 }, { 0x00D, 11 }, { 0x012, 12 },           // 1792
+  { 0x013, 12 }, { 0x014, 12 }, { 0x015, 12 }, { 0x016, 12 },           // 2048
+  { 0x017, 12 }, { 0x01C, 12 }, { 0x01D, 12 }, { 0x01E, 12 },           // 2304
+  { 0x01F, 12 }                                                         // 2560
+};
+
+///////////////////////////////////////////////////////////////
+enum {
+  eolCode = 0x001,                         // 000000000001
+  eolLen = 12,
+  runPeekLen = 13,                         // max length of run codes
+  modePeekLen = 7                          // max length of mode codes
+};
+
+enum {
+  modeV0 = 3,                              // vertical modes are modeV0 + (a1 - b1)
+  modePass = 7,
+  modeHoriz = 8
+};
+
+static const T4Code modeCodes[] = {
+  { 0x02, 7 }, { 0x02, 6 }, { 0x2, 3 },    // VL3, VL2, VL1
+  { 0x1, 1 },                              // V0
+  { 0x3, 3 }, { 0x03, 6 }, { 0x03, 7 },    // VR1, VR2, VR3
+  { 0x1, 4 },                              // P
+  { 0x1, 3 },                              // H
+};
+///////////////////////////////////////////////////////////////
+/*
+ * Decoding tables indexed by the next bits of the stream (the first bit is
+ * the most significant one). The len is 0 for invalid codes.
+ */
+static class T4DecodeTables
+{
+  public:
+    struct Entry {
+      short val;
+      BYTE len;
+    };
+
+    T4DecodeTables();
+
+    Entry run[2][1 << runPeekLen];
+    Entry mode[1 << modePeekLen];
+
+  private:
+    static void Add(Entry *table, int peekLen, const T4Code &code, int val);
+} tables;
+
+T4DecodeTables::T4DecodeTables()
+{
+  memset(run, 0, sizeof(run));
+  memset(mode, 0, sizeof(mode));
+
+  int i;
+
+  for (i = 0 ; i < 64 ; i++) {
+    Add(run[0], runPeekLen, whiteTerm[i], i);
+    Add(run[1], runPeekLen, blackTerm[i], i);
+  }
+
+  for (i = 0 ; i < 27 ; i++) {
+    Add(run[0], runPeekLen, whiteMakeup[i], (i + 1)*64);
+    Add(run[1], runPeekLen, blackMakeup[i], (i + 1)*64);
+  }
+
+  for (i = 0 ; i < 13 ; i++) {
+    Add(run[0], runPeekLen, extMakeup[i], 1792 + i*64);
+    Add(run[1], runPeekLen, extMakeup[i], 1792 + i*64);
+  }
+
+  for (i = 0 ; i < PINDEX(sizeof(modeCodes)/sizeof(modeCodes[0])) ; i++)
+    Add(mode, modePeekLen, modeCodes[i], i);
+}
+
+void T4DecodeTables::Add(Entry *table, int peekLen, const T4Code &code, int val)
+{
+  int shift = peekLen - code.len;
+
+  for (int i = 0 ; i < (1 << shift) ; i++) {
+    Entry &entry = table[(code.code << shift) | i];
+
+    entry.val = short(val);
+    entry.len = code.len;
+  }
+}
+///////////////////////////////////////////////////////////////
+T4Transcoder::T4Transcoder()
+{
+  Start(cMH, cMH, 1728);
+}
+
+void T4Transcoder::Start(Coding _from, Coding _to, int _width, int _k)
+{
+  from = _from;
+  to = _to;
+
+  if (_width <= 0)
+    _width = 1728;
+  else
+  if (_width > maxWidth)
+    _width = maxWidth;
+
+  width = _width;
+  k = _k > 0 ? _k : 1;
+
+  end = FALSE;
+  started = FALSE;
+  scanPos = 0;
+  scanZeros = 0;
+  emptyLines = 0;
+  linePos = 0;
+  inLen = 0;
+
+  ref = lineBuf[0];
+  cur = lineBuf[1];
+  refCount = 0;
+  curCount = 0;
+  ref[0] = ref[1] = ref[2] = width;
+  k2D = k;
+
+  acc = 0;
+  accBits = 0;
+  pOut = NULL;
+  bufLen = 0;
+
+  countIn = 0;
+  countOut = 0;
+  lines = 0;
+  errors = 0;
+}
+
+void T4Transcoder::Transcode(const BYTE * pData, PINDEX len, PBYTEArray & out)
+{
+  countIn += len;
+
+  if (end || len <= 0)
+    return;
+
+  pOut = &out;
+
+  memcpy(inBuf.GetPointer(inLen + len) + inLen, pData, len);
+  inLen += len;
+
+  if (from == cMMR)
+    DecodeT6();
+  else
+    DecodeT4();
+
+  /*
+   * Discard the decoded data
+   */
+  PINDEX keep = (from != cMMR && started) ? linePos : scanPos;
+  PINDEX drop = keep >> 3;
+
+  if (drop > 0) {
+    memmove(inBuf.GetPointer(), (const BYTE *)inBuf + drop, inLen - drop);
+    inLen -= drop;
+    scanPos -= drop*8;
+    linePos -= drop*8;
+  }
+
+  if (inLen > maxLineBytes) {
+    PTRACE(2, "T4Transcoder::Transcode too long line");
+
+    errors++;
+
+    if (from == cMMR) {
+      end = TRUE;
+      PutEnd();
+    } else {
+      started = FALSE;
+      scanPos -= inLen*8;
+      inLen = 0;
+    }
+  }
+
+  FlushBuf();
+  pOut = NULL;
+}
+
+void T4Transcoder::Flush(PBYTEArray & out)
+{
+  pOut = &out;
+
+  if (!end) {
+    end = TRUE;
+    PutEnd();
+  }
+
+  if (accBits) {
+    PutByte(acc);
+    acc = 0;
+    accBits = 0;
+  }
+
+  FlushBuf();
+  pOut = NULL;
+}
+
+void T4Transcoder::DecodeT4()
+{
+  const BYTE *p = inBuf;
+  PINDEX bits = inLen*8;
+
+  while (!end && scanPos < bits) {
+    if (((p[scanPos >> 3] >> (scanPos & 7)) & 1) == 0) {
+      scanZeros++;
+      scanPos++;
+      continue;
+    }
+
+    scanPos++;
+
+    if (scanZeros < eolLen - 1) {
+      scanZeros = 0;
+      continue;
+    }
+
+    /*
+     * EOL, the line is linePos..(scanPos - eolLen) including fill bits
+     */
+    if (started) {
+      int tagBits = (from == cMR) ? 1 : 0;
+      PINDEX lastOne = scanPos - 2 - scanZeros;
+
+      if (lastOne < linePos + tagBits) {
+        // EOL just after EOL
+        if (++emptyLines >= 2) {
+          // RTC
+          end = TRUE;
+          PutEnd();
+          break;
+        }
+      } else {
+        PINDEX pos = linePos;
+        PINDEX limit = scanPos - eolLen;
+        int res;
+
+        emptyLines = 0;
+
+        if (tagBits && ((p[pos >> 3] >> (pos & 7)) & 1) == 0)
+          res = DecodeLine2D(++pos, limit, FALSE);
+        else
+          res = DecodeLine1D(pos += tagBits, limit);
+
+        NextLine(res == 1);
+      }
+    } else {
+      started = TRUE;
+    }
+
+    linePos = scanPos;
+    scanZeros = 0;
+  }
+}
+
+void T4Transcoder::DecodeT6()
+{
+  while (!end) {
+    PINDEX pos = scanPos;
+    int res = DecodeLine2D(pos, inLen*8, TRUE);
+
+    if (res == 0)
+      break;
+
+    if (res < 0) {
+      PTRACE(2, "T4Transcoder::DecodeT6 bad line " << lines << ", the rest of page is lost");
+      errors++;
+    }
+
+    if (res != 1) {
+      end = TRUE;
+      PutEnd();
+      break;
+    }
+
+    scanPos = pos;
+    NextLine(TRUE);
+  }
+}
+
+void T4Transcoder::NextLine(PBoolean ok)
+{
+  if (!ok) {
+    PTRACE(4, "T4Transcoder::NextLine bad line " << lines << ", repeat previous one");
+    errors++;
+    curCount = refCount;
+    memcpy(cur, ref, (refCount + 3)*sizeof(cur[0]));
+  }
+
+  EncodeLine();
+
+  int *tmp = ref;
+  ref = cur;
+  cur = tmp;
+  refCount = curCount;
+  lines++;
+}
+
+void T4Transcoder::PutEnd()
+{
+  switch (to) {
+    case cMH:
+      for (int i = 0 ; i < 6 ; i++)
+        PutBits(eolCode, eolLen);
+      break;
+    case cMR:
+      for (int i = 0 ; i < 6 ; i++)
+        PutBits((eolCode << 1) | 1, eolLen + 1);
+      break;
+    case cMMR:
+      PutBits(eolCode, eolLen);
+      PutBits(eolCode, eolLen);
+      break;
+  }
+}
+///////////////////////////////////////////////////////////////
+unsigned T4Transcoder::Peek(PINDEX pos, int len) const
+{
+  const BYTE *p = inBuf;
+  PINDEX bits = inLen*8;
+  unsigned val = 0;
+
+  for (int i = 0 ; i < len ; i++, pos++) {
+    val <<= 1;
+
+    if (pos < bits)
+      val |= (p[pos >> 3] >> (pos & 7)) & 1;
+  }
+
+  return val;
+}
+
+int T4Transcoder::DecodeRun(PINDEX & pos, PINDEX limit, int color)
+{
+  int run = 0;
+
+  for (;;) {
+    const T4DecodeTables::Entry &entry = tables.run[color][Peek(pos, runPeekLen)];
+
+    if (entry.len == 0)
+      return (pos + runPeekLen > limit) ? -2 : -1;
+
+    if (pos + entry.len > limit)
+      return -2;
+
+    pos += entry.len;
+    run += entry.val;
+
+    if (entry.val < 64)
+      return run;
+
+    if (run > width)
+      return -1;
+  }
+}
+
+int T4Transcoder::DecodeLine1D(PINDEX & pos, PINDEX limit)
+{
+  int a0 = 0;
+  int color = 0;
+
+  curCount = 0;
+
+  while (a0 < width) {
+    int run = DecodeRun(pos, limit, color);
+
+    if (run == -2)
+      return 0;
+
+    if (run < 0 || a0 + run > width || curCount >= maxWidth)
+      return -1;
+
+    a0 += run;
+
+    if (a0 < width)
+      PutChange(a0);
+
+    color ^= 1;
+  }
+
+  cur[curCount] = cur[curCount + 1] = cur[curCount + 2] = width;
+
+  return 1;
+}
+
+int T4Transcoder::DecodeLine2D(PINDEX & pos, PINDEX limit, PBoolean eofb)
+{
+  if (eofb && Peek(pos, eolLen) == eolCode) {
+    if (pos + eolLen > limit)
+      return 0;
+
+    pos += eolLen;
+    return 2;
+  }
+
+  int a0 = 0;
+  int color = 0;
+  int ib = 0;
+  PBoolean first = TRUE;
+
+  curCount = 0;
+
+  while (a0 < width) {
+    if (curCount >= maxWidth)
+      return -1;
+
+    if (!first) {
+      while (ib < refCount && ref[ib] <= a0)
+        ib++;
+    }
+
+    // b1 is the first changing element on reference line of opposite colour
+    int jb = ib + ((ib ^ color) & 1);
+    int b1 = ref[jb];
+    int b2 = ref[jb + 1];
+
+    const T4DecodeTables::Entry &entry = tables.mode[Peek(pos, modePeekLen)];
+
+    if (entry.len == 0)
+      return (pos + eolLen > limit) ? 0 : -1;
+
+    if (pos + entry.len > limit)
+      return 0;
+
+    pos += entry.len;
+
+    switch (entry.val) {
+      case modePass:
+        a0 = b2;
+        break;
+      case modeHoriz: {
+        int run1 = DecodeRun(pos, limit, color);
+
+        if (run1 == -2)
+          return 0;
+
+        if (run1 < 0)
+          return -1;
+
+        int run2 = DecodeRun(pos, limit, color ^ 1);
+
+        if (run2 == -2)
+          return 0;
+
+        if (run2 < 0)
+          return -1;
+
+        int a1 = a0 + run1;
+        int a2 = a1 + run2;
+
+        if (a2 > width)
+          return -1;
+
+        if (a1 < width)
+          PutChange(a1);
+
+        if (a2 < width)
+          PutChange(a2);
+
+        a0 = a2;
+        break;
+      }
+      default: {
+        int a1 = b1 + entry.val - modeV0;
+
+        if (a1 < a0 || a1 > width)
+          return -1;
+
+        if (a1 < width)
+          PutChange(a1);
+
+        a0 = a1;
+        color ^= 1;
+      }
+    }
+
+    first = FALSE;
+  }
+
+  cur[curCount] = cur[curCount + 1] = cur[curCount + 2] = width;
+
+  return 1;
+}
+///////////////////////////////////////////////////////////////
+void T4Transcoder::EncodeLine()
+{
+  switch (to) {
+    case cMH:
+      PutBits(eolCode, eolLen);
+      Encode1D();
+      break;
+    case cMR:
+      PutBits(eolCode, eolLen);
+
+      if (k2D >= k - 1) {
+        PutBits(1, 1);
+        Encode1D();
+        k2D = 0;
+      } else {
+        PutBits(0, 1);
+        Encode2D();
+        k2D++;
+      }
+      break;
+    case cMMR:
+      Encode2D();
+      break;
+  }
+}
+
+void T4Transcoder::Encode1D()
+{
+  int a0 = 0;
+  int color = 0;
+
+  for (int i = 0 ; i <= curCount ; i++) {
+    int a1 = cur[i];    // cur[curCount] is width
+
+    EncodeRun(a1 - a0, color);
+    a0 = a1;
+    color ^= 1;
+  }
+}
+
+void T4Transcoder::Encode2D()
+{
+  int a0 = 0;
+  int color = 0;
+  int ia = 0;
+  int ib = 0;
+  PBoolean first = TRUE;
+
+  while (a0 < width) {
+    if (!first) {
+      while (ia < curCount && cur[ia] <= a0)
+        ia++;
+
+      while (ib < refCount && ref[ib] <= a0)
+        ib++;
+    }
+
+    int a1 = cur[ia];
+    int jb = ib + ((ib ^ color) & 1);
+    int b1 = ref[jb];
+    int b2 = ref[jb + 1];
+
+    if (b2 < a1) {
+      const T4Code &code = modeCodes[modePass];
+
+      PutBits(code.code, code.len);
+      a0 = b2;
+    }
+    else
+    if (a1 - b1 >= -3 && a1 - b1 <= 3) {
+      const T4Code &code = modeCodes[modeV0 + a1 - b1];
+
+      PutBits(code.code, code.len);
+      a0 = a1;
+      color ^= 1;
+    }
+    else {
+      const T4Code &code = modeCodes[modeHoriz];
+      int a2 = cur[ia + 1];
+
+      PutBits(code.code, code.len);
+      EncodeRun(a1 - a0, color);
+      EncodeRun(a2 - a1, color ^ 1);
+      a0 = a2;
+    }
+
+    first = FALSE;
+  }
+}
+
+void T4Transcoder::EncodeRun(int run, int color)
+{
+  while (run >= 2560 + 64) {
+    const T4Code &code = extMakeup[12];
+
+    PutBits(code.code, code.len);
+    run -= 2560;
+  }
+
+  if (run >= 64) {
+    int makeup = run & ~63;
+    const T4Code &code = makeup >= 1792 ? extMakeup[(makeup - 1792)/64]
+                                        : (color ? blackMakeup : whiteMakeup)[makeup/64 - 1];
+
+    PutBits(code.code, code.len);
+    run -= makeup;
+  }
+
+  const T4Code &code = (color ? blackTerm : whiteTerm)[run];
+
+  PutBits(code.code, code.len);
+}
+
+void T4Transcoder::PutBits(unsigned code, int len)
+{
+  while (len--) {
+    if ((code >> len) & 1)
+      acc |= BYTE(1 << accBits);
+
+    if (++accBits == 8) {
+      PutByte(acc);
+      acc = 0;
+      accBits = 0;
+    }
+  }
+}
+
+void T4Transcoder::FlushBuf()
+{
+  if (bufLen == 0)
+    return;
+
+  if (pOut != NULL)
+    pOut->Concatenate(PBYTEArray(buf, bufLen));
+
+  countOut += bufLen;
+  bufLen = 0;
+}
+///////////////////////////////////////////////////////////////
+
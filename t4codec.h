@@ -0,0 +1,180 @@
+/*
+ * t4codec.h
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: t4codec.h,v $
+ *
+ */
+
+#ifndef _T4CODEC_H
+#define _T4CODEC_H
+
+///////////////////////////////////////////////////////////////
+/**On-the-fly transcoder of non-ECM image data.
+
+   Decodes scan lines of T.4 (MH or MR) or T.6 (MMR) data and re-encodes
+   them with other coding. The page end (RTC or EOFB) is recognized and
+   generated. The bits are in the T.4 transmission order (LSB first).
+
+   If a T.4 scan line can't be decoded then the previous line is repeated.
+   If a T.6 scan line can't be decoded then the rest of the page is lost.
+ */
+class T4Transcoder
+{
+  public:
+    enum Coding {
+      cMH,                                 ///<  T.4 one-dimensional
+      cMR,                                 ///<  T.4 two-dimensional
+      cMMR                                 ///<  T.6
+    };
+
+    enum {
+      maxWidth = 4864,                     ///<  Max pixels per scan line
+      maxLineBytes = 4096                  ///<  Max size of coded scan line
+    };
+
+  /**@name Construction */
+  //@{
+    T4Transcoder();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Start new page.
+       The k is the max number of consecutive lines (one 1D and k-1 2D) for
+       the MR output.
+      */
+    void Start(
+      Coding from,
+      Coding to,
+      int width,
+      int k = 2
+    );
+
+    /**Transcode data and append the result to out.
+      */
+    void Transcode(
+      const BYTE * pData,
+      PINDEX len,
+      PBYTEArray & out
+    );
+
+    /**Append the page end (if it was not recognized) and the last
+       incomplete byte (padded with zeros) to out.
+      */
+    void Flush(
+      PBYTEArray & out
+    );
+
+    /**Returns TRUE if the page end was recognized.
+      */
+    PBoolean IsEnd() const { return end; }
+  //@}
+
+  /**@name Statistics */
+  //@{
+    long GetCountIn() const { return countIn; }
+    long GetCountOut() const { return countOut; }
+    long GetLines() const { return lines; }
+    long GetErrors() const { return errors; }
+  //@}
+
+  protected:
+    enum { bufSize = 64 };
+
+    void DecodeT4();
+    void DecodeT6();
+    void NextLine(PBoolean ok);
+    void PutEnd();
+
+    /**Decode one scan line to cur.
+       Returns 1 if decoded, 0 if more data needed, -1 if error or
+       2 if EOFB.
+      */
+    int DecodeLine1D(PINDEX & pos, PINDEX limit);
+    int DecodeLine2D(PINDEX & pos, PINDEX limit, PBoolean eofb);
+    int DecodeRun(PINDEX & pos, PINDEX limit, int color);
+    unsigned Peek(PINDEX pos, int len) const;
+
+    /**Add changing element to cur (two elements at the same position cancel
+       each other).
+      */
+    void PutChange(int a) {
+      if (curCount > 0 && cur[curCount - 1] == a)
+        curCount--;
+      else
+        cur[curCount++] = a;
+    }
+
+    void EncodeLine();
+    void Encode1D();
+    void Encode2D();
+    void EncodeRun(int run, int color);
+
+    void PutBits(unsigned code, int len);
+    void PutByte(BYTE b) {
+      buf[bufLen++] = b;
+      if (bufLen == bufSize)
+        FlushBuf();
+    }
+    void FlushBuf();
+
+    Coding from;
+    Coding to;
+    int width;
+    int k;
+
+    PBoolean end;
+    PBoolean started;                      ///<  First EOL was received (T.4)
+    PINDEX scanPos;                        ///<  Next bit to scan for EOL (T.4)
+    int scanZeros;
+    int emptyLines;
+    PINDEX linePos;                        ///<  First bit of current line
+
+    PBYTEArray inBuf;
+    PINDEX inLen;
+
+    int lineBuf[2][maxWidth + 4];          ///<  Changing elements + width sentinels
+    int * ref;
+    int * cur;
+    int refCount;
+    int curCount;
+    int k2D;                               ///<  2D lines after last 1D line (MR output)
+
+    BYTE acc;
+    int accBits;
+
+    PBYTEArray * pOut;
+    BYTE buf[bufSize];
+    PINDEX bufLen;
+
+    long countIn;
+    long countOut;
+    long lines;
+    long errors;
+};
+///////////////////////////////////////////////////////////////
+
+#endif  // _T4CODEC_H
+
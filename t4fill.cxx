@@ -0,0 +1,157 @@
+/*
+ * t4fill.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: t4fill.cxx,v $
+ *
+ */
+
+#include <ptlib.h>
+#include "t4fill.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+void T4FillBits::Start(int _minLineBits)
+{
+  minLineBits = _minLineBits;
+  zeros = 0;
+  lineBits = 0;
+  acc = 0;
+  accBits = 0;
+  pOut = NULL;
+  bufLen = 0;
+  countIn = 0;
+  countOut = 0;
+  lines = 0;
+}
+
+void T4FillBits::Filter(const BYTE * pData, PINDEX len, PBYTEArray & out)
+{
+  pOut = &out;
+  countIn += len;
+
+  for (PINDEX i = 0 ; i < len ; i++) {
+    BYTE b = pData[i];
+
+    if (b == 0) {
+      zeros += 8;
+      continue;
+    }
+
+    for (int n = 8 ; n ; n--, b >>= 1) {
+      if ((b & 1) == 0) {
+        zeros++;
+        continue;
+      }
+
+      if (zeros < eolZeros) {
+        Put(zeros, TRUE);
+        lineBits += zeros + 1;
+      } else {
+        int fill = 0;
+
+        /*
+         * Do not insert fill before the first EOL and between EOLs of RTC
+         * (the MR tag bit can be there)
+         */
+        if (minLineBits >= 0 && lineBits > 1)
+          fill = minLineBits - lineBits - (eolZeros + 1);
+
+        Put(eolZeros + (fill > 0 ? fill : 0), TRUE);
+        lineBits = 0;
+        lines++;
+      }
+
+      zeros = 0;
+    }
+  }
+
+  FlushBuf();
+  pOut = NULL;
+}
+
+void T4FillBits::Flush(PBYTEArray & out)
+{
+  pOut = &out;
+
+  if (accBits) {
+    PutByte(acc);
+    acc = 0;
+    accBits = 0;
+  }
+
+  zeros = 0;
+  FlushBuf();
+  pOut = NULL;
+}
+
+void T4FillBits::Put(int _zeros, PBoolean one)
+{
+  while (_zeros > 0) {
+    if (accBits == 0 && _zeros >= 8) {
+      PutByte(0);
+      _zeros -= 8;
+      continue;
+    }
+
+    int n = 8 - accBits;
+
+    if (n > _zeros)
+      n = _zeros;
+
+    accBits += n;
+    _zeros -= n;
+
+    if (accBits == 8) {
+      PutByte(acc);
+      acc = 0;
+      accBits = 0;
+    }
+  }
+
+  if (one) {
+    acc |= BYTE(1 << accBits);
+
+    if (++accBits == 8) {
+      PutByte(acc);
+      acc = 0;
+      accBits = 0;
+    }
+  }
+}
+
+void T4FillBits::FlushBuf()
+{
+  if (bufLen == 0)
+    return;
+
+  if (pOut != NULL)
+    pOut->Concatenate(PBYTEArray(buf, bufLen));
+
+  countOut += bufLen;
+  bufLen = 0;
+}
+///////////////////////////////////////////////////////////////
+
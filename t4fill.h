@@ -0,0 +1,120 @@
+/*
+ * t4fill.h
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: t4fill.h,v $
+ *
+ */
+
+#ifndef _T4FILL_H
+#define _T4FILL_H
+
+///////////////////////////////////////////////////////////////
+/**Fill bits filter for non-ECM T.4 data (MH/MR).
+
+   The fill bits are the zeros inserted before EOL (000000000001) to meet
+   the minimum transmission time of a coded scan line. The filter works in
+   one of two modes:
+
+     - removal, any run of zeros before EOL is reduced to 11 zeros;
+     - insertion, zeros are added before EOL to make each scan line at least
+       minLineBits bits long.
+
+   The bits are in the T.4 transmission order (LSB first).
+ */
+class T4FillBits
+{
+  public:
+    enum {
+      eolZeros = 11                        ///<  Zeros in EOL
+    };
+
+  /**@name Construction */
+  //@{
+    T4FillBits() { Start(-1); }
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Start new data stream.
+       If minLineBits < 0 then the fill bits will be removed, else the fill
+       bits will be inserted.
+      */
+    void Start(
+      int minLineBits
+    );
+
+    /**Filter data and append the result to out.
+      */
+    void Filter(
+      const BYTE * pData,
+      PINDEX len,
+      PBYTEArray & out
+    );
+
+    /**Append the last incomplete byte (padded with zeros) to out.
+       The trailing zeros are dropped.
+      */
+    void Flush(
+      PBYTEArray & out
+    );
+  //@}
+
+  /**@name Statistics */
+  //@{
+    long GetCountIn() const { return countIn; }
+    long GetCountOut() const { return countOut; }
+    long GetLines() const { return lines; }
+  //@}
+
+  protected:
+    enum { bufSize = 64 };
+
+    void Put(int zeros, PBoolean one);
+    void PutByte(BYTE b) {
+      buf[bufLen++] = b;
+      if (bufLen == bufSize)
+        FlushBuf();
+    }
+    void FlushBuf();
+
+    int minLineBits;
+    int zeros;                             ///<  Pending zeros
+    int lineBits;                          ///<  Bits sent after last EOL
+
+    BYTE acc;
+    int accBits;
+
+    PBYTEArray * pOut;
+    BYTE buf[bufSize];
+    PINDEX bufLen;
+
+    long countIn;
+    long countOut;
+    long lines;
+};
+///////////////////////////////////////////////////////////////
+
+#endif  // _T4FILL_H
+
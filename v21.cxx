@@ -0,0 +1,241 @@
+/*
+ * v21.cxx
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: v21.cxx,v $
+ *
+ */
+
+#include <ptlib.h>
+#include <math.h>
+#include "fcs.h"
+#include "v21.h"
+
+#define new PNEW
+
+///////////////////////////////////////////////////////////////
+#define SIMPLES_PER_SEC           8000
+#define BITS_PER_SEC              300
+#define TAB_LEN                   160     // 8000/50
+#define TAB_AMP                   255
+#define MARK_STEP                 33      // 1650/50
+#define SPACE_STEP                37      // 1850/50
+#define TWO_PI                    (3.1415926535897932384626433832795029L*2)
+///////////////////////////////////////////////////////////////
+static struct V21Tables {
+  V21Tables() {
+    for (int i = 0 ; i < TAB_LEN ; i++) {
+      cosTab[i] = (int)floor(TAB_AMP*cos(double((i*TWO_PI)/TAB_LEN)) + 0.5);
+      sinTab[i] = (int)floor(TAB_AMP*sin(double((i*TWO_PI)/TAB_LEN)) + 0.5);
+    }
+  }
+
+  int cosTab[TAB_LEN];
+  int sinTab[TAB_LEN];
+} tables;
+///////////////////////////////////////////////////////////////
+V21Receiver::V21Receiver()
+  : minLevel(100)
+  , index(0)
+  , markRe(0), markIm(0), spaceRe(0), spaceIm(0), power(0)
+  , tap(0)
+  , bitPhase(0)
+  , lastDecision(0)
+  , carrier(FALSE)
+  , carrierCount(0)
+  , inFrame(FALSE)
+  , ones(0)
+  , curByte(0)
+  , curBits(0)
+  , dataSize(0)
+  , frameSize(0)
+  , frames(0)
+  , badFrames(0)
+{
+  for (PINDEX i = 0 ; i < windowLen ; i++)
+    markReTap[i] = markImTap[i] = spaceReTap[i] = spaceImTap[i] = powerTap[i] = 0;
+}
+
+PBoolean V21Receiver::Write(const PInt16 *pSamples, PINDEX count, PINDEX &done)
+{
+  for (PINDEX i = 0 ; i < count ; i++) {
+    long x = pSamples[i];
+
+    // sliding correlators (exact in integers, no drift)
+
+    unsigned im = (index*MARK_STEP) % TAB_LEN;
+    unsigned is = (index*SPACE_STEP) % TAB_LEN;
+
+    if (++index == TAB_LEN)
+      index = 0;
+
+    long mRe = x*tables.cosTab[im];
+    long mIm = x*tables.sinTab[im];
+    long sRe = x*tables.cosTab[is];
+    long sIm = x*tables.sinTab[is];
+    long pw = (x*x) >> 6;
+
+    markRe += mRe - markReTap[tap];
+    markIm += mIm - markImTap[tap];
+    spaceRe += sRe - spaceReTap[tap];
+    spaceIm += sIm - spaceImTap[tap];
+    power += pw - powerTap[tap];
+
+    markReTap[tap] = mRe;
+    markImTap[tap] = mIm;
+    spaceReTap[tap] = sRe;
+    spaceImTap[tap] = sIm;
+    powerTap[tap] = pw;
+
+    if (++tap == windowLen)
+      tap = 0;
+
+    float markPw = float(markRe)*markRe + float(markIm)*markIm;
+    float spacePw = float(spaceRe)*spaceRe + float(spaceIm)*spaceIm;
+
+    // for the pure tone (mark + space)*2/(L*A^2) is equal to power*64
+
+    const float scale = float(windowLen)*TAB_AMP*TAB_AMP*32;
+    PBoolean on = (power*64 >= long(windowLen)*minLevel*minLevel &&
+                   (markPw + spacePw) >= float(power)*scale*0.5f);
+
+    if (on) {
+      if (!carrier && ++carrierCount >= windowLen) {
+        carrier = TRUE;
+        carrierCount = 0;
+        bitPhase = 0;
+        lastDecision = 0;
+        inFrame = FALSE;
+        ones = 0;
+      } else if (carrier) {
+        carrierCount = 0;
+      }
+    } else {
+      if (carrier && ++carrierCount >= windowLen*3) {
+        carrier = FALSE;
+        carrierCount = 0;
+        inFrame = FALSE;
+      } else if (!carrier) {
+        carrierCount = 0;
+      }
+    }
+
+    if (!carrier)
+      continue;
+
+    int decision = markPw > spacePw ? 1 : -1;
+
+    // the decision changes in the middle of the window, so the bit is
+    // sampled a half of bit after the change
+
+    if (lastDecision && decision != lastDecision)
+      bitPhase += (SIMPLES_PER_SEC/2 - bitPhase)/4;
+
+    lastDecision = decision;
+    bitPhase += BITS_PER_SEC;
+
+    if (bitPhase >= SIMPLES_PER_SEC) {
+      bitPhase -= SIMPLES_PER_SEC;
+
+      if (PutBit(decision > 0)) {
+        done = i + 1;
+        return TRUE;
+      }
+    }
+  }
+
+  done = count;
+  return FALSE;
+}
+
+PBoolean V21Receiver::PutBit(int bit)
+{
+  PBoolean ready = FALSE;
+
+  if (bit) {
+    if (++ones >= 7) {
+      inFrame = FALSE;    // abort or idle
+      return FALSE;
+    }
+  } else {
+    if (ones == 6) {      // flag
+      if (inFrame)
+        ready = EndFrame();
+
+      inFrame = TRUE;
+      dataSize = 0;
+      curBits = 0;
+      ones = 0;
+      return ready;
+    }
+
+    if (ones == 5) {      // stuffed zero
+      ones = 0;
+      return FALSE;
+    }
+
+    ones = 0;
+  }
+
+  if (!inFrame)
+    return FALSE;
+
+  curByte = BYTE((curByte << 1) | bit);
+
+  if (++curBits == 8) {
+    if (dataSize < (PINDEX)sizeof(data))
+      data[dataSize++] = curByte;
+    else
+      inFrame = FALSE;    // too long
+
+    curBits = 0;
+  }
+
+  return FALSE;
+}
+
+PBoolean V21Receiver::EndFrame()
+{
+  // the flag added 0 and six 1s to the data bits
+
+  if (curBits != 7 || dataSize < 3 + 2)
+    return FALSE;
+
+  FCS fcs;
+
+  fcs.build(data, dataSize - 2);
+
+  if (WORD(fcs) != WORD((data[dataSize - 2] << 8) | data[dataSize - 1])) {
+    badFrames++;
+    return FALSE;
+  }
+
+  frameSize = dataSize - 2;
+  memcpy(frame, data, frameSize);
+  frames++;
+
+  return TRUE;
+}
+///////////////////////////////////////////////////////////////
+
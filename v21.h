@@ -0,0 +1,108 @@
+/*
+ * v21.h
+ *
+ * T38FAX Pseudo Modem
+ *
+ * Copyright (c) 2011 Vyacheslav Frolov
+ *
+ * Open H323 Project
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Open H323 Library.
+ *
+ * The Initial Developer of the Original Code is Vyacheslav Frolov
+ *
+ * Contributor(s):
+ *
+ * $Log: v21.h,v $
+ *
+ */
+
+#ifndef _V21_H
+#define _V21_H
+
+///////////////////////////////////////////////////////////////
+/**V.21 channel 2 FSK demodulator and HDLC receiver for 8000 Hz PCM16.
+
+   The mark and space powers are calculated with one bit long sliding
+   correlators in integer arithmetic. The bit clock is synchronized by
+   the transitions. The HDLC frames with good FCS are collected (w/o FCS)
+   and can be got by GetFrame().
+ */
+class V21Receiver
+{
+  public:
+    enum {
+      maxFrameSize = 256,
+      windowLen = 27                       ///<  8000/300 rounded up
+    };
+
+    V21Receiver();
+
+    /**Set min carrier level in RMS (default 100).
+      */
+    void SetMinLevel(int level) { minLevel = level; }
+
+    /**Demodulate the audio. Returns TRUE if a frame is ready.
+       The rest of the audio should be passed again after GetFrame().
+      */
+    PBoolean Write(
+      const PInt16 *pSamples,
+      PINDEX count,
+      PINDEX &done
+    );
+
+    /**Get the ready frame (valid up to the next call of Write()).
+      */
+    const BYTE *GetFrame(PINDEX &size) const { size = frameSize; return frame; }
+
+    PBoolean IsCarrier() const { return carrier; }
+
+    long GetFrames() const { return frames; }
+    long GetBadFrames() const { return badFrames; }
+
+  protected:
+    PBoolean PutBit(int bit);
+    PBoolean EndFrame();
+
+    int minLevel;
+
+    // demodulator
+    unsigned index;
+    long markRe, markIm, spaceRe, spaceIm, power;
+    long markReTap[windowLen], markImTap[windowLen];
+    long spaceReTap[windowLen], spaceImTap[windowLen];
+    long powerTap[windowLen];
+    PINDEX tap;
+    int bitPhase;
+    int lastDecision;
+    PBoolean carrier;
+    int carrierCount;
+
+    // HDLC
+    PBoolean inFrame;
+    int ones;
+    BYTE curByte;
+    int curBits;
+    PINDEX dataSize;
+    BYTE data[maxFrameSize + 2];
+
+    BYTE frame[maxFrameSize];
+    PINDEX frameSize;
+
+    long frames;
+    long badFrames;
+};
+///////////////////////////////////////////////////////////////
+
+#endif  // _V21_H
+